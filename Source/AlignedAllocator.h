@@ -0,0 +1,47 @@
+// An allocator for standard containers whose storage must start on a cache-line boundary, so that
+// arrays read in the inner loop of generation never have an element straddling two cache lines.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+template <class T, size_t Alignment = 64>
+class AlignedAllocator
+{
+public:
+	typedef T value_type;
+	template <class U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() {}
+	template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+	// Allocates room for n objects. The block is over-allocated by Alignment bytes; the address
+	// of the underlying allocation is stored just before the aligned block, for deallocate().
+	T * allocate(size_t n)
+	{
+		char * raw = (char *)::operator new(n * sizeof(T) + Alignment + sizeof(void *));
+		uintptr_t start = (uintptr_t)(raw + sizeof(void *));
+		char * aligned = (char *)((start + Alignment - 1) & ~(uintptr_t)(Alignment - 1));
+		((void **)aligned)[-1] = raw;
+		return (T *)aligned;
+	}
+
+	void deallocate(T * block, size_t)
+	{
+		::operator delete(((void **)block)[-1]);
+	}
+};
+
+// All AlignedAllocators are interchangeable.
+template <class T, class U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &)
+{
+	return true;
+}
+template <class T, class U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &)
+{
+	return false;
+}
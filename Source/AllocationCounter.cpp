@@ -0,0 +1,84 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Replaces the global operator new and operator delete with versions that count, per thread, how *
+ * many allocations have been made, and otherwise behave like the standard ones. The count lives  *
+ * in a thread-local variable, so counting costs no synchronization and a measurement on one      *
+ * thread is not disturbed by allocations on other threads (such as the IngestPipeline's reader   *
+ * threads).                                                                                      *
+ *                                                                                                *
+ * Because the replacements are linked into the whole program, and not only into the self-test    *
+ * that reads the counts, they do everything the standard requires of operator new and operator   *
+ * delete: a failed allocation calls the new-handler and tries again until the handler gives up,  *
+ * and sized deallocation is replaced along with the unsized form, so that a compiler that calls  *
+ * it directly still reaches the matching free(). The standard array and nothrow forms call the   *
+ * basic ones, so they are counted too.                                                           *
+ **************************************************************************************************/
+
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	thread_local unsigned long long threadAllocations = 0;
+}
+
+/**************************************************************************************************
+ * Allocates size bytes, counting the allocation against the calling thread. As the standard      *
+ * operator new does, it calls the installed new-handler each time malloc() fails, and tries      *
+ * again, until there is no handler.                                                              *
+ *   Inputs:                                                                                      *
+ *      size: The number of bytes to allocate.                                                    *
+ *   return value: The allocated memory. Throws std::bad_alloc if there is not enough memory.     *
+ **************************************************************************************************/
+void * operator new(std::size_t size)
+{
+	++threadAllocations;
+	if (size == 0) size = 1;
+	for (;;)
+	{
+		void * memory = std::malloc(size);
+		if (memory) return memory;
+		std::new_handler handler = std::get_new_handler();
+		if (!handler) throw std::bad_alloc();
+		handler();
+	}
+}
+
+/**************************************************************************************************
+ * Frees memory allocated by operator new.                                                        *
+ *   Inputs:                                                                                      *
+ *      memory: The memory to free, or NULL.                                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void operator delete(void * memory) noexcept
+{
+	std::free(memory);
+}
+
+/**************************************************************************************************
+ * Frees memory allocated by operator new, when the compiler passes the size that was allocated.  *
+ *   Inputs:                                                                                      *
+ *      memory: The memory to free, or NULL.                                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void operator delete(void * memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+/**************************************************************************************************
+ * Constructor. Remembers how many allocations the calling thread had made so far.                *
+ **************************************************************************************************/
+AllocationCounter::AllocationCounter() : start(threadAllocations) {}
+
+/**************************************************************************************************
+ * Returns the number of allocations that the calling thread has made since the counter was       *
+ * constructed. Should be called on the thread that constructed the counter.                      *
+ *   return value: The number of allocations.                                                     *
+ **************************************************************************************************/
+unsigned long long AllocationCounter::Allocations() const
+{
+	return threadAllocations - start;
+}
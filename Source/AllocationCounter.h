@@ -0,0 +1,19 @@
+// Counts the heap allocations made by the current thread, so that code which is meant to run
+// without allocating (the training and generation loops, once warmed up) can be checked. Global
+// operator new is replaced in AllocationCounter.cpp to keep the count; every allocation in the
+// program goes through it, at the cost of incrementing one thread-local integer, and it otherwise
+// behaves exactly as the standard one does.
+
+#pragma once
+
+class AllocationCounter
+{
+	unsigned long long start;
+
+public:
+	// Constructor. Starts counting from zero.
+	AllocationCounter();
+
+	// Returns the number of allocations that this thread has made since the counter was constructed.
+	unsigned long long Allocations() const;
+};
@@ -0,0 +1,472 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * An end-to-end benchmark, for capacity planning and for catching performance regressions. Each  *
+ * corpus is synthetic: lines of made-up words drawn from a vocabulary of 20,000 with Zipf's law, *
+ * as the words of natural text roughly are, so a corpus of any size can be made without shipping *
+ * one, and every run of the benchmark sees the same one. It is split into files of at most 256   *
+ * MB, and into at least as many files as the most threads measured, so that training has a file  *
+ * for every pipeline.                                                                            *
+ *                                                                                                *
+ * For every order and token type, the corpus is trained, generated from and scored with each     *
+ * thread count in turn:                                                                          *
+ *    Training: runs a ConcurrentTrainer with one pipeline per thread, and is measured in         *
+ *              megabytes of text per second. (Each pipeline also reads and decodes on threads of *
+ *              its own, and the table's final sort runs on the shared pool, so training uses     *
+ *              more threads than its count says.)                                                *
+ *    Generation: compiles the model written by training, and then generates a fixed number of    *
+ *                tokens, shared out among the threads, from the one chain. The time from opening *
+ *                the model file to the first generated token is recorded too; it is the cold     *
+ *                start that a server pays.                                                       *
+ *    Scoring: scores the lines at the start of the corpus with a Scorer.                         *
+ *                                                                                                *
+ * Generation and scoring run on a pool of their own with exactly as many threads as are being    *
+ * measured: the work is handed to one of the pool's workers, and the benchmark waits for it      *
+ * without taking part, as a thread waiting for a TaskGroup otherwise would.                      *
+ *                                                                                                *
+ * The speedup of a thread count is its throughput against that of the fewest threads measured,   *
+ * which are taken to be perfectly efficient (so with one thread as the baseline, it is the usual *
+ * speedup), and the efficiency is the speedup per thread; together, over the thread counts, they *
+ * are the scaling curve of each phase. Peak memory is the process's peak resident memory during  *
+ * the measurement. On Linux the peak is started over before each measurement; elsewhere it can   *
+ * only grow, so it is only exact for the largest measurement so far.                             *
+ **************************************************************************************************/
+
+#include "Benchmark.h"
+#include "CompiledChain.h"
+#include "ConcurrentTrainer.h"
+#include "FilePath.h"
+#include "ModelFile.h"
+#include "Random.h"
+#include "Scorer.h"
+#include "ThreadPool.h"
+#include "Utf8Encoder.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+
+namespace
+{
+	const long long MEGABYTE = 1 << 20;
+	// The most bytes of corpus written to one file.
+	const long long MAX_FILE_BYTES = 256 * MEGABYTE;
+	// The number of distinct words in a corpus.
+	const int LEXICON_SIZE = 20000;
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Returns the seconds elapsed since start.
+	double SecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	// Runs work on one of pool's workers and waits for it without taking part, so that the work, and
+	// everything it runs in parallel on pool, uses exactly the pool's threads.
+	void RunInside(ThreadPool & pool, const std::function<void()> & work)
+	{
+		std::promise<void> done;
+		std::future<void> finished = done.get_future();
+		ThreadPool::TaskGroup group(pool);
+		group.Run([&]() {
+			work();
+			done.set_value();
+		});
+		finished.wait();
+	}
+
+	// The columns of a results file.
+	const char * HEADER = "phase\ttokens\torder\tcorpus_mb\tthreads\tseconds\tthroughput\tspeedup\t"
+	                      "efficiency\tpeak_mb\tfirst_token_ms";
+
+	// Identifies the measurement that a result belongs to, to match it with another run's.
+	std::tuple<std::wstring, std::wstring, int, long long, unsigned int> KeyOf(const Benchmark::Result & result)
+	{
+		return std::make_tuple(result.phase, result.tokenType, result.order, result.corpusMegabytes, result.threads);
+	}
+}
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      options: What to measure. If no thread counts are given, 1, 2, 4 and so on are measured,  *
+ *               up to one thread per core.                                                       *
+ **************************************************************************************************/
+Benchmark::Benchmark(const Options & options) : options(options) {}
+
+/**************************************************************************************************
+ * Writes a synthetic corpus: lines of 5 to 20 words, each drawn from a vocabulary of made-up     *
+ * words with the probability of the word of rank r proportional to 1 / r. The corpus is the same *
+ * every time for the same size and number of files.                                              *
+ *   Inputs:                                                                                      *
+ *      numBytes: The size of the corpus. Each file ends at the first line that reaches its       *
+ *                share.                                                                          *
+ *      numFiles: The number of files to split it into.                                           *
+ *      log: The stream to which an error is reported.                                            *
+ *   return value: The names of the files, or nothing if one of them could not be written (in     *
+ *                 which case none are left behind).                                              *
+ **************************************************************************************************/
+std::vector<std::wstring> Benchmark::WriteCorpus(long long numBytes, size_t numFiles, std::ostream & log) const
+{
+	Random rand(LEXICON_SIZE);
+	std::vector<std::string> lexicon;
+	std::vector<double> cumulative;
+	double total = 0;
+	for (int rank = 1; rank <= LEXICON_SIZE; ++rank)
+	{
+		std::string word;
+		for (int length = 1 + rand.nextInt(10); length > 0; --length) word += (char)('a' + rand.nextInt(26));
+		lexicon.push_back(word);
+		total += 1.0 / rank;
+		cumulative.push_back(total);
+	}
+
+	std::wstring directory = options.tempDirectory;
+	if (!directory.empty() && directory.back() != L'/' && directory.back() != L'\\') directory += L'/';
+	std::vector<std::wstring> files;
+	std::string buffer;
+	for (size_t f = 0; f < numFiles; ++f)
+	{
+		files.push_back(directory + L"markov-bench-" + std::to_wstring(f) + L".txt");
+		std::ofstream out(NativePath(files.back()), std::ios::binary);
+		const long long share = numBytes * (long long)(f + 1) / (long long)numFiles - numBytes * (long long)f / (long long)numFiles;
+		for (long long written = 0; out && written < share; )
+		{
+			buffer.clear();
+			while (buffer.size() < (size_t)MEGABYTE && written + (long long)buffer.size() < share)
+			{
+				for (int words = 5 + rand.nextInt(16); words > 0; --words)
+				{
+					double draw = rand.nextDouble() * total;
+					buffer += lexicon[std::upper_bound(cumulative.begin(), cumulative.end() - 1, draw) - cumulative.begin()];
+					buffer += (words > 1 ? " " : ".\n");
+				}
+			}
+			out.write(buffer.data(), buffer.size());
+			written += (long long)buffer.size();
+		}
+		if (!out.flush())
+		{
+			log << "Could not write " << EncodeUtf8(files.back()) << "." << std::endl;
+			for (size_t i = 0; i < files.size(); ++i) RemoveFile(files[i]);
+			return std::vector<std::wstring>();
+		}
+	}
+	return files;
+}
+
+/**************************************************************************************************
+ * Fills in the speedup and efficiency of the results of one phase of one configuration, which    *
+ * are the last ones measured. The result with the fewest threads is the baseline.                *
+ *   Inputs:                                                                                      *
+ *      first: The index of the first of those results.                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void Benchmark::ComputeSpeedups(size_t first)
+{
+	if (first >= results.size()) return;
+	const Result * baseline = &results[first];
+	for (size_t i = first; i < results.size(); ++i)
+	{
+		if (results[i].threads < baseline->threads) baseline = &results[i];
+	}
+	for (size_t i = first; i < results.size(); ++i)
+	{
+		Result & result = results[i];
+		result.speedup = baseline->throughput > 0 ? baseline->threads * result.throughput / baseline->throughput : 0;
+		result.efficiency = result.speedup / result.threads;
+	}
+}
+
+/**************************************************************************************************
+ * Runs the benchmark: for every corpus size, writes the corpus, measures every phase of every    *
+ * order and token type with every thread count, and deletes the corpus again. A line of progress *
+ * is written to log after each measurement.                                                      *
+ *   Inputs:                                                                                      *
+ *      log: The stream to which progress and errors are reported.                                *
+ *   return value: false if a corpus or model file could not be written or read, true otherwise.  *
+ **************************************************************************************************/
+bool Benchmark::Run(std::ostream & log)
+{
+	std::vector<unsigned int> threadCounts = options.threadCounts;
+	if (threadCounts.empty())
+	{
+		const unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+		for (unsigned int threads = 1; threads < cores; threads *= 2) threadCounts.push_back(threads);
+		threadCounts.push_back(cores);
+	}
+	std::sort(threadCounts.begin(), threadCounts.end());
+	threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+	threadCounts.erase(std::remove(threadCounts.begin(), threadCounts.end(), 0u), threadCounts.end());
+	if (threadCounts.empty()) return true;
+
+	std::wstring directory = options.tempDirectory;
+	if (!directory.empty() && directory.back() != L'/' && directory.back() != L'\\') directory += L'/';
+	const std::wstring modelPath = directory + L"markov-bench.mkv";
+
+	for (size_t s = 0; s < options.corpusMegabytes.size(); ++s)
+	{
+		const long long megabytes = options.corpusMegabytes[s];
+		const long long numBytes = megabytes * MEGABYTE;
+		const size_t numFiles = std::max((size_t)threadCounts.back(), (size_t)((numBytes + MAX_FILE_BYTES - 1) / MAX_FILE_BYTES));
+		log << "Writing a " << megabytes << " MB corpus in " << numFiles << " files..." << std::endl;
+		const std::vector<std::wstring> corpus = WriteCorpus(numBytes, numFiles, log);
+		if (corpus.empty()) return false;
+
+		// The texts to score: the lines at the start of the corpus.
+		std::vector<std::wstring> texts;
+		long long textBytes = 0;
+		for (size_t f = 0; f < corpus.size() && textBytes < options.scoreMegabytes * MEGABYTE; ++f)
+		{
+			std::ifstream in(NativePath(corpus[f]), std::ios::binary);
+			std::string line;
+			while (textBytes < options.scoreMegabytes * MEGABYTE && std::getline(in, line))
+			{
+				texts.push_back(std::wstring(line.begin(), line.end()));
+				textBytes += (long long)line.size() + 1;
+			}
+		}
+
+		bool succeeded = true;
+		for (size_t t = 0; t < options.tokenTypes.size() && succeeded; ++t)
+		{
+			for (size_t o = 0; o < options.orders.size() && succeeded; ++o)
+			{
+				const std::wstring & tokenType = options.tokenTypes[t];
+				const int order = options.orders[o];
+				Result result;
+				result.tokenType = tokenType;
+				result.order = order;
+				result.corpusMegabytes = megabytes;
+				auto record = [&](const std::wstring & phase, unsigned int threads, double seconds, double throughput) {
+					result.phase = phase;
+					result.threads = threads;
+					result.seconds = seconds;
+					result.throughput = throughput;
+					result.peakBytes = PeakMemory();
+					results.push_back(result);
+					log << EncodeUtf8(phase + L", " + tokenType + L", order ") << order << ", " << megabytes << " MB, "
+					    << threads << " threads: " << throughput << (phase == L"generate" ? " tokens/s" : " MB/s") << std::endl;
+				};
+
+				// Training. The model that the fewest threads train is written for the other phases.
+				size_t first = results.size();
+				for (size_t i = 0; i < threadCounts.size() && succeeded; ++i)
+				{
+					ResetPeakMemory();
+					Clock::time_point start = Clock::now();
+					ConcurrentTrainer trainer(order, tokenType);
+					trainer.Train(corpus, threadCounts[i]);
+					double seconds = SecondsSince(start);
+					record(L"train", threadCounts[i], seconds, (double)megabytes / seconds);
+					if (i == 0 && !trainer.WriteModel(modelPath))
+					{
+						log << "Could not write " << EncodeUtf8(modelPath) << "." << std::endl;
+						succeeded = false;
+					}
+				}
+				ComputeSpeedups(first);
+				if (!succeeded) break;
+
+				// Generation, after the time to the first token of a freshly loaded chain:
+				ResetPeakMemory();
+				Clock::time_point start = Clock::now();
+				CompiledChain chain;
+				ModelReader model;
+				if (!model.Open(modelPath) || !chain.Load(model))
+				{
+					log << "Could not read " << EncodeUtf8(modelPath) << "." << std::endl;
+					succeeded = false;
+					break;
+				}
+				Random firstRand(1);
+				chain.Generate(1, firstRand);
+				result.firstTokenSeconds = SecondsSince(start);
+
+				first = results.size();
+				for (size_t i = 0; i < threadCounts.size(); ++i)
+				{
+					const unsigned int threads = threadCounts[i];
+					ThreadPool::Options poolOptions;
+					poolOptions.threads = threads;
+					ThreadPool pool(poolOptions);
+					ResetPeakMemory();
+					start = Clock::now();
+					RunInside(pool, [&]() {
+						pool.ParallelFor(threads, [&](size_t part) {
+							const long long numGen = options.generateTokens * (long long)(part + 1) / threads -
+							                         options.generateTokens * (long long)part / threads;
+							Random rand((int)part + 1);
+							std::wstring output;
+							chain.Generate((int)numGen, rand, output);
+						});
+					});
+					double seconds = SecondsSince(start);
+					record(L"generate", threads, seconds, (double)options.generateTokens / seconds);
+				}
+				ComputeSpeedups(first);
+				result.firstTokenSeconds = 0;
+
+				// Scoring:
+				first = results.size();
+				for (size_t i = 0; i < threadCounts.size(); ++i)
+				{
+					ThreadPool::Options poolOptions;
+					poolOptions.threads = threadCounts[i];
+					ThreadPool pool(poolOptions);
+					Scorer::Options scorerOptions;
+					scorerOptions.pool = &pool;
+					Scorer scorer(chain, scorerOptions);
+					ResetPeakMemory();
+					start = Clock::now();
+					RunInside(pool, [&]() { scorer.ScoreBatch(texts); });
+					double seconds = SecondsSince(start);
+					record(L"score", threadCounts[i], seconds, (double)textBytes / MEGABYTE / seconds);
+				}
+				ComputeSpeedups(first);
+			}
+		}
+		RemoveFile(modelPath);
+		for (size_t f = 0; f < corpus.size(); ++f) RemoveFile(corpus[f]);
+		if (!succeeded) return false;
+	}
+	return true;
+}
+
+/**************************************************************************************************
+ * Returns the results, in the order in which they were measured.                                 *
+ **************************************************************************************************/
+const std::vector<Benchmark::Result> & Benchmark::Results() const
+{
+	return results;
+}
+
+/**************************************************************************************************
+ * Writes results as tab-separated values, one line per result after a header line. Memory is     *
+ * written in megabytes and the time to the first token in milliseconds (0 where it was not       *
+ * measured).                                                                                     *
+ *   Inputs:                                                                                      *
+ *      out: The stream to write to.                                                              *
+ *      results: The results.                                                                     *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void Benchmark::WriteResults(std::ostream & out, const std::vector<Result> & results)
+{
+	out << HEADER << '\n';
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result & r = results[i];
+		out << EncodeUtf8(r.phase) << '\t' << EncodeUtf8(r.tokenType) << '\t' << r.order << '\t' << r.corpusMegabytes << '\t'
+		    << r.threads << '\t' << r.seconds << '\t' << r.throughput << '\t' << r.speedup << '\t' << r.efficiency << '\t'
+		    << (double)r.peakBytes / MEGABYTE << '\t' << r.firstTokenSeconds * 1000 << '\n';
+	}
+	out.flush();
+}
+
+/**************************************************************************************************
+ * Reads results written by WriteResults(). The header line, and any line that does not hold a    *
+ * whole result, are skipped.                                                                     *
+ *   Inputs:                                                                                      *
+ *      in: The stream to read from.                                                              *
+ *   return value: The results.                                                                   *
+ **************************************************************************************************/
+std::vector<Benchmark::Result> Benchmark::ReadResults(std::istream & in)
+{
+	std::vector<Result> results;
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		std::string phase, tokenType;
+		Result r;
+		double peakMegabytes, firstTokenMilliseconds;
+		if (fields >> phase >> tokenType >> r.order >> r.corpusMegabytes >> r.threads >> r.seconds >> r.throughput >>
+		    r.speedup >> r.efficiency >> peakMegabytes >> firstTokenMilliseconds)
+		{
+			r.phase.assign(phase.begin(), phase.end());
+			r.tokenType.assign(tokenType.begin(), tokenType.end());
+			r.peakBytes = (long long)(peakMegabytes * MEGABYTE);
+			r.firstTokenSeconds = firstTokenMilliseconds / 1000;
+			results.push_back(r);
+		}
+	}
+	return results;
+}
+
+/**************************************************************************************************
+ * Compares the throughput of a run with that of an earlier one, measurement by measurement.      *
+ *   Inputs:                                                                                      *
+ *      baseline: The results of the earlier run.                                                 *
+ *      current: The results of the run to check.                                                 *
+ *      tolerance: How many percent slower than the baseline a measurement may be.                *
+ *   return value: A description of each measurement that is slower than that, such as "train,    *
+ *                 words, order 2, 1024 MB, 8 threads: 310 MB/s, against 402".                    *
+ **************************************************************************************************/
+std::vector<std::wstring> Benchmark::FindRegressions(const std::vector<Result> & baseline,
+                                                     const std::vector<Result> & current, double tolerance)
+{
+	std::map<std::tuple<std::wstring, std::wstring, int, long long, unsigned int>, double> expected;
+	for (size_t i = 0; i < baseline.size(); ++i) expected[KeyOf(baseline[i])] = baseline[i].throughput;
+
+	std::vector<std::wstring> regressions;
+	for (size_t i = 0; i < current.size(); ++i)
+	{
+		const Result & r = current[i];
+		auto it = expected.find(KeyOf(r));
+		if (it == expected.end() || r.throughput >= it->second * (1 - tolerance / 100)) continue;
+		std::wostringstream description;
+		description << r.phase << L", " << r.tokenType << L", order " << r.order << L", " << r.corpusMegabytes << L" MB, "
+		            << r.threads << L" threads: " << r.throughput << (r.phase == L"generate" ? L" tokens/s" : L" MB/s")
+		            << L", against " << it->second;
+		regressions.push_back(description.str());
+	}
+	return regressions;
+}
+
+/**************************************************************************************************
+ * Returns the peak resident memory (working set, on Windows) of the process.                     *
+ *   return value: The peak, in bytes, or 0 where the system does not report it.                  *
+ **************************************************************************************************/
+long long Benchmark::PeakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return (long long)counters.PeakWorkingSetSize;
+#elif defined(__linux__)
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+	{
+		if (line.compare(0, 6, "VmHWM:") == 0) return std::atoll(line.c_str() + 6) * 1024;
+	}
+	return 0;
+#else
+	return 0;
+#endif
+}
+
+/**************************************************************************************************
+ * Starts the peak resident memory over from the current usage. Only Linux allows this (by        *
+ * writing 5 to /proc/self/clear_refs); elsewhere the peak is the peak since the process started. *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void Benchmark::ResetPeakMemory()
+{
+#if defined(__linux__)
+	std::ofstream clear("/proc/self/clear_refs");
+	clear << "5";
+#endif
+}
@@ -0,0 +1,88 @@
+// An end-to-end benchmark of the engine, run by the bench console command. For every corpus size,
+// order and token type asked for, it writes a synthetic corpus, then trains, generates and scores
+// with every thread count asked for, recording throughput, the process's peak memory and the time
+// to the first generated token. The results are written as tab-separated values, with the speedup
+// and efficiency of each thread count, and can be compared with an earlier run to catch
+// regressions.
+
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class Benchmark
+{
+public:
+	// What to measure.
+	struct Options
+	{
+		std::vector<long long> corpusMegabytes; // corpus sizes, measured in order
+		std::vector<int> orders;
+		std::vector<std::wstring> tokenTypes;
+		std::vector<unsigned int> threadCounts; // the fewest is the baseline; none for 1, 2, 4... cores
+		long long generateTokens;  // generated per measurement, shared out among the threads
+		long long scoreMegabytes;  // scored per measurement, taken from the start of the corpus
+		std::wstring tempDirectory;
+
+		Options() : corpusMegabytes(1, 16), orders(1, 2), tokenTypes(1, L"words"), generateTokens(10000000),
+		            scoreMegabytes(16), tempDirectory(L".") {}
+	};
+
+	// One measurement: a phase ("train", "generate" or "score") of one configuration.
+	struct Result
+	{
+		std::wstring phase;
+		std::wstring tokenType;
+		int order = 0;
+		long long corpusMegabytes = 0;
+		unsigned int threads = 0;
+		double seconds = 0;
+		double throughput = 0;        // megabytes of text per second, or tokens per second generating
+		double speedup = 0;           // throughput against that of the fewest threads, times their number
+		double efficiency = 0;        // speedup per thread
+		long long peakBytes = 0;      // the process's peak resident memory during the measurement
+		double firstTokenSeconds = 0; // generating: from opening the model file to the first token
+	};
+
+private:
+	const Options options;
+	std::vector<Result> results;
+
+	// Writes a corpus of about numBytes bytes, split into files in the temporary directory. Returns
+	// the file names, or nothing if a file could not be written.
+	std::vector<std::wstring> WriteCorpus(long long numBytes, size_t numFiles, std::ostream & log) const;
+	// Fills in the speedup and efficiency of the results from first on, which must all belong to one
+	// phase of one configuration.
+	void ComputeSpeedups(size_t first);
+
+public:
+	// Constructor.
+	explicit Benchmark(const Options & options);
+
+	// Runs every measurement, reporting progress to log. Returns false if the corpus or a model file
+	// could not be written; the results measured until then are kept.
+	bool Run(std::ostream & log);
+
+	// The results, in the order in which they were measured.
+	const std::vector<Result> & Results() const;
+
+	// Writes results as tab-separated values, with a header line.
+	static void WriteResults(std::ostream & out, const std::vector<Result> & results);
+
+	// Reads results written by WriteResults(). Lines that cannot be read are skipped.
+	static std::vector<Result> ReadResults(std::istream & in);
+
+	// Describes every measurement in current whose throughput is more than tolerance percent below
+	// that of the same measurement in baseline. Measurements that only one of them has are ignored.
+	static std::vector<std::wstring> FindRegressions(const std::vector<Result> & baseline,
+	                                                 const std::vector<Result> & current, double tolerance);
+
+	// The peak resident memory of the process, in bytes, since it started or since the last call to
+	// ResetPeakMemory(); 0 where the system does not report it.
+	static long long PeakMemory();
+
+	// Starts the peak resident memory over from the current usage, where the system allows it.
+	static void ResetPeakMemory();
+};
@@ -0,0 +1,198 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Trains a Markov chain by sorting its records. StringChain::AddItems() looks every Prefix up in *
+ * a std::map and inserts into it, one token at a time, which for a large corpus means several    *
+ * cache misses per token, and the pairs must then be sorted again to be compiled. Here training  *
+ * only appends IDs to an array, and the record that ends at each token is not stored at all: it  *
+ * is the window of order + 1 IDs that ends there, so it is named by the position where the       *
+ * window starts.                                                                                 *
+ *                                                                                                *
+ * The windows are sorted with a least-significant-digit radix sort, one token position at a time *
+ * from the Suffix back to the first token of the Prefix, each a stable counting sort on the IDs  *
+ * at that position. IDs are sorted 16 bits at a time, so a vocabulary of up to 65,536 tokens     *
+ * needs one pass per position and a larger one two. Each pass runs on the shared thread pool:    *
+ * every thread counts the digits of a slice of the windows, the counts are summed into where     *
+ * each slice's windows of each digit go, and every thread then moves its slice. The passes are   *
+ * stable, so after the last one the windows are in order of their whole keys, and windows with   *
+ * equal keys are adjacent; counting the records is a single pass that compares each window with  *
+ * the one before.                                                                                *
+ *                                                                                                *
+ * The records are the same, with the same non-word padding, as those of OutOfCoreTrainer and     *
+ * StringChain.                                                                                   *
+ **************************************************************************************************/
+
+#include "BulkTrainer.h"
+#include "ModelFile.h"
+#include "StringChain.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace
+{
+	const int RADIX_BITS = 16;
+	const size_t RADIX = (size_t)1 << RADIX_BITS;
+	// Slices are no smaller than this, so that the counts of a slice cost little next to its windows:
+	const size_t MIN_SLICE_WINDOWS = RADIX * 4;
+}
+
+/**************************************************************************************************
+ * Constructor. The first Prefix is made of non-words, as every trainer's is.                     *
+ *   Inputs:                                                                                      *
+ *      order: The order of the Markov chain.                                                     *
+ *      tokenType: "words", "characters" or "punctuation".                                        *
+ **************************************************************************************************/
+BulkTrainer::BulkTrainer(int order, const std::wstring & tokenType)
+	: markovOrder(order), tokenType(tokenType), tokens(order, Vocabulary::NONWORD_ID)
+{
+}
+
+/**************************************************************************************************
+ * Appends the ID of the next token. The record that ends with it is implied.                     *
+ *   Inputs:                                                                                      *
+ *      token: The next token of the current input text.                                          *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void BulkTrainer::AddToken(const std::wstring & token)
+{
+	tokens.push_back(vocabulary.Intern(token));
+	sorted = false;
+	tokensInCurrentInput++;
+}
+
+/**************************************************************************************************
+ * Marks the end of an input text by adding non-word padding, exactly as StringChain::EndInput()  *
+ * does, so that generation can wrap from the end of one text into the beginning of the next.     *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void BulkTrainer::EndInput()
+{
+	if (tokensInCurrentInput == 0 && tokens.size() == (size_t)markovOrder) AddToken(NONWORD);
+	for (int i = 0; i < markovOrder; ++i) AddToken(NONWORD);
+	tokensInCurrentInput = 0;
+}
+
+/**************************************************************************************************
+ * Sorts the windows by radix sort (see the top of this file), and then counts the distinct       *
+ * records and Prefixes.                                                                          *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void BulkTrainer::Sort()
+{
+	if (sorted) return;
+	const size_t numWindows = tokens.size() - markovOrder;
+	windows.resize(numWindows);
+	for (size_t i = 0; i < numWindows; ++i) windows[i] = i;
+	std::vector<size_t> moved(numWindows);
+
+	ThreadPool & pool = ThreadPool::Shared();
+	const size_t numSlices = std::max((size_t)1, std::min(pool.NumThreads(), numWindows / MIN_SLICE_WINDOWS));
+	const size_t sliceSize = (numWindows + numSlices - 1) / numSlices;
+	std::vector<size_t> starts(numSlices * RADIX); // where the next window of each slice and digit goes
+	const unsigned int * ids = tokens.data();
+	const int highestShift = vocabulary.Size() > RADIX ? RADIX_BITS : 0;
+	for (int position = markovOrder; position >= 0; --position)
+	{
+		for (int shift = 0; shift <= highestShift; shift += RADIX_BITS)
+		{
+			auto digit = [ids, position, shift](size_t window) {
+				return (ids[window + position] >> shift) & (RADIX - 1);
+			};
+			pool.ParallelFor(numSlices, [&](size_t slice) {
+				size_t * counts = starts.data() + slice * RADIX;
+				std::fill(counts, counts + RADIX, 0);
+				const size_t end = std::min(numWindows, (slice + 1) * sliceSize);
+				for (size_t i = slice * sliceSize; i < end; ++i) counts[digit(windows[i])]++;
+			});
+			size_t total = 0;
+			bool oneDigit = false; // every window has the same digit, so the pass would change nothing
+			for (size_t d = 0; d < RADIX; ++d)
+			{
+				const size_t digitStart = total;
+				for (size_t slice = 0; slice < numSlices; ++slice)
+				{
+					const size_t count = starts[slice * RADIX + d];
+					starts[slice * RADIX + d] = total;
+					total += count;
+				}
+				oneDigit |= total - digitStart == numWindows;
+			}
+			if (oneDigit) continue;
+			pool.ParallelFor(numSlices, [&](size_t slice) {
+				size_t * next = starts.data() + slice * RADIX;
+				const size_t end = std::min(numWindows, (slice + 1) * sliceSize);
+				for (size_t i = slice * sliceSize; i < end; ++i) moved[next[digit(windows[i])]++] = windows[i];
+			});
+			windows.swap(moved);
+		}
+	}
+
+	numRecords = numPrefixes = 0;
+	for (size_t i = 0; i < numWindows; ++i)
+	{
+		const unsigned int * key = ids + windows[i];
+		const unsigned int * previous = i > 0 ? ids + windows[i - 1] : NULL;
+		if (previous == NULL || !std::equal(key, key + markovOrder, previous)) numPrefixes++;
+		if (previous == NULL || !std::equal(key, key + markovOrder + 1, previous)) numRecords++;
+	}
+	sorted = true;
+}
+
+/**************************************************************************************************
+ * Calls a function once for every distinct record, in sorted order. The keys passed to it point  *
+ * into the array of IDs, so nothing is copied.                                                   *
+ *   Inputs:                                                                                      *
+ *      visit: Called with the order + 1 IDs of each record and the number of times it occurred.  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void BulkTrainer::ForEachRecord(const std::function<void(const unsigned int * key, unsigned long long count)> & visit)
+{
+	Sort();
+	const int length = markovOrder + 1;
+	size_t i = 0;
+	while (i < windows.size())
+	{
+		const unsigned int * key = tokens.data() + windows[i];
+		size_t end = i + 1;
+		while (end < windows.size() && std::equal(key, key + length, tokens.data() + windows[end])) ++end;
+		visit(key, end - i);
+		i = end;
+	}
+}
+
+/**************************************************************************************************
+ * Returns the number of distinct records, sorting them first if need be.                         *
+ **************************************************************************************************/
+size_t BulkTrainer::NumRecords()
+{
+	Sort();
+	return numRecords;
+}
+
+/**************************************************************************************************
+ * Returns the number of distinct Prefixes, sorting the records first if need be.                 *
+ **************************************************************************************************/
+size_t BulkTrainer::NumPrefixes()
+{
+	Sort();
+	return numPrefixes;
+}
+
+/**************************************************************************************************
+ * Sorts and counts the records and writes them, along with the vocabulary, to a model file.      *
+ *   Inputs:                                                                                      *
+ *      path: The model file to create.                                                           *
+ *   return value: false if the model file could not be written, true otherwise.                  *
+ **************************************************************************************************/
+bool BulkTrainer::WriteModel(const std::wstring & path)
+{
+	ModelWriter writer;
+	if (!writer.Open(path, markovOrder, tokenType, vocabulary)) return false;
+	ForEachRecord([&writer](const unsigned int * key, unsigned long long count) { writer.Write(key, count); });
+	return writer.Close();
+}
+
+// Accessors.
+int BulkTrainer::Order() const { return markovOrder; }
+const std::wstring & BulkTrainer::TokenType() const { return tokenType; }
+const Vocabulary & BulkTrainer::GetVocabulary() const { return vocabulary; }
@@ -0,0 +1,56 @@
+// Trains a Markov chain in memory by sorting rather than by inserting. Every token is turned into
+// an ID and appended to one array, so training does no lookup but the Vocabulary's; once the input
+// is read, the <Prefix, Suffix> records (every window of order + 1 consecutive IDs) are radix
+// sorted in parallel, and equal records are counted in a single pass over the sorted windows.
+// The records come out already sorted, as a CompiledChain or a model file needs them, so a chain
+// is built from them with no map at all. Meant for training a whole corpus at once; the IDs take
+// four bytes per token of input until the records are sorted.
+
+#pragma once
+
+#include "TokenSink.h"
+#include "Vocabulary.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class BulkTrainer : public TokenSink
+{
+	const int markovOrder;
+	const std::wstring tokenType;
+	Vocabulary vocabulary;
+	std::vector<unsigned int> tokens;  // the IDs of every token, after markovOrder non-words
+	std::vector<size_t> windows;       // the first position of every record, in sorted order
+	size_t numRecords = 0, numPrefixes = 0; // distinct ones, once sorted
+	bool sorted = false;
+	long long tokensInCurrentInput = 0;
+
+	// Radix sorts the records, if they have not been sorted since the last token.
+	void Sort();
+
+public:
+	// Constructor.
+	BulkTrainer(int order, const std::wstring & tokenType);
+
+	// Appends the token's ID.
+	void AddToken(const std::wstring & token) override;
+
+	// Adds the non-word padding that follows the last token of an input text.
+	void EndInput() override;
+
+	// Calls visit once for every distinct record, in sorted order, with its key (the Prefix, then
+	// the Suffix) and the number of times it occurred.
+	void ForEachRecord(const std::function<void(const unsigned int * key, unsigned long long count)> & visit);
+
+	// The number of distinct records and of distinct Prefixes among them.
+	size_t NumRecords();
+	size_t NumPrefixes();
+
+	// Writes the records to a model file. Returns false if it could not be written.
+	bool WriteModel(const std::wstring & path);
+
+	// Accessors.
+	int Order() const;
+	const std::wstring & TokenType() const;
+	const Vocabulary & GetVocabulary() const;
+};
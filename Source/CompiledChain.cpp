@@ -0,0 +1,1161 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Compiles a Markov chain into a compressed-sparse-row state machine. StringChain::generate()    *
+ * spends most of its time finding the next Prefix: after each token is chosen it looks the new   *
+ * Prefix up in a std::map, which costs a chain of dependent pointer dereferences and             *
+ * comparisons. But the Prefix that follows a given <Prefix, Suffix> pair is always the same (the *
+ * old Prefix minus its first token, plus the Suffix), so it can be found once, ahead of time,    *
+ * and stored with the pair.                                                                      *
+ *                                                                                                *
+ * A compiled chain numbers its states (distinct Prefixes) and stores all edges (distinct         *
+ * <Prefix, Suffix> pairs) in one flat array, grouped by state. An edge holds the ID of the token *
+ * it emits, the number of the state it leads to, and the cumulative count of its state's edges   *
+ * up to and including itself. Generating a token then takes a random number below the state's    *
+ * total count, a search for the first edge whose cumulative count exceeds it, and a jump to that *
+ * edge's target. States with a single edge (common in higher-order chains) skip the random       *
+ * number entirely.                                                                               *
+ *                                                                                                *
+ * A model file's records are already sorted by Prefix and then by Suffix, which is exactly the   *
+ * order in which the edges are first laid out, so a model is compiled in a single sequential     *
+ * pass. A StringChain's pairs are first translated to token IDs and sorted.                      *
+ *                                                                                                *
+ * On large models, generation is dominated by cache misses rather than computation, so the data  *
+ * is arranged for locality. The arrays read for every token (the edge offsets and the edges      *
+ * themselves) are kept apart from the data that is rarely read (the Prefix of each state, and    *
+ * the text of each token), and start on cache-line boundaries. The text of all tokens is copied  *
+ * into a single pool, so that output is assembled from one contiguous block instead of strings   *
+ * scattered over the heap. Finally, OptimizeLayout() renumbers the states so that a state's      *
+ * likeliest successors are stored right after it.                                                *
+ *                                                                                                *
+ * In higher-order chains, most states have a single edge, and long stretches of the walk are     *
+ * fully determined: a state with one edge leads to another state with one edge, and so on. Like  *
+ * the unitigs of a de Bruijn graph, such stretches are collected into runs whose text is stored  *
+ * contiguously, so that Generate() emits the remainder of a run with a single copy and only      *
+ * draws a random number at states that branch.                                                   *
+ **************************************************************************************************/
+
+#include "CompiledChain.h"
+#include "TokenPolicy.h"
+#include "Tokenizer.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <deque>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+const unsigned int CompiledChain::NO_STATE;
+
+namespace
+{
+	// The limits of a compiled chain's 32-bit arrays. Edge offsets, token IDs and text offsets are
+	// unsigned ints; states are too, but start states are drawn with Random::nextInt(), which takes
+	// an int, and NO_STATE must never be a state.
+	const size_t MAX_STATES = INT_MAX;
+	const size_t MAX_OFFSET = 0xFFFFFFFF;
+
+	// Compares two keys as arrays of unsigned integers.
+	inline int CompareKeys(const unsigned int * a, const unsigned int * b, int length)
+	{
+		for (int i = 0; i < length; ++i)
+		{
+			if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+		}
+		return 0;
+	}
+
+	// Asks the processor to start loading the cache line that holds address.
+	inline void Prefetch(const void * address)
+	{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+		_mm_prefetch((const char *)address, _MM_HINT_T0);
+#elif defined(__GNUC__)
+		__builtin_prefetch(address);
+#else
+		(void)address;
+#endif
+	}
+
+	// Writes a static array definition named name, with perLine elements per line, each written by
+	// write(). Writes nothing for an empty array, which C++ does not allow; the image says NULL.
+	template <class T, class Write>
+	void WriteArray(std::ostream & out, const char * type, const std::string & name, const T * data, 
+	                size_t count, int perLine, Write write)
+	{
+		if (count == 0) return;
+		out << "alignas(64) static const " << type << " " << name << "[" << count << "] =\n{";
+		for (size_t i = 0; i < count; ++i)
+		{
+			out << (i % perLine == 0 ? "\n\t" : " ");
+			write(data[i]);
+			if (i + 1 < count) out << ",";
+		}
+		out << "\n};\n\n";
+	}
+}
+
+/**************************************************************************************************
+ * Constructor. The chain is empty, and its image describes its own (empty) arrays.               *
+ **************************************************************************************************/
+CompiledChain::CompiledChain()
+{
+	PointImageAtArrays();
+}
+
+/**************************************************************************************************
+ * Constructor for a chain whose arrays are already laid out, usually in static data built into   *
+ * the program (see WriteImage() and DefaultModel.h). Nothing is copied, not even the name of the *
+ * token type: the chain reads the arrays where they are, so it is ready at once, and it          *
+ * allocates nothing.                                                                             *
+ *   Inputs:                                                                                      *
+ *      image: The arrays. They must outlive the chain.                                           *
+ **************************************************************************************************/
+CompiledChain::CompiledChain(const Image & image)
+	: order(image.order), baked(true), image(image)
+{
+}
+
+/**************************************************************************************************
+ * Discards the current contents and prepares to compile a new chain.                             *
+ *   Inputs:                                                                                      *
+ *      order: The order of the new chain.                                                        *
+ *      tokenType: "words" or "characters".                                                       *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::Reset(int order, const std::wstring & tokenType)
+{
+	this->order = order;
+	this->tokenType = tokenType;
+	tooLarge = false;
+	vocabulary.reset(new Vocabulary);
+	edgeOffsets.clear();
+	edges.clear();
+	tokenText.clear();
+	tokenTextOffsets.clear();
+	vocabularyText.clear();
+	vocabularyOffsets.clear();
+	tokensByText.clear();
+	stateKeys.clear();
+	stateSteps.clear();
+	runSteps.clear();
+	runs.clear();
+	runText.clear();
+	stateIndex.clear();
+	sortedStates.clear();
+	leadingOffsets.clear();
+	baked = false;
+	PointImageAtArrays();
+}
+
+/**************************************************************************************************
+ * Points the image at the chain's own arrays. Called whenever the arrays may have moved: after   *
+ * they are built, and after anything that reallocates them.                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::PointImageAtArrays()
+{
+	image.order = order;
+	image.tokenType = tokenType.c_str();
+	image.numStates = edgeOffsets.empty() ? 0 : edgeOffsets.size() - 1;
+	image.numEdges = edges.size();
+	image.numTokens = tokenTextOffsets.empty() ? 0 : tokenTextOffsets.size() - 1;
+	image.numRunSteps = runSteps.size();
+	image.numRuns = runs.size();
+	image.numStateSlots = stateIndex.size();
+	image.numSeedStates = sortedStates.size();
+	image.edgeOffsets = edgeOffsets.data();
+	image.edges = edges.data();
+	image.tokenText = tokenText.data();
+	image.tokenTextOffsets = tokenTextOffsets.data();
+	image.vocabularyText = vocabularyText.data();
+	image.vocabularyOffsets = vocabularyOffsets.data();
+	image.tokensByText = tokensByText.data();
+	image.stateKeys = stateKeys.data();
+	image.stateSteps = stateSteps.data();
+	image.runSteps = runSteps.data();
+	image.runs = runs.data();
+	image.runText = runText.data();
+	image.stateIndex = stateIndex.data();
+	image.sortedStates = sortedStates.data();
+	image.leadingOffsets = leadingOffsets.data();
+}
+
+/**************************************************************************************************
+ * Adds one counted <Prefix, Suffix> record, starting a new state whenever the Prefix differs     *
+ * from the previous record's. Targets are filled in later by ResolveTargets(). A record that     *
+ * would take the chain past MAX_STATES states or MAX_OFFSET edges marks it as too large instead. *
+ *   Inputs:                                                                                      *
+ *      key: order + 1 token IDs: the Prefix, followed by the Suffix.                             *
+ *      count: The number of times the Suffix follows the Prefix.                                 *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::AddRecord(const unsigned int * key, unsigned long long count)
+{
+	size_t numStates = edgeOffsets.size();
+	bool newState = numStates == 0 || CompareKeys(&stateKeys[(numStates - 1) * order], key, order) != 0;
+	if (edges.size() >= MAX_OFFSET || (newState && numStates >= MAX_STATES)) tooLarge = true;
+	if (tooLarge) return;
+	Edge edge;
+	edge.cumulativeCount = count;
+	edge.token = key[order];
+	edge.target = NO_STATE;
+	if (newState)
+	{
+		stateKeys.insert(stateKeys.end(), key, key + order);
+		edgeOffsets.push_back((unsigned int)edges.size());
+	}
+	else edge.cumulativeCount += edges.back().cumulativeCount;
+	edges.push_back(edge);
+}
+
+/**************************************************************************************************
+ * Closes the edge offsets and finds the target of every edge: the state whose Prefix is the      *
+ * edge's own state's Prefix without its first token, followed by the edge's token. Until         *
+ * OptimizeLayout() runs, states are numbered in sorted order of their Prefixes, so the target is *
+ * found by binary search.                                                                        *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::ResolveTargets()
+{
+	const size_t numStates = edgeOffsets.size();
+	edgeOffsets.push_back((unsigned int)edges.size());
+
+	std::vector<unsigned int> targetKey(order);
+	const unsigned int * keys = stateKeys.data();
+	const int length = order;
+	for (size_t state = 0; state < numStates; ++state)
+	{
+		if (order > 0) std::copy(keys + state * order + 1, keys + (state + 1) * order, targetKey.begin());
+		for (unsigned int edge = edgeOffsets[state]; edge < edgeOffsets[state + 1]; ++edge)
+		{
+			if (order > 0) targetKey[order - 1] = edges[edge].token;
+
+			// Find the first state whose key is not less than targetKey:
+			size_t low = 0, high = numStates;
+			while (low < high)
+			{
+				size_t middle = (low + high) / 2;
+				if (CompareKeys(keys + middle * length, targetKey.data(), length) < 0) low = middle + 1;
+				else high = middle;
+			}
+			if (low < numStates && CompareKeys(keys + low * length, targetKey.data(), length) == 0)
+			{
+				edges[edge].target = (unsigned int)low;
+			}
+		}
+	}
+}
+
+/**************************************************************************************************
+ * Copies the text of every token into one contiguous pool, in the form in which it is written to *
+ * the output (see the Append() of the tokenizer policy, in TokenPolicy.h): words are preceded by *
+ * a space, characters are written as they are, and the non-word token is empty. Generate() can   *
+ * then append any token with a single copy and no further decisions. The tokens themselves are   *
+ * pooled the same way, with a list of the token IDs sorted by text, so that FindToken() needs no *
+ * hash table; the Vocabulary used while compiling can then be freed. Text that does not fit in   *
+ * 32-bit offsets marks the chain as too large.                                                   *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::BuildTextPool()
+{
+	tokenText.clear();
+	tokenTextOffsets.clear();
+	vocabularyText.clear();
+	vocabularyOffsets.clear();
+	VisitTokenPolicy(tokenType, [this](auto policy) {
+		std::wstring text;
+		for (size_t id = 0; id < vocabulary->Size(); ++id)
+		{
+			const std::wstring & token = vocabulary->Token((unsigned int)id);
+			vocabularyOffsets.push_back((unsigned int)vocabularyText.size());
+			vocabularyText.insert(vocabularyText.end(), token.begin(), token.end());
+			tokenTextOffsets.push_back((unsigned int)tokenText.size());
+			if (id == Vocabulary::NONWORD_ID) continue;
+			text.clear();
+			decltype(policy)::Append(text, token);
+			tokenText.insert(tokenText.end(), text.begin(), text.end());
+		}
+	});
+	tokenTextOffsets.push_back((unsigned int)tokenText.size());
+	vocabularyOffsets.push_back((unsigned int)vocabularyText.size());
+	if (tokenText.size() > MAX_OFFSET || vocabularyText.size() > MAX_OFFSET) tooLarge = true;
+
+	tokensByText.resize(vocabulary->Size());
+	for (size_t id = 0; id < tokensByText.size(); ++id) tokensByText[id] = (unsigned int)id;
+	const wchar_t * text = vocabularyText.data();
+	const unsigned int * offsets = vocabularyOffsets.data();
+	std::sort(tokensByText.begin(), tokensByText.end(), [text, offsets](unsigned int a, unsigned int b) {
+		return std::lexicographical_compare(text + offsets[a], text + offsets[a + 1], text + offsets[b], 
+		                                    text + offsets[b + 1]);
+	});
+}
+
+/**************************************************************************************************
+ * Collects the states that have a single edge into runs. A run starts at a single-edge state     *
+ * unless that state's only predecessor is itself a single-edge state, and continues for as long  *
+ * as the next state has a single edge and no other predecessor. Every single-edge state          *
+ * therefore belongs to exactly one run; runs are split wherever another edge leads into the      *
+ * middle of them, so that the text of each state is stored only once. States on a cycle of       *
+ * single-edge states, which have no start, are collected last, with the run's exit leading back  *
+ * to its own first state. Run text that does not fit in 32-bit offsets marks the chain as too    *
+ * large.                                                                                         *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::BuildRuns()
+{
+	const size_t numStates = edgeOffsets.empty() ? 0 : edgeOffsets.size() - 1;
+	stateSteps.assign(numStates, NO_STATE);
+	runSteps.clear();
+	runs.clear();
+	runText.clear();
+
+	auto isSingle = [this](unsigned int state) { return edgeOffsets[state + 1] - edgeOffsets[state] == 1; };
+
+	// Find the states whose only predecessor is a single-edge state, and so do not start a run:
+	std::vector<unsigned char> inDegree(numStates, 0), singleInDegree(numStates, 0);
+	for (size_t state = 0; state < numStates; ++state)
+	{
+		for (unsigned int e = edgeOffsets[state]; e < edgeOffsets[state + 1]; ++e)
+		{
+			unsigned int target = edges[e].target;
+			if (target == NO_STATE) continue;
+			if (inDegree[target] < 2) inDegree[target]++;
+			if (isSingle((unsigned int)state) && singleInDegree[target] < 2) singleInDegree[target]++;
+		}
+	}
+	auto continuesRun = [&](unsigned int state) { return inDegree[state] == 1 && singleInDegree[state] == 1; };
+
+	auto addRun = [&](unsigned int state) {
+		const unsigned int run = (unsigned int)runs.size();
+		do
+		{
+			const unsigned int token = edges[edgeOffsets[state]].token;
+			stateSteps[state] = (unsigned int)runSteps.size();
+			RunStep step = { (unsigned int)runText.size(), run };
+			runSteps.push_back(step);
+			runText.insert(runText.end(), tokenText.begin() + tokenTextOffsets[token], 
+			               tokenText.begin() + tokenTextOffsets[token + 1]);
+			state = edges[edgeOffsets[state]].target;
+		} while (state != NO_STATE && isSingle(state) && continuesRun(state) && stateSteps[state] == NO_STATE);
+		Run end = { (unsigned int)runSteps.size(), state };
+		runs.push_back(end);
+	};
+
+	for (size_t state = 0; state < numStates; ++state)
+	{
+		if (isSingle((unsigned int)state) && !continuesRun((unsigned int)state)) addRun((unsigned int)state);
+	}
+	for (size_t state = 0; state < numStates; ++state)
+	{
+		if (isSingle((unsigned int)state) && stateSteps[state] == NO_STATE) addRun((unsigned int)state);
+	}
+
+	// A final step marks where the text of the last run ends:
+	RunStep sentinel = { (unsigned int)runText.size(), NO_STATE };
+	runSteps.push_back(sentinel);
+	if (runText.size() > MAX_OFFSET) tooLarge = true;
+}
+
+/**************************************************************************************************
+ * Hashes a Prefix into a starting slot for the search of a stateIndex.                           *
+ *   Inputs:                                                                                      *
+ *      key: order token IDs.                                                                     *
+ *      slots: The number of slots in the stateIndex, a power of two.                             *
+ *   return value: The slot at which to start searching.                                          *
+ **************************************************************************************************/
+size_t CompiledChain::HashKey(const unsigned int * key, size_t slots) const
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (int i = 0; i < order; ++i) hash = (hash ^ key[i]) * 1099511628211ULL;
+	return (size_t)(hash ^ (hash >> 29)) & (slots - 1);
+}
+
+/**************************************************************************************************
+ * Fills stateIndex, a hash table from Prefixes to states. Once OptimizeLayout() has run, the     *
+ * states are no longer in sorted order, so the binary search that ResolveTargets() uses no       *
+ * longer works; the table lets FindState() find any Prefix's state in a probe or two instead. It *
+ * has twice as many slots as there are states (rounded up to a power of two), and costs about 8  *
+ * bytes per state.                                                                               *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::BuildStateIndex()
+{
+	const size_t numStates = edgeOffsets.empty() ? 0 : edgeOffsets.size() - 1;
+	stateIndex.clear();
+	if (numStates == 0) return;
+	size_t slots = 1;
+	while (slots < 2 * numStates) slots *= 2;
+	stateIndex.assign(slots, NO_STATE);
+	for (size_t state = 0; state < numStates; ++state)
+	{
+		size_t slot = HashKey(&stateKeys[state * order], slots);
+		while (stateIndex[slot] != NO_STATE) slot = (slot + 1) & (slots - 1);
+		stateIndex[slot] = (unsigned int)state;
+	}
+}
+
+/**************************************************************************************************
+ * Fills the seed index, which finds the states whose Prefixes begin with given tokens (see       *
+ * FindSeedState()). The states are listed in sorted order of their Prefixes, so that all the     *
+ * states beginning with the same tokens are listed together; and for each token, the position of *
+ * the first state that begins with it is recorded. The states beginning with one token are then  *
+ * found in constant time, and those beginning with several tokens by a binary search among them. *
+ * It costs 4 bytes per state and 4 per token.                                                    *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::BuildSeedIndex()
+{
+	const size_t numStates = edgeOffsets.empty() ? 0 : edgeOffsets.size() - 1;
+	sortedStates.clear();
+	leadingOffsets.clear();
+	if (numStates == 0 || order == 0) return;
+
+	sortedStates.resize(numStates);
+	for (size_t s = 0; s < numStates; ++s) sortedStates[s] = (unsigned int)s;
+	const unsigned int * keys = stateKeys.data();
+	const int length = order;
+	std::sort(sortedStates.begin(), sortedStates.end(), [keys, length](unsigned int a, unsigned int b) {
+		return CompareKeys(keys + (size_t)a * length, keys + (size_t)b * length, length) < 0;
+	});
+
+	leadingOffsets.assign(tokenTextOffsets.size(), 0);
+	for (size_t s = 0; s < numStates; ++s) leadingOffsets[stateKeys[(size_t)s * order] + 1]++;
+	for (size_t t = 1; t < leadingOffsets.size(); ++t) leadingOffsets[t] += leadingOffsets[t - 1];
+}
+
+/**************************************************************************************************
+ * Completes compilation once every record has been added, and frees the Vocabulary, whose tokens *
+ * are now in vocabularyText. A chain that turned out to be too large for its 32-bit arrays is    *
+ * emptied instead, since its numbers and offsets have wrapped around; generating from it would   *
+ * follow edges into the wrong states.                                                            *
+ *   return value: true if the chain was compiled, false if it was too large.                     *
+ **************************************************************************************************/
+bool CompiledChain::Finish()
+{
+	if (!tooLarge)
+	{
+		ResolveTargets();
+		BuildTextPool();
+	}
+	if (!tooLarge) OptimizeLayout();
+	const bool compiled = !tooLarge;
+	if (!compiled)
+	{
+		const std::wstring type = tokenType;
+		Reset(order, type);
+		OptimizeLayout();
+	}
+	vocabulary.reset();
+	return compiled;
+}
+
+/**************************************************************************************************
+ * Compiles a trained StringChain. Its tokens are given IDs, and its pairs are sorted by ID so    *
+ * that they can be added in order.                                                               *
+ *   Inputs:                                                                                      *
+ *      chain: The trained chain.                                                                 *
+ *      order: The order of the chain.                                                            *
+ *      tokenType: "words" or "characters".                                                       *
+ *   return value: true if the chain was compiled, false if it is too large (see Finish()).       *
+ **************************************************************************************************/
+bool CompiledChain::Compile(const StringChain & chain, int order, const std::wstring & tokenType)
+{
+	Reset(order, tokenType);
+	std::vector<unsigned int> records;
+	chain.ForEachPair([&](const std::list<std::wstring> & prefix, const std::wstring & suffix, 
+	                      unsigned long long count) {
+		for (auto it = prefix.begin(); it != prefix.end(); ++it) records.push_back(vocabulary->Intern(*it));
+		records.push_back(vocabulary->Intern(suffix));
+		records.push_back((unsigned int)count);
+		records.push_back((unsigned int)(count >> 32));
+	});
+	AddRecords(records);
+	return Finish();
+}
+
+/**************************************************************************************************
+ * Compiles one of the chains held in a frozen ContextTrie. The trie's vocabulary is used as it   *
+ * is, and its records are sorted so that they can be added in order.                             *
+ *   Inputs:                                                                                      *
+ *      trie: The frozen trie.                                                                    *
+ *      order: The order of the chain to compile, from 1 to trie.MaxOrder().                      *
+ *   return value: true if the chain was compiled, false if it is too large (see Finish()).       *
+ **************************************************************************************************/
+bool CompiledChain::Compile(const ContextTrie & trie, int order)
+{
+	Reset(order, trie.TokenType());
+	vocabulary.reset(new Vocabulary(trie.GetVocabulary()));
+	std::vector<unsigned int> records;
+	trie.ForEachRecord(order, [&](const unsigned int * key, unsigned long long count) {
+		records.insert(records.end(), key, key + order + 1);
+		records.push_back((unsigned int)count);
+		records.push_back((unsigned int)(count >> 32));
+	});
+	AddRecords(records);
+	return Finish();
+}
+
+/**************************************************************************************************
+ * Compiles the records of a BulkTrainer, which come out already sorted. The trainer also knows   *
+ * how many records and states there are, so the tables are allocated once at their exact size    *
+ * rather than grown as records are added.                                                        *
+ *   Inputs:                                                                                      *
+ *      trainer: The trainer, once every input has been read.                                     *
+ *   return value: true if the chain was compiled, false if it is too large (see Finish()).       *
+ **************************************************************************************************/
+bool CompiledChain::Compile(BulkTrainer & trainer)
+{
+	Reset(trainer.Order(), trainer.TokenType());
+	vocabulary.reset(new Vocabulary(trainer.GetVocabulary()));
+	edges.reserve(trainer.NumRecords());
+	edgeOffsets.reserve(trainer.NumPrefixes() + 1);
+	stateKeys.reserve(trainer.NumPrefixes() * order);
+	trainer.ForEachRecord([this](const unsigned int * key, unsigned long long count) { AddRecord(key, count); });
+	return Finish();
+}
+
+/**************************************************************************************************
+ * Sorts records by key and adds them in that order.                                              *
+ *   Inputs:                                                                                      *
+ *      records: The records, each order + 1 IDs followed by its count, split into two words, low *
+ *               word first.                                                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::AddRecords(const std::vector<unsigned int> & records)
+{
+	const size_t words = order + 3;
+	const size_t numRecords = records.size() / words;
+	if (numRecords > MAX_OFFSET)
+	{
+		tooLarge = true;
+		return;
+	}
+	std::vector<unsigned int> sorted(numRecords);
+	for (size_t i = 0; i < numRecords; ++i) sorted[i] = (unsigned int)i;
+	const unsigned int * base = records.data();
+	const int length = order + 1;
+	std::sort(sorted.begin(), sorted.end(), [base, words, length](unsigned int a, unsigned int b) {
+		return CompareKeys(base + (size_t)a * words, base + (size_t)b * words, length) < 0;
+	});
+
+	for (size_t i = 0; i < numRecords; ++i)
+	{
+		const unsigned int * record = base + (size_t)sorted[i] * words;
+		AddRecord(record, record[length] | ((unsigned long long)record[length + 1] << 32));
+	}
+}
+
+/**************************************************************************************************
+ * Compiles the contents of a model file, whose records are already in the required order.        *
+ *   Inputs:                                                                                      *
+ *      model: An opened model file.                                                              *
+ *   return value: true if every record was read and compiled, false if the file is truncated     *
+ *                 (see ModelReader::Truncated()) or its chain is too large (see Finish()).       *
+ **************************************************************************************************/
+bool CompiledChain::Load(ModelReader & model)
+{
+	Reset(model.Order(), model.TokenType());
+	vocabulary.reset(new Vocabulary(model.GetVocabulary()));
+	std::vector<unsigned int> key(order + 1);
+	unsigned long long count;
+	while (model.Next(key.data(), count))
+	{
+		if (count > 0) AddRecord(key.data(), count);
+	}
+	const bool compiled = Finish();
+	return compiled && !model.Truncated();
+}
+
+/**************************************************************************************************
+ * Renumbers the states for locality. Sorted order scatters a state's successors all over the     *
+ * edge array (the states that can follow "I am" are the states beginning with "am", which have   *
+ * nothing else in common), so nearly every generated token costs a cache miss or two. This pass  *
+ * lays the states out in breadth-first order instead, starting from the most frequently visited  *
+ * state and visiting each state's successors in order of decreasing edge count; when the search  *
+ * runs out, it restarts from the most frequent state not yet placed. A state's likeliest         *
+ * successors therefore end up stored close behind it, and the most frequently visited states,    *
+ * which account for most of the traversals, are packed together at the front of the arrays.      *
+ *                                                                                                *
+ * Only the numbering changes, never the chain itself: generation starts from a uniformly chosen  *
+ * state, which is equally likely to be any state under any numbering. The runs and the indexes   *
+ * refer to states by number, so they are rebuilt afterwards, in the new order.                   *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::OptimizeLayout()
+{
+	if (baked) return;
+	const size_t numStates = edgeOffsets.empty() ? 0 : edgeOffsets.size() - 1;
+	if (numStates == 0)
+	{
+		BuildRuns();
+		BuildStateIndex();
+		BuildSeedIndex();
+		PointImageAtArrays();
+		return;
+	}
+
+	// A state's total count is the number of times its Prefix occurred in the input:
+	std::vector<unsigned int> byFrequency(numStates);
+	for (size_t s = 0; s < numStates; ++s) byFrequency[s] = (unsigned int)s;
+	std::stable_sort(byFrequency.begin(), byFrequency.end(), [this](unsigned int a, unsigned int b) {
+		return edges[edgeOffsets[a + 1] - 1].cumulativeCount > edges[edgeOffsets[b + 1] - 1].cumulativeCount;
+	});
+
+	// Breadth-first search, following the heaviest edges first:
+	std::vector<unsigned int> newNumber(numStates, NO_STATE);
+	std::vector<unsigned int> layout;
+	layout.reserve(numStates);
+	std::vector<unsigned int> successors;
+	for (size_t i = 0; i < numStates; ++i)
+	{
+		if (newNumber[byFrequency[i]] != NO_STATE) continue;
+		newNumber[byFrequency[i]] = (unsigned int)layout.size();
+		layout.push_back(byFrequency[i]);
+
+		for (size_t next = layout.size() - 1; next < layout.size(); ++next)
+		{
+			unsigned int state = layout[next];
+			successors.clear();
+			for (unsigned int e = edgeOffsets[state]; e < edgeOffsets[state + 1]; ++e) successors.push_back(e);
+			const unsigned int first = edgeOffsets[state];
+			auto countOf = [this, first](unsigned int e) {
+				return edges[e].cumulativeCount - (e > first ? edges[e - 1].cumulativeCount : 0);
+			};
+			std::stable_sort(successors.begin(), successors.end(), [&countOf](unsigned int a, unsigned int b) {
+				return countOf(a) > countOf(b);
+			});
+			for (size_t k = 0; k < successors.size(); ++k)
+			{
+				unsigned int target = edges[successors[k]].target;
+				if (target != NO_STATE && newNumber[target] == NO_STATE)
+				{
+					newNumber[target] = (unsigned int)layout.size();
+					layout.push_back(target);
+				}
+			}
+		}
+	}
+
+	// Rebuild the arrays in the new order:
+	std::vector<unsigned int, AlignedAllocator<unsigned int>> newOffsets;
+	std::vector<Edge, AlignedAllocator<Edge>> newEdges;
+	std::vector<unsigned int> newKeys;
+	newOffsets.reserve(numStates + 1);
+	newEdges.reserve(edges.size());
+	newKeys.reserve(stateKeys.size());
+	for (size_t i = 0; i < numStates; ++i)
+	{
+		unsigned int state = layout[i];
+		newOffsets.push_back((unsigned int)newEdges.size());
+		for (unsigned int e = edgeOffsets[state]; e < edgeOffsets[state + 1]; ++e)
+		{
+			Edge edge = edges[e];
+			if (edge.target != NO_STATE) edge.target = newNumber[edge.target];
+			newEdges.push_back(edge);
+		}
+		newKeys.insert(newKeys.end(), stateKeys.begin() + state * order, 
+		               stateKeys.begin() + (state + 1) * order);
+	}
+	newOffsets.push_back((unsigned int)newEdges.size());
+	edgeOffsets.swap(newOffsets);
+	edges.swap(newEdges);
+	stateKeys.swap(newKeys);
+	BuildRuns();
+	BuildStateIndex();
+	BuildSeedIndex();
+	PointImageAtArrays();
+}
+
+/**************************************************************************************************
+ * Generates a string of gibberish. Starting from a random state, each step picks one of the      *
+ * current state's edges with probability proportional to its count, appends the edge's token to  *
+ * the output, and moves to the edge's target state. An edge without a target (which can only     *
+ * come from a damaged model file) restarts the walk at a random state. States with a single edge *
+ * need no random draw at all, and the whole run that they begin is emitted at once.              *
+ *                                                                                                *
+ * Apart from the output itself, nothing is allocated; see the overload below.                    *
+ *   Inputs:                                                                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests. A cancelled generation returns the output produced so     *
+ *               far.                                                                             *
+ *   return value: A string containing numGen tokens of generated gibberish.                      *
+ **************************************************************************************************/
+std::wstring CompiledChain::Generate(int numGen, Random & rand, ProgressMonitor * monitor) const
+{
+	std::wstring output;
+	Generate(numGen, rand, output, monitor);
+	return output;
+}
+
+/**************************************************************************************************
+ * Appends a string of gibberish to output, as described above. If output has room for the        *
+ * generated text, no heap allocations are performed at all, which lets a caller that generates   *
+ * repeatedly (such as a server worker) reuse one buffer.                                         *
+ *   Inputs:                                                                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the gibberish is appended.                                    *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests. A cancelled generation leaves the output produced so far. *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::Generate(int numGen, Random & rand, std::wstring & output, 
+                             ProgressMonitor * monitor) const
+{
+	if (IsEmpty()) return;
+	Walk((unsigned int)rand.nextInt((int)NumStates()), numGen, rand, output, monitor);
+}
+
+/**************************************************************************************************
+ * Walks the chain from a given state, appending the token of every edge taken to output, as      *
+ * described above. The state that the walk ends in is returned, so that a later walk can carry   *
+ * on where this one stopped (see GeneratorCursor).                                               *
+ *   Inputs:                                                                                      *
+ *      state: The state to start from.                                                           *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the gibberish is appended.                                    *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests.                                                           *
+ *   return value: The state from which the next token would have been generated.                 *
+ **************************************************************************************************/
+unsigned int CompiledChain::Walk(unsigned int state, int numGen, Random & rand, std::wstring & output, 
+                                 ProgressMonitor * monitor) const
+{
+	const int numStates = (int)image.numStates;
+	const unsigned int * offsets = image.edgeOffsets;
+	const Edge * edgeArray = image.edges;
+	const wchar_t * text = image.tokenText;
+	const unsigned int * textOffsets = image.tokenTextOffsets;
+	const unsigned int * steps = image.stateSteps;
+	const RunStep * stepArray = image.runSteps;
+	const Run * runArray = image.runs;
+	const wchar_t * runChars = image.runText;
+
+	int i = 0;
+	int nextReport = 0;
+	while (i < numGen)
+	{
+		// Report progress and honor cancellation requests every so often:
+		if (monitor && i >= nextReport)
+		{
+			monitor->SetTokensGenerated(i);
+			if (monitor->IsCancelled()) return state;
+			nextReport = i + 256;
+		}
+
+		unsigned int low = offsets[state], high = offsets[state + 1] - 1;
+		if (low == high)
+		{
+			// The state has a single edge, so emit as much of its run as is still needed. If the run
+			// is cut short, the output is complete, and the state in the middle of the run that the
+			// walk would continue from is found by following the single edges.
+			const unsigned int step = steps[state];
+			const Run & run = runArray[stepArray[step].run];
+			const unsigned int count = std::min(run.endStep - step, (unsigned int)(numGen - i));
+			output.append(runChars + stepArray[step].textOffset, 
+			              stepArray[step + count].textOffset - stepArray[step].textOffset);
+			i += count;
+			if (step + count == run.endStep)
+			{
+				state = run.exit;
+			}
+			else
+			{
+				for (unsigned int k = 0; k < count; ++k) state = edgeArray[offsets[state]].target;
+			}
+		}
+		else
+		{
+			// Choose one of the state's edges, by binary search for the first cumulative count that
+			// exceeds a random draw:
+			unsigned long long draw = rand.nextLong(edgeArray[high].cumulativeCount);
+			while (low < high)
+			{
+				unsigned int middle = (low + high) / 2;
+				if (edgeArray[middle].cumulativeCount <= draw) low = middle + 1;
+				else high = middle;
+			}
+			const Edge & edge = edgeArray[low];
+
+			// Save the token to the output and follow the edge:
+			output.append(text + textOffsets[edge.token], textOffsets[edge.token + 1] - textOffsets[edge.token]);
+			i++;
+			state = edge.target;
+		}
+		if (state == NO_STATE) state = (unsigned int)rand.nextInt(numStates);
+	}
+
+	if (monitor) monitor->SetTokensGenerated(numGen);
+	return state;
+}
+
+/**************************************************************************************************
+ * Finds a state from which to continue a context. The ideal state is the one whose Prefix is the *
+ * last order tokens of the context. If the context is shorter than that, or that Prefix never    *
+ * occurred, the context is shortened from the front until some Prefixes begin with what remains, *
+ * and one of those is chosen at random; at worst, the remainder is the context's last token. The *
+ * seed index makes each attempt a constant-time lookup followed by a binary search.              *
+ *   Inputs:                                                                                      *
+ *      context: The IDs of the context's tokens, with NO_STATE for tokens the chain has never    *
+ *               seen.                                                                            *
+ *      length: The number of tokens in the context.                                              *
+ *      rand: An object of type Random, for choosing among several matching states.               *
+ *      matched: Receives the number of tokens at the end of the context that the state's Prefix  *
+ *               begins with.                                                                     *
+ *   return value: The state, or NO_STATE if no Prefix begins with the context's last token.      *
+ **************************************************************************************************/
+unsigned int CompiledChain::FindSeedState(const unsigned int * context, size_t length, Random & rand, 
+                                          size_t & matched) const
+{
+	const unsigned int * keys = image.stateKeys;
+	const int keyLength = order;
+	for (size_t use = std::min(length, (size_t)order); use > 0; --use)
+	{
+		const unsigned int * tail = context + length - use;
+		if (use == (size_t)order)
+		{
+			unsigned int state = FindState(tail);
+			if (state == NO_STATE) continue;
+			matched = use;
+			return state;
+		}
+
+		// Find the states that begin with the first token of the tail, then narrow them down to the
+		// ones that begin with the whole tail:
+		if (tail[0] >= image.numTokens) continue;
+		const unsigned int * first = image.sortedStates + image.leadingOffsets[tail[0]];
+		const unsigned int * last = image.sortedStates + image.leadingOffsets[tail[0] + 1];
+		const int compared = (int)use;
+		auto range = std::equal_range(first, last, NO_STATE, [&](unsigned int a, unsigned int b) {
+			const unsigned int * keyA = (a == NO_STATE) ? tail : keys + (size_t)a * keyLength;
+			const unsigned int * keyB = (b == NO_STATE) ? tail : keys + (size_t)b * keyLength;
+			return CompareKeys(keyA, keyB, compared) < 0;
+		});
+		if (range.first == range.second) continue;
+		matched = use;
+		return *(range.first + rand.nextInt((int)(range.second - range.first)));
+	}
+	return NO_STATE;
+}
+
+/**************************************************************************************************
+ * Begins gibberish that continues a given context (a topic word, say, or the start of a          *
+ * sentence). The context is tokenized the way training texts are and a state is chosen to        *
+ * continue it (see FindSeedState()). The context is appended to output, followed by whatever the *
+ * chosen state's Prefix adds to it.                                                              *
+ *   Inputs:                                                                                      *
+ *      context: The text to continue. If it has no tokens, a random state is chosen and nothing  *
+ *               is appended.                                                                     *
+ *      maxTokens: The most tokens to append after the context.                                   *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the context and the rest of the Prefix are appended.          *
+ *      generated: Receives the number of tokens appended after the context.                      *
+ *   return value: The state from which to continue, or NO_STATE if no Prefix in the chain begins *
+ *                 with the context's last token (or the chain is empty), in which case output is *
+ *                 left unchanged.                                                                *
+ **************************************************************************************************/
+unsigned int CompiledChain::SeedFrom(const std::wstring & context, int maxTokens, Random & rand, 
+                                     std::wstring & output, int & generated) const
+{
+	generated = 0;
+	if (IsEmpty()) return NO_STATE;
+	std::vector<std::wstring> tokens;
+	Tokenizer tokenizer(image.tokenType);
+	tokenizer.Tokenize(context.data(), context.data() + context.size(), tokens);
+	tokenizer.Finish(tokens);
+	if (tokens.empty()) return (unsigned int)rand.nextInt((int)NumStates());
+
+	std::vector<unsigned int> ids(tokens.size());
+	for (size_t i = 0; i < tokens.size(); ++i)
+	{
+		if (!FindToken(tokens[i], ids[i])) ids[i] = NO_STATE;
+	}
+	size_t matched = 0;
+	unsigned int state = FindSeedState(ids.data(), ids.size(), rand, matched);
+	if (state == NO_STATE) return NO_STATE;
+
+	// Write the context, and then the rest of the state's Prefix:
+	AppendTokens(image.tokenType, tokens, output);
+	for (size_t i = matched; i < (size_t)order && generated < maxTokens; ++i, ++generated)
+	{
+		unsigned int token = image.stateKeys[(size_t)state * order + i];
+		output.append(image.tokenText + image.tokenTextOffsets[token], 
+		              image.tokenTextOffsets[token + 1] - image.tokenTextOffsets[token]);
+	}
+	return state;
+}
+
+/**************************************************************************************************
+ * Generates gibberish that continues a given context: the context, whatever the Prefix of the    *
+ * state chosen to continue it adds (see SeedFrom()), and then the walk from that state. All      *
+ * tokens after the context count towards numGen.                                                 *
+ *   Inputs:                                                                                      *
+ *      context: The text to continue. If it has no tokens, this is the same as Generate().       *
+ *      numGen: The number of words or characters to be generated after the context.              *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the context and the gibberish are appended.                   *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests.                                                           *
+ *   return value: true on success, false if no Prefix in the chain begins with the context's     *
+ *                 last token (or the chain is empty), in which case output is left unchanged.    *
+ **************************************************************************************************/
+bool CompiledChain::GenerateFrom(const std::wstring & context, int numGen, Random & rand, 
+                                 std::wstring & output, ProgressMonitor * monitor) const
+{
+	int generated = 0;
+	unsigned int state = SeedFrom(context, numGen, rand, output, generated);
+	if (state == NO_STATE) return false;
+	Walk(state, numGen - generated, rand, output, monitor);
+	return true;
+}
+
+/**************************************************************************************************
+ * Looks up the ID of a token, by binary search of the token IDs in order of their text.          *
+ *   Inputs:                                                                                      *
+ *      token: A word or character.                                                               *
+ *      id: Receives the token's ID, if it has one.                                               *
+ *   return value: true if the chain has seen the token, false otherwise.                         *
+ **************************************************************************************************/
+bool CompiledChain::FindToken(const std::wstring & token, unsigned int & id) const
+{
+	const wchar_t * text = image.vocabularyText;
+	const unsigned int * offsets = image.vocabularyOffsets;
+	const unsigned int * end = image.tokensByText + image.numTokens;
+	const unsigned int * found = std::lower_bound(image.tokensByText, end, token, 
+	                                              [text, offsets](unsigned int t, const std::wstring & value) {
+		return std::lexicographical_compare(text + offsets[t], text + offsets[t + 1], value.begin(), value.end());
+	});
+	if (found == end || !std::equal(token.begin(), token.end(), text + offsets[*found], text + offsets[*found + 1]))
+	{
+		return false;
+	}
+	id = *found;
+	return true;
+}
+
+/**************************************************************************************************
+ * Returns the token with a given ID.                                                             *
+ *   Inputs:                                                                                      *
+ *      id: The token's ID, which must be less than the number of tokens.                         *
+ *   return value: The token, or an empty string for the non-word.                                *
+ **************************************************************************************************/
+std::wstring CompiledChain::TokenString(unsigned int id) const
+{
+	return std::wstring(image.vocabularyText + image.vocabularyOffsets[id], 
+	                    image.vocabularyText + image.vocabularyOffsets[id + 1]);
+}
+
+/**************************************************************************************************
+ * Finds the state with a given Prefix. Prefixes containing NO_STATE (which callers may use to    *
+ * stand for tokens the chain has never seen) never match.                                        *
+ *   Inputs:                                                                                      *
+ *      prefix: order token IDs.                                                                  *
+ *   return value: The state, or NO_STATE if the chain has no state with that Prefix.             *
+ **************************************************************************************************/
+unsigned int CompiledChain::FindState(const unsigned int * prefix) const
+{
+	if (image.numStateSlots == 0) return NO_STATE;
+	const size_t mask = image.numStateSlots - 1;
+	for (size_t slot = HashKey(prefix, image.numStateSlots); image.stateIndex[slot] != NO_STATE; slot = (slot + 1) & mask)
+	{
+		unsigned int state = image.stateIndex[slot];
+		if (CompareKeys(image.stateKeys + (size_t)state * order, prefix, order) == 0) return state;
+	}
+	return NO_STATE;
+}
+
+/**************************************************************************************************
+ * Returns the state whose Prefix consists entirely of non-words. Every input text is trained     *
+ * starting from this Prefix, so scoring a text starts here too.                                  *
+ *   return value: The state, or NO_STATE if the chain is empty.                                  *
+ **************************************************************************************************/
+unsigned int CompiledChain::StartState() const
+{
+	std::vector<unsigned int> prefix(order, Vocabulary::NONWORD_ID);
+	return FindState(prefix.data());
+}
+
+/**************************************************************************************************
+ * Looks up the edge of a state that emits a given token. The edges of each state are stored in   *
+ * order of token ID (compilation adds them in that order, and OptimizeLayout() moves states but  *
+ * never reorders their edges), so the edge is found by binary search.                            *
+ *   Inputs:                                                                                      *
+ *      state: The state. Must not be NO_STATE.                                                   *
+ *      token: The ID of the token.                                                               *
+ *      count: Receives the number of times the token followed the state's Prefix.                *
+ *      total: Receives the number of times the state's Prefix was followed by any token.         *
+ *      target: Receives the state that the edge leads to (possibly NO_STATE).                    *
+ *   return value: true if the edge exists, false if the token never followed the state's Prefix  *
+ *                 (total is set either way).                                                     *
+ **************************************************************************************************/
+bool CompiledChain::FindEdge(unsigned int state, unsigned int token, unsigned long long & count, 
+                             unsigned long long & total, unsigned int & target) const
+{
+	unsigned int low = image.edgeOffsets[state], high = image.edgeOffsets[state + 1];
+	const unsigned int first = low;
+	total = image.edges[high - 1].cumulativeCount;
+	while (low < high)
+	{
+		unsigned int middle = (low + high) / 2;
+		if (image.edges[middle].token < token) low = middle + 1;
+		else high = middle;
+	}
+	if (low == image.edgeOffsets[state + 1] || image.edges[low].token != token) return false;
+	count = image.edges[low].cumulativeCount - (low > first ? image.edges[low - 1].cumulativeCount : 0);
+	target = image.edges[low].target;
+	return true;
+}
+
+/**************************************************************************************************
+ * Prefetches the offsets of a state's edges, the first of the two dependent loads that           *
+ * FindEdge() makes. Looking up many states at once, a caller can prefetch them all before using  *
+ * any, so that the cache misses overlap instead of being paid one after another.                 *
+ *   Inputs:                                                                                      *
+ *      state: The state, or NO_STATE (which is ignored).                                         *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::PrefetchState(unsigned int state) const
+{
+	if (state != NO_STATE) Prefetch(image.edgeOffsets + state);
+}
+
+/**************************************************************************************************
+ * Prefetches the start of a state's edges, the second of the two dependent loads that FindEdge() *
+ * makes. Should follow PrefetchState() for the same state after a delay.                         *
+ *   Inputs:                                                                                      *
+ *      state: The state, or NO_STATE (which is ignored).                                         *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::PrefetchEdges(unsigned int state) const
+{
+	if (state == NO_STATE) return;
+	Prefetch(image.edges + image.edgeOffsets[state]);
+	Prefetch(image.edges + image.edgeOffsets[state + 1] - 1);
+}
+
+/**************************************************************************************************
+ * Calls a function once for every <Prefix, Suffix> pair in the chain, with the number of times   *
+ * the pair occurs. The counts are recovered from the cumulative counts of the edges. Meant for   *
+ * checking the chain against the StringChain it was compiled from (see ReferenceOracle), not for *
+ * speed.                                                                                         *
+ *   Inputs:                                                                                      *
+ *      visit: The function to call, with the Prefix's tokens, the Suffix and the count.          *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::ForEachPair(const std::function<void(const std::list<std::wstring> & prefix,
+                                const std::wstring & suffix, unsigned long long count)> & visit) const
+{
+	const size_t numStates = NumStates();
+	for (size_t s = 0; s < numStates; ++s)
+	{
+		std::list<std::wstring> prefix;
+		for (int i = 0; i < order; ++i) prefix.push_back(TokenString(image.stateKeys[s * order + i]));
+		unsigned long long previous = 0;
+		for (unsigned int e = image.edgeOffsets[s]; e < image.edgeOffsets[s + 1]; ++e)
+		{
+			visit(prefix, TokenString(image.edges[e].token), image.edges[e].cumulativeCount - previous);
+			previous = image.edges[e].cumulativeCount;
+		}
+	}
+}
+
+/**************************************************************************************************
+ * Returns the chain's image: the arrays that generation and lookups read.                        *
+ **************************************************************************************************/
+const CompiledChain::Image & CompiledChain::GetImage() const
+{
+	return image;
+}
+
+/**************************************************************************************************
+ * Writes the chain's image as C++ source, so that a compiled chain can be built into the program *
+ * and used without reading or compiling anything (see DefaultModel.h). The source defines a      *
+ * static array for each of the image's arrays, followed by a CompiledChain::Image that describes *
+ * them; it must be compiled after CompiledChain.h is included. Characters are written as         *
+ * numbers, so the source is the same for any text, but a chain whose tokens use characters       *
+ * outside the Basic Multilingual Plane must be written on a platform with the same size of       *
+ * wchar_t as the one that compiles it.                                                           *
+ *   Inputs:                                                                                      *
+ *      out: The stream to write to.                                                              *
+ *      name: The name of the Image. The arrays are named after it.                               *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void CompiledChain::WriteImage(std::ostream & out, const std::string & name) const
+{
+	auto number = [&out](unsigned long long value) { out << value; };
+	auto character = [&out](wchar_t c) { out << (unsigned long)c; };
+	auto edge = [&out](const Edge & e) { out << "{ " << e.cumulativeCount << "ULL, " << e.token << ", " << e.target << " }"; };
+	auto runStep = [&out](const RunStep & step) { out << "{ " << step.textOffset << ", " << step.run << " }"; };
+	auto run = [&out](const Run & r) { out << "{ " << r.endStep << ", " << r.exit << " }"; };
+
+	const size_t numTokens = image.numTokens;
+	const size_t tokenTextLength = numTokens > 0 ? image.tokenTextOffsets[numTokens] : 0;
+	const size_t vocabularyLength = numTokens > 0 ? image.vocabularyOffsets[numTokens] : 0;
+	const size_t runTextLength = image.numRunSteps > 0 ? image.runSteps[image.numRunSteps - 1].textOffset : 0;
+	const size_t numOffsets = image.numStates > 0 ? image.numStates + 1 : 0;
+	const size_t numTextOffsets = numTokens > 0 ? numTokens + 1 : 0;
+	const size_t numLeadingOffsets = image.numSeedStates > 0 ? numTokens + 1 : 0;
+
+	WriteArray(out, "unsigned int", name + "EdgeOffsets", image.edgeOffsets, numOffsets, 12, number);
+	WriteArray(out, "CompiledChain::Edge", name + "Edges", image.edges, image.numEdges, 4, edge);
+	WriteArray(out, "wchar_t", name + "TokenText", image.tokenText, tokenTextLength, 16, character);
+	WriteArray(out, "unsigned int", name + "TokenTextOffsets", image.tokenTextOffsets, numTextOffsets, 12, number);
+	WriteArray(out, "wchar_t", name + "VocabularyText", image.vocabularyText, vocabularyLength, 16, character);
+	WriteArray(out, "unsigned int", name + "VocabularyOffsets", image.vocabularyOffsets, numTextOffsets, 12, number);
+	WriteArray(out, "unsigned int", name + "TokensByText", image.tokensByText, numTokens, 12, number);
+	WriteArray(out, "unsigned int", name + "StateKeys", image.stateKeys, image.numStates * order, 12, number);
+	WriteArray(out, "unsigned int", name + "StateSteps", image.stateSteps, image.numStates, 12, number);
+	WriteArray(out, "CompiledChain::RunStep", name + "RunSteps", image.runSteps, image.numRunSteps, 6, runStep);
+	WriteArray(out, "CompiledChain::Run", name + "Runs", image.runs, image.numRuns, 6, run);
+	WriteArray(out, "wchar_t", name + "RunText", image.runText, runTextLength, 16, character);
+	WriteArray(out, "unsigned int", name + "StateIndex", image.stateIndex, image.numStateSlots, 12, number);
+	WriteArray(out, "unsigned int", name + "SortedStates", image.sortedStates, image.numSeedStates, 12, number);
+	WriteArray(out, "unsigned int", name + "LeadingOffsets", image.leadingOffsets, numLeadingOffsets, 12, number);
+
+	auto pointer = [&out, &name](size_t count, const char * array) {
+		out << "\t" << (count > 0 ? name + array : std::string("NULL")) << ",\n";
+	};
+	out << "const CompiledChain::Image " << name << " =\n{\n";
+	out << "\t" << order << ", L\"";
+	for (const wchar_t * c = image.tokenType; *c; ++c) out << (char)*c;
+	out << "\",\n";
+	out << "\t" << image.numStates << ", " << image.numEdges << ", " << numTokens << ", " << image.numRunSteps << ", " 
+	    << image.numRuns << ", " << image.numStateSlots << ", " << image.numSeedStates << ",\n";
+	pointer(numOffsets, "EdgeOffsets");
+	pointer(image.numEdges, "Edges");
+	pointer(tokenTextLength, "TokenText");
+	pointer(numTextOffsets, "TokenTextOffsets");
+	pointer(vocabularyLength, "VocabularyText");
+	pointer(numTextOffsets, "VocabularyOffsets");
+	pointer(numTokens, "TokensByText");
+	pointer(image.numStates * order, "StateKeys");
+	pointer(image.numStates, "StateSteps");
+	pointer(image.numRunSteps, "RunSteps");
+	pointer(image.numRuns, "Runs");
+	pointer(runTextLength, "RunText");
+	pointer(image.numStateSlots, "StateIndex");
+	pointer(image.numSeedStates, "SortedStates");
+	pointer(numLeadingOffsets, "LeadingOffsets");
+	out << "};\n";
+}
+
+/**************************************************************************************************
+ * Returns true if the chain has no states, because nothing has been compiled yet or because it   *
+ * was compiled from an empty chain.                                                              *
+ **************************************************************************************************/
+bool CompiledChain::IsEmpty() const
+{
+	return image.numEdges == 0;
+}
+
+// Accessors.
+int CompiledChain::Order() const { return order; }
+const wchar_t * CompiledChain::TokenType() const { return image.tokenType; }
+size_t CompiledChain::NumStates() const { return image.numStates; }
+size_t CompiledChain::NumEdges() const { return image.numEdges; }
+size_t CompiledChain::NumRuns() const { return image.numRuns; }
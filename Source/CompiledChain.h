@@ -0,0 +1,246 @@
+// A Markov chain compiled into a state machine for fast generation. Every distinct Prefix becomes
+// a numbered state, and the Suffixes of each state are stored as a contiguous run of edges in
+// compressed-sparse-row (CSR) form. Each edge records the token it emits, the cumulative count
+// used to sample it, and the number of the state that the chain moves to when it is taken, so
+// generating a token is a random draw and a search of a short array, with no Prefix to build and
+// no map lookup. Everything a compiled chain reads is described by an Image of plain arrays, which
+// can also be written out as C++ source and built into the program (see DefaultModel.h). The
+// arrays number states, edges and text with 32-bit integers, so a chain can have at most INT_MAX
+// states and 4,294,967,295 edges and characters of token text; a larger one is not compiled.
+
+#pragma once
+
+#include "AlignedAllocator.h"
+#include "BulkTrainer.h"
+#include "ContextTrie.h"
+#include "ModelFile.h"
+#include "ProgressMonitor.h"
+#include "Random.h"
+#include "StringChain.h"
+#include "Vocabulary.h"
+#include <functional>
+#include <list>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class CompiledChain
+{
+	// Samples from the edges of several chains at once.
+	friend class MixtureChain;
+	// Walks the chain one piece at a time.
+	friend class GeneratorCursor;
+
+public:
+	// One <Prefix, Suffix> pair. Sixteen bytes, so four edges share each cache line.
+	struct Edge
+	{
+		unsigned long long cumulativeCount; // counts of the state's edges up to and including this one
+		unsigned int token;                 // the token emitted
+		unsigned int target;                // the state the chain moves to
+	};
+
+	// One state within a run: a maximal chain of states that have a single edge each.
+	struct RunStep
+	{
+		unsigned int textOffset; // where the text of the state's token starts in runText
+		unsigned int run;        // the run that the state belongs to
+	};
+
+	// The end of a run.
+	struct Run
+	{
+		unsigned int endStep; // one past the run's last step
+		unsigned int exit;    // the state that follows the run's last state
+	};
+
+	// A compiled chain as plain arrays: every array that generation and lookups read, with its
+	// length. The arrays are described with the members below.
+	struct Image
+	{
+		int order;
+		const wchar_t * tokenType;
+		size_t numStates, numEdges, numTokens, numRunSteps, numRuns, numStateSlots, numSeedStates;
+		const unsigned int * edgeOffsets;       // numStates + 1
+		const Edge * edges;                     // numEdges
+		const wchar_t * tokenText;              // tokenTextOffsets[numTokens]
+		const unsigned int * tokenTextOffsets;  // numTokens + 1
+		const wchar_t * vocabularyText;         // vocabularyOffsets[numTokens]
+		const unsigned int * vocabularyOffsets; // numTokens + 1
+		const unsigned int * tokensByText;      // numTokens
+		const unsigned int * stateKeys;         // numStates * order
+		const unsigned int * stateSteps;        // numStates
+		const RunStep * runSteps;               // numRunSteps
+		const Run * runs;                       // numRuns
+		const wchar_t * runText;                // runSteps[numRunSteps - 1].textOffset
+		const unsigned int * stateIndex;        // numStateSlots
+		const unsigned int * sortedStates;      // numSeedStates
+		const unsigned int * leadingOffsets;    // numTokens + 1, if numSeedStates > 0
+	};
+
+private:
+	int order = 0;
+	std::wstring tokenType; // the token type of a chain built at run time; read image.tokenType instead
+	std::unique_ptr<Vocabulary> vocabulary; // only while compiling
+	bool baked = false;    // true if image points at data built into the program
+	bool tooLarge = false; // set while compiling if the chain outgrows its 32-bit arrays
+	Image image;           // the arrays below, or baked data; the const methods read only this
+
+	// Hot data, read for every generated token. The edges of state s are edges[edgeOffsets[s]] to
+	// edges[edgeOffsets[s + 1] - 1].
+	std::vector<unsigned int, AlignedAllocator<unsigned int>> edgeOffsets;
+	std::vector<Edge, AlignedAllocator<Edge>> edges;
+
+	// Cold data. The text written for token t (including the leading space between words) is
+	// tokenText[tokenTextOffsets[t]] to tokenText[tokenTextOffsets[t + 1] - 1]:
+	std::vector<wchar_t> tokenText;
+	std::vector<unsigned int> tokenTextOffsets;
+	// The tokens themselves, stored the same way, and the token IDs in order of their text, for
+	// looking tokens up by binary search:
+	std::vector<wchar_t> vocabularyText;
+	std::vector<unsigned int> vocabularyOffsets;
+	std::vector<unsigned int> tokensByText;
+	// The Prefix of each state, as order token IDs per state:
+	std::vector<unsigned int> stateKeys;
+
+	// Runs, which let Generate() emit the tokens of consecutive single-edge states with one copy.
+	// The steps of a run are consecutive in runSteps, and so is their text in runText.
+	// stateSteps gives the step of each state, or NO_STATE for states with several edges.
+	std::vector<unsigned int> stateSteps;
+	std::vector<RunStep> runSteps;
+	std::vector<Run> runs;
+	std::vector<wchar_t> runText;
+
+	// An open-addressing hash table of state numbers, keyed by Prefix, for finding the state of an
+	// arbitrary Prefix (see FindState()). Empty slots hold NO_STATE.
+	std::vector<unsigned int> stateIndex;
+
+	// An index for seeding generation. sortedStates lists the states in sorted order of their
+	// Prefixes, so the states whose Prefixes begin with token t are sortedStates[leadingOffsets[t]]
+	// to sortedStates[leadingOffsets[t + 1] - 1], still sorted by the rest of the Prefix.
+	std::vector<unsigned int> sortedStates;
+	std::vector<unsigned int> leadingOffsets;
+
+	// Starts a new, empty chain.
+	void Reset(int order, const std::wstring & tokenType);
+	// Adds a counted <Prefix, Suffix> record. Records must be added in sorted order.
+	void AddRecord(const unsigned int * key, unsigned long long count);
+	// Fills in the edge targets once every record has been added.
+	void ResolveTargets();
+	// Copies the text of every token into tokenText, and the tokens into vocabularyText.
+	void BuildTextPool();
+	// Groups the states with a single edge into runs.
+	void BuildRuns();
+	// Fills stateIndex.
+	void BuildStateIndex();
+	// Fills sortedStates and leadingOffsets.
+	void BuildSeedIndex();
+	// Finds a state to continue a context from. Sets matched to the number of context tokens used.
+	unsigned int FindSeedState(const unsigned int * context, size_t length, Random & rand, 
+	                           size_t & matched) const;
+	// Appends context to output and finds a state to continue it, adding the rest of its Prefix.
+	unsigned int SeedFrom(const std::wstring & context, int maxTokens, Random & rand, std::wstring & output,
+	                      int & generated) const;
+	// Generates numGen tokens by walking the chain from state. Returns the state to continue from.
+	unsigned int Walk(unsigned int state, int numGen, Random & rand, std::wstring & output, 
+	                  ProgressMonitor * monitor) const;
+	// Computes the slot of a stateIndex with the given number of slots at which the search for a
+	// Prefix starts.
+	size_t HashKey(const unsigned int * key, size_t slots) const;
+	// Points image at the arrays above.
+	void PointImageAtArrays();
+	// Returns the token with the given ID.
+	std::wstring TokenString(unsigned int id) const;
+	// Sorts records (order + 1 IDs and a two-word count each) by key and adds them.
+	void AddRecords(const std::vector<unsigned int> & records);
+	// Completes compilation: resolves targets, builds the text pool and optimizes the layout.
+	// Returns false, and empties the chain, if the chain is too large.
+	bool Finish();
+
+public:
+	// Marks an edge whose target Prefix never occurs in the chain.
+	static const unsigned int NO_STATE = 0xFFFFFFFF;
+
+	// Constructor. The chain is empty until something is compiled or loaded into it.
+	CompiledChain();
+
+	// Constructor. The chain reads image in place, without copying it, so the arrays must outlive
+	// it; meant for images built into the program, which need no loading at all.
+	explicit CompiledChain(const Image & image);
+
+	// A chain's image points into the chain's own arrays, so chains are not copied.
+	CompiledChain(const CompiledChain &) = delete;
+	CompiledChain & operator=(const CompiledChain &) = delete;
+
+	// Compiles the contents of a trained StringChain. Each Compile() returns false, and leaves the
+	// chain empty, if the chain is too large to compile.
+	bool Compile(const StringChain & chain, int order, const std::wstring & tokenType);
+
+	// Compiles the chain of the given order held in a frozen ContextTrie.
+	bool Compile(const ContextTrie & trie, int order);
+
+	// Compiles the records of a BulkTrainer, sorting them first if it has not.
+	bool Compile(BulkTrainer & trainer);
+
+	// Compiles the contents of a model file. Returns false if the file is truncated or its chain is
+	// too large to compile; ModelReader::Truncated() tells which.
+	bool Load(ModelReader & model);
+
+	// The chain's arrays.
+	const Image & GetImage() const;
+
+	// Writes the chain's image to a stream as C++ source: static arrays, and a CompiledChain::Image
+	// named name that describes them.
+	void WriteImage(std::ostream & out, const std::string & name) const;
+
+	// Renumbers the states so that states that tend to follow one another are stored together, and
+	// rebuilds the runs and the indexes. Does nothing to a chain that reads a built-in image.
+	void OptimizeLayout();
+
+	// Generates numGen tokens of gibberish, starting from a random state.
+	std::wstring Generate(int numGen, Random & rand, ProgressMonitor * monitor = NULL) const;
+
+	// Appends numGen tokens of gibberish to output. Allocates nothing if output has enough capacity.
+	void Generate(int numGen, Random & rand, std::wstring & output, ProgressMonitor * monitor = NULL) const;
+
+	// Appends context to output, followed by numGen tokens of gibberish that continue it. Returns false
+	// (and appends nothing) if no Prefix in the chain begins with the context's last token.
+	bool GenerateFrom(const std::wstring & context, int numGen, Random & rand, std::wstring & output, 
+	                  ProgressMonitor * monitor = NULL) const;
+
+	// Looks up the ID of a token. Returns false if the chain has never seen the token.
+	bool FindToken(const std::wstring & token, unsigned int & id) const;
+
+	// Returns the state whose Prefix is the given order token IDs, or NO_STATE if there is none.
+	unsigned int FindState(const unsigned int * prefix) const;
+
+	// Returns the state in which every input text starts (its Prefix is all non-words), or NO_STATE
+	// if the chain is empty.
+	unsigned int StartState() const;
+
+	// Looks up the edge of state that emits token. Returns false if token never followed the state's
+	// Prefix. Otherwise sets count to the number of times it did, total to the number of times the
+	// Prefix was followed by anything, and target to the state the edge leads to.
+	bool FindEdge(unsigned int state, unsigned int token, unsigned long long & count, 
+	              unsigned long long & total, unsigned int & target) const;
+
+	// Hints to the processor that FindEdge() is about to be called for state. PrefetchState() loads
+	// the location of the state's edges, and PrefetchEdges(), once that has arrived, the edges.
+	void PrefetchState(unsigned int state) const;
+	void PrefetchEdges(unsigned int state) const;
+
+	// Calls visit once for every <Prefix, Suffix> pair, with the number of times it occurs.
+	void ForEachPair(const std::function<void(const std::list<std::wstring> & prefix, 
+	                 const std::wstring & suffix, unsigned long long count)> & visit) const;
+
+	// Returns true if nothing has been compiled (or the chain was trained on nothing).
+	bool IsEmpty() const;
+
+	// Accessors.
+	int Order() const;
+	const wchar_t * TokenType() const;
+	size_t NumStates() const;
+	size_t NumEdges() const;
+	size_t NumRuns() const;
+};
@@ -0,0 +1,293 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * A hash table of counted <Prefix, Suffix> records for training one model on several threads at  *
+ * once. The alternative, giving each thread a chain of its own and merging the chains            *
+ * afterwards, needs memory for every thread's copy of the pairs they have in common (which, for  *
+ * natural text, is most of them) on top of the merged result. Here every thread adds to the same *
+ * table, so each pair is stored once.                                                            *
+ *                                                                                                *
+ * The table uses open addressing with linear probing. A slot is three parallel entries: a tag,   *
+ * the key and a count. To add a key, a thread hashes it and probes from the slot the hash        *
+ * selects. A slot whose tag matches the hash and whose key is equal is the key's slot, and the   *
+ * count is added to it with an atomic add. An empty slot means the key is new: the thread claims *
+ * the slot by swapping its tag from EMPTY to BUSY with a compare-and-swap, writes the key, and   *
+ * then publishes the tag, after which other threads may compare against the key. A thread that   *
+ * loses the race for a slot, or that finds a slot BUSY, waits for the tag to be published and    *
+ * then compares against it as usual. Records are never removed, so a slot that holds a key holds *
+ * it for good.                                                                                   *
+ *                                                                                                *
+ * A table cannot be grown in place without locks, so growing stops the Writers instead. Each     *
+ * Writer has a flag that it raises while it uses the slots, and checks the table's growing flag  *
+ * after raising its own. Grow() raises the growing flag, waits until every Writer's flag is      *
+ * down, moves the records into twice as many slots (in parallel, on the shared ThreadPool), and  *
+ * lowers its flag again. Writers that find the table growing wait for growLock, which Grow()     *
+ * holds throughout. Each flag is only ever written by one thread, so adding costs no lock and no *
+ * contended memory, and the number of keys is counted in each Writer and only added to the       *
+ * table's total every PUBLISH_EVERY new keys. The table grows once that total exceeds two thirds *
+ * of the slots, which leaves room for the new keys that Writers have not counted yet; should it  *
+ * ever fill up regardless, the Writer that finds no empty slot grows it.                         *
+ **************************************************************************************************/
+
+#include "ConcurrentPairTable.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+	// Tags of slots that hold no key, and of slots whose key is being written:
+	const unsigned int EMPTY = 0;
+	const unsigned int BUSY = 1;
+	// New keys a Writer counts before adding them to the table's size:
+	const size_t PUBLISH_EVERY = 64;
+	// Slots whose records Grow() moves as one task, and keys sorted as one slice:
+	const size_t GROW_BLOCK = 1 << 14;
+	const size_t MIN_SLICE_KEYS = 1 << 14;
+
+	// The tag of a key with the given hash. Never EMPTY or BUSY.
+	inline unsigned int TagOf(unsigned long long hash)
+	{
+		unsigned int tag = (unsigned int)(hash >> 32);
+		return tag > BUSY ? tag : tag + 2;
+	}
+
+	// Whether a table with the given number of slots has too many keys.
+	inline bool TooFull(size_t keys, size_t capacity)
+	{
+		return keys * 3 > capacity * 2;
+	}
+}
+
+/**************************************************************************************************
+ * Constructor. Every slot starts out EMPTY.                                                      *
+ *   Inputs:                                                                                      *
+ *      capacity: The number of slots, a power of two.                                            *
+ *      keyLength: The number of token IDs per key.                                               *
+ **************************************************************************************************/
+ConcurrentPairTable::Slots::Slots(size_t capacity, int keyLength)
+	: capacity(capacity), tags(new std::atomic<unsigned int>[capacity]()),
+	  keys(new unsigned int[capacity * keyLength]), counts(new std::atomic<unsigned long long>[capacity]())
+{
+}
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      keyLength: The number of token IDs per key.                                               *
+ *      initialCapacity: The number of slots to start with. It is rounded up to a power of two.   *
+ **************************************************************************************************/
+ConcurrentPairTable::ConcurrentPairTable(int keyLength, size_t initialCapacity)
+	: keyLength(keyLength), size(0), growing(false)
+{
+	size_t capacity = 64;
+	while (capacity < initialCapacity) capacity *= 2;
+	slots.reset(new Slots(capacity, keyLength));
+}
+
+/**************************************************************************************************
+ * Returns the hash of a key. The bits that choose a key's first slot (the low ones) and the bits *
+ * of its tag (the high ones) are both mixed from every ID of the key.                            *
+ *   Inputs:                                                                                      *
+ *      key: keyLength token IDs.                                                                 *
+ *   return value: The 64-bit hash.                                                               *
+ **************************************************************************************************/
+unsigned long long ConcurrentPairTable::Hash(const unsigned int * key) const
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (int i = 0; i < keyLength; ++i) hash = (hash ^ key[i]) * 1099511628211ULL;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/**************************************************************************************************
+ * Adds count to the total of a key, claiming an empty slot for the key if it is not in the table *
+ * yet. Several threads may insert into the same slots at once.                                   *
+ *   Inputs:                                                                                      *
+ *      into: The slots to insert into.                                                           *
+ *      key: keyLength token IDs.                                                                 *
+ *      hash: The key's hash.                                                                     *
+ *      count: The number of occurrences to add.                                                  *
+ *   return value: ADDED if the key was already in the table, CLAIMED if it was new, or FULL if   *
+ *                 every slot holds another key.                                                  *
+ **************************************************************************************************/
+ConcurrentPairTable::InsertResult ConcurrentPairTable::Insert(Slots & into, const unsigned int * key,
+                                                              unsigned long long hash, unsigned long long count)
+{
+	const unsigned int tag = TagOf(hash);
+	const size_t mask = into.capacity - 1;
+	size_t slot = (size_t)hash & mask;
+	for (size_t probes = 0; probes < into.capacity; ++probes, slot = (slot + 1) & mask)
+	{
+		unsigned int current = into.tags[slot].load(std::memory_order_acquire);
+		if (current == EMPTY)
+		{
+			if (into.tags[slot].compare_exchange_strong(current, BUSY, std::memory_order_acquire))
+			{
+				std::copy(key, key + keyLength, &into.keys[slot * keyLength]);
+				into.counts[slot].store(count, std::memory_order_relaxed);
+				into.tags[slot].store(tag, std::memory_order_release);
+				return CLAIMED;
+			}
+			// Another thread claimed the slot first, and current is now its tag.
+		}
+		while (current == BUSY)
+		{
+			std::this_thread::yield();
+			current = into.tags[slot].load(std::memory_order_acquire);
+		}
+		if (current == tag && std::equal(key, key + keyLength, &into.keys[slot * keyLength]))
+		{
+			into.counts[slot].fetch_add(count, std::memory_order_relaxed);
+			return ADDED;
+		}
+	}
+	return FULL;
+}
+
+/**************************************************************************************************
+ * Doubles the number of slots. Every Writer is stopped first: the growing flag turns away any    *
+ * Writer that starts to add from now on, and the Writers that are adding already are waited for. *
+ * The records are then moved into the new slots in blocks, on the shared ThreadPool. If the      *
+ * table has already grown since the caller saw it (because several Writers found it too full at  *
+ * once), nothing is done.                                                                        *
+ *   Inputs:                                                                                      *
+ *      fromCapacity: The number of slots the caller found to be too few.                         *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ConcurrentPairTable::Grow(size_t fromCapacity)
+{
+	std::lock_guard<std::mutex> guard(growLock);
+	if (slots->capacity != fromCapacity) return;
+	growing.store(true);
+	for (size_t i = 0; i < writers.size(); ++i)
+	{
+		while (writers[i]->adding.load()) std::this_thread::yield();
+	}
+
+	const Slots & old = *slots;
+	std::unique_ptr<Slots> bigger(new Slots(old.capacity * 2, keyLength));
+	ThreadPool::Shared().ParallelFor((old.capacity + GROW_BLOCK - 1) / GROW_BLOCK, [&](size_t block) {
+		const size_t end = std::min(old.capacity, (block + 1) * GROW_BLOCK);
+		for (size_t slot = block * GROW_BLOCK; slot < end; ++slot)
+		{
+			if (old.tags[slot].load(std::memory_order_relaxed) == EMPTY) continue;
+			const unsigned int * key = &old.keys[slot * keyLength];
+			Insert(*bigger, key, Hash(key), old.counts[slot].load(std::memory_order_relaxed));
+		}
+	});
+	slots.swap(bigger);
+	growing.store(false);
+}
+
+/**************************************************************************************************
+ * Returns the number of distinct keys in the table. While Writers are adding, keys that they     *
+ * have not yet published are missing from it.                                                    *
+ **************************************************************************************************/
+size_t ConcurrentPairTable::Size() const
+{
+	return size.load();
+}
+
+/**************************************************************************************************
+ * Passes every key to output in sorted order, with its count. The occupied slots are sorted by   *
+ * key on the shared ThreadPool.                                                                  *
+ *   Inputs:                                                                                      *
+ *      output: Receives each key and its total count.                                            *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ConcurrentPairTable::ForEachSorted(const RecordCallback & output) const
+{
+	const Slots & current = *slots;
+	std::vector<size_t> order;
+	order.reserve(Size());
+	for (size_t slot = 0; slot < current.capacity; ++slot)
+	{
+		if (current.tags[slot].load(std::memory_order_acquire) != EMPTY) order.push_back(slot);
+	}
+
+	const unsigned int * keys = current.keys.get();
+	const int length = keyLength;
+	ThreadPool::Shared().ParallelSort(order, [keys, length](size_t a, size_t b) {
+		return std::lexicographical_compare(keys + a * length, keys + (a + 1) * length,
+		                                    keys + b * length, keys + (b + 1) * length);
+	}, MIN_SLICE_KEYS);
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		output(keys + order[i] * length, current.counts[order[i]].load(std::memory_order_relaxed));
+	}
+}
+
+/**************************************************************************************************
+ * Constructor. Registers the Writer, so that Grow() waits for it.                                *
+ *   Inputs:                                                                                      *
+ *      table: The table to add to.                                                               *
+ **************************************************************************************************/
+ConcurrentPairTable::Writer::Writer(ConcurrentPairTable & table) : table(table), adding(false)
+{
+	std::lock_guard<std::mutex> guard(table.growLock);
+	table.writers.push_back(this);
+}
+
+/**************************************************************************************************
+ * Destructor. Publishes the Writer's remaining new keys and unregisters it.                      *
+ **************************************************************************************************/
+ConcurrentPairTable::Writer::~Writer()
+{
+	Publish();
+	std::lock_guard<std::mutex> guard(table.growLock);
+	table.writers.erase(std::find(table.writers.begin(), table.writers.end(), this));
+}
+
+/**************************************************************************************************
+ * Adds the keys that this Writer has added since it last published them to the table's size.     *
+ *   return value: The table's new size.                                                          *
+ **************************************************************************************************/
+size_t ConcurrentPairTable::Writer::Publish()
+{
+	size_t keys = table.size.fetch_add(unpublished) + unpublished;
+	unpublished = 0;
+	return keys;
+}
+
+/**************************************************************************************************
+ * Adds count to the total of a key. The Writer's flag is raised before the growing flag is       *
+ * checked, and Grow() raises the growing flag before it checks the Writers' flags, so that       *
+ * either this Writer sees the table growing and waits, or Grow() sees the Writer adding and      *
+ * waits for it to finish. If the key is new, the table is grown when it becomes too full.        *
+ *   Inputs:                                                                                      *
+ *      key: keyLength token IDs.                                                                 *
+ *      count: The number of occurrences to add to the key's total.                               *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ConcurrentPairTable::Writer::Add(const unsigned int * key, unsigned long long count)
+{
+	const unsigned long long hash = table.Hash(key);
+	for (;;)
+	{
+		adding.store(true);
+		if (table.growing.load())
+		{
+			adding.store(false);
+			std::lock_guard<std::mutex> wait(table.growLock);
+			continue;
+		}
+		Slots & slots = *table.slots;
+		InsertResult result = table.Insert(slots, key, hash, count);
+		const size_t capacity = slots.capacity;
+		adding.store(false, std::memory_order_release);
+
+		if (result == FULL)
+		{
+			table.Grow(capacity);
+			continue;
+		}
+		if (result == CLAIMED && ++unpublished == PUBLISH_EVERY && TooFull(Publish(), capacity))
+		{
+			table.Grow(capacity);
+		}
+		return;
+	}
+}
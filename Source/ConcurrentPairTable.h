@@ -0,0 +1,85 @@
+// A hash table of counted <Prefix, Suffix> records that many threads can add to at once, so that
+// several ingestion threads can train one model in memory instead of each training a model of its
+// own to be merged afterwards. Each record's key is a fixed-length array of token IDs (the prefix
+// followed by the suffix). Slots are claimed and counts are added with atomic operations, without
+// locks; only growing the table briefly stops the threads that add to it.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class ConcurrentPairTable
+{
+public:
+	// Receives each key, in sorted order, together with its total count.
+	typedef std::function<void(const unsigned int * key, unsigned long long count)> RecordCallback;
+
+	// Adds records to the table. Every thread that adds records needs a Writer of its own.
+	class Writer
+	{
+		ConcurrentPairTable & table;
+		std::atomic<bool> adding;    // set while Add() uses the table's slots
+		size_t unpublished = 0;      // new keys not yet counted in table.size
+
+		// Adds this Writer's new keys to the table's size, and returns the new size.
+		size_t Publish();
+
+		friend class ConcurrentPairTable;
+
+	public:
+		// Constructor. Registers the Writer with the table.
+		explicit Writer(ConcurrentPairTable & table);
+
+		// Destructor. Unregisters the Writer.
+		~Writer();
+
+		// Adds count to the total of key, which holds the table's keyLength token IDs.
+		void Add(const unsigned int * key, unsigned long long count);
+	};
+
+private:
+	// The slots of the table. A slot's tag is EMPTY, BUSY while a thread writes its key, or a hash
+	// of the key, published only after the key is written.
+	struct Slots
+	{
+		size_t capacity; // a power of two
+		std::unique_ptr<std::atomic<unsigned int>[]> tags;
+		std::unique_ptr<unsigned int[]> keys;
+		std::unique_ptr<std::atomic<unsigned long long>[]> counts;
+
+		Slots(size_t capacity, int keyLength);
+	};
+
+	// What Insert() did:
+	enum InsertResult { ADDED, CLAIMED, FULL };
+
+	const int keyLength;
+	std::unique_ptr<Slots> slots;
+	std::atomic<size_t> size;         // keys in the table, apart from those not yet published
+	std::atomic<bool> growing;        // set while Grow() moves the records into bigger slots
+	std::mutex growLock;              // held by Grow(), and while a Writer is (un)registered
+	std::vector<Writer *> writers;
+
+	// Adds count to key in the given slots, claiming a slot for it if it is new.
+	InsertResult Insert(Slots & into, const unsigned int * key, unsigned long long hash,
+	                    unsigned long long count);
+	// Doubles the number of slots, unless another thread already has since it saw fromCapacity.
+	void Grow(size_t fromCapacity);
+	// Returns the hash of a key.
+	unsigned long long Hash(const unsigned int * key) const;
+
+public:
+	// Constructor. keyLength is the number of token IDs per key.
+	explicit ConcurrentPairTable(int keyLength, size_t initialCapacity = 1 << 16);
+
+	// The number of distinct keys. Exact once every Writer has been destroyed.
+	size_t Size() const;
+
+	// Calls output for every key, in sorted order, with its total count. No Writer may be adding at
+	// the same time.
+	void ForEachSorted(const RecordCallback & output) const;
+};
@@ -0,0 +1,155 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Trains a Markov chain in memory on several threads. A single IngestPipeline overlaps reading,  *
+ * decompressing and tokenizing with insertion, but insertion itself runs on one thread, and for  *
+ * a fast disk it is the slowest stage. Here the input files are dealt out in turn to several     *
+ * pipelines, each with an Inserter of its own that turns tokens into <Prefix, Suffix> records    *
+ * just as OutOfCoreTrainer does and adds them to one shared ConcurrentPairTable. Because every   *
+ * Inserter starts its first file from a Prefix of non-words, and every file ends with non-word   *
+ * padding, how the files are shared out does not change the records.                             *
+ *                                                                                                *
+ * The vocabulary is shared too, behind a lock; each Inserter keeps a copy of the IDs it has      *
+ * looked up, so that the lock is only taken for tokens that are new to that Inserter, which      *
+ * after the first few thousand tokens of natural text is rare. The IDs depend on the order in    *
+ * which the pipelines first meet the tokens, so the model file may number the tokens differently *
+ * from run to run, but it always describes the same chain.                                       *
+ *                                                                                                *
+ * The pipelines block on file reads and on their queues, so they run on threads of their own     *
+ * rather than on the shared ThreadPool, which the table uses to grow and to sort its records for *
+ * the model file.                                                                                *
+ **************************************************************************************************/
+
+#include "ConcurrentTrainer.h"
+#include "IngestPipeline.h"
+#include "ModelFile.h"
+#include "StringChain.h"
+#include "TokenSink.h"
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+
+// Turns the tokens of one pipeline into records, and adds them to the trainer's table.
+class ConcurrentTrainer::Inserter : public TokenSink
+{
+	ConcurrentTrainer & trainer;
+	ConcurrentPairTable::Writer writer;
+	std::unordered_map<std::wstring, unsigned int> ids; // the IDs this Inserter has looked up
+	std::vector<unsigned int> record;                   // the current prefix and room for the suffix
+	long long tokensInCurrentInput = 0;
+	bool anyRecords;
+
+public:
+	// Constructor. first is true for the Inserter that receives the first of the files.
+	Inserter(ConcurrentTrainer & trainer, bool first)
+		: trainer(trainer), writer(trainer.table), record(trainer.markovOrder + 1, Vocabulary::NONWORD_ID),
+		  anyRecords(!first)
+	{
+	}
+
+	// Records the <currentPrefix, token> pair and advances the current prefix.
+	void AddToken(const std::wstring & token) override
+	{
+		auto it = ids.find(token);
+		if (it == ids.end()) it = ids.insert(std::make_pair(token, trainer.Intern(token))).first;
+		record[trainer.markovOrder] = it->second;
+		writer.Add(record.data(), 1);
+		std::copy(record.begin() + 1, record.end(), record.begin());
+		anyRecords = true;
+		tokensInCurrentInput++;
+	}
+
+	// Adds the non-word padding that follows the last token of an input text, as OutOfCoreTrainer
+	// does. Only the Inserter with the first file can have seen no records before.
+	void EndInput() override
+	{
+		if (tokensInCurrentInput == 0 && !anyRecords) AddToken(NONWORD);
+		for (int i = 0; i < trainer.markovOrder; ++i) AddToken(NONWORD);
+		tokensInCurrentInput = 0;
+	}
+};
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      order: How many words or characters per Prefix.                                           *
+ *      tokenType: "words", "characters" or "punctuation".                                        *
+ **************************************************************************************************/
+ConcurrentTrainer::ConcurrentTrainer(int order, const std::wstring & tokenType)
+	: markovOrder(order), tokenType(tokenType), table(order + 1)
+{
+}
+
+/**************************************************************************************************
+ * Returns the ID of a token in the shared vocabulary, assigning the next free ID if it is new.   *
+ *   Inputs:                                                                                      *
+ *      token: A word or character.                                                               *
+ *   return value: The token's ID.                                                                *
+ **************************************************************************************************/
+unsigned int ConcurrentTrainer::Intern(const std::wstring & token)
+{
+	std::lock_guard<std::mutex> guard(vocabularyLock);
+	return vocabulary.Intern(token);
+}
+
+/**************************************************************************************************
+ * Reads the files and counts their records. File i goes to pipeline i % numPipelines, so every   *
+ * pipeline gets a share of the files, and the first file goes to the first pipeline. Each        *
+ * pipeline runs on a thread of its own, and the calling thread waits for all of them.            *
+ *   Inputs:                                                                                      *
+ *      filenames: Full paths of the text files to read.                                          *
+ *      numPipelines: How many pipelines may run at once. At most one per file is started.        *
+ *      monitor: Receives progress from every pipeline, and may cancel them. May be NULL.         *
+ *   return value: false if the monitor cancelled training, true otherwise.                       *
+ **************************************************************************************************/
+bool ConcurrentTrainer::Train(const std::vector<std::wstring> & filenames, size_t numPipelines,
+                              ProgressMonitor * monitor)
+{
+	numPipelines = std::max<size_t>(std::min(numPipelines, filenames.size()), 1);
+	std::vector<std::vector<std::wstring>> shares(numPipelines);
+	for (size_t i = 0; i < filenames.size(); ++i) shares[i % numPipelines].push_back(filenames[i]);
+
+	std::vector<std::thread> threads;
+	std::vector<char> completed(numPipelines);
+	std::mutex failedFilesLock;
+	failedFiles.clear();
+	for (size_t i = 0; i < numPipelines; ++i)
+	{
+		threads.emplace_back([&, i]() {
+			IngestPipeline pipeline(tokenType, monitor);
+			{
+				Inserter inserter(*this, i == 0);
+				completed[i] = pipeline.Run(shares[i], inserter);
+			}
+			std::lock_guard<std::mutex> guard(failedFilesLock);
+			const std::vector<std::wstring> & failed = pipeline.GetFailedFiles();
+			failedFiles.insert(failedFiles.end(), failed.begin(), failed.end());
+		});
+	}
+	for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+	return std::find(completed.begin(), completed.end(), 0) == completed.end();
+}
+
+/**************************************************************************************************
+ * Returns the files that could not be opened or decompressed during Train().                     *
+ **************************************************************************************************/
+const std::vector<std::wstring> & ConcurrentTrainer::GetFailedFiles() const
+{
+	return failedFiles;
+}
+
+/**************************************************************************************************
+ * Writes the counted records, sorted, along with the vocabulary, to a model file.                *
+ *   Inputs:                                                                                      *
+ *      path: The model file to create.                                                           *
+ *   return value: false if the model file could not be written, true otherwise.                  *
+ **************************************************************************************************/
+bool ConcurrentTrainer::WriteModel(const std::wstring & path)
+{
+	ModelWriter writer;
+	if (!writer.Open(path, markovOrder, tokenType, vocabulary)) return false;
+	table.ForEachSorted([&writer](const unsigned int * key, unsigned long long count) {
+		writer.Write(key, count);
+	});
+	return writer.Close();
+}
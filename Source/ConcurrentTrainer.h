@@ -0,0 +1,43 @@
+// Trains a Markov chain in memory on several threads at once. The input files are dealt out to a
+// number of IngestPipelines, which run side by side and all count their <Prefix, Suffix> records
+// in one ConcurrentPairTable; the table is then written out as a model file. The result is the
+// same model that OutOfCoreTrainer writes from the same files, but the records must fit in memory.
+
+#pragma once
+
+#include "ConcurrentPairTable.h"
+#include "ProgressMonitor.h"
+#include "Vocabulary.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+class ConcurrentTrainer
+{
+	class Inserter;
+
+	const int markovOrder;
+	const std::wstring tokenType;
+	ConcurrentPairTable table;
+	Vocabulary vocabulary;
+	std::mutex vocabularyLock;
+	std::vector<std::wstring> failedFiles;
+
+	// Returns the ID of a token, assigning it one if it is new. Called from every pipeline.
+	unsigned int Intern(const std::wstring & token);
+
+public:
+	// Constructor.
+	ConcurrentTrainer(int order, const std::wstring & tokenType);
+
+	// Reads the files, with up to numPipelines IngestPipelines at once. monitor may be NULL; its
+	// onProgress callback is called from every pipeline. Returns false if the monitor cancelled.
+	bool Train(const std::vector<std::wstring> & filenames, size_t numPipelines,
+	           ProgressMonitor * monitor = NULL);
+
+	// Files that could not be opened or decompressed during Train(). They are skipped.
+	const std::vector<std::wstring> & GetFailedFiles() const;
+
+	// Writes the counted records to a model file. Returns false if it could not be written.
+	bool WriteModel(const std::wstring & path);
+};
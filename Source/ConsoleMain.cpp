@@ -0,0 +1,901 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * The command-line interface. Each command is a function that takes the remaining arguments and  *
+ * returns an exit code. Options start with '-' and take a single value; all other arguments are  *
+ * file names. Run "Markov.exe help" for a summary of the commands.                               *
+ *                                                                                                *
+ * This file deliberately uses only the standard library (the Windows-specific console setup is   *
+ * done in Markov.cpp), so the same commands can be built and run on servers that do not have     *
+ * Windows.                                                                                       *
+ **************************************************************************************************/
+
+#include "ConsoleMain.h"
+#include "Benchmark.h"
+#include "CompiledChain.h"
+#include "ConcurrentTrainer.h"
+#include "FilePath.h"
+#include "IngestPipeline.h"
+#include "MarkovServer.h"
+#include "MixtureChain.h"
+#include "ModelArchive.h"
+#include "ModelFile.h"
+#include "OutOfCoreTrainer.h"
+#include "Scorer.h"
+#include "SelfTest.h"
+#include "StringChain.h"
+#include "ThreadPool.h"
+#include "TokenPolicy.h"
+#include "Utf8Encoder.h"
+#include "Utf8StreamBuf.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cwchar>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+
+namespace
+{
+	const wchar_t * USAGE =
+		L"Usage:\n"
+		L"  Markov.exe train <model> [-order N] [-tokens words|characters|punctuation] [-temp DIR]\n"
+		L"                   [-memory MB | -pipelines N] <text files...>\n"
+		L"      Trains a model file out of core, using at most about MB megabytes for sorting; or, with\n"
+		L"      -pipelines, in memory, reading N files at a time into one shared table.\n"
+		L"  Markov.exe merge <model> [-temp DIR] [-memory MB] <model files...>\n"
+		L"      Combines models trained separately (e.g. on different machines) into one.\n"
+		L"  Markov.exe append <model> [-temp DIR] [-memory MB] <text files...>\n"
+		L"      Adds texts to a model file without retraining it on all of its texts.\n"
+		L"  Markov.exe compact <model>\n"
+		L"      Folds the texts added with append into the rest of a model file.\n"
+		L"  Markov.exe pack <archive> [-temp DIR] [-memory MB] <model>\n"
+		L"      Stores a model file compactly, for keeping or shipping it.\n"
+		L"  Markov.exe unpack <model> <archive>\n"
+		L"      Turns an archive written by pack back into a model file.\n"
+		L"  Markov.exe generate <model> [-count N] [-seed N] [-start TEXT]\n"
+		L"      Generates N words or characters of gibberish from a model file, continuing TEXT.\n"
+		L"  Markov.exe mix [-weights W,W,...] [-count N] [-seed N] [-start TEXT] <model files...>\n"
+		L"      Generates from a weighted mixture of models, without merging them. Weights default to 1.\n"
+		L"  Markov.exe serve <socket> <model files...>\n"
+		L"      Loads the models and serves generation requests over a Unix domain socket.\n"
+		L"  Markov.exe request <socket> <model name> [-order N] [-count N] [-seed N] [-start TEXT]\n"
+		L"      Asks a running server to generate N words or characters from a model.\n"
+		L"  Markov.exe reload <socket> <model name> [-order N]\n"
+		L"      Makes a running server load a model again from its file, without interrupting requests.\n"
+		L"  Markov.exe score <model> <text files...>\n"
+		L"      Prints the log-likelihood, token count and perplexity of every line of the files.\n"
+		L"  Markov.exe bake <output.inc> [-order N] [-tokens words|characters|punctuation] <text file>\n"
+		L"      Writes a text and a chain compiled from it as C++ source, to be built into the program.\n"
+		L"  Markov.exe bench <results> [-sizes MB,MB,...] [-orders N,N,...] [-tokens T,T,...]\n"
+		L"                   [-threadcounts N,N,...] [-count N] [-score MB] [-temp DIR]\n"
+		L"                   [-baseline FILE] [-tolerance PERCENT]\n"
+		L"      Times training, generation and scoring of synthetic corpora with each number of threads,\n"
+		L"      and fails if anything is more than PERCENT (default 10) slower than in the baseline file.\n"
+		L"  Markov.exe selftest\n"
+		L"      Checks the engine's guarantees, and every backend against an independent reference.\n"
+		L"Every command also accepts:\n"
+		L"  -threads N     Runs parallel work (sorting, merging, scoring, serving) on N threads.\n"
+		L"                 The default is one per core.\n"
+		L"  -affinity CORE Pins those threads to cores CORE, CORE + 1, ... so that several processes\n"
+		L"                 on one machine can be given cores of their own.\n";
+
+	// Once appending has given a model this many delta segments, the model is compacted.
+	const unsigned int MAX_DELTA_SEGMENTS = 16;
+
+	// The largest values that the numeric options accept. Orders are capped as in the GUI, past the
+	// point where almost every context has been seen only once; counts and thread numbers must fit
+	// the int and unsigned int they are given to, and -memory must still fit a size_t in bytes.
+	const long long MAX_ORDER = 20;
+	const long long MAX_COUNT = INT_MAX;
+	const long long MAX_THREADS = UINT_MAX;
+	const long long MAX_MEMORY = (long long)(SIZE_MAX >> 20);
+
+	// The parsed arguments of a command: options by name (without the '-') and everything else.
+	struct Arguments
+	{
+		std::map<std::wstring, std::wstring> options;
+		std::vector<std::wstring> files;
+	};
+
+	// Writes a message to the standard error.
+	void PrintError(const std::wstring & message)
+	{
+		std::cerr << EncodeUtf8(message) << std::endl;
+	}
+
+	// Splits args into options and file names. Returns false if an option has no value.
+	bool ParseArguments(const std::vector<std::wstring> & args, Arguments & parsed)
+	{
+		for (size_t i = 1; i < args.size(); ++i)
+		{
+			if (args[i].size() > 1 && args[i][0] == L'-')
+			{
+				if (i + 1 == args.size())
+				{
+					PrintError(L"Missing value for " + args[i] + L".");
+					return false;
+				}
+				parsed.options[args[i].substr(1)] = args[i + 1];
+				++i;
+			}
+			else parsed.files.push_back(args[i]);
+		}
+		return true;
+	}
+
+	// Reads a non-negative integer option, no larger than maxValue. Returns false (after printing an
+	// error) if it is malformed or too large.
+	bool GetNumber(const Arguments & parsed, const std::wstring & name, long long & value,
+	               long long maxValue = LLONG_MAX)
+	{
+		auto it = parsed.options.find(name);
+		if (it == parsed.options.end()) return true; // keep the default
+		wchar_t * end;
+		long long number = std::wcstoll(it->second.c_str(), &end, 10);
+		if (it->second.empty() || *end != L'\0' || number < 0)
+		{
+			PrintError(L"-" + name + L" must be a non-negative integer.");
+			return false;
+		}
+		if (number > maxValue)
+		{
+			PrintError(L"-" + name + L" must be no larger than " + std::to_wstring(maxValue) + L".");
+			return false;
+		}
+		value = number;
+		return true;
+	}
+
+	// Reads an option that lists non-negative integers, separated by commas, each no larger than
+	// maxValue. Returns false (after printing an error) if it is malformed or a number is too large.
+	bool GetNumberList(const Arguments & parsed, const std::wstring & name, std::vector<long long> & values,
+	                   long long maxValue = LLONG_MAX)
+	{
+		auto it = parsed.options.find(name);
+		if (it == parsed.options.end()) return true; // keep the default
+		std::wistringstream list(it->second);
+		std::wstring item;
+		values.clear();
+		while (std::getline(list, item, L','))
+		{
+			wchar_t * end;
+			long long number = std::wcstoll(item.c_str(), &end, 10);
+			if (item.empty() || *end != L'\0' || number < 0)
+			{
+				PrintError(L"-" + name + L" must list non-negative integers, separated by commas.");
+				return false;
+			}
+			if (number > maxValue)
+			{
+				PrintError(L"-" + name + L" must list numbers no larger than " + std::to_wstring(maxValue) + L".");
+				return false;
+			}
+			values.push_back(number);
+		}
+		return true;
+	}
+
+	// Sets up the shared ThreadPool from the -threads and -affinity options. Returns false (after
+	// printing an error) if either is malformed.
+	bool ConfigureThreads(const Arguments & parsed)
+	{
+		long long threads = 0, firstCore = -1;
+		if (!GetNumber(parsed, L"threads", threads, MAX_THREADS)) return false;
+		if (!GetNumber(parsed, L"affinity", firstCore, MAX_THREADS)) return false;
+		ThreadPool::Options options;
+		options.threads = (unsigned int)threads;
+		options.pinThreads = (firstCore >= 0);
+		options.firstCore = options.pinThreads ? (unsigned int)firstCore : 0;
+		ThreadPool::Configure(options);
+		return true;
+	}
+
+	// Compiles a model file. Returns false (after printing an error) if it cannot be read.
+	bool LoadChain(const std::wstring & path, CompiledChain & chain)
+	{
+		ModelReader model;
+		if (!model.Open(path))
+		{
+			PrintError(L"\"" + path + L"\" is not a model file.");
+			return false;
+		}
+		if (!chain.Load(model))
+		{
+			PrintError(L"\"" + path + (model.Truncated() ? L"\" is truncated." : L"\" is too large to compile."));
+			return false;
+		}
+		return true;
+	}
+
+	// Writes text to out as the body of a C++ wide string literal, one line of text per line of
+	// source. Anything but printable ASCII is escaped.
+	void WriteStringLiteral(std::ostream & out, const std::wstring & text)
+	{
+		out << "\tL\"";
+		for (size_t i = 0; i < text.size(); ++i)
+		{
+			const wchar_t c = text[i];
+			if (c == L'"' || c == L'\\') out << '\\' << (char)c;
+			else if (c == L'\n') out << (i + 1 < text.size() ? "\\n\"\n\tL\"" : "\\n");
+			else if (c == L'\t') out << "\\t";
+			else if (c >= 32 && c < 127) out << (char)c;
+			else out << "\\x" << std::hex << (unsigned long)c << std::dec << "\" L\""; // ends the hex escape
+		}
+		out << "\"";
+	}
+
+	// Returns a string option, or defaultValue if it was not given.
+	std::wstring GetString(const Arguments & parsed, const std::wstring & name, 
+	                       const std::wstring & defaultValue)
+	{
+		auto it = parsed.options.find(name);
+		return it == parsed.options.end() ? defaultValue : it->second;
+	}
+
+	/**************************************************************************************************
+	 * Implements the train command: reads the text files with an IngestPipeline and trains a model   *
+	 * file out of core or, given -pipelines, in memory with a ConcurrentTrainer.                     *
+	 *    Usage: train <model> [-order N] [-tokens words|characters|punctuation] [-temp DIR]          *
+	 *           [-memory MB | -pipelines N] <text files...>                                          *
+	 **************************************************************************************************/
+	int Train(const Arguments & parsed)
+	{
+		long long order = 2, memory = 256, pipelines = 0;
+		if (!GetNumber(parsed, L"order", order, MAX_ORDER) || !GetNumber(parsed, L"memory", memory, MAX_MEMORY) ||
+		    !GetNumber(parsed, L"pipelines", pipelines, MAX_THREADS))
+		{
+			return 1;
+		}
+		std::wstring tokenType = GetString(parsed, L"tokens", L"words");
+		if (!IsTokenType(tokenType))
+		{
+			PrintError(L"-tokens must be \"words\", \"characters\" or \"punctuation\".");
+			return 1;
+		}
+		if (parsed.files.size() < 2 || order < 1 || memory < 1 || pipelines < 0)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		std::vector<std::wstring> inputs(parsed.files.begin() + 1, parsed.files.end());
+		if (pipelines > 0)
+		{
+			ConcurrentTrainer trainer((int)order, tokenType);
+			trainer.Train(inputs, (size_t)pipelines);
+			const std::vector<std::wstring> & failedFiles = trainer.GetFailedFiles();
+			for (size_t i = 0; i < failedFiles.size(); ++i) PrintError(L"Could not read \"" + failedFiles[i] + L"\".");
+			if (!trainer.WriteModel(parsed.files[0]))
+			{
+				PrintError(L"Could not write \"" + parsed.files[0] + L"\".");
+				return 1;
+			}
+			return failedFiles.empty() ? 0 : 2;
+		}
+
+		OutOfCoreTrainer trainer((int)order, tokenType, GetString(parsed, L"temp", L"."), 
+		                         (size_t)memory << 20);
+		IngestPipeline pipeline(tokenType);
+		pipeline.Run(inputs, trainer);
+		const std::vector<std::wstring> & failedFiles = pipeline.GetFailedFiles();
+		for (size_t i = 0; i < failedFiles.size(); ++i) PrintError(L"Could not read \"" + failedFiles[i] + L"\".");
+
+		if (!trainer.WriteModel(parsed.files[0]))
+		{
+			PrintError(L"Could not write \"" + parsed.files[0] + L"\" or a temporary file.");
+			return 1;
+		}
+		return failedFiles.empty() ? 0 : 2;
+	}
+
+	/**************************************************************************************************
+	 * Implements the merge command, which combines model files into one.                             *
+	 *    Usage: merge <model> [-temp DIR] [-memory MB] <model files...>                              *
+	 **************************************************************************************************/
+	int Merge(const Arguments & parsed)
+	{
+		long long memory = 256;
+		if (!GetNumber(parsed, L"memory", memory, MAX_MEMORY)) return 1;
+		if (parsed.files.size() < 2 || memory < 1)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		std::vector<std::wstring> inputs(parsed.files.begin() + 1, parsed.files.end());
+		std::wstring error;
+		if (!OutOfCoreTrainer::MergeModels(inputs, parsed.files[0], GetString(parsed, L"temp", L"."), 
+		                                   (size_t)memory << 20, error))
+		{
+			PrintError(error);
+			return 1;
+		}
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the append command: trains the text files into a delta segment of an existing model *
+	 * file, so that only the new texts need to be read. A model in the old format is compacted       *
+	 * first, which converts it to one that can take deltas; a model that has accumulated             *
+	 * MAX_DELTA_SEGMENTS deltas is compacted afterwards. That compaction runs here, in the           *
+	 * foreground, rather than in the background: a console command cannot leave work running once it *
+	 * returns, and a compaction beside a later append would lose that append's delta when it renamed *
+	 * its file over the model. The compact command lets a scheduled job compact at a quiet time      *
+	 * instead.                                                                                       *
+	 *    Usage: append <model> [-temp DIR] [-memory MB] <text files...>                              *
+	 **************************************************************************************************/
+	int Append(const Arguments & parsed)
+	{
+		long long memory = 256;
+		if (!GetNumber(parsed, L"memory", memory, MAX_MEMORY)) return 1;
+		if (parsed.files.size() < 2 || memory < 1)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		const std::wstring & path = parsed.files[0];
+		std::wstring error;
+		bool convert;
+		{
+			ModelReader model;
+			if (!model.Open(path))
+			{
+				PrintError(L"\"" + path + L"\" is not a model file.");
+				return 1;
+			}
+			convert = !model.CanAppend();
+		}
+		if (convert && !CompactModel(path, error))
+		{
+			PrintError(error);
+			return 1;
+		}
+
+		std::unique_ptr<OutOfCoreTrainer> trainer;
+		std::wstring tokenType;
+		unsigned int deltaCount;
+		{
+			ModelReader model;
+			model.Open(path);
+			tokenType = model.TokenType();
+			deltaCount = model.DeltaCount();
+			trainer.reset(new OutOfCoreTrainer(model.Order(), tokenType, GetString(parsed, L"temp", L"."), 
+			                                   (size_t)memory << 20));
+			trainer->ContinueModel(model);
+		}
+		std::vector<std::wstring> inputs(parsed.files.begin() + 1, parsed.files.end());
+		IngestPipeline pipeline(tokenType);
+		pipeline.Run(inputs, *trainer);
+		const std::vector<std::wstring> & failedFiles = pipeline.GetFailedFiles();
+		for (size_t i = 0; i < failedFiles.size(); ++i) PrintError(L"Could not read \"" + failedFiles[i] + L"\".");
+
+		if (!trainer->AppendDelta(path))
+		{
+			PrintError(L"Could not append to \"" + path + L"\" or write a temporary file.");
+			return 1;
+		}
+		if (deltaCount + 1 >= MAX_DELTA_SEGMENTS && !CompactModel(path, error))
+		{
+			PrintError(error);
+			return 1;
+		}
+		return failedFiles.empty() ? 0 : 2;
+	}
+
+	/**************************************************************************************************
+	 * Implements the compact command, which folds a model file's delta segments into its base        *
+	 * records.                                                                                       *
+	 *    Usage: compact <model>                                                                      *
+	 **************************************************************************************************/
+	int Compact(const Arguments & parsed)
+	{
+		if (parsed.files.size() != 1)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+		std::wstring error;
+		if (!CompactModel(parsed.files[0], error))
+		{
+			PrintError(error);
+			return 1;
+		}
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the pack command, which writes a model file as a compact archive.                   *
+	 *    Usage: pack <archive> [-temp DIR] [-memory MB] <model>                                      *
+	 **************************************************************************************************/
+	int Pack(const Arguments & parsed)
+	{
+		long long memory = 256;
+		if (!GetNumber(parsed, L"memory", memory, MAX_MEMORY)) return 1;
+		if (parsed.files.size() != 2 || memory < 1)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+		std::wstring error;
+		if (!PackModel(parsed.files[1], parsed.files[0], GetString(parsed, L"temp", L"."), (size_t)memory << 20, error))
+		{
+			PrintError(error);
+			return 1;
+		}
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the unpack command, which turns an archive back into a model file.                  *
+	 *    Usage: unpack <model> <archive>                                                             *
+	 **************************************************************************************************/
+	int Unpack(const Arguments & parsed)
+	{
+		if (parsed.files.size() != 2)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+		std::wstring error;
+		if (!UnpackModel(parsed.files[1], parsed.files[0], error))
+		{
+			PrintError(error);
+			return 1;
+		}
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the generate command: compiles a model file and prints gibberish generated from it. *
+	 * If a start text is given, the gibberish continues it.                                          *
+	 *    Usage: generate <model> [-count N] [-seed N] [-start TEXT]                                  *
+	 **************************************************************************************************/
+	int Generate(const Arguments & parsed)
+	{
+		long long count = 100, seed = -1;
+		if (!GetNumber(parsed, L"count", count, MAX_COUNT) || !GetNumber(parsed, L"seed", seed, INT_MAX)) return 1;
+		if (parsed.files.size() != 1)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		CompiledChain chain;
+		if (!LoadChain(parsed.files[0], chain)) return 1;
+		Random rand = seed < 0 ? Random() : Random((int)seed);
+		std::wstring output;
+		if (!chain.GenerateFrom(GetString(parsed, L"start", L""), (int)count, rand, output))
+		{
+			PrintError(L"The model has never seen the last word of the start text.");
+			return 1;
+		}
+		std::cout << EncodeUtf8(output) << std::endl;
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the mix command: compiles the model files and prints gibberish generated from a     *
+	 * weighted mixture of them (see MixtureChain). The weights are given as one comma-separated      *
+	 * list, in the order of the model files.                                                         *
+	 *    Usage: mix [-weights W,W,...] [-count N] [-seed N] [-start TEXT] <model files...>           *
+	 **************************************************************************************************/
+	int Mix(const Arguments & parsed)
+	{
+		long long count = 100, seed = -1;
+		if (!GetNumber(parsed, L"count", count, MAX_COUNT) || !GetNumber(parsed, L"seed", seed, INT_MAX)) return 1;
+		if (parsed.files.empty())
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		std::vector<double> weights(parsed.files.size(), 1.0);
+		auto option = parsed.options.find(L"weights");
+		if (option != parsed.options.end())
+		{
+			std::wistringstream list(option->second);
+			std::wstring item;
+			size_t numWeights = 0;
+			bool valid = true;
+			while (valid && std::getline(list, item, L','))
+			{
+				wchar_t * end;
+				double weight = std::wcstod(item.c_str(), &end);
+				valid = !item.empty() && *end == L'\0' && weight >= 0 && numWeights < weights.size();
+				if (valid) weights[numWeights++] = weight;
+			}
+			if (!valid || numWeights != weights.size())
+			{
+				PrintError(L"-weights must list one non-negative number for each model file.");
+				return 1;
+			}
+		}
+
+		std::vector<CompiledChain> chains(parsed.files.size());
+		MixtureChain mixture;
+		for (size_t i = 0; i < chains.size(); ++i)
+		{
+			if (!LoadChain(parsed.files[i], chains[i])) return 1;
+			if (!mixture.Add(chains[i], weights[i]))
+			{
+				PrintError(L"\"" + parsed.files[i] + L"\" has a different order or token type from the others.");
+				return 1;
+			}
+		}
+		if (mixture.IsEmpty())
+		{
+			PrintError(L"Every model is either empty or weighted 0.");
+			return 1;
+		}
+		Random rand = seed < 0 ? Random() : Random((int)seed);
+		std::wstring output;
+		if (!mixture.GenerateFrom(GetString(parsed, L"start", L""), (int)count, rand, output))
+		{
+			PrintError(L"No model with a weight above 0 can continue the start text.");
+			return 1;
+		}
+		std::cout << EncodeUtf8(output) << std::endl;
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the score command: prints the score of every line of the text files under a model,  *
+	 * one line of output per line of input, as the log-likelihood, the number of tokens and the      *
+	 * perplexity, separated by tabs. Lines are read and scored in large batches, so that files of    *
+	 * any size can be scored with all threads busy. The number of texts scored per second is         *
+	 * reported on the standard error.                                                                *
+	 *    Usage: score <model> <text files...>                                                        *
+	 **************************************************************************************************/
+	int Score(const Arguments & parsed)
+	{
+		if (parsed.files.size() < 2)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		CompiledChain chain;
+		if (!LoadChain(parsed.files[0], chain)) return 1;
+		Scorer scorer(chain);
+
+		const size_t BATCH_SIZE = 65536;
+		std::vector<std::wstring> batch;
+		long long numTexts = 0, numTokens = 0;
+		auto started = std::chrono::steady_clock::now();
+		auto flush = [&]() {
+			std::vector<Scorer::Score> scores = scorer.ScoreBatch(batch);
+			for (size_t i = 0; i < scores.size(); ++i)
+			{
+				std::cout << scores[i].logLikelihood << '\t' << scores[i].numTokens << '\t' 
+				          << scores[i].Perplexity() << '\n';
+				numTokens += (long long)scores[i].numTokens;
+			}
+			numTexts += (long long)batch.size();
+			batch.clear();
+		};
+
+		for (size_t i = 1; i < parsed.files.size(); ++i)
+		{
+			std::ifstream file(NativePath(parsed.files[i]), std::ios::binary);
+			if (!file)
+			{
+				PrintError(L"Could not read \"" + parsed.files[i] + L"\".");
+				return 1;
+			}
+			Utf8StreamBuf buffer(file);
+			std::wistream text(&buffer);
+			std::wstring line;
+			while (std::getline(text, line))
+			{
+				batch.push_back(line);
+				if (batch.size() == BATCH_SIZE) flush();
+			}
+		}
+		flush();
+		std::cout.flush();
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		std::cerr << "Scored " << numTexts << " texts (" << numTokens << " tokens) in " << seconds << " s, " 
+		          << (long long)(numTexts / std::max(seconds, 1e-9)) << " texts/s" << std::endl;
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the serve command: loads the model files and serves requests until the process is   *
+	 * terminated.                                                                                    *
+	 *    Usage: serve <socket> <model files...>                                                      *
+	 **************************************************************************************************/
+	int Serve(const Arguments & parsed)
+	{
+		if (parsed.files.size() < 2)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		MarkovServer server;
+		std::wstring error;
+		for (size_t i = 1; i < parsed.files.size(); ++i)
+		{
+			if (!server.LoadModel(parsed.files[i], error))
+			{
+				PrintError(error);
+				return 1;
+			}
+		}
+		if (!server.Start(parsed.files[0], error))
+		{
+			PrintError(error);
+			return 1;
+		}
+
+		std::vector<std::pair<std::wstring, int>> models = server.GetModels();
+		for (size_t i = 0; i < models.size(); ++i)
+		{
+			std::cout << "Serving \"" << EncodeUtf8(models[i].first) << "\" (order " << models[i].second << ")\n";
+		}
+		std::cout << "Listening at " << EncodeUtf8(parsed.files[0]) << std::endl;
+		server.Wait();
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the request command, which sends a single request to a running server and prints    *
+	 * the response.                                                                                  *
+	 *    Usage: request <socket> <model name> [-order N] [-count N] [-seed N] [-start TEXT]          *
+	 **************************************************************************************************/
+	int Request(const Arguments & parsed)
+	{
+		long long order = 2, count = 100, seed = -1;
+		if (!GetNumber(parsed, L"order", order, MAX_ORDER) ||
+			!GetNumber(parsed, L"count", count, ServerProtocol::MAX_NUM_GEN) ||
+			!GetNumber(parsed, L"seed", seed, ServerProtocol::MAX_SEED)) return 1;
+		if (parsed.files.size() != 2)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		LocalSocket socket;
+		if (!socket.Connect(parsed.files[0]))
+		{
+			PrintError(L"Could not connect to \"" + parsed.files[0] + L"\".");
+			return 1;
+		}
+		GenerationRequest request;
+		request.modelName = parsed.files[1];
+		request.order = (int)order;
+		request.numGen = (int)count;
+		request.seed = seed;
+		request.context = GetString(parsed, L"start", L"");
+		GenerationResponse response;
+		if (!ServerProtocol::SendRequest(socket, request) || !ServerProtocol::ReceiveResponse(socket, response))
+		{
+			PrintError(L"The server closed the connection.");
+			return 1;
+		}
+		if (response.status != GenerationResponse::OK)
+		{
+			std::cerr << response.text << std::endl;
+			return 1;
+		}
+		std::cout << response.text << std::endl;
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the reload command, which makes a running server load a model again from its file,  *
+	 * once the file has been replaced by a newly trained model.                                      *
+	 *    Usage: reload <socket> <model name> [-order N]                                              *
+	 **************************************************************************************************/
+	int Reload(const Arguments & parsed)
+	{
+		long long order = 2;
+		if (!GetNumber(parsed, L"order", order, MAX_ORDER)) return 1;
+		if (parsed.files.size() != 2)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		LocalSocket socket;
+		if (!socket.Connect(parsed.files[0]))
+		{
+			PrintError(L"Could not connect to \"" + parsed.files[0] + L"\".");
+			return 1;
+		}
+		GenerationRequest request;
+		request.modelName = parsed.files[1];
+		request.order = (int)order;
+		request.reload = true;
+		GenerationResponse response;
+		if (!ServerProtocol::SendRequest(socket, request) || !ServerProtocol::ReceiveResponse(socket, response))
+		{
+			PrintError(L"The server closed the connection.");
+			return 1;
+		}
+		if (response.status != GenerationResponse::OK)
+		{
+			std::cerr << response.text << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	/**************************************************************************************************
+	 * Implements the bench command: runs a Benchmark and writes its results to a file of             *
+	 * tab-separated values. Given a baseline (the results file of an earlier run), it also lists     *
+	 * every measurement that has become more than the tolerance slower, and fails if there are any,  *
+	 * so that it can gate a build.                                                                   *
+	 *    Usage: bench <results> [-sizes MB,MB,...] [-orders N,N,...] [-tokens T,T,...]               *
+	 *           [-threadcounts N,N,...] [-count N] [-score MB] [-temp DIR] [-baseline FILE]          *
+	 *           [-tolerance PERCENT]                                                                 *
+	 **************************************************************************************************/
+	int Bench(const Arguments & parsed)
+	{
+		Benchmark::Options options;
+		std::vector<long long> orders(1, 2), threadCounts;
+		long long tolerance = 10;
+		if (!GetNumberList(parsed, L"sizes", options.corpusMegabytes, MAX_MEMORY) ||
+		    !GetNumberList(parsed, L"orders", orders, MAX_ORDER) ||
+		    !GetNumberList(parsed, L"threadcounts", threadCounts, MAX_THREADS) ||
+		    !GetNumber(parsed, L"count", options.generateTokens, MAX_COUNT) ||
+		    !GetNumber(parsed, L"score", options.scoreMegabytes, MAX_MEMORY) || !GetNumber(parsed, L"tolerance", tolerance))
+		{
+			return 1;
+		}
+		std::wistringstream tokenTypes(GetString(parsed, L"tokens", L"words"));
+		options.tokenTypes.clear();
+		for (std::wstring tokenType; std::getline(tokenTypes, tokenType, L','); )
+		{
+			if (!IsTokenType(tokenType))
+			{
+				PrintError(L"-tokens must list \"words\", \"characters\" or \"punctuation\", separated by commas.");
+				return 1;
+			}
+			options.tokenTypes.push_back(tokenType);
+		}
+		options.orders.assign(orders.begin(), orders.end());
+		options.threadCounts.assign(threadCounts.begin(), threadCounts.end());
+		options.tempDirectory = GetString(parsed, L"temp", L".");
+		if (parsed.files.size() != 1 || std::count(orders.begin(), orders.end(), 0LL) > 0)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		std::vector<Benchmark::Result> baseline;
+		auto baselineFile = parsed.options.find(L"baseline");
+		if (baselineFile != parsed.options.end())
+		{
+			std::ifstream in(NativePath(baselineFile->second));
+			baseline = Benchmark::ReadResults(in);
+			if (baseline.empty())
+			{
+				PrintError(L"\"" + baselineFile->second + L"\" holds no benchmark results.");
+				return 1;
+			}
+		}
+
+		Benchmark benchmark(options);
+		bool completed = benchmark.Run(std::cerr);
+		std::ofstream out(NativePath(parsed.files[0]), std::ios::binary);
+		Benchmark::WriteResults(out, benchmark.Results());
+		if (!out)
+		{
+			PrintError(L"Could not write \"" + parsed.files[0] + L"\".");
+			return 1;
+		}
+		if (!completed) return 1;
+
+		std::vector<std::wstring> regressions = Benchmark::FindRegressions(baseline, benchmark.Results(), (double)tolerance);
+		for (size_t i = 0; i < regressions.size(); ++i) PrintError(L"Slower than the baseline: " + regressions[i]);
+		return regressions.empty() ? 0 : 3;
+	}
+
+	/**************************************************************************************************
+	 * Implements the bake command: trains and compiles a chain from a text file, and writes the text *
+	 * and the chain's image (see CompiledChain::WriteImage()) as C++ source. This is how             *
+	 * DefaultModel.inc, the example built into the program, is made; the file names its definitions  *
+	 * to suit DefaultModel.cpp. The chain is trained with StringChain::AddItems(), as the GUI trains *
+	 * the example when it needs another order or token type, so both give the same chain.            *
+	 *    Usage: bake <output.inc> [-order N] [-tokens words|characters|punctuation] <text file>      *
+	 **************************************************************************************************/
+	int Bake(const Arguments & parsed)
+	{
+		long long order = 2;
+		if (!GetNumber(parsed, L"order", order, MAX_ORDER)) return 1;
+		std::wstring tokenType = GetString(parsed, L"tokens", L"words");
+		if (!IsTokenType(tokenType))
+		{
+			PrintError(L"-tokens must be \"words\", \"characters\" or \"punctuation\".");
+			return 1;
+		}
+		if (parsed.files.size() != 2 || order < 1)
+		{
+			PrintError(USAGE);
+			return 1;
+		}
+
+		std::ifstream file(NativePath(parsed.files[1]), std::ios::binary);
+		if (!file)
+		{
+			PrintError(L"Could not read \"" + parsed.files[1] + L"\".");
+			return 1;
+		}
+		Utf8StreamBuf buffer(file);
+		const std::wstring text((std::istreambuf_iterator<wchar_t>(&buffer)), std::istreambuf_iterator<wchar_t>());
+
+		StringChain trained((int)order);
+		std::wistringstream stream(text);
+		trained.AddItems(stream, tokenType);
+		CompiledChain chain;
+		if (!chain.Compile(trained, (int)order, tokenType))
+		{
+			PrintError(L"\"" + parsed.files[1] + L"\" is too large to compile.");
+			return 1;
+		}
+
+		const std::wstring & path = parsed.files[1];
+		const std::wstring name = path.substr(path.find_last_of(L"/\\") + 1);
+		std::ofstream out(NativePath(parsed.files[0]), std::ios::binary);
+		out << "// Written by \"Markov.exe bake\" with -order " << order << " -tokens " << EncodeUtf8(tokenType) 
+		    << ". Do not edit; bake it again instead.\n\n";
+		out << "static const wchar_t defaultModelName[] =\n";
+		WriteStringLiteral(out, name);
+		out << ";\n\nstatic const wchar_t defaultModelText[] =\n";
+		WriteStringLiteral(out, text);
+		out << ";\n\n";
+		chain.WriteImage(out, "defaultModel");
+		if (!out.flush())
+		{
+			PrintError(L"Could not write \"" + parsed.files[0] + L"\".");
+			return 1;
+		}
+		return 0;
+	}
+}
+
+/**************************************************************************************************
+ * Runs a command-line command.                                                                   *
+ *   Inputs:                                                                                      *
+ *      args: The command name, followed by its arguments.                                        *
+ *   return value: 0 on success, 1 if the command failed or was used incorrectly, 2 if training    *
+ *                 succeeded but some input files could not be read, and 3 if a benchmark found   *
+ *                 regressions.                                                                   *
+ **************************************************************************************************/
+int RunConsoleCommand(const std::vector<std::wstring> & args)
+{
+	Arguments parsed;
+	if (args.empty() || !ParseArguments(args, parsed))
+	{
+		PrintError(USAGE);
+		return 1;
+	}
+	if (!ConfigureThreads(parsed)) return 1;
+
+	if (args[0] == L"train") return Train(parsed);
+	if (args[0] == L"merge") return Merge(parsed);
+	if (args[0] == L"append") return Append(parsed);
+	if (args[0] == L"compact") return Compact(parsed);
+	if (args[0] == L"pack") return Pack(parsed);
+	if (args[0] == L"unpack") return Unpack(parsed);
+	if (args[0] == L"generate") return Generate(parsed);
+	if (args[0] == L"mix") return Mix(parsed);
+	if (args[0] == L"serve") return Serve(parsed);
+	if (args[0] == L"request") return Request(parsed);
+	if (args[0] == L"reload") return Reload(parsed);
+	if (args[0] == L"score") return Score(parsed);
+	if (args[0] == L"bench") return Bench(parsed);
+	if (args[0] == L"bake") return Bake(parsed);
+	if (args[0] == L"selftest") return RunSelfTest(std::cout) ? 0 : 1;
+	PrintError(USAGE);
+	return args[0] == L"help" ? 0 : 1;
+}
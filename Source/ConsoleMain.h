@@ -0,0 +1,13 @@
+// Command-line interface to the Markov generator, for batch jobs that are too large or too
+// repetitive for the GUI: training model files out of core, merging model files, generating text
+// from a model file, and serving generation requests to other programs. Markov.exe runs a command
+// instead of opening its window whenever it is started with arguments.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Runs the command described by args (not including the program name). Output is written to the
+// standard output as UTF-8, and errors to the standard error. Returns the process exit code.
+int RunConsoleCommand(const std::vector<std::wstring> & args);
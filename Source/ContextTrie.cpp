@@ -0,0 +1,381 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Stores the counts of the Markov chains of every order from 1 to N in one trie. A chain of      *
+ * order k counts which token follows each context of k tokens; the chains of orders 1 to N read  *
+ * the same texts, and the context of order k is the last k tokens of the context of order k + 1. *
+ * So the trie is keyed from the newest token backwards: the root's children are the contexts of  *
+ * order 1 (the last token), their children are the contexts of order 2 (the token before that),  *
+ * and so on, and each context of order k + 1 is stored as one more node below the context of     *
+ * order k that it ends with. A node costs its token, the start of its children and the start of  *
+ * its Suffixes, however long its context is, and contexts that end the same way share all of     *
+ * their shorter nodes.                                                                           *
+ *                                                                                                *
+ * The trie is trained in one pass. Each token is counted after the current context at every      *
+ * depth at once, walking down from the root through the last N tokens read. The only difference  *
+ * between the chains of different orders is the padding: a chain of order k follows every text   *
+ * with k non-words, so the i-th non-word of the padding is only counted for orders of i and      *
+ * more. With that, the counts at depth k are exactly the counts that a chain trained with order  *
+ * k on the same texts would have, which ReferenceOracle checks for every order up to the trie's. *
+ *                                                                                                *
+ * Training uses hash tables, which are fast to update but large. Freeze() then packs the trie    *
+ * into sorted arrays in compressed-sparse-row form: the nodes are renumbered level by level, so  *
+ * that the children of a node are consecutive and sorted by token, and the Suffixes of a node    *
+ * are consecutive and sorted by token with their cumulative counts beside them. A context is     *
+ * then found by one binary search per token, and a Suffix is drawn by one more.                  *
+ **************************************************************************************************/
+
+#include "ContextTrie.h"
+#include "TokenPolicy.h"
+#include <algorithm>
+
+const unsigned int ContextTrie::NO_NODE;
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      maxOrder: The highest order of chain that the trie will hold. Chains of every order from  *
+ *                1 up to this one are trained together.                                          *
+ *      tokenType: "words", "characters" or "punctuation".                                        *
+ **************************************************************************************************/
+ContextTrie::ContextTrie(int maxOrder, const std::wstring & tokenType)
+	: maxOrder(maxOrder), tokenType(tokenType), parents(1, NO_NODE), tokens(1, Vocabulary::NONWORD_ID),
+	  depths(1, 0), history(maxOrder, Vocabulary::NONWORD_ID)
+{
+}
+
+/**************************************************************************************************
+ * Returns the child of a node for a token, creating the child if it does not exist yet.          *
+ *   Inputs:                                                                                      *
+ *      parent: The node whose context the child extends by one older token.                      *
+ *      token: The ID of that older token.                                                        *
+ *   return value: The child node.                                                                *
+ **************************************************************************************************/
+unsigned int ContextTrie::Child(unsigned int parent, unsigned int token)
+{
+	auto inserted = childIndex.insert(std::make_pair(((unsigned long long)parent << 32) | token,
+	                                                 (unsigned int)parents.size()));
+	if (inserted.second)
+	{
+		parents.push_back(parent);
+		tokens.push_back(token);
+		depths.push_back((unsigned char)(depths[parent] + 1));
+	}
+	return inserted.first->second;
+}
+
+/**************************************************************************************************
+ * Counts a token after the current context of each order from minDepth to maxOrder, then makes   *
+ * the token the newest token of the context.                                                     *
+ *   Inputs:                                                                                      *
+ *      token: The ID of the token that follows the context.                                      *
+ *      minDepth: The lowest order for which the token is counted.                                *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ContextTrie::Count(unsigned int token, int minDepth)
+{
+	unsigned int node = 0;
+	for (int depth = 1; depth <= maxOrder; ++depth)
+	{
+		node = Child(node, history[maxOrder - depth]);
+		if (depth >= minDepth) counts[((unsigned long long)node << 32) | token]++;
+	}
+	if (maxOrder > 0)
+	{
+		std::copy(history.begin() + 1, history.end(), history.begin());
+		history.back() = token;
+	}
+	anyRecords = true;
+}
+
+/**************************************************************************************************
+ * Counts a token after the current context of every order.                                       *
+ *   Inputs:                                                                                      *
+ *      token: A word or character.                                                               *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ContextTrie::AddToken(const std::wstring & token)
+{
+	Count(vocabulary.Intern(token), 1);
+	tokensInCurrentInput++;
+}
+
+/**************************************************************************************************
+ * Adds the non-word padding that follows the last token of an input text. A chain of order k     *
+ * adds k non-words, so the i-th non-word is only counted for orders of i and more. An empty      *
+ * first text adds a non-word for every order, as a chain of any order would.                     *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ContextTrie::EndInput()
+{
+	if (tokensInCurrentInput == 0 && !anyRecords) Count(Vocabulary::NONWORD_ID, 1);
+	for (int i = 1; i <= maxOrder; ++i) Count(Vocabulary::NONWORD_ID, i);
+	tokensInCurrentInput = 0;
+}
+
+/**************************************************************************************************
+ * Packs the trie into sorted arrays and frees the hash tables that training used. The nodes are  *
+ * renumbered a level at a time; within a level they are sorted by the new number of their parent *
+ * and then by token, so that the children of each node are consecutive and sorted, and the nodes *
+ * of each level are consecutive too. A node's parent then need not be stored: it is the last     *
+ * node whose children begin at or before it.                                                     *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ContextTrie::Freeze()
+{
+	if (frozen) return;
+	const size_t numNodes = parents.size();
+
+	// Renumber the nodes level by level:
+	std::vector<std::vector<unsigned int>> levels(maxOrder + 1);
+	for (unsigned int node = 0; node < numNodes; ++node) levels[depths[node]].push_back(node);
+	std::vector<unsigned int> newNumbers(numNodes);
+	levelOffsets.assign(1, 0);
+	unsigned int next = 0;
+	for (int depth = 0; depth <= maxOrder; ++depth)
+	{
+		std::vector<unsigned int> & level = levels[depth];
+		if (depth > 0)
+		{
+			std::sort(level.begin(), level.end(), [&](unsigned int a, unsigned int b) {
+				if (parents[a] != parents[b]) return newNumbers[parents[a]] < newNumbers[parents[b]];
+				return tokens[a] < tokens[b];
+			});
+		}
+		for (size_t i = 0; i < level.size(); ++i) newNumbers[level[i]] = next++;
+		levelOffsets.push_back(next);
+	}
+
+	// Every node but the root is the child of a node numbered before it, and the children of the
+	// nodes of one level fill the next level in the same order, so the children of each node begin
+	// where those of the node before it end. Nodes of the deepest level have no children:
+	const size_t numParents = levelOffsets[maxOrder];
+	nodeTokens.assign(numNodes, Vocabulary::NONWORD_ID);
+	std::vector<unsigned int> numChildren(numParents, 0);
+	for (unsigned int node = 1; node < numNodes; ++node)
+	{
+		nodeTokens[newNumbers[node]] = tokens[node];
+		numChildren[newNumbers[parents[node]]]++;
+	}
+	childOffsets.assign(numParents + 1, 1);
+	for (size_t node = 0; node < numParents; ++node) childOffsets[node + 1] = childOffsets[node] + numChildren[node];
+
+	// Sort the counts by node and Suffix, and accumulate them:
+	std::vector<std::pair<unsigned long long, unsigned long long>> sorted;
+	sorted.reserve(counts.size());
+	for (auto it = counts.begin(); it != counts.end(); ++it)
+	{
+		const unsigned long long node = newNumbers[(unsigned int)(it->first >> 32)];
+		sorted.push_back(std::make_pair((node << 32) | (it->first & 0xFFFFFFFF), it->second));
+	}
+	std::sort(sorted.begin(), sorted.end());
+	edgeOffsets.assign(numNodes + 1, 0);
+	edgeTokens.resize(sorted.size());
+	edgeCumulative.resize(sorted.size());
+	unsigned long long total = 0;
+	for (size_t i = 0; i < sorted.size(); ++i)
+	{
+		const unsigned int node = (unsigned int)(sorted[i].first >> 32);
+		if (i == 0 || node != (unsigned int)(sorted[i - 1].first >> 32)) total = 0;
+		total += sorted[i].second;
+		edgeTokens[i] = (unsigned int)sorted[i].first;
+		edgeCumulative[i] = total;
+		edgeOffsets[node + 1]++;
+	}
+	for (size_t node = 0; node < numNodes; ++node) edgeOffsets[node + 1] += edgeOffsets[node];
+
+	// Free the tables that training used:
+	std::unordered_map<unsigned long long, unsigned int>().swap(childIndex);
+	std::unordered_map<unsigned long long, unsigned long long>().swap(counts);
+	std::vector<unsigned int>().swap(parents);
+	std::vector<unsigned int>().swap(tokens);
+	std::vector<unsigned char>().swap(depths);
+	frozen = true;
+}
+
+/**************************************************************************************************
+ * Returns the parent of a node of the frozen trie: the last node whose children begin at or      *
+ * before it.                                                                                     *
+ *   Inputs:                                                                                      *
+ *      node: A node other than the root.                                                         *
+ *   return value: The node's parent.                                                             *
+ **************************************************************************************************/
+unsigned int ContextTrie::Parent(unsigned int node) const
+{
+	return (unsigned int)(std::upper_bound(childOffsets.begin(), childOffsets.end(), node) - childOffsets.begin()) - 1;
+}
+
+/**************************************************************************************************
+ * Reads the context of a node back from the trie. The node holds the oldest token, and each of   *
+ * its ancestors below the root a newer one.                                                      *
+ *   Inputs:                                                                                      *
+ *      node: The node.                                                                           *
+ *      depth: The node's depth, which is the number of tokens in its context.                    *
+ *      context: Receives depth token IDs, oldest first.                                          *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ContextTrie::ReadContext(unsigned int node, int depth, unsigned int * context) const
+{
+	for (int i = 0; i < depth; ++i, node = Parent(node)) context[i] = nodeTokens[node];
+}
+
+/**************************************************************************************************
+ * Finds the node of a context.                                                                   *
+ *   Inputs:                                                                                      *
+ *      context: The token IDs of the context, oldest first.                                      *
+ *      order: The number of tokens in the context.                                               *
+ *   return value: The context's node, or NO_NODE if the context never occurred.                  *
+ **************************************************************************************************/
+unsigned int ContextTrie::FindNode(const unsigned int * context, int order) const
+{
+	unsigned int node = 0;
+	for (int depth = 1; depth <= order; ++depth)
+	{
+		auto begin = nodeTokens.begin() + childOffsets[node], end = nodeTokens.begin() + childOffsets[node + 1];
+		auto found = std::lower_bound(begin, end, context[order - depth]);
+		if (found == end || *found != context[order - depth]) return NO_NODE;
+		node = (unsigned int)(found - nodeTokens.begin());
+	}
+	return node;
+}
+
+/**************************************************************************************************
+ * Picks a random context of an order that has Suffixes. A few contexts are only ever passed      *
+ * through on the way to longer ones while padding is counted, and have none; they are drawn and  *
+ * rejected, so every context with Suffixes is equally likely, just as every Prefix of a trained  *
+ * chain is.                                                                                      *
+ *   Inputs:                                                                                      *
+ *      order: The order of the context.                                                          *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *   return value: The context's node, or NO_NODE if no context of the order has Suffixes.        *
+ **************************************************************************************************/
+unsigned int ContextTrie::RandomNode(int order, Random & rand) const
+{
+	const unsigned int first = levelOffsets[order], last = levelOffsets[order + 1];
+	if (edgeOffsets[first] == edgeOffsets[last]) return NO_NODE;
+	while (true)
+	{
+		unsigned int node = first + (unsigned int)rand.nextInt((int)(last - first));
+		if (edgeOffsets[node] != edgeOffsets[node + 1]) return node;
+	}
+}
+
+/**************************************************************************************************
+ * Calls a function for every <Prefix, Suffix> record of a chain held in the trie, with its       *
+ * count.                                                                                         *
+ *   Inputs:                                                                                      *
+ *      order: The order of the chain, from 1 to MaxOrder().                                      *
+ *      output: The function to call for each record. Its key holds the Prefix's order token IDs, *
+ *              oldest first, followed by the Suffix's ID.                                        *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ContextTrie::ForEachRecord(int order, const std::function<void(const unsigned int * key,
+                                unsigned long long count)> & output) const
+{
+	std::vector<unsigned int> key(order + 1);
+	for (unsigned int node = levelOffsets[order]; node < levelOffsets[order + 1]; ++node)
+	{
+		ReadContext(node, order, key.data());
+		for (unsigned int edge = edgeOffsets[node]; edge < edgeOffsets[node + 1]; ++edge)
+		{
+			key[order] = edgeTokens[edge];
+			output(key.data(), edgeCumulative[edge] - (edge == edgeOffsets[node] ? 0 : edgeCumulative[edge - 1]));
+		}
+	}
+}
+
+/**************************************************************************************************
+ * Appends gibberish generated by a chain held in the trie to a string, starting from a random    *
+ * Prefix, as StringChain::generate() does.                                                       *
+ *   Inputs:                                                                                      *
+ *      order: The order of the chain, from 1 to MaxOrder().                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the gibberish is appended.                                    *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests.                                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ContextTrie::Generate(int order, int numGen, Random & rand, std::wstring & output,
+                           ProgressMonitor * monitor) const
+{
+	VisitTokenPolicy(tokenType, [&](auto policy) {
+		Walk<decltype(policy)>(order, numGen, rand, output, monitor);
+	});
+}
+
+/**************************************************************************************************
+ * Generate(), for one tokenizer policy, which decides how each token is written to the output.   *
+ *   Inputs:                                                                                      *
+ *      order: The order of the chain, from 1 to MaxOrder().                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the gibberish is appended.                                    *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests.                                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+template <class Policy>
+void ContextTrie::Walk(int order, int numGen, Random & rand, std::wstring & output, ProgressMonitor * monitor) const
+{
+	unsigned int node = RandomNode(order, rand);
+	if (node == NO_NODE) return; // nothing was read
+
+	// The context, oldest token first, read back from the starting node:
+	std::vector<unsigned int> context(order);
+	ReadContext(node, order, context.data());
+
+	for (int i = 0; i < numGen; ++i)
+	{
+		// Report progress and honor cancellation requests every so often:
+		if (monitor && i % 256 == 0)
+		{
+			monitor->SetTokensGenerated(i);
+			if (monitor->IsCancelled()) return;
+		}
+
+		// Every context that a Suffix leads to is followed by something, thanks to the padding, but
+		// start afresh rather than stop if one is not:
+		if (node == NO_NODE || edgeOffsets[node] == edgeOffsets[node + 1])
+		{
+			node = RandomNode(order, rand);
+			ReadContext(node, order, context.data());
+		}
+
+		// Choose one of the context's Suffixes, by binary search for the first cumulative count that
+		// exceeds a random draw:
+		auto begin = edgeCumulative.begin() + edgeOffsets[node], end = edgeCumulative.begin() + edgeOffsets[node + 1];
+		unsigned long long draw = rand.nextLong(end[-1]);
+		const unsigned int id = edgeTokens[std::upper_bound(begin, end, draw) - edgeCumulative.begin()];
+
+		// Advance the context by 1 token, and find its node:
+		if (order > 0)
+		{
+			std::copy(context.begin() + 1, context.end(), context.begin());
+			context.back() = id;
+		}
+		node = FindNode(context.data(), order);
+
+		// Save the token to the output, unless it is a non-word:
+		if (id != Vocabulary::NONWORD_ID) Policy::Append(output, vocabulary.Token(id));
+	}
+
+	if (monitor) monitor->SetTokensGenerated(numGen);
+}
+
+/**************************************************************************************************
+ * Returns the number of bytes used by the packed trie, not counting the vocabulary.              *
+ **************************************************************************************************/
+size_t ContextTrie::MemoryUsage() const
+{
+	return sizeof(unsigned int) * (nodeTokens.size() + childOffsets.size() +
+	                               levelOffsets.size() + edgeOffsets.size() + edgeTokens.size()) +
+	       sizeof(unsigned long long) * edgeCumulative.size();
+}
+
+// Accessors.
+int ContextTrie::MaxOrder() const { return maxOrder; }
+const std::wstring & ContextTrie::TokenType() const { return tokenType; }
+const Vocabulary & ContextTrie::GetVocabulary() const { return vocabulary; }
+size_t ContextTrie::NumNodes() const { return nodeTokens.size(); }
+size_t ContextTrie::NumEdges() const { return edgeTokens.size(); }
@@ -0,0 +1,100 @@
+// The counts of Markov chains of every order from 1 to N, trained in one pass and stored in one
+// trie. A node stands for a context: the root for no tokens at all, its children for the last
+// token, their children for the last two tokens, and so on, so a node at depth k is a Prefix of
+// order k and shares the nodes of its shorter contexts with every other Prefix that ends the same
+// way. Each node stores its own token, the start of its children and the counts of the Suffixes
+// that followed its context; its parent is implied by where it is stored. One trie trained with
+// order N serves generation (or compilation) at any order up to N, with exactly the counts that a
+// chain trained with that order would have.
+
+#pragma once
+
+#include "ProgressMonitor.h"
+#include "Random.h"
+#include "TokenSink.h"
+#include "Vocabulary.h"
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ContextTrie : public TokenSink
+{
+	const int maxOrder;
+	const std::wstring tokenType;
+	Vocabulary vocabulary;
+
+	// While training, nodes are numbered in the order they are created:
+	std::unordered_map<unsigned long long, unsigned int> childIndex; // parent << 32 | token -> child
+	std::unordered_map<unsigned long long, unsigned long long> counts; // node << 32 | suffix -> count
+	std::vector<unsigned int> parents, tokens; // of each node
+	std::vector<unsigned char> depths;
+	std::vector<unsigned int> history; // token IDs of the last maxOrder tokens read, oldest first
+	long long tokensInCurrentInput = 0;
+	bool anyRecords = false;
+
+	// Once frozen, nodes are renumbered level by level, and within a level by parent and then by
+	// token. The children of node n are nodes childOffsets[n] to childOffsets[n + 1] - 1, sorted by
+	// token (only nodes above the deepest level have an entry), and the nodes at depth d are
+	// levelOffsets[d] to levelOffsets[d + 1] - 1. The Suffixes of node n are edgeTokens[edgeOffsets[n]]
+	// to edgeTokens[edgeOffsets[n + 1] - 1], sorted, with the counts of the node's Suffixes up to and
+	// including each one in edgeCumulative.
+	std::vector<unsigned int> nodeTokens, childOffsets, levelOffsets;
+	std::vector<unsigned int> edgeOffsets, edgeTokens;
+	std::vector<unsigned long long> edgeCumulative;
+	bool frozen = false;
+
+	// Returns the child of parent for token, creating it if it does not exist yet.
+	unsigned int Child(unsigned int parent, unsigned int token);
+	// Counts token after the current context at every depth from minDepth to maxOrder.
+	void Count(unsigned int token, int minDepth);
+	// Returns the parent of a node of the frozen trie, the one whose children include it.
+	unsigned int Parent(unsigned int node) const;
+	// Writes the context of a node of the given depth to context, oldest token first.
+	void ReadContext(unsigned int node, int depth, unsigned int * context) const;
+	// Finds the node of a context, given as order token IDs, oldest first. Returns NO_NODE if the
+	// context never occurred.
+	unsigned int FindNode(const unsigned int * context, int order) const;
+	// Picks a node at depth order that has Suffixes, with every such node equally likely.
+	unsigned int RandomNode(int order, Random & rand) const;
+	// Generate(), compiled once for each tokenizer policy (see TokenPolicy.h).
+	template <class Policy> void Walk(int order, int numGen, Random & rand, std::wstring & output,
+	                                  ProgressMonitor * monitor) const;
+
+public:
+	// Marks a context that has no node.
+	static const unsigned int NO_NODE = 0xFFFFFFFF;
+
+	// Constructor. The trie will hold chains of every order from 1 to maxOrder.
+	ContextTrie(int maxOrder, const std::wstring & tokenType);
+
+	// Counts the token after the current context of every order, and advances the context.
+	void AddToken(const std::wstring & token) override;
+
+	// Adds the non-word padding that follows the last token of an input text.
+	void EndInput() override;
+
+	// Packs the trie into its compact, sorted form and frees the tables used while training. Call
+	// once, after the last input; the methods below read only the packed trie.
+	void Freeze();
+
+	// Calls output for every counted <Prefix, Suffix> record of the given order (at most
+	// MaxOrder()), in no particular order. key holds the Prefix's order token IDs, oldest first,
+	// followed by the Suffix.
+	void ForEachRecord(int order, const std::function<void(const unsigned int * key,
+	                   unsigned long long count)> & output) const;
+
+	// Appends numGen tokens of gibberish, generated by the chain of the given order, to output.
+	void Generate(int order, int numGen, Random & rand, std::wstring & output,
+	              ProgressMonitor * monitor = NULL) const;
+
+	// The number of bytes used by the packed trie, apart from the vocabulary.
+	size_t MemoryUsage() const;
+
+	// Accessors.
+	int MaxOrder() const;
+	const std::wstring & TokenType() const;
+	const Vocabulary & GetVocabulary() const;
+	size_t NumNodes() const;
+	size_t NumEdges() const;
+};
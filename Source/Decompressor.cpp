@@ -0,0 +1,181 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Streaming decompressors for gzip (.gz) and Zstandard (.zst) files. Compressed data is fed in   *
+ * arbitrary blocks as it is read from disk, and the decompressed bytes are appended to an output *
+ * buffer, so a compressed corpus is never written back to disk in decompressed form.             *
+ * Multi-member gzip files (as produced by concatenating .gz files, or by parallel compressors    *
+ * such as pigz) and multi-frame zstd files are read in their entirety.                           *
+ *                                                                                                *
+ * The actual decompression is done by zlib and libzstd. Each is compiled in only when            *
+ * MARKOV_WITH_ZLIB or MARKOV_WITH_ZSTD is defined (and the corresponding library is linked), so  *
+ * the program still builds on a machine that has neither.                                        *
+ **************************************************************************************************/
+
+#include "Decompressor.h"
+
+#ifdef MARKOV_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MARKOV_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+	const size_t OUTPUT_BLOCK_SIZE = 256 * 1024;
+
+#ifdef MARKOV_WITH_ZLIB
+	// Decompresses gzip data with zlib. inflate() is told to expect a gzip header (the "16 +" in the
+	// window-bits argument), and is reset after the end of each member so that concatenated members
+	// are decompressed one after another. inflate() is called again whenever it fills the output
+	// buffer, even once it has taken all the input, since it may still be holding output back.
+	class GzipDecompressor : public Decompressor
+	{
+		z_stream stream;
+		bool memberEnded = false;
+
+	public:
+		GzipDecompressor()
+		{
+			stream = z_stream();
+			inflateInit2(&stream, 16 + MAX_WBITS);
+		}
+
+		~GzipDecompressor() override
+		{
+			inflateEnd(&stream);
+		}
+
+		bool Decompress(const char * input, size_t length, std::vector<char> & output) override
+		{
+			stream.next_in = (Bytef *)input;
+			stream.avail_in = (uInt)length;
+			std::vector<char> buffer(OUTPUT_BLOCK_SIZE);
+			bool outputFull = false;
+			while (stream.avail_in > 0 || outputFull)
+			{
+				// Another member follows the one that just ended:
+				if (memberEnded)
+				{
+					inflateReset(&stream);
+					memberEnded = false;
+				}
+
+				stream.next_out = (Bytef *)buffer.data();
+				stream.avail_out = (uInt)buffer.size();
+				int result = inflate(&stream, Z_NO_FLUSH);
+				output.insert(output.end(), buffer.data(), buffer.data() + (buffer.size() - stream.avail_out));
+				outputFull = (stream.avail_out == 0);
+				if (result == Z_STREAM_END) memberEnded = true;
+				else if (result == Z_BUF_ERROR) break; // all input consumed; more is needed
+				else if (result != Z_OK) return false;
+			}
+			return true;
+		}
+
+		bool Finish() override
+		{
+			return memberEnded;
+		}
+	};
+#endif
+
+#ifdef MARKOV_WITH_ZSTD
+	// Decompresses Zstandard data with libzstd's streaming API, which moves on to the next frame by
+	// itself when one frame ends.
+	class ZstdDecompressor : public Decompressor
+	{
+		ZSTD_DStream * stream;
+		size_t lastHint = 0; // 0 once a frame has been completely decoded
+
+	public:
+		ZstdDecompressor()
+		{
+			stream = ZSTD_createDStream();
+			ZSTD_initDStream(stream);
+		}
+
+		~ZstdDecompressor() override
+		{
+			ZSTD_freeDStream(stream);
+		}
+
+		bool Decompress(const char * input, size_t length, std::vector<char> & output) override
+		{
+			std::vector<char> buffer(OUTPUT_BLOCK_SIZE);
+			ZSTD_inBuffer in = { input, length, 0 };
+			bool outputFull = false;
+			while (in.pos < in.size || outputFull)
+			{
+				ZSTD_outBuffer out = { buffer.data(), buffer.size(), 0 };
+				lastHint = ZSTD_decompressStream(stream, &out, &in);
+				if (ZSTD_isError(lastHint)) return false;
+				output.insert(output.end(), buffer.data(), buffer.data() + out.pos);
+				outputFull = (out.pos == out.size);
+			}
+			return true;
+		}
+
+		bool Finish() override
+		{
+			return lastHint == 0;
+		}
+	};
+#endif
+}
+
+/**************************************************************************************************
+ * Recognizes a format from the first bytes of a file. gzip files begin with 1F 8B, and zstd      *
+ * frames begin with the little-endian magic number 0xFD2FB528.                                   *
+ *   Inputs:                                                                                      *
+ *      bytes: The first bytes of the file.                                                       *
+ *      length: How many bytes are available (4 is enough).                                       *
+ *   return value: GZIP, ZSTD, or PLAIN for anything else.                                        *
+ **************************************************************************************************/
+Decompressor::Format Decompressor::DetectFormat(const char * bytes, size_t length)
+{
+	const unsigned char * b = (const unsigned char *)bytes;
+	if (length >= 2 && b[0] == 0x1F && b[1] == 0x8B) return GZIP;
+	if (length >= 4 && b[0] == 0x28 && b[1] == 0xB5 && b[2] == 0x2F && b[3] == 0xFD) return ZSTD;
+	return PLAIN;
+}
+
+/**************************************************************************************************
+ * Returns true if this build can decompress the given format. PLAIN is always supported.         *
+ **************************************************************************************************/
+bool Decompressor::IsSupported(Format format)
+{
+	switch (format)
+	{
+#ifdef MARKOV_WITH_ZLIB
+	case GZIP: return true;
+#endif
+#ifdef MARKOV_WITH_ZSTD
+	case ZSTD: return true;
+#endif
+	case PLAIN: return true;
+	default: return false;
+	}
+}
+
+/**************************************************************************************************
+ * Creates a decompressor for the given format.                                                   *
+ *   Inputs:                                                                                      *
+ *      format: The format detected with DetectFormat().                                          *
+ *   return value: A new decompressor owned by the caller, or NULL if the format is PLAIN or is   *
+ *                 not supported by this build.                                                   *
+ **************************************************************************************************/
+Decompressor * Decompressor::Create(Format format)
+{
+	switch (format)
+	{
+#ifdef MARKOV_WITH_ZLIB
+	case GZIP: return new GzipDecompressor();
+#endif
+#ifdef MARKOV_WITH_ZSTD
+	case ZSTD: return new ZstdDecompressor();
+#endif
+	default: return NULL;
+	}
+}
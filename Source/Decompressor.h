@@ -0,0 +1,35 @@
+// Streaming decompression for compressed input files. The format of a file is detected from its
+// first few bytes, so a .gz or .zst corpus can be read directly without first decompressing it to a
+// temporary file. gzip support requires zlib (define MARKOV_WITH_ZLIB) and zstd support requires
+// libzstd (define MARKOV_WITH_ZSTD); without them, compressed files are detected but rejected.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+class Decompressor
+{
+public:
+	// The formats that can be recognized from a file's magic bytes.
+	enum Format { PLAIN, GZIP, ZSTD };
+
+	virtual ~Decompressor() {}
+
+	// Recognizes a format from the first bytes of a file. Anything unrecognized is PLAIN.
+	static Format DetectFormat(const char * bytes, size_t length);
+
+	// Returns true if this build can decompress the given format.
+	static bool IsSupported(Format format);
+
+	// Creates a decompressor for the given format, or returns NULL if the format is PLAIN or is not
+	// supported by this build. The caller owns the returned object.
+	static Decompressor * Create(Format format);
+
+	// Decompresses the next block of compressed input, appending the result to output. Returns
+	// false if the input is corrupt.
+	virtual bool Decompress(const char * input, size_t length, std::vector<char> & output) = 0;
+
+	// Called after the last block. Returns false if the compressed stream was cut short.
+	virtual bool Finish() = 0;
+};
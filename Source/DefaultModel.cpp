@@ -0,0 +1,42 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * The example corpus and the chain trained on it, both built into the program. DefaultModel.inc  *
+ * defines the corpus's name and text, and the arrays of a CompiledChain compiled from it, as     *
+ * static data; the chain is only attached to those arrays, on first use. The order and token     *
+ * type that the chain was trained with are recorded in its image, so callers can tell whether it *
+ * is the chain they need.                                                                        *
+ **************************************************************************************************/
+
+#include "DefaultModel.h"
+
+#include "DefaultModel.inc"
+
+const wchar_t * const DEFAULT_MODEL_NAME = defaultModelName;
+
+/**************************************************************************************************
+ * Returns the text of the example corpus, exactly as it was read when the chain was baked.       *
+ **************************************************************************************************/
+const wchar_t * DefaultModelText()
+{
+	return defaultModelText;
+}
+
+/**************************************************************************************************
+ * Returns the arrays of the built-in chain.                                                      *
+ **************************************************************************************************/
+const CompiledChain::Image & DefaultModelImage()
+{
+	return defaultModel;
+}
+
+/**************************************************************************************************
+ * Returns the built-in chain, attaching it to its arrays the first time. The chain copies        *
+ * nothing, so this takes microseconds even the first time, and is safe to call from several      *
+ * threads at once.                                                                               *
+ **************************************************************************************************/
+const CompiledChain & DefaultModelChain()
+{
+	static const CompiledChain chain(defaultModel);
+	return chain;
+}
@@ -0,0 +1,21 @@
+// The example corpus that the GUI starts out with, built into the program together with a chain
+// already trained and compiled from it. Generating from the example therefore needs no file, no
+// training and no loading: the chain reads its arrays straight out of the program's static data.
+// DefaultModel.inc is written by "Markov.exe bake" (see ConsoleMain.cpp), and must be baked again
+// whenever simple.txt, the tokenizers or the layout of CompiledChain change.
+
+#pragma once
+
+#include "CompiledChain.h"
+
+// The name under which the example corpus is listed.
+extern const wchar_t * const DEFAULT_MODEL_NAME;
+
+// Returns the text of the example corpus, for training it with another order or token type.
+const wchar_t * DefaultModelText();
+
+// Returns the arrays of the built-in chain.
+const CompiledChain::Image & DefaultModelImage();
+
+// Returns the built-in chain. The first call attaches it to its arrays; nothing is read or copied.
+const CompiledChain & DefaultModelChain();
@@ -0,0 +1,330 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * An external merge sort for <Prefix, Suffix> records. Training a chain out of core produces one *
+ * record per token of input, which is far more than fits in memory for a large corpus. The       *
+ * records are collected in a fixed-size buffer; each time the buffer fills up it is sorted,      *
+ * adjacent records with equal keys are combined into one, and the result is written to a         *
+ * temporary run file. Because natural text repeats itself a great deal, the runs are usually     *
+ * much smaller than the buffer that produced them.                                               *
+ *                                                                                                *
+ * Finish() then performs a k-way merge of the runs, using a priority queue that holds the        *
+ * current record of each run, and sums the counts of equal keys as they come out of the queue.   *
+ * At most MAX_MERGE_WIDTH runs are merged at once (each open run needs its own read buffer); if  *
+ * there are more, groups of runs are first merged into larger runs. Nothing larger than the      *
+ * buffer and one record per open run is ever held in memory.                                     *
+ *                                                                                                *
+ * Both phases use the shared ThreadPool. The buffer is sorted in slices, one per thread, which   *
+ * are then merged in pairs; and when there are too many runs to merge at once, the groups of     *
+ * runs are merged into larger runs in parallel. Only the final merge, which feeds the records to *
+ * the caller in order, runs on a single thread.                                                  *
+ **************************************************************************************************/
+
+#include "ExternalSorter.h"
+#include "FilePath.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <queue>
+
+const size_t ExternalSorter::MAX_MERGE_WIDTH;
+
+namespace
+{
+	const size_t RUN_BUFFER_SIZE = 1 << 16;
+	// The fewest records worth sorting as a slice of their own:
+	const size_t MIN_SLICE_RECORDS = 1 << 14;
+
+	// Compares two keys as arrays of unsigned integers.
+	inline int CompareKeys(const unsigned int * a, const unsigned int * b, int length)
+	{
+		for (int i = 0; i < length; ++i)
+		{
+			if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+		}
+		return 0;
+	}
+
+	// Writes one record to a run file.
+	inline void WriteRecord(std::ofstream & out, const unsigned int * key, int keyLength,
+	                        unsigned long long count)
+	{
+		out.write((const char *)key, keyLength * sizeof(unsigned int));
+		out.write((const char *)&count, sizeof(count));
+	}
+}
+
+// Reads the records of one run file back in order, one at a time.
+class ExternalSorter::RunReader
+{
+	std::ifstream file;
+	std::vector<char> fileBuffer;
+	const int keyLength;
+
+public:
+	std::vector<unsigned int> key;
+	unsigned long long count = 0;
+
+	RunReader(const std::wstring & path, int keyLength) 
+		: fileBuffer(RUN_BUFFER_SIZE), keyLength(keyLength), key(keyLength)
+	{
+		file.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+		file.open(NativePath(path), std::ios::binary);
+	}
+
+	bool IsOpen() const { return file.is_open(); }
+
+	// Reads the next record. Returns false at the end of the run.
+	bool Next()
+	{
+		if (!file.read((char *)key.data(), keyLength * sizeof(unsigned int))) return false;
+		return (bool)file.read((char *)&count, sizeof(count));
+	}
+};
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      keyLength: The number of token IDs in every key.                                          *
+ *      tempDirectory: The directory in which to create temporary run files. It must exist.       *
+ *      memoryBudget: Roughly how many bytes the in-memory buffer may use.                        *
+ **************************************************************************************************/
+ExternalSorter::ExternalSorter(int keyLength, const std::wstring & tempDirectory, size_t memoryBudget)
+	: keyLength(keyLength), tempDirectory(tempDirectory)
+{
+	// Each buffered record also needs an entry in the index used to sort the buffer, and another in
+	// the buffer into which the sorted slices of the index are merged:
+	size_t bytesPerRecord = RecordWords() * sizeof(unsigned int) + 2 * sizeof(unsigned int);
+	maxBufferedRecords = std::max<size_t>(memoryBudget / bytesPerRecord, 1024);
+	buffer.reserve(maxBufferedRecords * RecordWords());
+}
+
+/**************************************************************************************************
+ * Destructor. Deletes any temporary run files that have not been merged yet, such as those left  *
+ * behind when training is cancelled.                                                             *
+ **************************************************************************************************/
+ExternalSorter::~ExternalSorter()
+{
+	for (size_t i = 0; i < runs.size(); ++i) RemoveFile(runs[i]);
+}
+
+/**************************************************************************************************
+ * Returns the name for a new temporary run file. The name includes this object's address and the *
+ * time it was created, so that several sorters (in this process or in others) can share a        *
+ * directory.                                                                                     *
+ **************************************************************************************************/
+std::wstring ExternalSorter::NewRunName()
+{
+	static const long long started = std::chrono::steady_clock::now().time_since_epoch().count();
+	std::wstring name = tempDirectory;
+	if (!name.empty() && name.back() != L'/' && name.back() != L'\\') name += L'/';
+	name += L"markov-" + std::to_wstring(started) + L"-" + std::to_wstring((unsigned long long)this) +
+		L"-" + std::to_wstring(nextRunNumber++) + L".run";
+	return name;
+}
+
+/**************************************************************************************************
+ * Adds a record to the buffer, spilling the buffer to a run first if it is full.                 *
+ *   Inputs:                                                                                      *
+ *      key: keyLength token IDs.                                                                 *
+ *      count: The number of occurrences to add to the key's total.                               *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ExternalSorter::Add(const unsigned int * key, unsigned long long count)
+{
+	if (buffer.size() >= maxBufferedRecords * RecordWords()) SpillBuffer();
+	buffer.insert(buffer.end(), key, key + keyLength);
+	buffer.push_back((unsigned int)count);
+	buffer.push_back((unsigned int)(count >> 32));
+}
+
+/**************************************************************************************************
+ * Sorts the buffer and passes its records to output in sorted order, combining records with      *
+ * equal keys. The index of the records is sorted on the shared ThreadPool, in as many slices as  *
+ * it has threads (if there are enough records), which are then merged in pairs. The buffer is    *
+ * left empty.                                                                                    *
+ *   Inputs:                                                                                      *
+ *      output: Receives each distinct key in the buffer and its total count.                     *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ExternalSorter::SortBuffer(const RecordCallback & output)
+{
+	const size_t words = RecordWords();
+	const size_t numRecords = buffer.size() / words;
+
+	// Sort an index of the records rather than moving the records themselves:
+	std::vector<unsigned int> order(numRecords);
+	for (size_t i = 0; i < numRecords; ++i) order[i] = (unsigned int)i;
+	const unsigned int * base = buffer.data();
+	const int length = keyLength;
+	auto less = [base, words, length](unsigned int a, unsigned int b) {
+		return CompareKeys(base + a * words, base + b * words, length) < 0;
+	};
+
+	ThreadPool::Shared().ParallelSort(order, less, MIN_SLICE_RECORDS);
+
+	size_t i = 0;
+	while (i < numRecords)
+	{
+		const unsigned int * key = base + order[i] * words;
+		unsigned long long total = 0;
+		for (; i < numRecords && CompareKeys(key, base + order[i] * words, length) == 0; ++i)
+		{
+			const unsigned int * record = base + order[i] * words;
+			total += record[length] | ((unsigned long long)record[length + 1] << 32);
+		}
+		output(key, total);
+	}
+	buffer.clear();
+}
+
+/**************************************************************************************************
+ * Sorts the buffer, combines records with equal keys, and writes the result to a new run file.   *
+ * The buffer is left empty.                                                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ExternalSorter::SpillBuffer()
+{
+	if (buffer.empty()) return;
+	std::wstring runName = NewRunName();
+	std::vector<char> fileBuffer(RUN_BUFFER_SIZE);
+	std::ofstream run;
+	run.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+	run.open(NativePath(runName), std::ios::binary | std::ios::trunc);
+	if (!run.is_open())
+	{
+		failed = true;
+		buffer.clear();
+		return;
+	}
+	runs.push_back(runName);
+	const int length = keyLength;
+	SortBuffer([&run, length](const unsigned int * key, unsigned long long count) {
+		WriteRecord(run, key, length, count);
+	});
+	run.close();
+	if (!run) failed = true;
+}
+
+/**************************************************************************************************
+ * Merges sorted run files into one sorted stream of records, summing the counts of equal keys.   *
+ * The input files are left in place.                                                             *
+ *   Inputs:                                                                                      *
+ *      inputs: The run files to merge.                                                           *
+ *      output: Receives each distinct key and its total count, in sorted order.                  *
+ *   return value: false if a run file could not be opened, true otherwise.                       *
+ **************************************************************************************************/
+bool ExternalSorter::MergeRuns(const std::vector<std::wstring> & inputs, const RecordCallback & output)
+{
+	std::vector<std::unique_ptr<RunReader>> readers;
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		readers.emplace_back(new RunReader(inputs[i], keyLength));
+		if (!readers.back()->IsOpen()) return false;
+	}
+
+	// A min-heap of the runs that have records left, ordered by their current keys:
+	const int length = keyLength;
+	auto later = [length](RunReader * a, RunReader * b) {
+		return CompareKeys(a->key.data(), b->key.data(), length) > 0;
+	};
+	std::priority_queue<RunReader *, std::vector<RunReader *>, decltype(later)> heap(later);
+	for (size_t i = 0; i < readers.size(); ++i)
+	{
+		if (readers[i]->Next()) heap.push(readers[i].get());
+	}
+
+	std::vector<unsigned int> pendingKey(keyLength);
+	unsigned long long pendingCount = 0;
+	bool havePending = false;
+	while (!heap.empty())
+	{
+		RunReader * top = heap.top();
+		heap.pop();
+		if (havePending && CompareKeys(pendingKey.data(), top->key.data(), length) == 0)
+		{
+			pendingCount += top->count;
+		}
+		else
+		{
+			if (havePending) output(pendingKey.data(), pendingCount);
+			pendingKey = top->key;
+			pendingCount = top->count;
+			havePending = true;
+		}
+		if (top->Next()) heap.push(top);
+	}
+	if (havePending) output(pendingKey.data(), pendingCount);
+	return true;
+}
+
+/**************************************************************************************************
+ * Delivers every distinct key in sorted order, with its counts summed. If nothing was ever       *
+ * spilled, the buffer is simply sorted in memory and no temporary files are used. Otherwise the  *
+ * buffer is spilled as the final run, runs are merged in groups of MAX_MERGE_WIDTH (as many      *
+ * groups at once as there are) until few enough remain, and the last merge feeds the output.     *
+ * Temporary files are deleted as soon as they have been merged.                                  *
+ *   Inputs:                                                                                      *
+ *      output: Receives each distinct key and its total count.                                   *
+ *   return value: false if a temporary file could not be written or read, true otherwise.        *
+ **************************************************************************************************/
+bool ExternalSorter::Finish(const RecordCallback & output)
+{
+	if (failed) return false;
+	if (runs.empty())
+	{
+		// Everything fit in memory:
+		SortBuffer(output);
+		return true;
+	}
+	SpillBuffer();
+	if (failed) return false;
+
+	while (runs.size() > MAX_MERGE_WIDTH)
+	{
+		const size_t numGroups = runs.size() / MAX_MERGE_WIDTH;
+		std::vector<std::vector<std::wstring>> groups(numGroups);
+		std::vector<std::wstring> mergedNames(numGroups);
+		for (size_t g = 0; g < numGroups; ++g)
+		{
+			groups[g].assign(runs.begin() + g * MAX_MERGE_WIDTH, runs.begin() + (g + 1) * MAX_MERGE_WIDTH);
+			mergedNames[g] = NewRunName();
+		}
+		runs.erase(runs.begin(), runs.begin() + numGroups * MAX_MERGE_WIDTH);
+
+		std::vector<char> merged(numGroups, 0);
+		ThreadPool::Shared().ParallelFor(numGroups, [&](size_t g) {
+			std::vector<char> fileBuffer(RUN_BUFFER_SIZE);
+			std::ofstream out;
+			out.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+			out.open(NativePath(mergedNames[g]), std::ios::binary | std::ios::trunc);
+			const int length = keyLength;
+			bool ok = out.is_open() && MergeRuns(groups[g], [&out, length](const unsigned int * key, 
+			                                                               unsigned long long count) {
+				WriteRecord(out, key, length, count);
+			});
+			out.close();
+			for (size_t i = 0; i < groups[g].size(); ++i) RemoveFile(groups[g][i]);
+			merged[g] = ok && out;
+		});
+		runs.insert(runs.end(), mergedNames.begin(), mergedNames.end());
+		if (std::find(merged.begin(), merged.end(), 0) != merged.end()) return false;
+	}
+
+	bool ok = MergeRuns(runs, output);
+	for (size_t i = 0; i < runs.size(); ++i) RemoveFile(runs[i]);
+	runs.clear();
+	return ok;
+}
+
+/**************************************************************************************************
+ * Returns true if a temporary file could not be written. Training can check this periodically    *
+ * and give up early instead of discovering the problem in Finish().                              *
+ **************************************************************************************************/
+bool ExternalSorter::Failed() const
+{
+	return failed;
+}
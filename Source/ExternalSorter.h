@@ -0,0 +1,59 @@
+// Sorts and aggregates more records than fit in memory. Each record is a fixed-length key of
+// token IDs plus a count. Records are collected in a memory buffer; whenever the buffer fills, it
+// is sorted, records with equal keys are combined, and the result is spilled to a temporary "run"
+// file. Finish() then merges all the runs, summing the counts of equal keys across runs.
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class ExternalSorter
+{
+public:
+	// Receives each distinct key, in sorted order, together with its total count.
+	typedef std::function<void(const unsigned int * key, unsigned long long count)> RecordCallback;
+
+private:
+	class RunReader;
+
+	const int keyLength;
+	const std::wstring tempDirectory;
+	size_t maxBufferedRecords;
+	std::vector<unsigned int> buffer;  // keyLength IDs followed by a two-word count, per record
+	std::vector<std::wstring> runs;    // temporary files not yet merged
+	unsigned int nextRunNumber = 0;
+	bool failed = false;
+
+	// Words used by one record in the buffer.
+	size_t RecordWords() const { return keyLength + 2; }
+	// Returns the name for a new temporary run file.
+	std::wstring NewRunName();
+	// Sorts the buffer and passes its aggregated contents to output.
+	void SortBuffer(const RecordCallback & output);
+	// Sorts the buffer and writes its aggregated contents to a new run.
+	void SpillBuffer();
+	// Merges runs into a single sorted, aggregated stream of records.
+	bool MergeRuns(const std::vector<std::wstring> & inputs, const RecordCallback & output);
+
+public:
+	// Maximum number of runs merged at once. More runs are merged in several passes.
+	static const size_t MAX_MERGE_WIDTH = 64;
+
+	// Constructor. Runs are created in tempDirectory, and the buffer holds about memoryBudget bytes.
+	ExternalSorter(int keyLength, const std::wstring & tempDirectory, size_t memoryBudget);
+
+	// Destructor. Deletes any temporary files that remain.
+	~ExternalSorter();
+
+	// Adds a record. Records may be added in any order, and a key may be added any number of times.
+	void Add(const unsigned int * key, unsigned long long count);
+
+	// Passes every distinct key to output in sorted order, with its counts summed. Returns false if
+	// a temporary file could not be written or read back.
+	bool Finish(const RecordCallback & output);
+
+	// Returns true if a temporary file could not be written.
+	bool Failed() const;
+};
@@ -0,0 +1,59 @@
+// Converts a wide-character path into the form the standard file streams accept. Microsoft's
+// streams take wchar_t paths directly; elsewhere the path is converted to a UTF-8 narrow string.
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+inline const wchar_t * NativePath(const std::wstring & path) { return path.c_str(); }
+#else
+#include <locale>
+#include <codecvt>
+inline std::string NativePath(const std::wstring & path)
+{
+	return std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(path);
+}
+#endif
+
+// Deletes a file. Returns true if it was deleted.
+inline bool RemoveFile(const std::wstring & path)
+{
+#ifdef _WIN32
+	return _wremove(path.c_str()) == 0;
+#else
+	return std::remove(NativePath(path).c_str()) == 0;
+#endif
+}
+
+// Returns the directory for temporary files: %TEMP% on Windows, $TMPDIR or /tmp elsewhere.
+inline std::wstring TempDirectory()
+{
+#ifdef _WIN32
+	const wchar_t * directory = _wgetenv(L"TEMP");
+	return directory ? directory : L".";
+#else
+	const char * directory = std::getenv("TMPDIR");
+	return std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(directory ? directory : "/tmp");
+#endif
+}
+
+// Reads the size of a file and the time it was last modified, which together tell whether it has
+// changed since it was last read. Returns false if the file cannot be found.
+inline bool GetFileStamp(const std::wstring & path, long long & size, long long & modified)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_wstat64(path.c_str(), &info) != 0) return false;
+#else
+	struct stat info;
+	if (stat(NativePath(path).c_str(), &info) != 0) return false;
+#endif
+	size = (long long)info.st_size;
+	modified = (long long)info.st_mtime;
+	return true;
+}
@@ -0,0 +1,83 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * A cursor into a compiled chain. Generating from a chain needs two kinds of state: the chain    *
+ * itself, which is large and, once compiled, never changes; and the current state of the walk    *
+ * and the random number generator, which are tiny and change with every token. CompiledChain     *
+ * holds only the first kind, and all of its generation methods are const, so the second kind     *
+ * lives here. A cursor holds a shared pointer to its chain, so the chain stays alive for as long *
+ * as any cursor still walks it, however the rest of the program replaces or unloads it.          *
+ *                                                                                                *
+ * Because the cursor remembers the state it stopped in, a text can be generated a piece at a     *
+ * time (as a server streaming a long response would) and still be the same text that one call    *
+ * would give for the same seed: CompiledChain::Walk() returns the state it would continue from,  *
+ * even in the middle of a run of single-edge states.                                             *
+ **************************************************************************************************/
+
+#include "GeneratorCursor.h"
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      chain: The compiled chain to walk. It must not be NULL.                                   *
+ *      seed: The seed of the cursor's random number generator.                                   *
+ **************************************************************************************************/
+GeneratorCursor::GeneratorCursor(std::shared_ptr<const CompiledChain> chain, int seed)
+	: chain(std::move(chain)), rand(seed), state(CompiledChain::NO_STATE)
+{
+}
+
+/**************************************************************************************************
+ * Makes the next call to Generate() start from a random state.                                   *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void GeneratorCursor::Restart()
+{
+	state = CompiledChain::NO_STATE;
+}
+
+/**************************************************************************************************
+ * Moves the cursor to a state that continues a context, as CompiledChain::GenerateFrom() does.   *
+ *   Inputs:                                                                                      *
+ *      context: The text to continue. If it has no tokens, the cursor moves to a random state.   *
+ *      maxTokens: The most tokens to append after the context.                                   *
+ *      output: The string to which the context and the rest of the state's Prefix are appended.  *
+ *      generated: Receives the number of tokens appended after the context.                      *
+ *   return value: true on success, false if no Prefix in the chain begins with the context's     *
+ *                 last token (or the chain is empty), in which case neither output nor the       *
+ *                 cursor is changed.                                                             *
+ **************************************************************************************************/
+bool GeneratorCursor::Seek(const std::wstring & context, int maxTokens, std::wstring & output, int & generated)
+{
+	unsigned int found = chain->SeedFrom(context, maxTokens, rand, output, generated);
+	if (found == CompiledChain::NO_STATE) return false;
+	state = found;
+	return true;
+}
+
+/**************************************************************************************************
+ * Appends gibberish to output, continuing from the cursor's state, and moves the cursor to the   *
+ * state that the next token would come from. A cursor that has no state yet starts from a random *
+ * one, drawn just as CompiledChain::Generate() draws it, so a new cursor and a Random with the   *
+ * same seed give the same text.                                                                  *
+ *   Inputs:                                                                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      output: The string to which the gibberish is appended.                                    *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests.                                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void GeneratorCursor::Generate(int numGen, std::wstring & output, ProgressMonitor * monitor)
+{
+	if (chain->IsEmpty() || numGen <= 0) return;
+	if (state == CompiledChain::NO_STATE) state = (unsigned int)rand.nextInt((int)chain->NumStates());
+	state = chain->Walk(state, numGen, rand, output, monitor);
+}
+
+/**************************************************************************************************
+ * Returns the chain that the cursor walks.                                                       *
+ **************************************************************************************************/
+const CompiledChain & GeneratorCursor::Chain() const
+{
+	return *chain;
+}
@@ -0,0 +1,39 @@
+// The mutable half of generation: a position in a compiled chain and a random number generator of
+// its own. A CompiledChain never changes once it has been compiled, so it can be shared read-only
+// by any number of cursors on any number of threads, without locks and without copies; each
+// request (or each text being written a piece at a time) gets a cursor of its own.
+
+#pragma once
+
+#include "CompiledChain.h"
+#include "ProgressMonitor.h"
+#include "Random.h"
+#include <memory>
+#include <string>
+
+class GeneratorCursor
+{
+	std::shared_ptr<const CompiledChain> chain;
+	Random rand;
+	unsigned int state; // the state to continue from, or NO_STATE to start from a random one
+
+public:
+	// Constructor. The cursor's generator is seeded with seed, and it starts at a random state.
+	GeneratorCursor(std::shared_ptr<const CompiledChain> chain, int seed);
+
+	// Makes the next Generate() start from a random state, as a new text would.
+	void Restart();
+
+	// Appends context to output and moves to a state that continues it, appending the rest of that
+	// state's Prefix too, up to maxTokens tokens. Sets generated to the number of tokens appended
+	// after the context. Returns false, and changes nothing, if no Prefix in the chain begins with
+	// the context's last token.
+	bool Seek(const std::wstring & context, int maxTokens, std::wstring & output, int & generated);
+
+	// Appends numGen tokens of gibberish to output, continuing from where the cursor is. Generating
+	// a text in several pieces gives the same text as generating it at once.
+	void Generate(int numGen, std::wstring & output, ProgressMonitor * monitor = NULL);
+
+	// The chain that the cursor walks.
+	const CompiledChain & Chain() const;
+};
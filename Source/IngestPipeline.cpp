@@ -0,0 +1,301 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Reads a set of input files into a TokenSink. The old approach (open a file, read every token   *
+ * into the map, close it, move on to the next file) leaves the CPU idle while it waits for the   *
+ * disk and leaves the disk idle while the map is being updated. Here the work is split into      *
+ * three stages that run at the same time:                                                        *
+ *                                                                                                *
+ *   1. The reader thread reads each file in large chunks and moves straight on to the next file, *
+ *     staying up to readAheadChunks chunks ahead of the decoder. On a cold cache this keeps the  *
+ *     disk busy the entire time.                                                                 *
+ *   2. The decoder thread decodes the UTF-8 chunks and splits them into tokens.                  *
+ *   3. The calling thread inserts the tokens into the sink, one batch per chunk.                 *
+ *                                                                                                *
+ * The stages are connected by bounded single-producer/single-consumer lock-free queues, so a     *
+ * slow stage makes the faster ones wait rather than letting memory grow without limit. The       *
+ * tokens reach the sink in exactly the order they appear in the files, so the result is          *
+ * identical to calling StringChain::AddItems on each file in turn.                               *
+ *                                                                                                *
+ * Read-ahead uses an ordinary thread with blocking reads, which works on every platform the      *
+ * program runs on; asynchronous OS-level I/O would not change the overlap, only which thread     *
+ * waits for the disk.                                                                            *
+ **************************************************************************************************/
+
+#include "IngestPipeline.h"
+#include "Tokenizer.h"
+#include "Utf8Decoder.h"
+#include "Decompressor.h"
+#include "FilePath.h"
+#include <fstream>
+#include <thread>
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      tokenType: A string indicating whether words or characters are being used for the Markov  *
+ *                 chain. Allowed values: "words", "characters".                                  *
+ *      monitor: Optional. Receives the number of bytes consumed, and is polled for cancellation  *
+ *               requests.                                                                        *
+ *      options: Chunk size and queue lengths.                                                    *
+ **************************************************************************************************/
+IngestPipeline::IngestPipeline(const std::wstring & tokenType, ProgressMonitor * monitor,
+                               const Options & options)
+	: tokenType(tokenType), options(options), monitor(monitor) {}
+
+/**************************************************************************************************
+ * Reads every file into the sink. The reader and decoder stages run on their own threads for the *
+ * duration of the call; the sink is only ever touched by the calling thread. EndInput() is       *
+ * called on the sink after the last token of each file. If the monitor's cancellation flag is    *
+ * raised, every stage stops promptly and the sink is left partially built.                       *
+ *                                                                                                *
+ * Each stage abandons the queue it pushes to when it stops, whether it has pushed the end of the *
+ * input, been cancelled or been abandoned itself, so a stage waiting for its input can never     *
+ * wait for a stage that has already gone; the calling thread's Pop() returns false instead.      *
+ *   Inputs:                                                                                      *
+ *      filenames: Full paths of the UTF-8 text files to read, in order.                          *
+ *      sink: Receives the tokens of every file.                                                  *
+ *   return value: true if every file was read, false if the job was cancelled.                   *
+ **************************************************************************************************/
+bool IngestPipeline::Run(const std::vector<std::wstring> & filenames, TokenSink & sink)
+{
+	failedFiles.clear();
+	SpscQueue<ByteChunk> rawChunks(options.readAheadChunks);
+	SpscQueue<ByteChunk> chunks(options.queuedChunks);
+	SpscQueue<TokenBatch> batches(options.queuedBatches);
+
+	std::thread reader(&IngestPipeline::ReaderStage, this, std::cref(filenames), std::ref(rawChunks));
+	std::thread decompressor(&IngestPipeline::DecompressionStage, this, std::cref(filenames),
+	                         std::ref(rawChunks), std::ref(chunks));
+	std::thread decoder(&IngestPipeline::DecoderStage, this, std::ref(chunks), std::ref(batches));
+
+	// Insertion stage:
+	bool completed = false;
+	TokenBatch batch;
+	while (batches.Pop(batch))
+	{
+		if (monitor && monitor->IsCancelled()) break;
+		for (size_t i = 0; i < batch.tokens.size(); ++i) sink.AddToken(batch.tokens[i]);
+		if (batch.endOfFile) sink.EndInput();
+		if (batch.endOfInput)
+		{
+			completed = true;
+			break;
+		}
+	}
+
+	// Release the other stages if they are waiting on a queue, then wait for them to exit:
+	rawChunks.Abandon();
+	chunks.Abandon();
+	batches.Abandon();
+	reader.join();
+	decompressor.join();
+	decoder.join();
+	return completed;
+}
+
+/**************************************************************************************************
+ * The reader stage. Reads every file in chunks of options.chunkSize bytes and queues them for    *
+ * the decompression stage, then abandons the queue so that the decompression stage stops once it *
+ * has the last chunk, even if the job was cancelled before the end-of-input marker was queued.   *
+ * Files that cannot be opened are recorded in failedFiles and skipped.                           *
+ *   Inputs:                                                                                      *
+ *      filenames: Full paths of the files to read, in order.                                     *
+ *      rawChunks: The queue leading to the decompression stage.                                  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void IngestPipeline::ReaderStage(const std::vector<std::wstring> & filenames, 
+                                 SpscQueue<ByteChunk> & rawChunks)
+{
+	ReadFiles(filenames, rawChunks);
+	rawChunks.Abandon();
+}
+
+/**************************************************************************************************
+ * Reads the files for the reader stage, ending with the end-of-input marker unless the job is    *
+ * cancelled or the decompression stage abandons the queue.                                       *
+ *   Inputs:                                                                                      *
+ *      filenames: Full paths of the files to read, in order.                                     *
+ *      rawChunks: The queue leading to the decompression stage.                                  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void IngestPipeline::ReadFiles(const std::vector<std::wstring> & filenames, SpscQueue<ByteChunk> & rawChunks)
+{
+	for (size_t i = 0; i < filenames.size(); ++i)
+	{
+		if (monitor && monitor->IsCancelled()) return;
+		std::ifstream fid(NativePath(filenames[i]), std::ios::binary);
+		if (!fid.is_open())
+		{
+			AddFailedFile(filenames[i]);
+			continue;
+		}
+
+		bool startOfFile = true;
+		bool endOfFile = false;
+		while (!endOfFile)
+		{
+			if (monitor && monitor->IsCancelled()) return;
+			ByteChunk chunk;
+			chunk.fileIndex = i;
+			chunk.startOfFile = startOfFile;
+			chunk.bytes.resize(options.chunkSize);
+			fid.read(chunk.bytes.data(), chunk.bytes.size());
+			chunk.bytes.resize((size_t)fid.gcount());
+			endOfFile = chunk.endOfFile = !fid;
+			startOfFile = false;
+			if (!rawChunks.Push(std::move(chunk))) return;
+		}
+	}
+
+	ByteChunk last;
+	last.endOfInput = true;
+	rawChunks.Push(std::move(last));
+}
+
+/**************************************************************************************************
+ * The decompression stage. The format of each file is recognized from the first bytes of its     *
+ * first chunk. Chunks of plain files are passed straight through; chunks of compressed files are *
+ * decompressed and passed on in pieces of at most options.chunkSize bytes, so that the decoder's *
+ * work (and its memory) stays bounded no matter how well the data compresses. A compressed file  *
+ * that this build cannot decompress, or whose data turns out to be corrupt, is recorded in       *
+ * failedFiles. Its remaining chunks are dropped, but the end of the file is still passed on so   *
+ * that the sink sees a complete (if shortened) input. The number of bytes consumed is counted    *
+ * here, in terms of the bytes on disk, so that it matches the file sizes in the                  *
+ * ProgressMonitor's bytesTotal.                                                                  *
+ *   Inputs:                                                                                      *
+ *      filenames: Full paths of the files being read, for error reporting.                       *
+ *      rawChunks: The queue leading from the reader stage.                                       *
+ *      chunks: The queue leading to the decoder stage.                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void IngestPipeline::DecompressionStage(const std::vector<std::wstring> & filenames, 
+                                        SpscQueue<ByteChunk> & rawChunks, 
+                                        SpscQueue<ByteChunk> & chunks)
+{
+	Decompressor * decompressor = NULL;
+	bool skippingFile = false;
+	ByteChunk raw;
+
+	while (rawChunks.Pop(raw))
+	{
+		if (monitor && monitor->IsCancelled()) break;
+		if (monitor) monitor->AddBytes(raw.bytes.size());
+
+		if (raw.startOfFile)
+		{
+			delete decompressor;
+			decompressor = NULL;
+			skippingFile = false;
+			Decompressor::Format format = Decompressor::DetectFormat(raw.bytes.data(), raw.bytes.size());
+			if (format != Decompressor::PLAIN)
+			{
+				decompressor = Decompressor::Create(format);
+				if (decompressor == NULL)
+				{
+					AddFailedFile(filenames[raw.fileIndex]);
+					skippingFile = true;
+				}
+			}
+		}
+
+		// The end-of-input marker and chunks of plain files go straight through:
+		if (raw.endOfInput)
+		{
+			chunks.Push(std::move(raw));
+			break;
+		}
+		if (decompressor == NULL && !skippingFile)
+		{
+			if (!chunks.Push(std::move(raw))) break;
+			continue;
+		}
+
+		std::vector<char> inflated;
+		if (!skippingFile)
+		{
+			bool intact = decompressor->Decompress(raw.bytes.data(), raw.bytes.size(), inflated);
+			if (intact && raw.endOfFile) intact = decompressor->Finish();
+			if (!intact)
+			{
+				AddFailedFile(filenames[raw.fileIndex]);
+				skippingFile = true;
+			}
+		}
+
+		// Pass the decompressed bytes on in pieces no larger than chunkSize:
+		size_t offset = 0;
+		bool aborted = false;
+		do
+		{
+			size_t pieceSize = inflated.size() - offset;
+			if (pieceSize > options.chunkSize) pieceSize = options.chunkSize;
+			ByteChunk piece;
+			piece.fileIndex = raw.fileIndex;
+			piece.bytes.assign(inflated.begin() + offset, inflated.begin() + offset + pieceSize);
+			offset += pieceSize;
+			piece.endOfFile = raw.endOfFile && offset == inflated.size();
+			if (piece.bytes.empty() && !piece.endOfFile) break;
+			aborted = !chunks.Push(std::move(piece));
+		} while (offset < inflated.size() && !aborted);
+		if (aborted) break;
+	}
+
+	delete decompressor;
+	chunks.Abandon();
+}
+
+/**************************************************************************************************
+ * The decoder stage. Decodes each chunk of (decompressed) bytes and splits it into tokens. A new *
+ * decoder and tokenizer are started for every file, so that a multi-byte character or word can   *
+ * never run from the end of one file into the beginning of the next.                             *
+ *   Inputs:                                                                                      *
+ *      chunks: The queue leading from the reader stage.                                          *
+ *      batches: The queue leading to the insertion stage.                                        *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void IngestPipeline::DecoderStage(SpscQueue<ByteChunk> & chunks, SpscQueue<TokenBatch> & batches)
+{
+	Utf8Decoder decoder;
+	Tokenizer tokenizer(tokenType);
+	std::vector<wchar_t> text;
+	ByteChunk chunk;
+
+	while (chunks.Pop(chunk))
+	{
+		if (monitor && monitor->IsCancelled()) break;
+		TokenBatch batch;
+		batch.endOfFile = chunk.endOfFile;
+		batch.endOfInput = chunk.endOfInput;
+
+		text.resize(chunk.bytes.size() + 4);
+		const char * bytes = chunk.bytes.data();
+		size_t length = decoder.Decode(bytes, bytes + chunk.bytes.size(), text.data());
+		if (chunk.endOfFile) length += decoder.Finish(text.data() + length);
+		tokenizer.Tokenize(text.data(), text.data() + length, batch.tokens);
+		if (chunk.endOfFile) tokenizer.Finish(batch.tokens);
+
+		if (!batches.Push(std::move(batch)) || chunk.endOfInput) break;
+	}
+	batches.Abandon();
+}
+
+/**************************************************************************************************
+ * Records that a file could not be read. Called from both the reader and decompression stages.   *
+ *   Inputs:                                                                                      *
+ *      filename: The full path of the file.                                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void IngestPipeline::AddFailedFile(const std::wstring & filename)
+{
+	std::lock_guard<std::mutex> guard(failedFilesLock);
+	failedFiles.push_back(filename);
+}
+
+/**************************************************************************************************
+ * Returns the files that could not be opened or decompressed during the last Run().              *
+ **************************************************************************************************/
+const std::vector<std::wstring> & IngestPipeline::GetFailedFiles() const
+{
+	return failedFiles;
+}
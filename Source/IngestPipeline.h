@@ -0,0 +1,77 @@
+// Reads input files into a TokenSink (such as a StringChain) using four concurrent stages: a reader
+// thread that reads ahead through the files, a decompression thread that inflates .gz and .zst
+// files, a decoder thread that decodes UTF-8 and splits the text into tokens, and the calling
+// thread, which inserts the tokens into the sink. The stages are connected by bounded lock-free
+// queues, so disk reads, decompression, decoding and insertion all overlap.
+
+#pragma once
+
+#include "ProgressMonitor.h"
+#include "SpscQueue.h"
+#include "TokenSink.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+class IngestPipeline
+{
+public:
+	// Tuning parameters for the pipeline.
+	struct Options
+	{
+		size_t chunkSize;       // bytes per disk read
+		size_t readAheadChunks; // chunks that may be read ahead of the decompressor
+		size_t queuedChunks;    // decompressed chunks that may wait for the decoder
+		size_t queuedBatches;   // token batches that may wait for the inserter
+
+		Options() : chunkSize(1 << 20), readAheadChunks(16), queuedChunks(16), queuedBatches(16) {}
+	};
+
+private:
+	// A block of bytes read from one file (compressed or not, depending on the stage).
+	struct ByteChunk
+	{
+		std::vector<char> bytes;
+		size_t fileIndex = 0;     // which file the bytes came from
+		bool startOfFile = false; // the first chunk of its file
+		bool endOfFile = false;   // the last chunk of its file
+		bool endOfInput = false; // no more files follow
+	};
+
+	// The tokens decoded from one ByteChunk.
+	struct TokenBatch
+	{
+		std::vector<std::wstring> tokens;
+		bool endOfFile = false;
+		bool endOfInput = false;
+	};
+
+	const std::wstring tokenType;
+	const Options options;
+	ProgressMonitor * monitor;
+	std::vector<std::wstring> failedFiles;
+	std::mutex failedFilesLock;
+
+	// Records that a file could not be read. Called from the reader and decompression stages.
+	void AddFailedFile(const std::wstring & filename);
+
+	// The three pipeline stages that run on their own threads:
+	void ReaderStage(const std::vector<std::wstring> & filenames, SpscQueue<ByteChunk> & rawChunks);
+	void DecompressionStage(const std::vector<std::wstring> & filenames, 
+	                        SpscQueue<ByteChunk> & rawChunks, SpscQueue<ByteChunk> & chunks);
+	void DecoderStage(SpscQueue<ByteChunk> & chunks, SpscQueue<TokenBatch> & batches);
+
+	// Reads the files for the reader stage, which abandons its queue once this returns.
+	void ReadFiles(const std::vector<std::wstring> & filenames, SpscQueue<ByteChunk> & rawChunks);
+
+public:
+	// Constructor. tokenType is "words" or "characters". monitor may be NULL.
+	IngestPipeline(const std::wstring & tokenType, ProgressMonitor * monitor = NULL,
+	               const Options & options = Options());
+
+	// Reads every file into the sink. Returns false if the monitor cancelled the job.
+	bool Run(const std::vector<std::wstring> & filenames, TokenSink & sink);
+
+	// Files that could not be opened or decompressed during the last Run(). They are skipped.
+	const std::vector<std::wstring> & GetFailedFiles() const;
+};
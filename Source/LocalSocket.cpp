@@ -0,0 +1,250 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Unix domain stream sockets for the generation server. Only the handful of operations the       *
+ * server and its clients need are provided, and the differences between Winsock and POSIX        *
+ * sockets (the handle type, closesocket() versus close(), the need to call WSAStartup(), and     *
+ * suppressing SIGPIPE when a client disconnects mid-response) are confined to this file.         *
+ **************************************************************************************************/
+
+#include "LocalSocket.h"
+#include "FilePath.h"
+#include "Utf8Encoder.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#ifndef IO_REPARSE_TAG_AF_UNIX
+#define IO_REPARSE_TAG_AF_UNIX 0x80000023L
+#endif
+namespace
+{
+	const LocalSocket::Handle INVALID_HANDLE = (LocalSocket::Handle)INVALID_SOCKET;
+	const int SEND_FLAGS = 0;
+	const int SHUTDOWN_BOTH = SD_BOTH;
+	void CloseSocketHandle(LocalSocket::Handle handle) { closesocket((SOCKET)handle); }
+
+	// Winsock must be initialized once before any socket is created.
+	bool InitializeSockets()
+	{
+		static const bool initialized = [] {
+			WSADATA data;
+			return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}();
+		return initialized;
+	}
+
+	// Tells whether a path names a socket file, some other file, or nothing. Winsock's socket files
+	// are reparse points with a tag of their own.
+	enum PathKind { NOTHING, SOCKET_FILE, OTHER_FILE };
+	PathKind ExaminePath(const std::wstring & path)
+	{
+		WIN32_FIND_DATAW data;
+		HANDLE find = FindFirstFileW(path.c_str(), &data);
+		if (find == INVALID_HANDLE_VALUE)
+		{
+			DWORD error = GetLastError();
+			return (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) ? NOTHING : OTHER_FILE;
+		}
+		FindClose(find);
+		bool isSocket = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && 
+		                data.dwReserved0 == IO_REPARSE_TAG_AF_UNIX;
+		return isSocket ? SOCKET_FILE : OTHER_FILE;
+	}
+}
+#else
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+namespace
+{
+	const LocalSocket::Handle INVALID_HANDLE = -1;
+	const int SEND_FLAGS = MSG_NOSIGNAL; // report a closed connection as an error, not a signal
+	const int SHUTDOWN_BOTH = SHUT_RDWR;
+	void CloseSocketHandle(LocalSocket::Handle handle) { close(handle); }
+	bool InitializeSockets() { return true; }
+
+	// Tells whether a path names a socket file, some other file, or nothing. A symbolic link is
+	// another file, even if it leads to a socket.
+	enum PathKind { NOTHING, SOCKET_FILE, OTHER_FILE };
+	PathKind ExaminePath(const std::wstring & path)
+	{
+		struct stat info;
+		if (lstat(NativePath(path).c_str(), &info) != 0) return errno == ENOENT ? NOTHING : OTHER_FILE;
+		return S_ISSOCK(info.st_mode) ? SOCKET_FILE : OTHER_FILE;
+	}
+}
+#endif
+
+namespace
+{
+	// Fills in a socket address for path. Returns false if the path is too long.
+	bool MakeAddress(const std::wstring & path, sockaddr_un & address)
+	{
+		std::string narrowPath = EncodeUtf8(path);
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (narrowPath.size() >= sizeof(address.sun_path)) return false;
+		std::memcpy(address.sun_path, narrowPath.c_str(), narrowPath.size());
+		return true;
+	}
+}
+
+// Constructors, destructor and move operations.
+LocalSocket::LocalSocket() : handle(INVALID_HANDLE) {}
+LocalSocket::LocalSocket(Handle handle) : handle(handle) {}
+LocalSocket::~LocalSocket() { Close(); }
+LocalSocket::LocalSocket(LocalSocket && other) : handle(other.handle) { other.handle = INVALID_HANDLE; }
+LocalSocket & LocalSocket::operator=(LocalSocket && other)
+{
+	if (this != &other)
+	{
+		Close();
+		handle = other.handle;
+		other.handle = INVALID_HANDLE;
+	}
+	return *this;
+}
+
+/**************************************************************************************************
+ * Creates a socket that listens for connections at the given path. A socket file left behind by  *
+ * a server that did not shut down cleanly would make bind() fail, so it is deleted first, but    *
+ * only once a test connection to it has failed, which shows that no server is listening there.   *
+ * Any other file at the path is left alone, and so is the socket of a server that is still       *
+ * running: both make Listen() fail.                                                              *
+ *   Inputs:                                                                                      *
+ *      path: The file system path of the socket.                                                 *
+ *   return value: true if the socket is listening, false otherwise.                              *
+ **************************************************************************************************/
+bool LocalSocket::Listen(const std::wstring & path)
+{
+	Close();
+	sockaddr_un address;
+	if (!InitializeSockets() || !MakeAddress(path, address)) return false;
+	switch (ExaminePath(path))
+	{
+	case NOTHING:
+		break;
+	case SOCKET_FILE:
+	{
+		LocalSocket probe;
+		if (probe.Connect(path)) return false;
+		if (!RemoveFile(path)) return false;
+		break;
+	}
+	default:
+		return false;
+	}
+
+	handle = (Handle)socket(AF_UNIX, SOCK_STREAM, 0);
+	if (handle == INVALID_HANDLE) return false;
+	if (bind(handle, (const sockaddr *)&address, sizeof(address)) != 0 || listen(handle, SOMAXCONN) != 0)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+/**************************************************************************************************
+ * Waits for the next client to connect.                                                          *
+ *   return value: The connection to the client, or a closed socket if accepting failed or the    *
+ *                 listening socket was shut down.                                                *
+ **************************************************************************************************/
+LocalSocket LocalSocket::Accept()
+{
+	if (handle == INVALID_HANDLE) return LocalSocket();
+	Handle client = (Handle)accept(handle, NULL, NULL);
+	return LocalSocket(client);
+}
+
+/**************************************************************************************************
+ * Connects to a server.                                                                          *
+ *   Inputs:                                                                                      *
+ *      path: The file system path of the server's socket.                                        *
+ *   return value: true if connected, false otherwise.                                            *
+ **************************************************************************************************/
+bool LocalSocket::Connect(const std::wstring & path)
+{
+	Close();
+	sockaddr_un address;
+	if (!InitializeSockets() || !MakeAddress(path, address)) return false;
+	handle = (Handle)socket(AF_UNIX, SOCK_STREAM, 0);
+	if (handle == INVALID_HANDLE) return false;
+	if (connect(handle, (const sockaddr *)&address, sizeof(address)) != 0)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+/**************************************************************************************************
+ * Reads exactly length bytes, looping until they have all arrived.                               *
+ *   Inputs:                                                                                      *
+ *      buffer: Receives the bytes.                                                               *
+ *      length: The number of bytes to read.                                                      *
+ *   return value: false if the connection was closed or failed before length bytes arrived.      *
+ **************************************************************************************************/
+bool LocalSocket::ReadAll(void * buffer, size_t length)
+{
+	char * next = (char *)buffer;
+	while (length > 0)
+	{
+		int chunk = length > (1 << 30) ? (1 << 30) : (int)length;
+		int received = (int)recv(handle, next, chunk, 0);
+		if (received <= 0) return false;
+		next += received;
+		length -= received;
+	}
+	return true;
+}
+
+/**************************************************************************************************
+ * Writes exactly length bytes, looping until they have all been sent.                            *
+ *   Inputs:                                                                                      *
+ *      buffer: The bytes to send.                                                                *
+ *      length: The number of bytes to send.                                                      *
+ *   return value: false if the connection was closed or failed.                                  *
+ **************************************************************************************************/
+bool LocalSocket::WriteAll(const void * buffer, size_t length)
+{
+	const char * next = (const char *)buffer;
+	while (length > 0)
+	{
+		int chunk = length > (1 << 30) ? (1 << 30) : (int)length;
+		int sent = (int)send(handle, next, chunk, SEND_FLAGS);
+		if (sent <= 0) return false;
+		next += sent;
+		length -= sent;
+	}
+	return true;
+}
+
+/**************************************************************************************************
+ * Disables further reads and writes. Unlike Close(), this is safe to call while another thread   *
+ * is blocked on the socket, and wakes that thread up.                                            *
+ **************************************************************************************************/
+void LocalSocket::Shutdown()
+{
+	if (handle != INVALID_HANDLE) shutdown(handle, SHUTDOWN_BOTH);
+}
+
+/**************************************************************************************************
+ * Closes the socket, if it is open.                                                              *
+ **************************************************************************************************/
+void LocalSocket::Close()
+{
+	if (handle != INVALID_HANDLE) CloseSocketHandle(handle);
+	handle = INVALID_HANDLE;
+}
+
+// Returns true if the socket is open.
+bool LocalSocket::IsOpen() const
+{
+	return handle != INVALID_HANDLE;
+}
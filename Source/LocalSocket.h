@@ -0,0 +1,60 @@
+// A minimal wrapper around Unix domain (AF_UNIX) stream sockets, which connect processes on the
+// same machine through a path in the file system. Windows supports them from Windows 10 version
+// 1803 on (through Winsock and afunix.h); elsewhere they are the usual POSIX sockets.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class LocalSocket
+{
+public:
+#ifdef _WIN32
+	typedef unsigned long long Handle; // a SOCKET
+#else
+	typedef int Handle;                // a file descriptor
+#endif
+
+private:
+	Handle handle;
+
+	explicit LocalSocket(Handle handle);
+
+public:
+	// Constructor. The socket starts out closed.
+	LocalSocket();
+	// Destructor. Closes the socket.
+	~LocalSocket();
+	// Sockets can be moved but not copied.
+	LocalSocket(LocalSocket && other);
+	LocalSocket & operator=(LocalSocket && other);
+	LocalSocket(const LocalSocket &) = delete;
+	LocalSocket & operator=(const LocalSocket &) = delete;
+
+	// Creates a socket listening at path, replacing a stale socket file that no server is listening
+	// at. Returns false on failure, including when path is any other kind of file or a live socket.
+	bool Listen(const std::wstring & path);
+
+	// Waits for a client to connect to a listening socket. Returns a closed socket on failure, which
+	// includes Shutdown() being called on the listening socket from another thread.
+	LocalSocket Accept();
+
+	// Connects to a socket listening at path. Returns false on failure.
+	bool Connect(const std::wstring & path);
+
+	// Reads exactly length bytes. Returns false if the connection closed or failed first.
+	bool ReadAll(void * buffer, size_t length);
+
+	// Writes exactly length bytes. Returns false if the connection closed or failed.
+	bool WriteAll(const void * buffer, size_t length);
+
+	// Stops all reads and writes, waking any thread blocked in Accept() or ReadAll().
+	void Shutdown();
+
+	// Closes the socket.
+	void Close();
+
+	// Returns true if the socket is open.
+	bool IsOpen() const;
+};
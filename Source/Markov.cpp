@@ -10,6 +10,9 @@
  * starts the message loop. The GUI display is handled in the MarkovMainWindow class, and most of *
  * the under-the-hood work is performed by the StringChain class, which utilizes the Prefix,      *
  * Suffix, and Random classes.                                                                    *
+ *                                                                                                *
+ * When started with command-line arguments, the program runs a console command instead of        *
+ * showing its window (see ConsoleMain.cpp).                                                      *
  **************************************************************************************************/
 
 #ifndef UNICODE
@@ -20,10 +23,46 @@
 #endif
 
 #include "MarkovMainWindow.h"
+#include "ConsoleMain.h"
 #include <Windows.h>	 
+#include <shellapi.h>
+#include <cstdio>
+
+/**************************************************************************************************
+ * Runs a console command. Markov.exe is a GUI program, so it has no console of its own; it       *
+ * borrows the console of the command prompt that started it (or opens a new one) and points the *
+ * standard streams at it. UTF-8 output is requested so that generated text displays correctly.   *
+ *   Inputs:                                                                                      *
+ *      args: The command-line arguments, not including the program name.                         *
+ *   return value: The command's exit code.                                                       *
+ **************************************************************************************************/
+static int RunFromCommandLine(const std::vector<std::wstring> & args)
+{
+	if (!AttachConsole(ATTACH_PARENT_PROCESS)) AllocConsole();
+	FILE * stream;
+	freopen_s(&stream, "CONOUT$", "w", stdout);
+	freopen_s(&stream, "CONOUT$", "w", stderr);
+	SetConsoleOutputCP(CP_UTF8);
+	int exitCode = RunConsoleCommand(args);
+	fflush(stdout);
+	fflush(stderr);
+	FreeConsole();
+	return exitCode;
+}
 
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow)
 {
+	// Run a console command instead of the GUI if any arguments were given:
+	int argc;
+	LPWSTR * argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	if (argv && argc > 1)
+	{
+		std::vector<std::wstring> args(argv + 1, argv + argc);
+		LocalFree(argv);
+		return RunFromCommandLine(args);
+	}
+	if (argv) LocalFree(argv);
+
 	// create and show the main window:
 	MarkovMainWindow mainWin;
 	if (mainWin.Create(L"Markov Generator", WS_OVERLAPPEDWINDOW, 840, 535, CW_USEDEFAULT,CW_USEDEFAULT, 0))
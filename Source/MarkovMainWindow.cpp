@@ -6,23 +6,32 @@
  * gibberish, and a button for opening an advanced options dialog. The advanced options dialog    *
  * provides options for changing the order of the Markov chain, the number of tokens to generate  *
  * when the Generate button is pressed, and whether to use words or characters for the Markov     *
- * chain. The GUI is resizeable.                                                                  *
+ * chain. Each file has a weight, shown in the box below the list when the file is selected,      *
+ * which says how much it counts relative to the others. The GUI is resizeable.                   *
  **************************************************************************************************/
 
 #include "MarkovMainWindow.h"
 #include "COM_util.h"
+#include "DefaultModel.h"
 #include "StringChain.h"
 #include "resource.h"
 #include <string>
 #include <tchar.h>
 #include <locale>
 #include <codecvt>
+#include <fstream>
+#include <algorithm>
+#include <climits>
+#include <cwchar>
+#include <sstream>
 #include <Windows.h>
 #define MAX_ORDER 20
 #define MIN_ORDER 1
 #define MAX_GEN 9999
 #define MIN_GEN 1
 #define MAX_INPUT_SIZE 5
+#define MAX_WEIGHT 1000.0
+#define MAX_WEIGHT_SIZE 16
 
 /**************************************************************************************************
  * Message handler for the main window. A WM_CREATE message will prompt the program to create the *
@@ -31,7 +40,8 @@
  * message, and calls an approprate OnClick function. WM_PAINT and WM_SIZE are encountered        *
  * whenever the GUI background needs repainting or when the window has been resized,              *
  * respectively. All other types of messages are forwarded to the default Windows message         *
- * handler, DefWindowProc.                                                                        *
+ * handler, DefWindowProc. WM_TIMER and WM_WORKER_DONE messages report on the background job      *
+ * started by the Generate button.                                                                *
  *   Inputs:                                                                                      *
  *      uMsg: An unsigned integer indicating the type of message.                                 *
  *      wParam: A UINT_PTR pointing to additional info about the message (the exact contents      *
@@ -50,9 +60,17 @@ LRESULT MarkovMainWindow::HandleMessage(UINT uMsg, WPARAM wParam, LPARAM lParam)
 		GenerateGUI();
 		InitializeGeneratorFileList(); // puts a default item in the listbox
 		Resize();
+
+		// The worker finishes on its own thread; hand the result back to this one:
+		HWND hwnd = m_hwnd;
+		worker.SetCompletionCallback([hwnd](MarkovWorker::Status status) {
+			PostMessage(hwnd, WM_WORKER_DONE, (WPARAM)status, 0);
+		});
 		return 0;
 	}
 	case WM_CLOSE:
+		worker.Cancel();
+		worker.Wait();
 		DeleteObject(boldFont);
 		DestroyWindow(m_hwnd);
 		return 0;
@@ -65,13 +83,28 @@ LRESULT MarkovMainWindow::HandleMessage(UINT uMsg, WPARAM wParam, LPARAM lParam)
 	case WM_SIZE:
 		Resize();
 		return 0;
+	case WM_TIMER:
+		if (wParam == progressTimerID) UpdateProgress();
+		return 0;
+	case WM_WORKER_DONE:
+		OnWorkerDone((MarkovWorker::Status)wParam);
+		return 0;
 	case WM_COMMAND:
 	{
 		// Determine which control the user clicked and call its corresponding OnClick method:
 		HWND controlHandle = (HWND)lParam;
 		if (controlHandle == addAFileButton) return AddAFileButtonOnClick();
 		else if (controlHandle == removeFileButton)	return RemoveFileButtonOnClick();
-		else if (controlHandle == listBox) return 0;
+		else if (controlHandle == listBox)
+		{
+			if (HIWORD(wParam) == LBN_SELCHANGE) ShowSelectedWeight();
+			return 0;
+		}
+		else if (controlHandle == weightEdit)
+		{
+			if (HIWORD(wParam) == EN_KILLFOCUS) ApplyWeight();
+			return 0;
+		}
 		else if (controlHandle == generateButton) return GenerateButtonOnClick();
 		else if (controlHandle == advancedButton) return AdvancedButtonOnClick();
 		else return -1;
@@ -116,6 +149,18 @@ void MarkovMainWindow::Resize()
 			remove_button_width, //---------------------------------------------------------- width
 			button_height, //---------------------------------------------------------------- height
 			0);
+		SetWindowPos(weightLabel, HWND_TOP, 
+			standard_margin + add_button_width + standard_margin, //------------------------- x
+			3 * standard_margin + static_text_height + box_height + 4, //-------------------- y
+			weight_label_width, //----------------------------------------------------------- width
+			button_height - 4, //------------------------------------------------------------ height
+			0);
+		SetWindowPos(weightEdit, HWND_TOP, 
+			2 * standard_margin + add_button_width + weight_label_width, //------------------ x
+			3 * standard_margin + static_text_height + box_height, //------------------------ y
+			weight_edit_width, //------------------------------------------------------------ width
+			button_height, //---------------------------------------------------------------- height
+			0);
 		SetWindowPos(generateButton, HWND_TOP, 
 			2*standard_margin+listBox_width+editControl_width/2 - generate_button_width/2, // x 
 			3 * standard_margin + static_text_height + box_height, //------------------------ y
@@ -165,7 +210,8 @@ void MarkovMainWindow::OnPaint()
 
 /**************************************************************************************************
  * Removes the currently selected file from the listbox whenever the Remove File Button is        *
- * clicked. If no files are selected, nothing is removed.                                         *
+ * clicked. If no files are selected, nothing is removed. The other files' submodels stay in the  *
+ * worker, so generating from what is left does not read any file again.                          *
  *   return value: always 0.                                                                      *
  **************************************************************************************************/
 int MarkovMainWindow::RemoveFileButtonOnClick()
@@ -179,6 +225,7 @@ int MarkovMainWindow::RemoveFileButtonOnClick()
 		numFiles--;
 		// set the selection to the first item, for easy mass deleting
 		SendMessage(listBox, LB_SETCURSEL, 0, NULL); 
+		ShowSelectedWeight();
 	}
 	return 0;
 }
@@ -231,6 +278,7 @@ int MarkovMainWindow::AddAFileButtonOnClick()
 							fileList.back().index = newIndex;
 							SendMessage(listBox, LB_SETCURSEL, newIndex, NULL);
 							numFiles++;
+							ShowSelectedWeight();
 							return 0;
 						}
 					}
@@ -243,16 +291,31 @@ int MarkovMainWindow::AddAFileButtonOnClick()
 }
 
 /**************************************************************************************************
- * Generates gibberish from the selected files whenever the Generate Button is clicked. All the   *
- * files are read one at a time and then the giberish is generated from the entire Markov chain.  *
- * If a particular file cannot be opened, a MessageBox is displayed, asking the user whether to   *
- * ignore the file, try opening it again, or abort the execution. The generated gibberish is then *
- * displayed in the Edit Control on the right-hand side of the GUI. Note: all input is assumed to *
- * be UTF-8 encoded.                                                                              *
+ * Generates gibberish from the selected files whenever the Generate Button is clicked. Every     *
+ * file (but the built-in example) is first checked to make sure that it can be opened; if a      *
+ * particular file cannot be opened, a MessageBox is displayed, asking the user whether to ignore *
+ * the file, try opening it again, or abort the execution. The files are then read and the        *
+ * gibberish generated on a background thread (only files that the worker has not read before, or *
+ * that have changed since, are actually read; see MarkovWorker), so that the GUI remains         *
+ * responsive while large files are being read. While the job is running, the Generate button     *
+ * becomes a Cancel button, and the Edit Control on the right-hand side of the GUI shows how far  *
+ * the job has progressed. Once the job has finished, OnWorkerDone() displays the gibberish.      *
+ * Note: all input is assumed to be UTF-8 encoded.                                                *
  *   return value: always 0.                                                                      *
  **************************************************************************************************/
 int MarkovMainWindow::GenerateButtonOnClick()
 {
+	// A second click while a job is running cancels it:
+	if (jobInFlight)
+	{
+		cancelRequested = true;
+		worker.Cancel();
+		return 0;
+	}
+
+	// Take the weight being typed, in case the box still has the focus:
+	ApplyWeight();
+
 	if (numFiles < 1)
 	{
 		MessageBox(m_hwnd, L"You must specify at least 1 file.", NULL, MB_OK | MB_ICONEXCLAMATION);
@@ -261,13 +324,19 @@ int MarkovMainWindow::GenerateButtonOnClick()
 	else
 	{
 		std::wstring filename;
-		std::wstring output;
-		StringChain stringChain(mOptions.order);
+		std::vector<std::wstring> readableFiles;
+		std::vector<double> weights;
 
-		// Read in all selected files. 
+		// Make sure all selected files can be opened before starting. 
 		for (int i = 0; i < numFiles; ++i) 
 		{
 			filename = fileList.at(i).fullPath;
+			if (filename == DEFAULT_MODEL_NAME)
+			{
+				readableFiles.push_back(filename);
+				weights.push_back(fileList.at(i).weight);
+				continue;
+			}
 			std::wifstream fid(filename.c_str());
 
 			// If a file cannot be opened, ask the user what to do
@@ -279,7 +348,6 @@ int MarkovMainWindow::GenerateButtonOnClick()
 				switch (decision)
 				{
 				case IDABORT:
-					stringChain.deleteMap();
 					return 0;
 				case IDRETRY:
 					fid.open(filename.c_str());
@@ -290,25 +358,117 @@ int MarkovMainWindow::GenerateButtonOnClick()
 				break;
 			}
 
-			// If the file was successfully opened, process it
-			if(fid.is_open())
+			if (fid.is_open())
 			{
-				fid.imbue(std::locale(fid.getloc(), new std::codecvt_utf8_utf16<wchar_t>));
-				stringChain.AddItems(fid, mOptions.tokenType);
-				fid.close();
+				readableFiles.push_back(filename);
+				weights.push_back(fileList.at(i).weight);
 			}
 		}
+		if (std::find_if(weights.begin(), weights.end(), [](double w) { return w > 0; }) == weights.end())
+		{
+			MessageBox(m_hwnd, L"At least one file must have a weight above 0.", NULL, 
+			           MB_OK | MB_ICONEXCLAMATION);
+			return 0;
+		}
 
-		// Generate gibberish
-		output += stringChain.generate(mOptions.numGen, mOptions.order, mOptions.tokenType, rand);
-		stringChain.deleteMap();
-
-		// set the edit control's text to display the gibberish
-		SetWindowText(editControl, output.c_str());
+		// Read the files on the background thread. Generation starts when training finishes.
+		if (worker.StartTraining(readableFiles, weights, mOptions.order, mOptions.tokenType))
+		{
+			jobInFlight = true;
+			workerIsTraining = true;
+			cancelRequested = false;
+			SetWindowText(generateButton, L"Cancel");
+			SetTimer(m_hwnd, progressTimerID, 100, NULL);
+			UpdateProgress();
+		}
 		return 0;
 	}
 }
 
+/**************************************************************************************************
+ * Shows how far the background job has progressed in the Edit Control. Called periodically by a  *
+ * timer while a job is running.                                                                  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovMainWindow::UpdateProgress()
+{
+	const ProgressMonitor & progress = worker.GetProgress();
+	std::wstring status;
+	if (workerIsTraining)
+	{
+		status = L"Reading files... " + std::to_wstring(progress.bytesConsumed.load() / 1024);
+		status += L" of " + std::to_wstring(progress.bytesTotal.load() / 1024) + L" KB";
+	}
+	else
+	{
+		status = L"Generating... " + std::to_wstring(progress.tokensGenerated.load());
+		status += L" of " + std::to_wstring(mOptions.numGen) + L" tokens";
+	}
+	SetWindowText(editControl, status.c_str());
+}
+
+/**************************************************************************************************
+ * Called (via a WM_WORKER_DONE message) whenever the background job ends. When training has      *
+ * finished, any files that could not be read (such as compressed files that are corrupt, or in a *
+ * format this build cannot decompress) are listed, and generation is started; when generation    *
+ * has finished, the gibberish is displayed in the Edit Control. If the job was cancelled, a      *
+ * short note is displayed instead, and so is an error if there was nothing to generate from. The *
+ * job counts as in flight until this has run, so a click on Cancel after training has ended, but *
+ * before generation has started, still cancels it.                                               *
+ *   Inputs:                                                                                      *
+ *      status: The outcome of the job that just ended.                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovMainWindow::OnWorkerDone(MarkovWorker::Status status)
+{
+	if (status == MarkovWorker::CANCELLED || (cancelRequested && status == MarkovWorker::FINISHED))
+	{
+		EndBackgroundJob();
+		SetWindowText(editControl, L"Cancelled.");
+	}
+	else if (status == MarkovWorker::FAILED)
+	{
+		EndBackgroundJob();
+		SetWindowText(editControl, L"None of the selected files could be read, so there is nothing to "
+		                           L"generate from.");
+	}
+	else if (status == MarkovWorker::FINISHED && workerIsTraining)
+	{
+		// Compressed files can only be checked once they are read. Mention any that failed:
+		std::vector<std::wstring> failedFiles = worker.GetFailedFiles();
+		if (!failedFiles.empty())
+		{
+			std::wstring message = L"The following files could not be read, or were too large to compile, and "
+			                       L"were skipped:\r\n";
+			for (size_t i = 0; i < failedFiles.size(); ++i) message += failedFiles[i] + L"\r\n";
+			MessageBox(m_hwnd, message.c_str(), L"File Error", MB_OK | MB_ICONEXCLAMATION);
+		}
+
+		workerIsTraining = false;
+		if (!worker.StartGeneration(mOptions.numGen, Random(rand.nextInt(INT_MAX))))
+		{
+			EndBackgroundJob();
+			SetWindowText(editControl, L"Generation could not be started.");
+		}
+	}
+	else
+	{
+		EndBackgroundJob();
+		SetWindowText(editControl, worker.GetOutput().c_str());
+	}
+}
+
+/**************************************************************************************************
+ * Puts the GUI back into its idle state after a background job ends.                             *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovMainWindow::EndBackgroundJob()
+{
+	jobInFlight = false;
+	KillTimer(m_hwnd, progressTimerID);
+	SetWindowText(generateButton, L"Generate!");
+}
+
 /**************************************************************************************************
  * Displays the Advanced Options dialog box whenever the Advanced Button is clicked. The dialog   *
  * box features controls for setting the order of the Markov chain, how many words or characters  *
@@ -324,19 +484,82 @@ int MarkovMainWindow :: AdvancedButtonOnClick()
 	return 0;
 }
 
+/**************************************************************************************************
+ * Shows the weight of the selected file in the weight box. The box is disabled while no file is  *
+ * selected.                                                                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovMainWindow::ShowSelectedWeight()
+{
+	int selectedFileIndex = (int)SendMessage(listBox, LB_GETCURSEL, 0, 0);
+	if (selectedFileIndex == LB_ERR)
+	{
+		SetWindowText(weightEdit, L"");
+		EnableWindow(weightEdit, FALSE);
+		return;
+	}
+	std::wostringstream text;
+	text << fileList.at(selectedFileIndex).weight;
+	SetWindowText(weightEdit, text.str().c_str());
+	EnableWindow(weightEdit, TRUE);
+}
+
+/**************************************************************************************************
+ * Gives the selected file the weight typed into the weight box, and shows it in the listbox.     *
+ * Called when the box loses the focus. A weight must be a number from 0 to MAX_WEIGHT; anything  *
+ * else is discarded, and the file's weight is shown again. Changing a weight never requires a    *
+ * file to be read again: it only changes how the worker mixes the files' submodels.              *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovMainWindow::ApplyWeight()
+{
+	int selectedFileIndex = (int)SendMessage(listBox, LB_GETCURSEL, 0, 0);
+	if (selectedFileIndex == LB_ERR) return;
+
+	wchar_t buff[MAX_WEIGHT_SIZE];
+	GetWindowText(weightEdit, buff, MAX_WEIGHT_SIZE);
+	wchar_t * end;
+	double weight = std::wcstod(buff, &end);
+	FileRoster & file = fileList.at(selectedFileIndex);
+	if (end != buff && *end == L'\0' && weight >= 0 && weight <= MAX_WEIGHT && weight != file.weight)
+	{
+		file.weight = weight;
+		SendMessage(listBox, LB_DELETESTRING, selectedFileIndex, NULL);
+		SendMessage(listBox, LB_INSERTSTRING, selectedFileIndex, (LPARAM)ListBoxText(file).c_str());
+		SendMessage(listBox, LB_SETCURSEL, selectedFileIndex, NULL);
+	}
+	ShowSelectedWeight();
+}
+
+/**************************************************************************************************
+ * Returns the text that represents a file in the listbox: the file's name, followed by its       *
+ * weight if that is anything but 1.                                                              *
+ *   Inputs:                                                                                      *
+ *      file: The file.                                                                           *
+ *   return value: The text.                                                                      *
+ **************************************************************************************************/
+std::wstring MarkovMainWindow::ListBoxText(const FileRoster & file)
+{
+	if (file.weight == 1.0) return file.name;
+	std::wostringstream text;
+	text << file.name << L"  (weight " << file.weight << L")";
+	return text.str();
+}
+
 /**************************************************************************************************
  * Adds the example file to the file list and makes it the selected item. This function is called *
- * only once, immediately after the main window GUI is generated.                                 *
+ * only once, immediately after the main window GUI is generated. The example is built into the   *
+ * program (see DefaultModel.h), so its path is just its name, which MarkovWorker recognizes.     *
  *   return value: none                                                                           *
  **************************************************************************************************/
 void MarkovMainWindow::InitializeGeneratorFileList()
 {
-	fileList.push_back(MarkovMainWindow::FileRoster{ L"simple.txt", 
-		L"C:\\Root\\C++\\manual_workspace\\redoneHwAssignments\\6_markov\\simple.txt", -1 });
+	fileList.push_back(MarkovMainWindow::FileRoster{ DEFAULT_MODEL_NAME, DEFAULT_MODEL_NAME, -1 });
 	DWORD newIndex = SendMessage(listBox, LB_ADDSTRING, 0, (LPARAM)fileList.at(0).name.c_str());
 	fileList.at(0).index = newIndex;
 	numFiles++;
 	SendMessage(listBox, LB_SETCURSEL, newIndex, NULL);
+	ShowSelectedWeight();
 }
 
 /**************************************************************************************************
@@ -407,6 +630,27 @@ void MarkovMainWindow::GenerateGUI()
 		(HMENU)generateButtonID,
 		NULL,
 		NULL);
+	weightLabel = CreateWindowEx(
+		0L, 
+		TEXT("static"), 
+		TEXT("Weight:"), 
+		WS_CHILD | WS_VISIBLE, 
+		0, 0, 0, 0, 
+		m_hwnd, 
+		(HMENU)weightLabelID, 
+		NULL, 
+		NULL);
+	weightEdit = CreateWindowEx(
+		0L, 
+		TEXT("edit"), 
+		NULL,
+		WS_CHILD | WS_VISIBLE | ES_LEFT | ES_AUTOHSCROLL | WS_BORDER,
+		0, 0, 0, 0,
+		m_hwnd,
+		(HMENU)weightEditID, 
+		NULL,
+		NULL);
+	SendMessage(weightEdit, EM_SETLIMITTEXT, MAX_WEIGHT_SIZE - 1, 0);
 	advancedButton = CreateWindowEx(
 		0L, 
 		TEXT("button"),
@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include "BaseWindow.h"
 #include "Random.h"
+#include "MarkovWorker.h"
 #include <vector>
 #include <ShObjIdl.h>    // Needed for COM's openfile dialog
 
@@ -16,6 +17,7 @@ class MarkovMainWindow : public BaseWindow<MarkovMainWindow>
 		std::wstring name;     // simple name of the file
 		std::wstring fullPath; // absolute path of the file
 		int index = -1;        // an index to help identify a file to be deleted
+		double weight = 1.0;   // how much the file counts when generating, relative to the others
 
 		FileRoster(std::wstring newName, std::wstring newDirectoryPath, int newIndex)
 		{
@@ -46,6 +48,8 @@ class MarkovMainWindow : public BaseWindow<MarkovMainWindow>
 	HWND staticLabel;
 	HWND generateButton;
 	HWND advancedButton;
+	HWND weightLabel;
+	HWND weightEdit;
 	HFONT boldFont;
 
 	// Unique identifiers for each child window:
@@ -56,6 +60,13 @@ class MarkovMainWindow : public BaseWindow<MarkovMainWindow>
 	const int staticLabelID = 205;
 	const int generateButtonID = 206;
 	const int advancedButtonID = 207;
+	const int weightLabelID = 208;
+	const int weightEditID = 209;
+
+	// Posted by the background worker when a training or generation job ends:
+	static const UINT WM_WORKER_DONE = WM_APP + 1;
+	// Identifies the timer that refreshes the progress display while a job runs:
+	static const UINT_PTR progressTimerID = 301;
 
 	// Fixed sizes for various elements on the UI:
 	const int standard_margin = 15;
@@ -65,6 +76,8 @@ class MarkovMainWindow : public BaseWindow<MarkovMainWindow>
 	const int remove_button_width = 100;
 	const int generate_button_width = 80;
 	const int advanced_button_width = 70;
+	const int weight_label_width = 45;
+	const int weight_edit_width = 50;
 	const int listBox_width = 300;
 
 	// Variable sizes for various elements on the UI:
@@ -86,6 +99,16 @@ class MarkovMainWindow : public BaseWindow<MarkovMainWindow>
 	// A random number generator to be used throughout the application
 	Random rand;
 
+	// Trains and generates on a background thread so that the GUI stays responsive:
+	MarkovWorker worker;
+	// True from the start of a training job until the window has handled the end of the generation
+	// job that follows it. The worker is idle for a moment in between, so it cannot tell this:
+	bool jobInFlight = false;
+	// True while the worker is training, false while it is generating:
+	bool workerIsTraining = false;
+	// True once the user has clicked Cancel during the current job:
+	bool cancelRequested = false;
+
 	/*****************************************************************
 	 * Private functions related to the main window                  *
 	 *****************************************************************/
@@ -106,6 +129,18 @@ class MarkovMainWindow : public BaseWindow<MarkovMainWindow>
 	int GenerateButtonOnClick();
 	// Displays the Advanced Options dialog box whenever the Advanced Button is clicked.
 	int AdvancedButtonOnClick();
+	// Shows the weight of the selected file in the weight box.
+	void ShowSelectedWeight();
+	// Gives the selected file the weight typed into the weight box.
+	void ApplyWeight();
+	// The text that represents a file in the listbox: its name, and its weight if that is not 1.
+	static std::wstring ListBoxText(const FileRoster & file);
+	// Shows how far the background job has progressed in the Edit Control.
+	void UpdateProgress();
+	// Starts generation after training, or displays the result, when a background job ends.
+	void OnWorkerDone(MarkovWorker::Status status);
+	// Puts the GUI back into its idle state after a background job ends.
+	void EndBackgroundJob();
 
 	/*****************************************************************
 	 * Private functions related to the Advanced Options dialog box: *
@@ -127,7 +162,8 @@ public:
 
 	// Constructor
 	MarkovMainWindow() : addAFileButton(NULL), removeFileButton(NULL), editControl(NULL), 
-		listBox(NULL), staticLabel(NULL), generateButton(NULL), advancedButton(NULL) {} 
+		listBox(NULL), staticLabel(NULL), generateButton(NULL), advancedButton(NULL), weightLabel(NULL), 
+		weightEdit(NULL) {} 
 	// Sets the name of the Window Class.
 	PCWSTR ClassName() const; 
 	// Message handler for the main window.
@@ -0,0 +1,406 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * The generation server. Its threads are organized as follows:                                   *
+ *                                                                                                *
+ * The acceptor thread waits for clients to connect, and starts a connection thread for each one. *
+ *                                                                                                *
+ * A connection thread reads requests from its client one at a time. Each request is placed in    *
+ * the queue of the model it names, and the connection thread waits for the response and sends it *
+ * back before reading the next request. A client that wants several requests served at once can  *
+ * simply open several connections.                                                               *
+ *                                                                                                *
+ * The responses are generated by tasks on a ThreadPool (the engine's shared pool, unless the     *
+ * options name another), so that the server's generation shares the machine's cores with         *
+ * everything else the process does instead of adding threads of its own. When a request arrives, *
+ * a task is submitted for its model unless the model already has as many tasks as the pool has   *
+ * threads; each task takes a share of the model's queued requests (at most maxBatchSize) and     *
+ * serves the whole batch, and if more requests have arrived in the meantime, submits another     *
+ * task for the next batch. Batching keeps a thread on the same compiled chain (and so the same   *
+ * memory) for as long as there is demand for it; resubmitting rather than looping lets the tasks *
+ * of other models take their turn in between.                                                    *
+ *                                                                                                *
+ * A compiled chain is never modified after it is loaded, and each request is generated with a    *
+ * GeneratorCursor of its own, which holds everything that changes while generating. So the tasks *
+ * of one model need no lock to share its chain, and a single popular model can keep every core   *
+ * of the pool busy.                                                                              *
+ *                                                                                                *
+ * Reloading a model compiles its file into a new chain on the connection thread that asked for   *
+ * it, while the old chain goes on serving, and then publishes the new chain through the model's  *
+ * ModelHandle. Every request acquires the chain when its generation starts, so requests already  *
+ * being generated finish on the old chain and later ones get the new one; no request waits for   *
+ * the reload or fails because of it, and the old chain is freed once the last request using it   *
+ * is done.                                                                                       *
+ **************************************************************************************************/
+
+#include "MarkovServer.h"
+#include "ModelFile.h"
+#include "FilePath.h"
+#include "Utf8Encoder.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+/**************************************************************************************************
+ * Constructor. Nothing is started until Start().                                                 *
+ *   Inputs:                                                                                      *
+ *      options: Tuning parameters for the server.                                                *
+ **************************************************************************************************/
+MarkovServer::MarkovServer(const Options & options) 
+	: options(options), pool(options.pool ? *options.pool : ThreadPool::Shared()), batches(pool) {}
+
+/**************************************************************************************************
+ * Destructor. Stops the server if it is running.                                                 *
+ **************************************************************************************************/
+MarkovServer::~MarkovServer()
+{
+	Stop();
+}
+
+/**************************************************************************************************
+ * Loads a model file. The model is known to clients by its file name without the directory or    *
+ * extension, together with its order; so "C:\models\hamlet.mkv" trained with order 2 serves      *
+ * requests for model "hamlet" with order 2.                                                      *
+ *   Inputs:                                                                                      *
+ *      path: The model file to load.                                                             *
+ *      error: Receives a description of the problem if the model cannot be loaded.               *
+ *   return value: true if the model was loaded, false otherwise.                                 *
+ **************************************************************************************************/
+bool MarkovServer::LoadModel(const std::wstring & path, std::wstring & error)
+{
+	std::unique_ptr<Model> model(new Model);
+	size_t nameStart = path.find_last_of(L"/\\");
+	model->name = path.substr(nameStart == std::wstring::npos ? 0 : nameStart + 1);
+	model->name = model->name.substr(0, model->name.rfind(L'.'));
+	model->path = path;
+	std::shared_ptr<const CompiledChain> chain = LoadChain(path, model->order, error);
+	if (!chain) return false;
+	if (models.count(std::make_pair(model->name, model->order)))
+	{
+		error = L"A model named \"" + model->name + L"\" with order " + std::to_wstring(model->order) + 
+			L" is already loaded.";
+		return false;
+	}
+
+	model->chain.Publish(chain);
+	std::pair<std::wstring, int> key(model->name, model->order);
+	models[key] = std::move(model);
+	return true;
+}
+
+/**************************************************************************************************
+ * Loads a model file into a new chain.                                                           *
+ *   Inputs:                                                                                      *
+ *      path: The model file to load.                                                             *
+ *      order: Receives the order of the model.                                                   *
+ *      error: Receives a description of the problem if the model cannot be loaded.               *
+ *   return value: The chain, or NULL if the model could not be loaded.                           *
+ **************************************************************************************************/
+std::shared_ptr<const CompiledChain> MarkovServer::LoadChain(const std::wstring & path, int & order,
+                                                             std::wstring & error)
+{
+	ModelReader reader;
+	if (!reader.Open(path))
+	{
+		error = L"\"" + path + L"\" is not a model file.";
+		return NULL;
+	}
+	order = reader.Order();
+	std::shared_ptr<CompiledChain> chain(new CompiledChain);
+	if (!chain->Load(reader))
+	{
+		error = L"\"" + path + (reader.Truncated() ? L"\" is truncated." : L"\" is too large to compile.");
+		return NULL;
+	}
+	return chain;
+}
+
+/**************************************************************************************************
+ * Loads a model again from the file it was first loaded from, typically after the file has been  *
+ * replaced by a newly trained one, and publishes the new chain in place of the old. The file is  *
+ * read and compiled on the calling thread while the old chain goes on serving requests. The      *
+ * model map itself never changes once the server has started, so it is read without a lock.      *
+ *   Inputs:                                                                                      *
+ *      name: The name of the model.                                                              *
+ *      order: The order of the model. The file must still have this order.                       *
+ *      error: Receives a description of the problem if the model cannot be reloaded. The old     *
+ *             chain                                                                              *
+ *             is kept in that case.                                                              *
+ *   return value: true if the new chain was published, false otherwise.                          *
+ **************************************************************************************************/
+bool MarkovServer::ReloadModel(const std::wstring & name, int order, std::wstring & error)
+{
+	auto it = models.find(std::make_pair(name, order));
+	if (it == models.end())
+	{
+		error = L"No model named \"" + name + L"\" with order " + std::to_wstring(order) + L" is loaded.";
+		return false;
+	}
+	Model * model = it->second.get();
+	int newOrder;
+	std::shared_ptr<const CompiledChain> chain = LoadChain(model->path, newOrder, error);
+	if (!chain) return false;
+	if (newOrder != order)
+	{
+		error = L"\"" + model->path + L"\" now has order " + std::to_wstring(newOrder) + L".";
+		return false;
+	}
+	model->chain.Publish(chain);
+	return true;
+}
+
+/**************************************************************************************************
+ * Starts serving. The socket is created first, so that a failure to listen leaves no threads     *
+ * running.                                                                                       *
+ *   Inputs:                                                                                      *
+ *      socketPath: The file system path at which to listen.                                      *
+ *      error: Receives a description of the problem if the server cannot start.                  *
+ *   return value: true if the server is running, false otherwise.                                *
+ **************************************************************************************************/
+bool MarkovServer::Start(const std::wstring & socketPath, std::wstring & error)
+{
+	if (!listener.Listen(socketPath))
+	{
+		error = L"Could not listen at \"" + socketPath + L"\".";
+		return false;
+	}
+	this->socketPath = socketPath;
+	stopping = false;
+	acceptor = std::thread(&MarkovServer::AcceptLoop, this);
+	return true;
+}
+
+/**************************************************************************************************
+ * Stops the server: the listening socket is shut down so that the acceptor thread exits, every   *
+ * connection is shut down so that its thread exits, and finally the tasks finish whatever        *
+ * requests are still queued. Calling Stop() on a server that is not running does nothing.        *
+ **************************************************************************************************/
+void MarkovServer::Stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(queueLock);
+		stopping = true;
+	}
+	stopRequested.notify_all();
+
+	listener.Shutdown();
+	if (acceptor.joinable()) acceptor.join();
+	if (listener.IsOpen())
+	{
+		listener.Close();
+		RemoveFile(socketPath);
+	}
+
+	// The acceptor has exited, so nothing else adds to the list of connections now:
+	for (auto it = connections.begin(); it != connections.end(); ++it) it->socket.Shutdown();
+	for (auto it = connections.begin(); it != connections.end(); ++it)
+	{
+		if (it->thread.joinable()) it->thread.join();
+	}
+	connections.clear();
+
+	batches.Wait();
+}
+
+/**************************************************************************************************
+ * Blocks until Stop() is called from another thread.                                             *
+ **************************************************************************************************/
+void MarkovServer::Wait()
+{
+	std::unique_lock<std::mutex> lock(queueLock);
+	stopRequested.wait(lock, [this] { return stopping; });
+}
+
+/**************************************************************************************************
+ * Returns the names and orders of the loaded models.                                             *
+ **************************************************************************************************/
+std::vector<std::pair<std::wstring, int>> MarkovServer::GetModels() const
+{
+	std::vector<std::pair<std::wstring, int>> names;
+	for (auto it = models.begin(); it != models.end(); ++it) names.push_back(it->first);
+	return names;
+}
+
+/**************************************************************************************************
+ * The body of the acceptor thread. Accepts connections until the listening socket is shut down,  *
+ * starting a thread for each one.                                                                *
+ **************************************************************************************************/
+void MarkovServer::AcceptLoop()
+{
+	while (true)
+	{
+		LocalSocket client = listener.Accept();
+		{
+			std::lock_guard<std::mutex> guard(queueLock);
+			if (stopping) return;
+		}
+		if (!client.IsOpen())
+		{
+			// Probably out of file handles. Wait for some connections to close, then try again.
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			continue;
+		}
+
+		std::lock_guard<std::mutex> guard(connectionsLock);
+		ReapConnections();
+		connections.emplace_back();
+		Connection & connection = connections.back();
+		connection.socket = std::move(client);
+		connection.thread = std::thread(&MarkovServer::ServeConnection, this, &connection);
+	}
+}
+
+/**************************************************************************************************
+ * Joins and discards the threads of connections that have closed, so that a long-running server  *
+ * does not accumulate them. connectionsLock must be held.                                        *
+ **************************************************************************************************/
+void MarkovServer::ReapConnections()
+{
+	for (auto it = connections.begin(); it != connections.end();)
+	{
+		if (it->finished)
+		{
+			it->thread.join();
+			it = connections.erase(it);
+		}
+		else ++it;
+	}
+}
+
+/**************************************************************************************************
+ * The body of a connection thread. Reads requests, queues them, and sends back each response,    *
+ * until the client disconnects, sends something that is not a valid request, or the server       *
+ * stops.                                                                                         *
+ *   Inputs:                                                                                      *
+ *      connection: The connection to serve.                                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovServer::ServeConnection(Connection * connection)
+{
+	GenerationRequest request;
+	while (ServerProtocol::ReceiveRequest(connection->socket, request))
+	{
+		GenerationResponse response = Submit(request).get();
+		if (!ServerProtocol::SendResponse(connection->socket, response)) break;
+	}
+	connection->socket.Shutdown();
+
+	std::lock_guard<std::mutex> guard(connectionsLock);
+	connection->finished = true;
+}
+
+/**************************************************************************************************
+ * Queues a request, and submits a task to answer the model's requests unless the model already   *
+ * has one per thread of the pool. Requests that can be answered immediately (because they name   *
+ * an unknown model, are invalid, or arrive while the server is stopping) are answered without    *
+ * being queued, and so are requests to reload a model, which reload it on the calling thread.    *
+ *   Inputs:                                                                                      *
+ *      request: The request to queue.                                                            *
+ *   return value: A future that receives the response.                                           *
+ **************************************************************************************************/
+std::future<GenerationResponse> MarkovServer::Submit(const GenerationRequest & request)
+{
+	std::shared_ptr<PendingRequest> pending(new PendingRequest);
+	pending->request = request;
+	std::future<GenerationResponse> result = pending->response.get_future();
+	GenerationResponse immediate;
+
+	auto it = models.find(std::make_pair(request.modelName, request.order));
+	if (it == models.end())
+	{
+		immediate.status = GenerationResponse::UNKNOWN_MODEL;
+		immediate.text = EncodeUtf8(L"No model named \"" + request.modelName + L"\" with order " + 
+		                            std::to_wstring(request.order) + L" is loaded.");
+		pending->response.set_value(immediate);
+		return result;
+	}
+	if (request.reload)
+	{
+		std::wstring error;
+		if (!ReloadModel(request.modelName, request.order, error))
+		{
+			immediate.status = GenerationResponse::RELOAD_FAILED;
+			immediate.text = EncodeUtf8(error);
+		}
+		pending->response.set_value(immediate);
+		return result;
+	}
+	if (request.numGen < 0 || request.numGen > ServerProtocol::MAX_NUM_GEN)
+	{
+		immediate.status = GenerationResponse::BAD_REQUEST;
+		immediate.text = "numGen is out of range.";
+		pending->response.set_value(immediate);
+		return result;
+	}
+
+	Model * model = it->second.get();
+	std::unique_lock<std::mutex> lock(queueLock);
+	if (stopping)
+	{
+		lock.unlock();
+		immediate.status = GenerationResponse::SHUTTING_DOWN;
+		immediate.text = "The server is shutting down.";
+		pending->response.set_value(immediate);
+		return result;
+	}
+	model->queue.push_back(pending);
+	if (model->tasks < pool.NumThreads())
+	{
+		model->tasks++;
+		batches.Run([this, model]() { ServeBatch(model); });
+	}
+	return result;
+}
+
+/**************************************************************************************************
+ * The body of a task that answers a model's requests. Takes a batch of the model's queued        *
+ * requests, an equal share for each of the model's tasks but at most maxBatchSize, and generates *
+ * a response for each with a GeneratorCursor of its own, on the chain that is current when the   *
+ * request's turn comes. If more requests have been queued in the meantime, another task is       *
+ * submitted for them; otherwise the task ends, and the model waits for the next request to       *
+ * submit one. When the server stops, the tasks keep going until every queued request has been    *
+ * answered.                                                                                      *
+ *   Inputs:                                                                                      *
+ *      model: The model whose requests are answered.                                             *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovServer::ServeBatch(Model * model)
+{
+	std::vector<std::shared_ptr<PendingRequest>> batch;
+	std::unique_lock<std::mutex> lock(queueLock);
+	const size_t share = std::min((model->queue.size() + model->tasks - 1) / model->tasks, options.maxBatchSize);
+	while (!model->queue.empty() && batch.size() < share)
+	{
+		batch.push_back(model->queue.front());
+		model->queue.pop_front();
+		// Random() is seeded from the clock in seconds, which would give every request that
+		// arrives in the same second the same output, so unseeded requests draw seeds here:
+		if (batch.back()->request.seed < 0) batch.back()->request.seed = seeds.nextInt(INT_MAX);
+	}
+	lock.unlock();
+
+	std::wstring text; // reused for every request in the batch
+	for (size_t i = 0; i < batch.size(); ++i)
+	{
+		const GenerationRequest & request = batch[i]->request;
+		GeneratorCursor cursor(model->chain.Acquire(), (int)request.seed);
+		GenerationResponse response;
+		text.clear();
+		int generated = 0;
+		if (request.context.empty() || cursor.Seek(request.context, request.numGen, text, generated))
+		{
+			cursor.Generate(request.numGen - generated, text);
+		}
+		else
+		{
+			response.status = GenerationResponse::UNKNOWN_CONTEXT;
+			text = L"The model has never seen the last word of the context.";
+		}
+		response.text = EncodeUtf8(text);
+		batch[i]->response.set_value(response);
+	}
+
+	lock.lock();
+	if (!model->queue.empty()) batches.Run([this, model]() { ServeBatch(model); });
+	else model->tasks--;
+}
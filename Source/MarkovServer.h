@@ -0,0 +1,126 @@
+// A long-running generation server. Model files are loaded once, at startup, and clients then
+// request gibberish from them over a Unix domain socket (see ServerProtocol.h), avoiding the cost
+// of starting a process and loading a model for every request. A model can be reloaded from its
+// file while the server runs, without pausing or failing any request. Each connection is handled by its
+// own thread, which queues its requests; the queued requests are answered in batches by tasks on a
+// ThreadPool, as many at once for one model as the pool has threads.
+
+#pragma once
+
+#include "LocalSocket.h"
+#include "ServerProtocol.h"
+#include "CompiledChain.h"
+#include "GeneratorCursor.h"
+#include "ModelHandle.h"
+#include "ThreadPool.h"
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class MarkovServer
+{
+public:
+	// Tuning parameters for the server.
+	struct Options
+	{
+		ThreadPool * pool;   // the pool that runs generation, or NULL for the shared pool
+		size_t maxBatchSize; // requests a task takes from one model's queue at a time
+
+		Options() : pool(NULL), maxBatchSize(64) {}
+	};
+
+private:
+	// A request waiting to be answered, and the promise through which its response is delivered.
+	struct PendingRequest
+	{
+		GenerationRequest request;
+		std::promise<GenerationResponse> response;
+	};
+
+	// A loaded model and the requests queued for it. A chain is never changed once loaded, so the
+	// tasks answering its requests share it; tasks counts them. Reloading publishes a new chain.
+	struct Model
+	{
+		std::wstring name;
+		std::wstring path; // the file the model was loaded from
+		int order = 0;
+		ModelHandle chain;
+		std::deque<std::shared_ptr<PendingRequest>> queue;
+		size_t tasks = 0;
+	};
+
+	// A client connection and the thread serving it.
+	struct Connection
+	{
+		LocalSocket socket;
+		std::thread thread;
+		bool finished = false;
+	};
+
+	const Options options;
+	std::map<std::pair<std::wstring, int>, std::unique_ptr<Model>> models;
+
+	// Guards the queues and the stopping flag:
+	std::mutex queueLock;
+	std::condition_variable stopRequested;
+	bool stopping = false;
+	Random seeds; // seeds for requests that do not specify one
+
+	std::wstring socketPath;
+	LocalSocket listener;
+	std::thread acceptor;
+	ThreadPool & pool;
+	ThreadPool::TaskGroup batches; // the tasks that answer requests
+	std::mutex connectionsLock;
+	std::list<Connection> connections;
+
+	// The bodies of the server's threads.
+	void AcceptLoop();
+	void ServeConnection(Connection * connection);
+	// The body of a task that answers a batch of a model's requests.
+	void ServeBatch(Model * model);
+
+	// Queues a request and returns the future through which its response will arrive.
+	std::future<GenerationResponse> Submit(const GenerationRequest & request);
+	// Loads a model file into a new chain. Returns NULL and describes the problem in error on failure.
+	static std::shared_ptr<const CompiledChain> LoadChain(const std::wstring & path, int & order,
+	                                                      std::wstring & error);
+
+	// Joins and discards connection threads that have finished.
+	void ReapConnections();
+
+public:
+	// Constructor
+	MarkovServer(const Options & options = Options());
+
+	// Destructor. Stops the server if it is running.
+	~MarkovServer();
+
+	// Loads a model file. Must be called before Start(). Returns false and describes the problem in
+	// error if the file cannot be loaded.
+	bool LoadModel(const std::wstring & path, std::wstring & error);
+
+	// Loads the model named name with the given order again from its file, and publishes it once it
+	// has loaded. Requests that began before keep the chain they started with. May be called while
+	// the server is running. Returns false and describes the problem in error on failure.
+	bool ReloadModel(const std::wstring & name, int order, std::wstring & error);
+
+	// Starts listening at socketPath and starts accepting connections. Returns false on failure.
+	bool Start(const std::wstring & socketPath, std::wstring & error);
+
+	// Stops accepting connections, closes existing ones, and waits for every thread to exit.
+	void Stop();
+
+	// Blocks until the acceptor thread exits, which happens when Stop() is called.
+	void Wait();
+
+	// Returns the names (and orders) of the loaded models.
+	std::vector<std::pair<std::wstring, int>> GetModels() const;
+};
@@ -0,0 +1,382 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Runs training and generation jobs on a background thread. Only one job runs at a time: a       *
+ * training job selects the files to generate from, and any number of generation jobs may then be *
+ * run against them. Both kinds of job share a single ProgressMonitor, whose counters (bytes      *
+ * consumed while training, tokens produced while generating) can be polled from any thread, and  *
+ * whose cancellation flag is checked by the IngestPipeline as it reads, so even a job reading a  *
+ * very large file stops promptly when cancelled.                                                 *
+ *                                                                                                *
+ * Each file is trained into a chain of its own (a submodel), which is kept, along with the       *
+ * file's size and modification time, until the file changes or MAX_SUBMODELS more recently       *
+ * selected submodels have been made. A training job reads only the files that have no up-to-date *
+ * submodel, so once every file has been read, selecting a different set of files, or weighting   *
+ * them differently, takes no more than a lookup. Generation draws from a MixtureChain of the     *
+ * selected submodels, which with every weight 1 draws exactly as a single chain trained on all   *
+ * of the files would.                                                                            *
+ *                                                                                                *
+ * The example corpus is not a file at all: a file named DEFAULT_MODEL_NAME stands for the corpus *
+ * built into the program (see DefaultModel.h), whose chain is already compiled for the default   *
+ * order and token type. Selecting it with those settings reads and trains nothing; with others,  *
+ * it is trained from the built-in text, as a file would be.                                      *
+ *                                                                                                *
+ * When a job ends, the completion callback is invoked on the worker thread. A GUI should use it  *
+ * only to post a message to its own thread, and then collect the results with GetOutput() from   *
+ * there.                                                                                         *
+ **************************************************************************************************/
+
+#include "MarkovWorker.h"
+#include "BulkTrainer.h"
+#include "DefaultModel.h"
+#include "IngestPipeline.h"
+#include "FilePath.h"
+#include <algorithm>
+#include <sstream>
+
+namespace
+{
+	// Returns a chain of the example corpus: the built-in chain, attached to its arrays in place, if
+	// it has the given order and token type, or else one trained and compiled from the built-in text.
+	std::unique_ptr<CompiledChain> DefaultModelSubmodel(int order, const std::wstring & tokenType)
+	{
+		const CompiledChain::Image & image = DefaultModelImage();
+		if (image.order == order && tokenType == image.tokenType)
+		{
+			return std::unique_ptr<CompiledChain>(new CompiledChain(image));
+		}
+		StringChain chain(order);
+		std::wistringstream text(DefaultModelText());
+		chain.AddItems(text, tokenType);
+		std::unique_ptr<CompiledChain> compiled(new CompiledChain);
+		compiled->Compile(chain, order, tokenType);
+		return compiled;
+	}
+}
+
+/**************************************************************************************************
+ * Constructor. No thread is started until the first job.                                         *
+ **************************************************************************************************/
+MarkovWorker::MarkovWorker() : status(IDLE) {}
+
+/**************************************************************************************************
+ * Destructor. Cancels any running job, waits for the worker thread to exit, and frees the        *
+ * submodels.                                                                                     *
+ **************************************************************************************************/
+MarkovWorker::~MarkovWorker()
+{
+	Cancel();
+	Wait();
+}
+
+/**************************************************************************************************
+ * Sets the function to call whenever a job finishes, is cancelled, or fails.                     *
+ *   Inputs:                                                                                      *
+ *      callback: The function to call. It runs on the worker thread.                             *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovWorker::SetCompletionCallback(CompletionCallback callback)
+{
+	onComplete = callback;
+}
+
+/**************************************************************************************************
+ * Prepares to start a new job. Jobs must be started from a single controlling thread. The thread *
+ * of the previous job (which has already finished, or it would still be RUNNING) is joined, and  *
+ * the progress counters are reset.                                                               *
+ *   return value: false if a job is still running, true otherwise.                               *
+ **************************************************************************************************/
+bool MarkovWorker::BeginJob()
+{
+	if (status.load() == RUNNING) return false;
+	if (thread.joinable()) thread.join();
+	progress.Reset();
+	status = RUNNING;
+	return true;
+}
+
+/**************************************************************************************************
+ * Records the outcome of a job and notifies the completion callback. Called last by every job.   *
+ *   Inputs:                                                                                      *
+ *      outcome: FINISHED, CANCELLED, or FAILED.                                                  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovWorker::EndJob(Status outcome)
+{
+	status = outcome;
+	if (onComplete) onComplete(outcome);
+}
+
+/**************************************************************************************************
+ * Starts a training job on the worker thread. The job trains a submodel for every file that has  *
+ * no up-to-date one, and then selects the files' submodels for generation. The previous          *
+ * selection is kept until the new one is complete, so a cancelled training job leaves it usable  *
+ * (and keeps the submodels it finished).                                                         *
+ *   Inputs:                                                                                      *
+ *      filenames: Full paths of the UTF-8 text files to read.                                    *
+ *      weights: How much each file counts when generating, relative to the others. A file with   *
+ *               no weight counts 1.                                                              *
+ *      order: How many words or characters per Prefix.                                           *
+ *      tokenType: "words" or "characters".                                                       *
+ *   return value: false if a job is already running, true otherwise.                             *
+ **************************************************************************************************/
+bool MarkovWorker::StartTraining(const std::vector<std::wstring> & filenames, 
+                                 const std::vector<double> & weights, int order, std::wstring tokenType)
+{
+	if (!BeginJob()) return false;
+	thread = std::thread(&MarkovWorker::TrainingJob, this, filenames, weights, order, tokenType);
+	return true;
+}
+
+/**************************************************************************************************
+ * Starts generating gibberish from the selected submodels on the worker thread.                  *
+ *   Inputs:                                                                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: The pseudorandom number generator to use. The worker uses its own copy.             *
+ *   return value: false if a job is already running, true otherwise.                             *
+ **************************************************************************************************/
+bool MarkovWorker::StartGeneration(int numGen, Random rand)
+{
+	if (!BeginJob()) return false;
+	thread = std::thread(&MarkovWorker::GenerationJob, this, numGen, rand);
+	return true;
+}
+
+/**************************************************************************************************
+ * Returns the submodel trained on a file, provided the file has not changed since.               *
+ *   Inputs:                                                                                      *
+ *      filename: The file's full path.                                                           *
+ *      order, tokenType: The configuration the submodel must have been trained with.             *
+ *      size, modified: The file's current size and modification time.                            *
+ *   return value: The submodel, or NULL if there is no up-to-date one.                           *
+ **************************************************************************************************/
+MarkovWorker::Submodel * MarkovWorker::FindSubmodel(const std::wstring & filename, int order, 
+                                                    const std::wstring & tokenType, long long size, 
+                                                    long long modified)
+{
+	for (size_t i = 0; i < submodels.size(); ++i)
+	{
+		Submodel & submodel = submodels[i];
+		if (submodel.filename == filename && submodel.order == order && submodel.tokenType == tokenType &&
+			submodel.size == size && submodel.modified == modified) return &submodel;
+	}
+	return NULL;
+}
+
+/**************************************************************************************************
+ * Frees the submodels that can no longer be used, because a newer submodel of the same file has  *
+ * been selected, and then the least recently selected ones beyond MAX_SUBMODELS. The submodels   *
+ * of the current selection are always kept, however many there are, because the mixture refers   *
+ * to their chains; the cap only limits how many others are kept besides them. Called with        *
+ * resultLock held.                                                                               *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovWorker::EvictSubmodels()
+{
+	std::vector<Submodel> kept, unselected;
+	for (size_t i = 0; i < submodels.size(); ++i)
+	{
+		if (submodels[i].lastUsed == trainingJobs)
+		{
+			kept.push_back(std::move(submodels[i]));
+			continue;
+		}
+		bool superseded = false;
+		for (size_t j = 0; j < submodels.size(); ++j)
+		{
+			superseded |= submodels[j].lastUsed == trainingJobs && submodels[j].filename == submodels[i].filename &&
+			              submodels[j].order == submodels[i].order && submodels[j].tokenType == submodels[i].tokenType;
+		}
+		if (!superseded) unselected.push_back(std::move(submodels[i]));
+	}
+	std::stable_sort(unselected.begin(), unselected.end(), [](const Submodel & a, const Submodel & b) {
+		return a.lastUsed > b.lastUsed;
+	});
+	if (unselected.size() > MAX_SUBMODELS) unselected.resize(MAX_SUBMODELS);
+	for (size_t i = 0; i < unselected.size(); ++i) kept.push_back(std::move(unselected[i]));
+	submodels = std::move(kept);
+}
+
+/**************************************************************************************************
+ * The body of a training job. The files that have no up-to-date submodel are found first, and    *
+ * their total size is measured so that bytesConsumed can be displayed as a fraction of           *
+ * bytesTotal. Each of them is then read by an IngestPipeline, which overlaps disk reads and      *
+ * decoding with the BulkTrainer that collects its tokens, and the trainer's sorted records are   *
+ * compiled (see CompiledChain) into a new submodel. Files that cannot be read, or whose chains   *
+ * are too large to compile, are skipped and remembered. Finally the files' submodels are         *
+ * selected: if they are the submodels that are already selected, only their weights change;      *
+ * otherwise a new MixtureChain is built. The example corpus is neither measured nor read (see    *
+ * the top of this file).                                                                         *
+ **************************************************************************************************/
+void MarkovWorker::TrainingJob(std::vector<std::wstring> filenames, std::vector<double> weights, int order, 
+                               std::wstring tokenType)
+{
+	const size_t numFiles = filenames.size();
+	std::vector<long long> sizes(numFiles, -1), modified(numFiles, -1);
+	std::vector<size_t> unread;
+	long long totalSize = 0;
+	for (size_t i = 0; i < numFiles; ++i)
+	{
+		if (filenames[i] != DEFAULT_MODEL_NAME) GetFileStamp(filenames[i], sizes[i], modified[i]);
+		if (FindSubmodel(filenames[i], order, tokenType, sizes[i], modified[i]) == NULL)
+		{
+			unread.push_back(i);
+			if (sizes[i] > 0) totalSize += sizes[i];
+		}
+	}
+	progress.bytesTotal = totalSize;
+
+	std::vector<std::wstring> newFailedFiles;
+	for (size_t u = 0; u < unread.size(); ++u)
+	{
+		const size_t i = unread[u];
+		std::unique_ptr<CompiledChain> compiled;
+		if (filenames[i] == DEFAULT_MODEL_NAME) compiled = DefaultModelSubmodel(order, tokenType);
+		else
+		{
+			BulkTrainer trainer(order, tokenType);
+			IngestPipeline pipeline(tokenType, &progress);
+			if (!pipeline.Run(std::vector<std::wstring>(1, filenames[i]), trainer))
+			{
+				EndJob(CANCELLED);
+				return;
+			}
+			if (!pipeline.GetFailedFiles().empty())
+			{
+				newFailedFiles.push_back(filenames[i]);
+				continue;
+			}
+			compiled.reset(new CompiledChain);
+			if (!compiled->Compile(trainer))
+			{
+				newFailedFiles.push_back(filenames[i]);
+				continue;
+			}
+		}
+
+		Submodel submodel;
+		submodel.filename = filenames[i];
+		submodel.order = order;
+		submodel.tokenType = tokenType;
+		submodel.size = sizes[i];
+		submodel.modified = modified[i];
+		submodel.lastUsed = 0;
+		submodel.chain = std::move(compiled);
+		std::lock_guard<std::mutex> guard(resultLock);
+		submodels.push_back(std::move(submodel));
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(resultLock);
+		++trainingJobs;
+		std::vector<const CompiledChain *> selection;
+		std::vector<double> selectionWeights;
+		for (size_t i = 0; i < numFiles; ++i)
+		{
+			Submodel * submodel = FindSubmodel(filenames[i], order, tokenType, sizes[i], modified[i]);
+			if (submodel == NULL) continue;
+			submodel->lastUsed = trainingJobs;
+			selection.push_back(submodel->chain.get());
+			selectionWeights.push_back(i < weights.size() ? weights[i] : 1.0);
+		}
+
+		bool sameSubmodels = (selection.size() == mixture.NumSubmodels());
+		for (size_t i = 0; i < selection.size() && sameSubmodels; ++i)
+		{
+			sameSubmodels = (selection[i] == &mixture.Submodel(i));
+		}
+		if (sameSubmodels)
+		{
+			for (size_t i = 0; i < selection.size(); ++i) mixture.SetWeight(i, selectionWeights[i]);
+		}
+		else
+		{
+			mixture = MixtureChain();
+			for (size_t i = 0; i < selection.size(); ++i) mixture.Add(*selection[i], selectionWeights[i]);
+		}
+		EvictSubmodels();
+		failedFiles = newFailedFiles;
+	}
+	EndJob(FINISHED);
+}
+
+/**************************************************************************************************
+ * The body of a generation job. Fails if no files have been selected yet. A single file is       *
+ * generated from by its own chain, which is faster than a mixture of one.                        *
+ **************************************************************************************************/
+void MarkovWorker::GenerationJob(int numGen, Random rand)
+{
+	bool trained;
+	{
+		std::lock_guard<std::mutex> guard(resultLock);
+		trained = (mixture.NumSubmodels() > 0);
+		if (mixture.NumSubmodels() == 1 && mixture.Weight(0) > 0)
+		{
+			output = mixture.Submodel(0).Generate(numGen, rand, &progress);
+		}
+		else if (trained) output = mixture.Generate(numGen, rand, &progress);
+	}
+	if (!trained) EndJob(FAILED);
+	else EndJob(progress.IsCancelled() ? CANCELLED : FINISHED);
+}
+
+/**************************************************************************************************
+ * Asks the running job (if any) to stop as soon as possible. Returns immediately; use Wait() to  *
+ * block until the job has actually stopped.                                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovWorker::Cancel()
+{
+	progress.Cancel();
+}
+
+/**************************************************************************************************
+ * Blocks until the running job (if any) has stopped.                                             *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MarkovWorker::Wait()
+{
+	if (thread.joinable()) thread.join();
+}
+
+/**************************************************************************************************
+ * Returns true while a job is running.                                                           *
+ **************************************************************************************************/
+bool MarkovWorker::IsBusy() const
+{
+	return status.load() == RUNNING;
+}
+
+/**************************************************************************************************
+ * Returns the outcome of the most recent job (IDLE if none has been started).                    *
+ **************************************************************************************************/
+MarkovWorker::Status MarkovWorker::GetStatus() const
+{
+	return (Status)status.load();
+}
+
+/**************************************************************************************************
+ * Returns the live progress counters. Safe to read from any thread while a job is running.       *
+ **************************************************************************************************/
+const ProgressMonitor & MarkovWorker::GetProgress() const
+{
+	return progress;
+}
+
+/**************************************************************************************************
+ * Returns the gibberish produced by the most recent generation job.                              *
+ **************************************************************************************************/
+std::wstring MarkovWorker::GetOutput()
+{
+	std::lock_guard<std::mutex> guard(resultLock);
+	return output;
+}
+
+/**************************************************************************************************
+ * Returns the files that could not be read during the most recent training job.                  *
+ **************************************************************************************************/
+std::vector<std::wstring> MarkovWorker::GetFailedFiles()
+{
+	std::lock_guard<std::mutex> guard(resultLock);
+	return failedFiles;
+}
@@ -0,0 +1,113 @@
+// Runs Markov chain training and generation on a background thread, so that reading large files
+// does not freeze the caller (for example, the GUI's message loop). Progress can be polled through
+// GetProgress(), and a running job can be cancelled at any time. Every file is trained into a
+// submodel of its own, which is kept until the file changes, and generation draws from a weighted
+// mixture of the selected submodels, so changing the selection or the weights retrains nothing.
+
+#pragma once
+
+#include "CompiledChain.h"
+#include "MixtureChain.h"
+#include "ProgressMonitor.h"
+#include "Random.h"
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+
+class MarkovWorker
+{
+public:
+	// The outcome of the most recent job.
+	enum Status { IDLE, RUNNING, FINISHED, CANCELLED, FAILED };
+
+	// Called on the worker thread when a job ends. Must not call back into the MarkovWorker
+	// (post a message to the owning thread instead).
+	typedef std::function<void(Status)> CompletionCallback;
+
+private:
+	// A chain trained on a single file.
+	struct Submodel
+	{
+		std::wstring filename;
+		int order;
+		std::wstring tokenType;
+		long long size;              // the file's size and modification time when it was read
+		long long modified;
+		unsigned long long lastUsed; // the number of the last training job that selected it
+		std::unique_ptr<CompiledChain> chain;
+	};
+
+	// The most submodels kept besides those of the current selection, which are never freed. Beyond
+	// this, the least recently selected ones are freed.
+	static const size_t MAX_SUBMODELS = 32;
+
+	std::thread thread;
+	std::atomic<int> status;
+	ProgressMonitor progress;
+	CompletionCallback onComplete;
+
+	// Guards the results below, which are written by the worker thread:
+	std::mutex resultLock;
+	std::vector<Submodel> submodels;
+	MixtureChain mixture; // the submodels selected by the last training job, with their weights
+	unsigned long long trainingJobs = 0;
+	std::wstring output;
+	std::vector<std::wstring> failedFiles;
+
+	// Joins the previous job's thread and prepares to start another. Returns false if busy.
+	bool BeginJob();
+	// Records the outcome of a job and notifies the completion callback.
+	void EndJob(Status outcome);
+	// Returns the submodel trained on the current contents of a file, or NULL if there is none.
+	Submodel * FindSubmodel(const std::wstring & filename, int order, const std::wstring & tokenType,
+	                        long long size, long long modified);
+	// Frees the submodels that are out of date or have not been selected for the longest time.
+	void EvictSubmodels();
+	// The bodies of the two kinds of job, run on the worker thread.
+	void TrainingJob(std::vector<std::wstring> filenames, std::vector<double> weights, int order, 
+	                 std::wstring tokenType);
+	void GenerationJob(int numGen, Random rand);
+
+public:
+	// Constructor
+	MarkovWorker();
+	// Destructor. Cancels any running job and waits for it to stop.
+	~MarkovWorker();
+
+	// Sets the function to call whenever a job finishes, is cancelled, or fails.
+	void SetCompletionCallback(CompletionCallback callback);
+
+	// Trains a submodel for each of the given UTF-8 files that has none yet, and selects the files'
+	// submodels, with the given weights, for generation. Returns false if a job is running.
+	bool StartTraining(const std::vector<std::wstring> & filenames, const std::vector<double> & weights,
+	                   int order, std::wstring tokenType);
+
+	// Starts generating from the selected submodels. Returns false if a job is running.
+	bool StartGeneration(int numGen, Random rand);
+
+	// Asks the running job (if any) to stop as soon as possible.
+	void Cancel();
+
+	// Blocks until the running job (if any) has stopped.
+	void Wait();
+
+	// Returns true while a job is running.
+	bool IsBusy() const;
+
+	// The outcome of the most recent job.
+	Status GetStatus() const;
+
+	// Live progress counters for the running job.
+	const ProgressMonitor & GetProgress() const;
+
+	// The gibberish produced by the most recent generation job.
+	std::wstring GetOutput();
+
+	// Files that could not be opened, or were too large to compile, during the most recent training
+	// job.
+	std::vector<std::wstring> GetFailedFiles();
+};
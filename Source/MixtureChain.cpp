@@ -0,0 +1,354 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Generates gibberish from a weighted mixture of compiled chains. Training each input file into  *
+ * a chain of its own, and mixing the chains only when generating, means that changing which      *
+ * files are used (or how much each one counts) costs nothing: no chain is retrained or merged.   *
+ *                                                                                                *
+ * The submodels share no token IDs, so the mixture keeps a vocabulary of its own and a pair of   *
+ * translation tables per submodel. The current Prefix is kept under the mixture's IDs, and every *
+ * submodel keeps track of its state for that Prefix (NO_STATE if it never saw it). To draw a     *
+ * token, each submodel with a state is given a mass of its weight times its state's total count; *
+ * a submodel is chosen in proportion to its mass, and one of its edges by the usual binary       *
+ * search of the cumulative counts. The probability of a Suffix is then the weighted sum of its   *
+ * counts divided by the weighted sum of the totals, exactly as if the weighted counts had been   *
+ * merged.                                                                                        *
+ *                                                                                                *
+ * After each token, the chosen submodel follows its edge. The others follow the edge for the     *
+ * same token if they have it, and otherwise look the new Prefix up in their state index: a       *
+ * submodel that never saw the old Prefix, or never saw this token after it, may still have seen  *
+ * the new Prefix. When no submodel has seen the Prefix, the walk jumps to a random state, as     *
+ * CompiledChain::Generate() does.                                                                *
+ **************************************************************************************************/
+
+#include "MixtureChain.h"
+#include "TokenPolicy.h"
+#include "Tokenizer.h"
+#include <algorithm>
+
+/**************************************************************************************************
+ * Adds a submodel to the mixture. The submodel's tokens are added to the mixture's vocabulary,   *
+ * and the translation tables of every submodel are extended to cover the new tokens.             *
+ *   Inputs:                                                                                      *
+ *      chain: The submodel. It must outlive the mixture.                                         *
+ *      weight: How much the submodel's counts count, relative to the others'. A submodel with a  *
+ *              weight of 0 is ignored until it is given another weight.                          *
+ *   return value: true on success, false if the weight is negative or the chain's order or token *
+ *                 type differs from those of the submodels already added.                        *
+ **************************************************************************************************/
+bool MixtureChain::Add(const CompiledChain & chain, double weight)
+{
+	if (weight < 0) return false;
+	if (!components.empty() && (chain.Order() != order || chain.TokenType() != tokenType)) return false;
+	order = chain.Order();
+	tokenType = chain.TokenType();
+
+	Component component;
+	component.chain = &chain;
+	component.weight = weight;
+	const size_t numTokens = chain.image.numTokens;
+	component.toShared.resize(numTokens);
+	for (size_t t = 0; t < numTokens; ++t)
+	{
+		component.toShared[t] = vocabulary.Intern(chain.TokenString((unsigned int)t));
+	}
+	components.push_back(std::move(component));
+
+	for (size_t c = 0; c < components.size(); ++c)
+	{
+		components[c].fromShared.resize(vocabulary.Size(), CompiledChain::NO_STATE);
+	}
+	Component & added = components.back();
+	for (size_t t = 0; t < numTokens; ++t) added.fromShared[added.toShared[t]] = (unsigned int)t;
+	return true;
+}
+
+/**************************************************************************************************
+ * Changes the weight of a submodel. This is all it takes to change the mix.                      *
+ *   Inputs:                                                                                      *
+ *      index: The submodel, numbered in the order in which they were added.                      *
+ *      weight: The new weight, as for Add().                                                     *
+ *   return value: false if the weight is negative, true otherwise.                               *
+ **************************************************************************************************/
+bool MixtureChain::SetWeight(size_t index, double weight)
+{
+	if (weight < 0) return false;
+	components[index].weight = weight;
+	return true;
+}
+
+/**************************************************************************************************
+ * Generates a string of gibberish from the mixture, starting from a random state of a submodel   *
+ * chosen in proportion to its weight.                                                            *
+ *   Inputs:                                                                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests.                                                           *
+ *   return value: The gibberish, or "" if the mixture is empty.                                  *
+ **************************************************************************************************/
+std::wstring MixtureChain::Generate(int numGen, Random & rand, ProgressMonitor * monitor) const
+{
+	std::wstring output;
+	Generate(numGen, rand, output, monitor);
+	return output;
+}
+
+/**************************************************************************************************
+ * Appends a string of gibberish to output, as described above.                                   *
+ *   Inputs:                                                                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the gibberish is appended.                                    *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests. A cancelled generation leaves the output produced so far. *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MixtureChain::Generate(int numGen, Random & rand, std::wstring & output, 
+                            ProgressMonitor * monitor) const
+{
+	if (IsEmpty()) return;
+	std::vector<unsigned int> prefix(order), states(components.size()), scratch(order);
+	Restart(rand, prefix.data(), states.data(), scratch.data());
+	Walk(prefix.data(), states.data(), numGen, rand, output, monitor);
+}
+
+/**************************************************************************************************
+ * Generates gibberish that continues a given context. The context is tokenized the way training  *
+ * texts are, and the walk starts from the Prefix made of its last order tokens; a context        *
+ * shorter than that is padded with non-words, so it is continued the way the start of a text     *
+ * would be. The output begins with the context, followed by the walk.                            *
+ *   Inputs:                                                                                      *
+ *      context: The text to continue. If it has no tokens, this is the same as Generate().       *
+ *      numGen: The number of words or characters to be generated after the context.              *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the context and the gibberish are appended.                   *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests.                                                           *
+ *   return value: true on success, false if no submodel with a weight above 0 has the Prefix, in *
+ *                 which case output is left unchanged.                                           *
+ **************************************************************************************************/
+bool MixtureChain::GenerateFrom(const std::wstring & context, int numGen, Random & rand, 
+                                std::wstring & output, ProgressMonitor * monitor) const
+{
+	if (IsEmpty()) return false;
+	std::vector<std::wstring> tokens;
+	Tokenizer tokenizer(tokenType);
+	tokenizer.Tokenize(context.data(), context.data() + context.size(), tokens);
+	tokenizer.Finish(tokens);
+	if (tokens.empty())
+	{
+		Generate(numGen, rand, output, monitor);
+		return true;
+	}
+
+	std::vector<unsigned int> prefix(order, Vocabulary::NONWORD_ID);
+	const size_t used = std::min(tokens.size(), (size_t)order);
+	for (size_t i = 0; i < used; ++i)
+	{
+		if (!vocabulary.Find(tokens[tokens.size() - used + i], prefix[order - used + i])) return false;
+	}
+	std::vector<unsigned int> states(components.size()), scratch(order);
+	FindStates(prefix.data(), states.data(), scratch.data());
+	bool found = false;
+	for (size_t c = 0; c < components.size(); ++c)
+	{
+		found |= (states[c] != CompiledChain::NO_STATE && components[c].weight > 0);
+	}
+	if (!found) return false;
+
+	AppendTokens(tokenType, tokens, output);
+	Walk(prefix.data(), states.data(), numGen, rand, output, monitor);
+	return true;
+}
+
+/**************************************************************************************************
+ * Walks the mixture, appending the token of every edge taken to output, as described above.      *
+ *   Inputs:                                                                                      *
+ *      prefix: The current Prefix, as order mixture token IDs. Updated as the walk proceeds.     *
+ *      states: The state of every submodel for the Prefix. Updated as the walk proceeds.         *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the gibberish is appended.                                    *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests.                                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MixtureChain::Walk(unsigned int * prefix, unsigned int * states, int numGen, Random & rand, 
+                        std::wstring & output, ProgressMonitor * monitor) const
+{
+	const size_t numComponents = components.size();
+	std::vector<double> masses(numComponents);
+	std::vector<unsigned int> scratch(order);
+
+	int i = 0;
+	int nextReport = 0;
+	while (i < numGen)
+	{
+		// Report progress and honor cancellation requests every so often:
+		if (monitor && i >= nextReport)
+		{
+			monitor->SetTokensGenerated(i);
+			if (monitor->IsCancelled()) return;
+			nextReport = i + 256;
+		}
+
+		// Weigh each submodel by how often it saw the Prefix:
+		double total = 0;
+		size_t last = 0;
+		for (size_t c = 0; c < numComponents; ++c)
+		{
+			masses[c] = 0;
+			if (states[c] == CompiledChain::NO_STATE || components[c].weight <= 0) continue;
+			const CompiledChain & chain = *components[c].chain;
+			const unsigned long long stateTotal = chain.image.edges[chain.image.edgeOffsets[states[c] + 1] - 1].cumulativeCount;
+			masses[c] = components[c].weight * (double)stateTotal;
+			total += masses[c];
+			last = c;
+		}
+		if (total <= 0)
+		{
+			Restart(rand, prefix, states, scratch.data());
+			continue;
+		}
+
+		// Choose a submodel, and then one of its edges, by binary search for the first cumulative
+		// count that exceeds what is left of the draw:
+		double draw = rand.nextDouble() * total;
+		size_t chosen = 0;
+		while (chosen < last && draw >= masses[chosen]) draw -= masses[chosen++];
+		const Component & component = components[chosen];
+		const CompiledChain & chain = *component.chain;
+		unsigned int low = chain.image.edgeOffsets[states[chosen]], high = chain.image.edgeOffsets[states[chosen] + 1] - 1;
+		const unsigned long long countDraw = std::min((unsigned long long)(draw / component.weight), 
+		                                              chain.image.edges[high].cumulativeCount - 1);
+		while (low < high)
+		{
+			unsigned int middle = (low + high) / 2;
+			if (chain.image.edges[middle].cumulativeCount <= countDraw) low = middle + 1;
+			else high = middle;
+		}
+		const CompiledChain::Edge & edge = chain.image.edges[low];
+		const unsigned int * textOffsets = chain.image.tokenTextOffsets;
+		output.append(chain.image.tokenText + textOffsets[edge.token], 
+		              textOffsets[edge.token + 1] - textOffsets[edge.token]);
+		i++;
+
+		// Move to the next Prefix, in every submodel:
+		const unsigned int token = component.toShared[edge.token];
+		std::copy(prefix + 1, prefix + order, prefix);
+		prefix[order - 1] = token;
+		for (size_t c = 0; c < numComponents; ++c)
+		{
+			const Component & other = components[c];
+			if (c == chosen) states[c] = edge.target;
+			else if (other.weight > 0)
+			{
+				const unsigned int otherToken = other.fromShared[token];
+				unsigned long long count, stateTotal;
+				unsigned int target;
+				if (states[c] != CompiledChain::NO_STATE && otherToken != CompiledChain::NO_STATE &&
+					other.chain->FindEdge(states[c], otherToken, count, stateTotal, target)) states[c] = target;
+				else states[c] = FindState(other, prefix, scratch.data());
+			}
+		}
+	}
+
+	if (monitor) monitor->SetTokensGenerated(numGen);
+}
+
+/**************************************************************************************************
+ * Chooses a new place to continue from: a submodel, in proportion to its weight, and one of its  *
+ * states, uniformly. Every submodel is moved to that state's Prefix. The mixture must not be     *
+ * empty.                                                                                         *
+ *   Inputs:                                                                                      *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      prefix: Receives the chosen Prefix, as order mixture token IDs.                           *
+ *      states: Receives the state of every submodel for the Prefix.                              *
+ *      scratch: Room for order token IDs.                                                        *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MixtureChain::Restart(Random & rand, unsigned int * prefix, unsigned int * states, 
+                           unsigned int * scratch) const
+{
+	double total = 0;
+	size_t last = 0;
+	for (size_t c = 0; c < components.size(); ++c)
+	{
+		if (components[c].weight <= 0 || components[c].chain->IsEmpty()) continue;
+		total += components[c].weight;
+		last = c;
+	}
+	double draw = rand.nextDouble() * total;
+	size_t chosen = 0;
+	for (; chosen < last; ++chosen)
+	{
+		if (components[chosen].weight <= 0 || components[chosen].chain->IsEmpty()) continue;
+		if (draw < components[chosen].weight) break;
+		draw -= components[chosen].weight;
+	}
+
+	const Component & component = components[chosen];
+	const unsigned int state = (unsigned int)rand.nextInt((int)component.chain->NumStates());
+	const unsigned int * key = &component.chain->stateKeys[(size_t)state * order];
+	for (int i = 0; i < order; ++i) prefix[i] = component.toShared[key[i]];
+	FindStates(prefix, states, scratch);
+}
+
+/**************************************************************************************************
+ * Finds the state of every submodel whose Prefix is the given one. Submodels with a weight of 0  *
+ * are given NO_STATE.                                                                            *
+ *   Inputs:                                                                                      *
+ *      prefix: order mixture token IDs.                                                          *
+ *      states: Receives the state of every submodel.                                             *
+ *      scratch: Room for order token IDs.                                                        *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void MixtureChain::FindStates(const unsigned int * prefix, unsigned int * states, 
+                              unsigned int * scratch) const
+{
+	for (size_t c = 0; c < components.size(); ++c)
+	{
+		states[c] = components[c].weight > 0 ? FindState(components[c], prefix, scratch) : CompiledChain::NO_STATE;
+	}
+}
+
+/**************************************************************************************************
+ * Finds the state of one submodel whose Prefix is the given one, by translating the Prefix into  *
+ * the submodel's token IDs and looking it up in the submodel's state index.                      *
+ *   Inputs:                                                                                      *
+ *      component: The submodel.                                                                  *
+ *      prefix: order mixture token IDs.                                                          *
+ *      scratch: Room for order token IDs.                                                        *
+ *   return value: The state, or NO_STATE if the submodel never saw the Prefix.                   *
+ **************************************************************************************************/
+unsigned int MixtureChain::FindState(const Component & component, const unsigned int * prefix, 
+                                     unsigned int * scratch) const
+{
+	for (int i = 0; i < order; ++i)
+	{
+		scratch[i] = component.fromShared[prefix[i]];
+		if (scratch[i] == CompiledChain::NO_STATE) return CompiledChain::NO_STATE;
+	}
+	return component.chain->FindState(scratch);
+}
+
+/**************************************************************************************************
+ * Returns true if the mixture has nothing to generate from: no submodel with a weight above 0    *
+ * has any states.                                                                                *
+ **************************************************************************************************/
+bool MixtureChain::IsEmpty() const
+{
+	for (size_t c = 0; c < components.size(); ++c)
+	{
+		if (components[c].weight > 0 && !components[c].chain->IsEmpty()) return false;
+	}
+	return true;
+}
+
+// Accessors.
+int MixtureChain::Order() const { return order; }
+const std::wstring & MixtureChain::TokenType() const { return tokenType; }
+size_t MixtureChain::NumSubmodels() const { return components.size(); }
+const CompiledChain & MixtureChain::Submodel(size_t index) const { return *components[index].chain; }
+double MixtureChain::Weight(size_t index) const { return components[index].weight; }
@@ -0,0 +1,78 @@
+// Generates gibberish from a weighted mixture of several compiled chains (submodels), without
+// merging them into one. After each Prefix, every Suffix is drawn with probability proportional to
+// the sum, over the submodels, of the submodel's weight times the number of times the submodel saw
+// the pair. Each input text is trained from its own starting Prefix, so with every weight 1 the
+// mixture draws exactly as the chain trained on all of the submodels' texts would; a submodel can
+// therefore be added, dropped or reweighted without retraining anything.
+
+#pragma once
+
+#include "CompiledChain.h"
+#include "ProgressMonitor.h"
+#include "Random.h"
+#include "Vocabulary.h"
+#include <string>
+#include <vector>
+
+class MixtureChain
+{
+	// A submodel, and the tables that translate between its token IDs and the mixture's.
+	struct Component
+	{
+		const CompiledChain * chain;
+		double weight;
+		std::vector<unsigned int> toShared;   // the mixture's ID of each of the chain's tokens
+		std::vector<unsigned int> fromShared; // the chain's ID of each of the mixture's, or NO_STATE
+	};
+
+	int order = 0;
+	std::wstring tokenType;
+	std::vector<Component> components;
+	// Every token of every submodel, under the mixture's own IDs:
+	Vocabulary vocabulary;
+
+	// Returns the state of a submodel whose Prefix is the given order tokens (mixture IDs), or
+	// NO_STATE if there is none. scratch must hold order IDs.
+	unsigned int FindState(const Component & component, const unsigned int * prefix, 
+	                       unsigned int * scratch) const;
+	// Moves every submodel to the state of prefix.
+	void FindStates(const unsigned int * prefix, unsigned int * states, unsigned int * scratch) const;
+	// Picks a submodel in proportion to its weight and a random state within it, and moves every
+	// submodel to that state's Prefix.
+	void Restart(Random & rand, unsigned int * prefix, unsigned int * states, unsigned int * scratch) const;
+	// Generates numGen tokens from the states of prefix.
+	void Walk(unsigned int * prefix, unsigned int * states, int numGen, Random & rand, 
+	          std::wstring & output, ProgressMonitor * monitor) const;
+
+public:
+	// Adds a submodel. The chain is not copied, so it must outlive the mixture (and must not be
+	// changed while the mixture is in use). Returns false if the weight is negative or the chain's
+	// order or token type differs from the submodels added before it.
+	bool Add(const CompiledChain & chain, double weight);
+
+	// Changes the weight of the index'th submodel. Returns false if the weight is negative.
+	bool SetWeight(size_t index, double weight);
+
+	// Generates numGen tokens of gibberish, starting from a random state.
+	std::wstring Generate(int numGen, Random & rand, ProgressMonitor * monitor = NULL) const;
+
+	// Appends numGen tokens of gibberish to output.
+	void Generate(int numGen, Random & rand, std::wstring & output, ProgressMonitor * monitor = NULL) const;
+
+	// Appends context to output, followed by numGen tokens of gibberish that continue it from the
+	// Prefix made of its last order tokens (padded at the front with non-words if it is shorter). A
+	// context without tokens is the same as Generate(). Returns false (and appends nothing) if no
+	// submodel with a weight above 0 has that Prefix.
+	bool GenerateFrom(const std::wstring & context, int numGen, Random & rand, std::wstring & output, 
+	                  ProgressMonitor * monitor = NULL) const;
+
+	// Returns true if no submodel with a weight above 0 has anything to generate from.
+	bool IsEmpty() const;
+
+	// Accessors.
+	int Order() const;
+	const std::wstring & TokenType() const;
+	size_t NumSubmodels() const;
+	const CompiledChain & Submodel(size_t index) const;
+	double Weight(size_t index) const;
+};
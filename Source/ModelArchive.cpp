@@ -0,0 +1,533 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Packing and unpacking model archives. A model file spends order + 1 four-byte IDs and an       *
+ * eight-byte count on every record, which is what makes it quick to read but is mostly zeros:    *
+ * nearly all counts are small, and consecutive records usually share their whole Prefix and      *
+ * differ by a little in their Suffix. An archive stores only those differences, as               *
+ * variable-length integers, so most records take three or four bytes.                            *
+ *                                                                                                *
+ * The IDs are renumbered before packing, by how often each token occurs as a Suffix, most often  *
+ * first. Common tokens then have IDs below 128, which fit in a single byte wherever they appear  *
+ * as IDs of their own, and the Suffixes of a Prefix are close together, which keeps their        *
+ * differences small. The renumbering changes the records' sort order, so the translated records  *
+ * are sorted again with an ExternalSorter, which lets models larger than memory be packed. The   *
+ * non-word keeps ID 0, as the Vocabulary requires; an unpacked model therefore holds the same    *
+ * records as the packed one, with the same tokens and counts, but with its tokens numbered       *
+ * differently.                                                                                   *
+ *                                                                                                *
+ * Each block of records starts over from a record stored in full, so that blocks can be decoded  *
+ * independently. Unpacking reads a batch of blocks, decodes them in parallel on the shared       *
+ * thread pool and writes them out in order, one batch after another, so that memory use does not *
+ * grow with the model.                                                                           *
+ **************************************************************************************************/
+
+#include "ModelArchive.h"
+#include "ExternalSorter.h"
+#include "FilePath.h"
+#include "ModelFile.h"
+#include "ThreadPool.h"
+#include "Vocabulary.h"
+#include <algorithm>
+#include <cwchar>
+#include <fstream>
+#include <numeric>
+
+namespace
+{
+	const char MAGIC[4] = { 'M', 'K', 'V', 'A' };
+	const unsigned int FORMAT_VERSION = 1;
+	const size_t RECORDS_PER_BLOCK = 1 << 16;
+	const size_t FILE_BUFFER_SIZE = 1 << 20;
+	// Unpacking decodes this many blocks per thread at a time:
+	const size_t BLOCKS_PER_THREAD = 4;
+	// A block's position and record count:
+	const unsigned long long DIRECTORY_ENTRY_SIZE = sizeof(unsigned long long) + sizeof(unsigned int);
+
+	template <class T> void WriteValue(std::ostream & out, T value)
+	{
+		out.write((const char *)&value, sizeof(value));
+	}
+
+	template <class T> bool ReadValue(std::istream & in, T & value)
+	{
+		return (bool)in.read((char *)&value, sizeof(value));
+	}
+
+	// Appends value to out as a varint.
+	void PutVarint(std::string & out, unsigned long long value)
+	{
+		while (value >= 0x80)
+		{
+			out += (char)((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+		out += (char)value;
+	}
+
+	// Reads a varint at pos, moving pos past it. Returns false if it runs past end.
+	bool GetVarint(const unsigned char *& pos, const unsigned char * end, unsigned long long & value)
+	{
+		value = 0;
+		for (int shift = 0; pos < end && shift < 64; shift += 7)
+		{
+			const unsigned char byte = *pos++;
+			value |= (unsigned long long)(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+
+	// Converts text to UTF-16 code units, as a model file stores it.
+	std::vector<unsigned short> ToUtf16(const std::wstring & text)
+	{
+		std::vector<unsigned short> units;
+		for (size_t i = 0; i < text.size(); ++i)
+		{
+			unsigned long c = (unsigned long)text[i];
+			if (c > 0xFFFF)
+			{
+				c -= 0x10000;
+				units.push_back((unsigned short)(0xD800 + (c >> 10)));
+				units.push_back((unsigned short)(0xDC00 + (c & 0x3FF)));
+			}
+			else units.push_back((unsigned short)c);
+		}
+		return units;
+	}
+
+	// Converts UTF-16 code units back into text.
+	std::wstring FromUtf16(const std::vector<unsigned short> & units)
+	{
+		std::wstring text;
+		for (size_t i = 0; i < units.size(); ++i)
+		{
+#if WCHAR_MAX > 0xFFFF
+			// Recombine surrogate pairs into single characters:
+			if (units[i] >= 0xD800 && units[i] <= 0xDBFF && i + 1 < units.size() &&
+				units[i + 1] >= 0xDC00 && units[i + 1] <= 0xDFFF)
+			{
+				text += (wchar_t)(0x10000 + ((units[i] - 0xD800) << 10) + (units[i + 1] - 0xDC00));
+				++i;
+				continue;
+			}
+#endif
+			text += (wchar_t)units[i];
+		}
+		return text;
+	}
+
+	// Appends the vocabulary section of an archive to out.
+	void PutVocabulary(std::string & out, const std::wstring & tokenType, const std::vector<std::wstring> & tokens)
+	{
+		const std::vector<unsigned short> type = ToUtf16(tokenType);
+		PutVarint(out, type.size());
+		for (size_t i = 0; i < type.size(); ++i) PutVarint(out, type[i]);
+		PutVarint(out, tokens.size());
+
+		std::vector<std::pair<std::vector<unsigned short>, unsigned int>> sorted(tokens.size());
+		for (size_t id = 0; id < tokens.size(); ++id) sorted[id] = std::make_pair(ToUtf16(tokens[id]), (unsigned int)id);
+		std::sort(sorted.begin(), sorted.end());
+		std::vector<unsigned short> previous;
+		for (size_t i = 0; i < sorted.size(); ++i)
+		{
+			const std::vector<unsigned short> & units = sorted[i].first;
+			size_t shared = 0;
+			while (shared < units.size() && shared < previous.size() && units[shared] == previous[shared]) ++shared;
+			PutVarint(out, shared);
+			PutVarint(out, units.size() - shared);
+			for (size_t k = shared; k < units.size(); ++k) PutVarint(out, units[k]);
+			PutVarint(out, sorted[i].second);
+			previous = units;
+		}
+	}
+
+	// Reads a vocabulary section written by PutVocabulary(), giving the tokens in ID order. Returns
+	// false if the section is corrupt.
+	bool GetVocabulary(const std::string & section, std::wstring & tokenType, std::vector<std::wstring> & tokens)
+	{
+		const unsigned char * pos = (const unsigned char *)section.data();
+		const unsigned char * const end = pos + section.size();
+		unsigned long long length, unit, size;
+		std::vector<unsigned short> units;
+		if (!GetVarint(pos, end, length) || length > (unsigned long long)(end - pos)) return false;
+		for (unsigned long long k = 0; k < length; ++k)
+		{
+			if (!GetVarint(pos, end, unit) || unit > 0xFFFF) return false;
+			units.push_back((unsigned short)unit);
+		}
+		tokenType = FromUtf16(units);
+		if (!GetVarint(pos, end, size) || size > (unsigned long long)(end - pos)) return false;
+
+		tokens.assign((size_t)size, std::wstring());
+		std::vector<bool> seen((size_t)size, false);
+		units.clear();
+		for (unsigned long long i = 0; i < size; ++i)
+		{
+			unsigned long long shared, id;
+			if (!GetVarint(pos, end, shared) || shared > units.size()) return false;
+			if (!GetVarint(pos, end, length) || length > (unsigned long long)(end - pos)) return false;
+			units.resize((size_t)shared);
+			for (unsigned long long k = 0; k < length; ++k)
+			{
+				if (!GetVarint(pos, end, unit) || unit > 0xFFFF) return false;
+				units.push_back((unsigned short)unit);
+			}
+			if (!GetVarint(pos, end, id) || id >= size || seen[(size_t)id]) return false;
+			seen[(size_t)id] = true;
+			tokens[(size_t)id] = FromUtf16(units);
+		}
+		return pos == end;
+	}
+
+	// Encodes records into a block, each against the record before it.
+	class BlockEncoder
+	{
+		const int keyLength;
+		std::vector<unsigned int> previous;
+
+	public:
+		std::string bytes;
+		unsigned int numRecords = 0;
+
+		explicit BlockEncoder(int keyLength) : keyLength(keyLength), previous(keyLength) {}
+
+		void Add(const unsigned int * key, unsigned long long count)
+		{
+			int k = 0;
+			if (numRecords > 0)
+			{
+				// The keys are sorted and distinct, so the first ID that differs is the greater one:
+				while (key[k] == previous[k]) ++k;
+				PutVarint(bytes, k);
+				PutVarint(bytes, key[k] - previous[k] - 1);
+				++k;
+			}
+			for (; k < keyLength; ++k) PutVarint(bytes, key[k]);
+			PutVarint(bytes, count);
+			std::copy(key, key + keyLength, previous.begin());
+			numRecords++;
+		}
+
+		void Clear()
+		{
+			bytes.clear();
+			numRecords = 0;
+		}
+	};
+
+	// A block of an archive, read and decoded for unpacking.
+	struct Block
+	{
+		std::string bytes;
+		unsigned int numRecords = 0;
+		std::vector<unsigned int> keys; // keyLength IDs per record
+		std::vector<unsigned long long> counts;
+		bool corrupt = false;
+	};
+
+	// Decodes a block's bytes into its keys and counts, setting corrupt if they do not make sense.
+	void DecodeBlock(Block & block, int keyLength, unsigned long long vocabularySize)
+	{
+		const unsigned char * pos = (const unsigned char *)block.bytes.data();
+		const unsigned char * const end = pos + block.bytes.size();
+		block.keys.resize((size_t)block.numRecords * keyLength);
+		block.counts.resize(block.numRecords);
+		unsigned long long value;
+		for (unsigned int r = 0; r < block.numRecords; ++r)
+		{
+			unsigned int * key = block.keys.data() + (size_t)r * keyLength;
+			int k = 0;
+			if (r > 0)
+			{
+				const unsigned int * previous = key - keyLength;
+				if (!GetVarint(pos, end, value) || value >= (unsigned long long)keyLength) break;
+				k = (int)value;
+				std::copy(previous, previous + k, key);
+				if (!GetVarint(pos, end, value) || value >= vocabularySize - previous[k] - 1) break;
+				key[k] = previous[k] + (unsigned int)value + 1;
+				++k;
+			}
+			for (; k < keyLength; ++k)
+			{
+				if (!GetVarint(pos, end, value) || value >= vocabularySize) break;
+				key[k] = (unsigned int)value;
+			}
+			if (k < keyLength || !GetVarint(pos, end, block.counts[r]) || block.counts[r] == 0) break;
+			if (r + 1 == block.numRecords && pos == end) return;
+		}
+		block.corrupt = true;
+	}
+}
+
+/**************************************************************************************************
+ * Writes a model file as an archive. The model is read twice: once to count how often each token *
+ * occurs as a Suffix, which decides the new IDs, and once to translate its records into them.    *
+ *   Inputs:                                                                                      *
+ *      modelPath: The model file to pack. Its delta segments, if any, are folded into the        *
+ *                 archive.                                                                       *
+ *      archivePath: The archive to create. An existing file is overwritten.                      *
+ *      tempDirectory: Where the sorter may create its temporary files.                           *
+ *      memoryBudget: Roughly how many bytes the sorter's buffer may use.                         *
+ *      error: Receives a description of the problem if packing fails.                            *
+ *   return value: true if the archive was written, false otherwise.                              *
+ **************************************************************************************************/
+bool PackModel(const std::wstring & modelPath, const std::wstring & archivePath,
+               const std::wstring & tempDirectory, size_t memoryBudget, std::wstring & error)
+{
+	ModelReader counting;
+	if (!counting.Open(modelPath))
+	{
+		error = L"\"" + modelPath + L"\" is not a model file.";
+		return false;
+	}
+	const int order = counting.Order();
+	const size_t vocabularySize = counting.GetVocabulary().Size();
+
+	std::vector<unsigned long long> occurrences(vocabularySize, 0);
+	std::vector<unsigned int> key(order + 1);
+	unsigned long long count;
+	while (counting.Next(key.data(), count))
+	{
+		for (int k = 0; k <= order; ++k)
+		{
+			if (key[k] >= vocabularySize)
+			{
+				error = L"\"" + modelPath + L"\" is corrupt.";
+				return false;
+			}
+		}
+		occurrences[key[order]] += count;
+	}
+	if (counting.Truncated())
+	{
+		error = L"\"" + modelPath + L"\" is truncated.";
+		return false;
+	}
+
+	// Number the tokens by descending number of occurrences, leaving the non-word at 0:
+	std::vector<unsigned int> ranked(vocabularySize);
+	std::iota(ranked.begin(), ranked.end(), 0u);
+	std::stable_sort(ranked.begin() + 1, ranked.end(), [&occurrences](unsigned int a, unsigned int b) {
+		return occurrences[a] > occurrences[b];
+	});
+	std::vector<unsigned int> translation(vocabularySize);
+	std::vector<std::wstring> tokens(vocabularySize);
+	for (size_t id = 0; id < vocabularySize; ++id)
+	{
+		translation[ranked[id]] = (unsigned int)id;
+		tokens[id] = counting.GetVocabulary().Token(ranked[id]);
+	}
+
+	ModelReader model;
+	if (!model.Open(modelPath))
+	{
+		error = L"\"" + modelPath + L"\" is not a model file.";
+		return false;
+	}
+	ExternalSorter sorter(order + 1, tempDirectory, memoryBudget);
+	while (model.Next(key.data(), count))
+	{
+		for (int k = 0; k <= order; ++k) key[k] = translation[key[k]];
+		sorter.Add(key.data(), count);
+	}
+
+	std::vector<char> fileBuffer(FILE_BUFFER_SIZE);
+	std::ofstream file;
+	file.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+	file.open(NativePath(archivePath), std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		error = L"Could not create \"" + archivePath + L"\".";
+		return false;
+	}
+
+	// The header is written again at the end, once the counts and the directory are known:
+	std::string section;
+	PutVocabulary(section, model.TokenType(), tokens);
+	unsigned long long recordCount = 0, directoryPosition = 0;
+	std::vector<unsigned long long> blockPositions;
+	std::vector<unsigned int> blockRecords;
+	auto writeHeader = [&]() {
+		file.write(MAGIC, sizeof(MAGIC));
+		WriteValue(file, FORMAT_VERSION);
+		WriteValue(file, (unsigned int)order);
+		WriteValue(file, recordCount);
+		WriteValue(file, (unsigned int)blockPositions.size());
+		WriteValue(file, directoryPosition);
+		WriteValue(file, (unsigned long long)section.size());
+	};
+	writeHeader();
+	file.write(section.data(), section.size());
+
+	BlockEncoder block(order + 1);
+	auto writeBlock = [&]() {
+		blockPositions.push_back((unsigned long long)file.tellp());
+		blockRecords.push_back(block.numRecords);
+		file.write(block.bytes.data(), block.bytes.size());
+		block.Clear();
+	};
+	bool sorted = sorter.Finish([&](const unsigned int * key, unsigned long long count) {
+		block.Add(key, count);
+		recordCount++;
+		if (block.numRecords == RECORDS_PER_BLOCK) writeBlock();
+	});
+	if (block.numRecords > 0) writeBlock();
+
+	directoryPosition = (unsigned long long)file.tellp();
+	for (size_t i = 0; i < blockPositions.size(); ++i)
+	{
+		WriteValue(file, blockPositions[i]);
+		WriteValue(file, blockRecords[i]);
+	}
+	file.seekp(0);
+	writeHeader();
+	bool written = (bool)file;
+	file.close();
+
+	if (!sorted || !written || model.Truncated())
+	{
+		RemoveFile(archivePath);
+		if (model.Truncated()) error = L"\"" + modelPath + L"\" is truncated.";
+		else error = L"Could not write \"" + archivePath + L"\" or a temporary file.";
+		return false;
+	}
+	return true;
+}
+
+/**************************************************************************************************
+ * Writes an archive as a model file. Blocks are decoded a batch at a time, each batch in         *
+ * parallel, and checked as they are: an archive that is corrupt or truncated leaves no model     *
+ * file behind.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      archivePath: The archive written by PackModel().                                          *
+ *      modelPath: The model file to create. An existing file is overwritten.                     *
+ *      error: Receives a description of the problem if unpacking fails.                          *
+ *   return value: true if the model file was written, false otherwise.                           *
+ **************************************************************************************************/
+bool UnpackModel(const std::wstring & archivePath, const std::wstring & modelPath, std::wstring & error)
+{
+	std::vector<char> fileBuffer(FILE_BUFFER_SIZE);
+	std::ifstream file;
+	file.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+	file.open(NativePath(archivePath), std::ios::binary);
+	if (!file.is_open())
+	{
+		error = L"Could not open \"" + archivePath + L"\".";
+		return false;
+	}
+
+	char magic[sizeof(MAGIC)];
+	unsigned int version, order, blockCount;
+	unsigned long long recordCount, directoryPosition, sectionSize;
+	if (!file.read(magic, sizeof(magic)) || std::char_traits<char>::compare(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		!ReadValue(file, version) || version < 1 || version > FORMAT_VERSION)
+	{
+		error = L"\"" + archivePath + L"\" is not a model archive.";
+		return false;
+	}
+	const std::wstring corrupt = L"\"" + archivePath + L"\" is corrupt or truncated.";
+	if (!ReadValue(file, order) || !ReadValue(file, recordCount) || !ReadValue(file, blockCount) ||
+		!ReadValue(file, directoryPosition) || !ReadValue(file, sectionSize) || order < 1 || order > 64)
+	{
+		error = corrupt;
+		return false;
+	}
+	const std::streamoff sectionPosition = file.tellg();
+	std::vector<unsigned long long> blockPositions(blockCount);
+	std::vector<unsigned int> blockRecords(blockCount);
+	file.seekg(0, std::ios::end);
+	const unsigned long long fileSize = (unsigned long long)(std::streamoff)file.tellg();
+	if (sectionSize > fileSize || directoryPosition > fileSize ||
+		directoryPosition + (unsigned long long)blockCount * DIRECTORY_ENTRY_SIZE != fileSize)
+	{
+		error = corrupt;
+		return false;
+	}
+	file.seekg(directoryPosition);
+	unsigned long long recordsInBlocks = 0;
+	for (unsigned int i = 0; i < blockCount; ++i)
+	{
+		if (!ReadValue(file, blockPositions[i]) || !ReadValue(file, blockRecords[i]) || blockRecords[i] == 0 ||
+			blockPositions[i] < (unsigned long long)sectionPosition + sectionSize ||
+			(i > 0 && blockPositions[i] <= blockPositions[i - 1]) || blockPositions[i] >= directoryPosition)
+		{
+			error = corrupt;
+			return false;
+		}
+		recordsInBlocks += blockRecords[i];
+	}
+
+	std::string section((size_t)sectionSize, '\0');
+	std::wstring tokenType;
+	std::vector<std::wstring> tokens;
+	file.seekg(sectionPosition);
+	if (recordsInBlocks != recordCount || !file.read(&section[0], section.size()) ||
+		!GetVocabulary(section, tokenType, tokens) || tokens.empty() || tokens[0] != Vocabulary().Token(0))
+	{
+		error = corrupt;
+		return false;
+	}
+	Vocabulary vocabulary;
+	for (size_t id = 1; id < tokens.size(); ++id)
+	{
+		if (vocabulary.Intern(tokens[id]) != id)
+		{
+			error = corrupt;
+			return false;
+		}
+	}
+
+	ModelWriter writer;
+	if (!writer.Open(modelPath, (int)order, tokenType, vocabulary))
+	{
+		error = L"Could not create \"" + modelPath + L"\".";
+		return false;
+	}
+	const int keyLength = (int)order + 1;
+	ThreadPool & pool = ThreadPool::Shared();
+	std::vector<Block> batch(pool.NumThreads() * BLOCKS_PER_THREAD);
+	std::vector<unsigned int> lastKey;
+	bool valid = true;
+	for (size_t first = 0; first < blockCount && valid; first += batch.size())
+	{
+		const size_t numBlocks = std::min(batch.size(), blockCount - first);
+		for (size_t i = 0; i < numBlocks && valid; ++i)
+		{
+			const size_t b = first + i;
+			const unsigned long long end = b + 1 < blockCount ? blockPositions[b + 1] : directoryPosition;
+			batch[i].bytes.resize((size_t)(end - blockPositions[b]));
+			batch[i].numRecords = blockRecords[b];
+			batch[i].corrupt = false;
+			file.seekg(blockPositions[b]);
+			valid = (bool)file.read(&batch[i].bytes[0], batch[i].bytes.size());
+		}
+		if (!valid) break;
+
+		pool.ParallelFor(numBlocks, [&](size_t i) { DecodeBlock(batch[i], keyLength, tokens.size()); });
+
+		for (size_t i = 0; i < numBlocks && valid; ++i)
+		{
+			const Block & block = batch[i];
+			// Each block is sorted by construction, but must also follow on from the one before:
+			valid = !block.corrupt && (lastKey.empty() ||
+				std::lexicographical_compare(lastKey.begin(), lastKey.end(), block.keys.begin(),
+				                             block.keys.begin() + keyLength));
+			if (!valid) break;
+			for (unsigned int r = 0; r < block.numRecords; ++r)
+			{
+				writer.Write(block.keys.data() + (size_t)r * keyLength, block.counts[r]);
+			}
+			lastKey.assign(block.keys.end() - keyLength, block.keys.end());
+		}
+	}
+	bool written = writer.Close();
+
+	if (!valid || !written)
+	{
+		RemoveFile(modelPath);
+		error = valid ? L"Could not write \"" + modelPath + L"\"." : corrupt;
+		return false;
+	}
+	return true;
+}
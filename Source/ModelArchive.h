@@ -0,0 +1,31 @@
+// Archival storage for model files. PackModel() re-encodes a model file compactly, for keeping or
+// shipping it: tokens are renumbered by how often they occur, so that the common ones get small
+// IDs, every record is delta coded against the one before it and written with variable-length
+// integers, and the vocabulary is front coded. UnpackModel() turns an archive back into a model
+// file, which is the form the rest of the program reads. The records are split into blocks that
+// can each be decoded on their own, so unpacking decodes many blocks at once.
+//
+// Layout (fixed-size integers little-endian; a varint holds 7 bits per byte, lowest bits first,
+// with the high bit set on every byte but the last):
+//    "MKVA", format version, order, record count, block count, directory position, section size
+//    vocabulary section: the token type and the vocabulary size, then the tokens sorted by their
+//       UTF-16 code units, each as the number of units it shares with the token before, the number
+//       of units that follow and those units, and then its ID (all varints)
+//    blocks of up to RECORDS_PER_BLOCK records, sorted as in a model file. The first record of a
+//       block stores its token IDs as they are; every other record stores how many leading IDs it
+//       shares with the record before, how much greater its next ID is less one, and its remaining
+//       IDs. Each record ends with its count (all varints).
+//    directory: the position and record count of every block
+
+#pragma once
+
+#include <string>
+
+// Writes the model file at modelPath as an archive at archivePath. Returns false and describes the
+// problem in error on failure.
+bool PackModel(const std::wstring & modelPath, const std::wstring & archivePath,
+               const std::wstring & tempDirectory, size_t memoryBudget, std::wstring & error);
+
+// Writes the archive at archivePath as a model file at modelPath. The tokens keep the IDs they were
+// given when packing. Returns false and describes the problem in error on failure.
+bool UnpackModel(const std::wstring & archivePath, const std::wstring & modelPath, std::wstring & error);
@@ -0,0 +1,461 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Reading and writing model files. A model file holds everything needed to rebuild a Markov      *
+ * chain: its order, its token type, its vocabulary, and one record per distinct <Prefix, Suffix> *
+ * pair with the number of times that pair occurred. Records are sorted by prefix and then by     *
+ * suffix, which is the order in which an external sort produces them and the order in which two  *
+ * model files can be merged with a single sequential pass.                                       *
+ *                                                                                                *
+ * Tokens are stored as UTF-16 rather than UTF-8 so that every token round-trips exactly,         *
+ * including the lone surrogate halves that occur as separate "characters" when a character-based *
+ * chain is trained on text containing characters outside the Basic Multilingual Plane. Integers  *
+ * are written in the machine's native byte order, which is little-endian on every platform this  *
+ * program runs on.                                                                               *
+ *                                                                                                *
+ * A delta segment is appended to the end of the file and only then counted in the header, so a   *
+ * model whose append was interrupted still reads as it did before. Each segment is sorted on its *
+ * own, and a reader merges the segments on the fly, the same way the ExternalSorter merges its   *
+ * runs; every extra segment costs a little more per record read, which is why they should be     *
+ * compacted from time to time.                                                                   *
+ **************************************************************************************************/
+
+#include "ModelFile.h"
+#include "FilePath.h"
+#include <algorithm>
+#include <cwchar>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace
+{
+	const char MAGIC[4] = { 'M', 'K', 'V', 'M' };
+	const char DELTA_MAGIC[4] = { 'M', 'K', 'V', 'D' };
+	const unsigned int FORMAT_VERSION = 2;
+	const size_t FILE_BUFFER_SIZE = 1 << 20;
+	// Delta segments are usually small, and a reader keeps one buffer per segment:
+	const size_t DELTA_BUFFER_SIZE = 1 << 16;
+
+	template <class T> void WriteValue(std::ostream & out, T value)
+	{
+		out.write((const char *)&value, sizeof(value));
+	}
+
+	template <class T> bool ReadValue(std::istream & in, T & value)
+	{
+		return (bool)in.read((char *)&value, sizeof(value));
+	}
+
+	// Writes a string as a UTF-16 length followed by UTF-16 code units.
+	void WriteString(std::ostream & out, const std::wstring & text)
+	{
+		std::vector<unsigned short> units;
+		for (size_t i = 0; i < text.size(); ++i)
+		{
+			unsigned long c = (unsigned long)text[i];
+			if (c > 0xFFFF)
+			{
+				c -= 0x10000;
+				units.push_back((unsigned short)(0xD800 + (c >> 10)));
+				units.push_back((unsigned short)(0xDC00 + (c & 0x3FF)));
+			}
+			else units.push_back((unsigned short)c);
+		}
+		WriteValue(out, (unsigned int)units.size());
+		if (!units.empty()) out.write((const char *)units.data(), units.size() * sizeof(unsigned short));
+	}
+
+	// Reads a string written by WriteString.
+	bool ReadString(std::istream & in, std::wstring & text)
+	{
+		unsigned int length;
+		if (!ReadValue(in, length)) return false;
+		std::vector<unsigned short> units(length);
+		if (length > 0 && !in.read((char *)units.data(), length * sizeof(unsigned short))) return false;
+		text.clear();
+		for (size_t i = 0; i < units.size(); ++i)
+		{
+#if WCHAR_MAX > 0xFFFF
+			// Recombine surrogate pairs into single characters:
+			if (units[i] >= 0xD800 && units[i] <= 0xDBFF && i + 1 < units.size() &&
+				units[i + 1] >= 0xDC00 && units[i + 1] <= 0xDFFF)
+			{
+				text += (wchar_t)(0x10000 + ((units[i] - 0xD800) << 10) + (units[i + 1] - 0xDC00));
+				++i;
+				continue;
+			}
+#endif
+			text += (wchar_t)units[i];
+		}
+		return true;
+	}
+
+	// Replaces the file at path with the file at replacement.
+	bool ReplaceWith(const std::wstring & path, const std::wstring & replacement)
+	{
+#ifdef _WIN32
+		return MoveFileExW(replacement.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return std::rename(NativePath(replacement).c_str(), NativePath(path).c_str()) == 0;
+#endif
+	}
+}
+
+/**************************************************************************************************
+ * Creates a model file and writes its header and vocabulary. The record count is written as zero *
+ * and filled in by Close(). The file has no delta segments.                                      *
+ *   Inputs:                                                                                      *
+ *      path: The file to create. An existing file is overwritten.                                *
+ *      order: The order of the Markov chain.                                                     *
+ *      tokenType: "words" or "characters".                                                       *
+ *      vocabulary: Maps the token IDs used in the records to tokens.                             *
+ *   return value: false if the file cannot be created, true otherwise.                           *
+ **************************************************************************************************/
+bool ModelWriter::Open(const std::wstring & path, int order, const std::wstring & tokenType,
+                       const Vocabulary & vocabulary)
+{
+	fileBuffer.resize(FILE_BUFFER_SIZE);
+	file.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+	file.open(NativePath(path), std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) return false;
+
+	this->order = order;
+	recordCount = 0;
+	file.write(MAGIC, sizeof(MAGIC));
+	WriteValue(file, FORMAT_VERSION);
+	WriteValue(file, (unsigned int)order);
+	WriteString(file, tokenType);
+	WriteValue(file, (unsigned int)vocabulary.Size());
+	recordCountPosition = file.tellp();
+	WriteValue(file, recordCount);
+	WriteValue(file, (unsigned int)0); // delta count
+	for (size_t i = 0; i < vocabulary.Size(); ++i) WriteString(file, vocabulary.Token((unsigned int)i));
+	return (bool)file;
+}
+
+/**************************************************************************************************
+ * Appends a record to the file. Records must be written sorted by their keys (compared as arrays *
+ * of unsigned integers), and no key may be written twice.                                        *
+ *   Inputs:                                                                                      *
+ *      key: order + 1 token IDs: the Prefix, followed by the Suffix.                             *
+ *      count: The number of times the Suffix followed the Prefix.                                *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ModelWriter::Write(const unsigned int * key, unsigned long long count)
+{
+	file.write((const char *)key, (order + 1) * sizeof(unsigned int));
+	WriteValue(file, count);
+	recordCount++;
+}
+
+/**************************************************************************************************
+ * Fills in the record count in the header and closes the file.                                   *
+ *   return value: false if any write to the file failed, true otherwise.                         *
+ **************************************************************************************************/
+bool ModelWriter::Close()
+{
+	file.seekp(recordCountPosition);
+	WriteValue(file, recordCount);
+	bool ok = (bool)file;
+	file.close();
+	return ok;
+}
+
+/**************************************************************************************************
+ * Opens a model file and reads its header and vocabulary. The headers of the delta segments are  *
+ * read too, adding their tokens to the vocabulary, and each segment (the base records included)  *
+ * gets its own stream, positioned at its first record, so that Next() can merge them.            *
+ *   Inputs:                                                                                      *
+ *      path: The model file to open.                                                             *
+ *   return value: false if the file cannot be opened or is not a model file of a known version.  *
+ **************************************************************************************************/
+bool ModelReader::Open(const std::wstring & path)
+{
+	std::vector<char> fileBuffer(FILE_BUFFER_SIZE);
+	std::ifstream file;
+	file.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+	file.open(NativePath(path), std::ios::binary);
+	if (!file.is_open()) return false;
+
+	char magic[sizeof(MAGIC)];
+	unsigned int storedOrder, vocabularySize;
+	if (!file.read(magic, sizeof(magic)) || std::char_traits<char>::compare(magic, MAGIC, sizeof(MAGIC)) != 0) 
+		return false;
+	if (!ReadValue(file, version) || version < 1 || version > FORMAT_VERSION) return false;
+	if (!ReadValue(file, storedOrder) || !ReadString(file, tokenType)) return false;
+	if (!ReadValue(file, vocabularySize) || !ReadValue(file, recordCount)) return false;
+	order = (int)storedOrder;
+	deltaCount = 0;
+	if (version >= 2)
+	{
+		deltaCountPosition = file.tellg();
+		if (!ReadValue(file, deltaCount)) return false;
+	}
+
+	// The tokens are stored in ID order, so interning them in turn reproduces the same IDs. The
+	// first one is the non-word token, which the Vocabulary already holds as ID 0.
+	std::wstring token;
+	for (unsigned int i = 0; i < vocabularySize; ++i)
+	{
+		if (!ReadString(file, token)) return false;
+		if (vocabulary.Intern(token) != i) return false;
+	}
+
+	// Find where each segment's records start, reading the tokens that the deltas add on the way:
+	const std::streamoff recordSize = (order + 1) * sizeof(unsigned int) + sizeof(unsigned long long);
+	std::vector<std::streampos> starts(1, file.tellg());
+	std::vector<unsigned long long> counts(1, recordCount);
+	for (unsigned int d = 0; d < deltaCount; ++d)
+	{
+		unsigned int previousSize, newTokens;
+		unsigned long long deltaRecords;
+		file.seekg(starts.back() + (std::streamoff)counts.back() * recordSize);
+		if (!file.read(magic, sizeof(magic)) || 
+			std::char_traits<char>::compare(magic, DELTA_MAGIC, sizeof(DELTA_MAGIC)) != 0) return false;
+		if (!ReadValue(file, previousSize) || previousSize != vocabulary.Size()) return false;
+		if (!ReadValue(file, newTokens) || !ReadValue(file, deltaRecords)) return false;
+		for (unsigned int i = 0; i < newTokens; ++i)
+		{
+			if (!ReadString(file, token)) return false;
+			if (vocabulary.Intern(token) != previousSize + i) return false;
+		}
+		starts.push_back(file.tellg());
+		counts.push_back(deltaRecords);
+		recordCount += deltaRecords;
+	}
+	endOfSegments = starts.back() + (std::streamoff)counts.back() * recordSize;
+
+	segments.clear();
+	for (size_t i = 0; i < starts.size(); ++i)
+	{
+		segments.emplace_back(new Segment);
+		Segment & segment = *segments.back();
+		segment.fileBuffer.resize(i == 0 ? FILE_BUFFER_SIZE : DELTA_BUFFER_SIZE);
+		segment.file.rdbuf()->pubsetbuf(segment.fileBuffer.data(), segment.fileBuffer.size());
+		segment.file.open(NativePath(path), std::ios::binary);
+		if (!segment.file.is_open() || !segment.file.seekg(starts[i])) return false;
+		segment.remaining = counts[i];
+		segment.key.resize(order + 1);
+	}
+	truncated = false;
+
+	// With several segments, Next() needs the first record of each in hand:
+	if (segments.size() > 1)
+	{
+		for (size_t i = 0; i < segments.size(); ++i) Advance(*segments[i]);
+	}
+	return true;
+}
+
+/**************************************************************************************************
+ * Reads the next record of a segment into the segment's key and count.                           *
+ *   Inputs:                                                                                      *
+ *      segment: The segment to read from.                                                        *
+ *   return value: false at the end of the segment (or if the file is truncated), true otherwise. *
+ **************************************************************************************************/
+bool ModelReader::Advance(Segment & segment)
+{
+	segment.hasRecord = false;
+	if (segment.remaining == 0) return false;
+	if (!segment.file.read((char *)segment.key.data(), (order + 1) * sizeof(unsigned int)) ||
+		!ReadValue(segment.file, segment.count))
+	{
+		truncated = true;
+		segment.remaining = 0;
+		return false;
+	}
+	segment.remaining--;
+	segment.hasRecord = true;
+	return true;
+}
+
+/**************************************************************************************************
+ * Reads the next record. A file without delta segments is simply read in order. Otherwise the    *
+ * segments are merged: the smallest key among the segments' current records is the next one, and *
+ * its count is the sum of its counts in every segment that has it.                               *
+ *   Inputs:                                                                                      *
+ *      key: Receives order + 1 token IDs: the Prefix, followed by the Suffix.                    *
+ *      count: Receives the number of times the Suffix followed the Prefix.                       *
+ *   return value: false once every record has been read (or if the file is truncated).           *
+ **************************************************************************************************/
+bool ModelReader::Next(unsigned int * key, unsigned long long & count)
+{
+	if (segments.size() == 1)
+	{
+		Segment & segment = *segments[0];
+		if (segment.remaining == 0) return false;
+		if (!segment.file.read((char *)key, (order + 1) * sizeof(unsigned int)) || !ReadValue(segment.file, count))
+		{
+			truncated = true;
+			segment.remaining = 0;
+			return false;
+		}
+		segment.remaining--;
+		return true;
+	}
+
+	const Segment * smallest = NULL;
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		if (segments[i]->hasRecord && (smallest == NULL || segments[i]->key < smallest->key)) 
+			smallest = segments[i].get();
+	}
+	if (smallest == NULL) return false;
+	std::copy(smallest->key.begin(), smallest->key.end(), key);
+	count = 0;
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		Segment & segment = *segments[i];
+		if (!segment.hasRecord || !std::equal(segment.key.begin(), segment.key.end(), key)) continue;
+		count += segment.count;
+		Advance(segment);
+	}
+	return true;
+}
+
+// Accessors for the header fields.
+int ModelReader::Order() const { return order; }
+const std::wstring & ModelReader::TokenType() const { return tokenType; }
+const Vocabulary & ModelReader::GetVocabulary() const { return vocabulary; }
+unsigned long long ModelReader::RecordCount() const { return recordCount; }
+unsigned int ModelReader::DeltaCount() const { return deltaCount; }
+bool ModelReader::Truncated() const { return truncated; }
+bool ModelReader::CanAppend() const { return version >= 2; }
+
+/**************************************************************************************************
+ * Opens a model file for appending a delta segment, and writes the segment's header and new      *
+ * tokens. The segment goes right after the last segment that the header counts, overwriting      *
+ * whatever an interrupted append may have left there. The record count is written as zero and    *
+ * filled in by Close().                                                                          *
+ *   Inputs:                                                                                      *
+ *      path: The model file.                                                                     *
+ *      order: The order of the Markov chain. Must match the model's.                             *
+ *      tokenType: "words" or "characters". Must match the model's.                               *
+ *      vocabulary: Maps the token IDs used in the records to tokens. Its first tokens must be    *
+ *                  the model's, in the same order; the rest are added to the model.              *
+ *   return value: false if the file cannot be opened, is not a model that can take delta         *
+ *                 segments, or does not match order, tokenType and vocabulary. true otherwise.   *
+ **************************************************************************************************/
+bool DeltaWriter::Open(const std::wstring & path, int order, const std::wstring & tokenType, 
+                       const Vocabulary & vocabulary)
+{
+	std::streampos start;
+	size_t existingSize;
+	{
+		ModelReader model;
+		if (!model.Open(path) || !model.CanAppend()) return false;
+		if (model.Order() != order || model.TokenType() != tokenType) return false;
+		const Vocabulary & existing = model.GetVocabulary();
+		existingSize = existing.Size();
+		if (vocabulary.Size() < existingSize) return false;
+		for (size_t i = 0; i < existingSize; ++i)
+		{
+			if (vocabulary.Token((unsigned int)i) != existing.Token((unsigned int)i)) return false;
+		}
+		deltaCount = model.deltaCount;
+		deltaCountPosition = model.deltaCountPosition;
+		start = model.endOfSegments;
+	}
+
+	fileBuffer.resize(FILE_BUFFER_SIZE);
+	file.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+	file.open(NativePath(path), std::ios::in | std::ios::out | std::ios::binary);
+	if (!file.is_open() || !file.seekp(start)) return false;
+
+	this->order = order;
+	recordCount = 0;
+	file.write(DELTA_MAGIC, sizeof(DELTA_MAGIC));
+	WriteValue(file, (unsigned int)existingSize);
+	WriteValue(file, (unsigned int)(vocabulary.Size() - existingSize));
+	recordCountPosition = file.tellp();
+	WriteValue(file, recordCount);
+	for (size_t i = existingSize; i < vocabulary.Size(); ++i) WriteString(file, vocabulary.Token((unsigned int)i));
+	return (bool)file;
+}
+
+/**************************************************************************************************
+ * Appends a record to the segment. Records must be written sorted by their keys, and no key may  *
+ * be written twice (it may, of course, also occur in the base records or in other segments).     *
+ *   Inputs:                                                                                      *
+ *      key: order + 1 token IDs: the Prefix, followed by the Suffix.                             *
+ *      count: The number of times to add to the pair's count.                                    *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void DeltaWriter::Write(const unsigned int * key, unsigned long long count)
+{
+	file.write((const char *)key, (order + 1) * sizeof(unsigned int));
+	WriteValue(file, count);
+	recordCount++;
+}
+
+/**************************************************************************************************
+ * Fills in the segment's record count and then, once the segment is written out, counts it in    *
+ * the model's header. Until that last write, readers do not see the segment at all.              *
+ *   return value: false if any write to the file failed, true otherwise.                         *
+ **************************************************************************************************/
+bool DeltaWriter::Close()
+{
+	file.seekp(recordCountPosition);
+	WriteValue(file, recordCount);
+	file.flush();
+	if (file)
+	{
+		file.seekp(deltaCountPosition);
+		WriteValue(file, deltaCount + 1);
+	}
+	bool ok = (bool)file;
+	file.close();
+	return ok;
+}
+
+/**************************************************************************************************
+ * Rewrites a model file with every delta segment folded into the base records. The merged        *
+ * records that ModelReader produces are already sorted and counted, so they are simply written   *
+ * out again, to a new file next to the old one; the new file then replaces the old one in a      *
+ * single rename, so the model is never missing or half written, and a program that has already   *
+ * loaded it (such as a running server) is not disturbed.                                         *
+ *   Inputs:                                                                                      *
+ *      path: The model file to compact.                                                          *
+ *      error: Receives a description of the problem if compaction fails.                         *
+ *   return value: true if the model was compacted, false otherwise.                              *
+ **************************************************************************************************/
+bool CompactModel(const std::wstring & path, std::wstring & error)
+{
+	const std::wstring compacted = path + L".compacting";
+	bool complete, written;
+	{
+		ModelReader model;
+		if (!model.Open(path))
+		{
+			error = L"\"" + path + L"\" is not a model file.";
+			return false;
+		}
+		ModelWriter writer;
+		if (!writer.Open(compacted, model.Order(), model.TokenType(), model.GetVocabulary()))
+		{
+			error = L"Could not create \"" + compacted + L"\".";
+			return false;
+		}
+		std::vector<unsigned int> key(model.Order() + 1);
+		unsigned long long count;
+		while (model.Next(key.data(), count)) writer.Write(key.data(), count);
+		complete = !model.Truncated();
+		written = writer.Close();
+	}
+
+	if (!complete || !written)
+	{
+		RemoveFile(compacted);
+		error = complete ? L"Could not write \"" + compacted + L"\"." : L"\"" + path + L"\" is truncated.";
+		return false;
+	}
+	if (!ReplaceWith(path, compacted))
+	{
+		RemoveFile(compacted);
+		error = L"Could not replace \"" + path + L"\".";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,129 @@
+// Reading and writing trained models on disk. A model file stores a Markov chain as counted
+// <Prefix, Suffix> records of token IDs, sorted by prefix and then by suffix, along with the
+// vocabulary that maps the IDs back to tokens. Files are written and read sequentially, so models
+// far larger than memory can be produced and merged.
+//
+// New texts can be added to a model without retraining it: their records are appended as a delta
+// segment, which brings any new tokens and the counts to add. ModelReader merges the base records
+// and the deltas as it reads, so readers see a single sorted list of records either way, and
+// CompactModel() folds the deltas into the base once they accumulate.
+//
+// Layout (all integers little-endian):
+//    "MKVM", format version, order, token type, vocabulary size, record count, delta count
+//    vocabulary: for each ID in order, a UTF-16 length and the UTF-16 code units of the token
+//    records: order + 1 token IDs (the prefix, then the suffix) and a 64-bit occurrence count
+//    delta segments, each:
+//       "MKVD", vocabulary size before the segment, number of new tokens, record count
+//       new tokens: numbered on from the vocabulary before the segment, stored like the vocabulary
+//       records: as above, sorted, using the IDs of the vocabulary including the new tokens
+// Version 1 files have no delta count and no deltas.
+
+#pragma once
+
+#include "Vocabulary.h"
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ModelWriter
+{
+	std::ofstream file;
+	std::vector<char> fileBuffer;
+	int order = 0;
+	unsigned long long recordCount = 0;
+	std::streampos recordCountPosition;
+
+public:
+	// Creates the file and writes the header and vocabulary. Returns false if it cannot be created.
+	bool Open(const std::wstring & path, int order, const std::wstring & tokenType, 
+	          const Vocabulary & vocabulary);
+
+	// Appends a record. key holds order + 1 token IDs. Records must be written in sorted order.
+	void Write(const unsigned int * key, unsigned long long count);
+
+	// Fills in the record count and closes the file. Returns false if any write failed.
+	bool Close();
+};
+
+class ModelReader
+{
+	// Reads the records of one segment (the base records, or one delta's) in order.
+	struct Segment
+	{
+		std::ifstream file;
+		std::vector<char> fileBuffer;
+		unsigned long long remaining = 0; // records not read yet
+		std::vector<unsigned int> key;    // the current record, if any
+		unsigned long long count = 0;
+		bool hasRecord = false;
+	};
+
+	unsigned int version = 0;
+	int order = 0;
+	std::wstring tokenType;
+	Vocabulary vocabulary;
+	unsigned long long recordCount = 0;  // in all segments
+	unsigned int deltaCount = 0;
+	std::streampos deltaCountPosition;   // where the header stores deltaCount
+	std::streampos endOfSegments;        // where the next delta segment would go
+	std::vector<std::unique_ptr<Segment>> segments;
+	bool truncated = false;
+
+	// Reads the current record of a segment. Returns false at the end of the segment.
+	bool Advance(Segment & segment);
+
+	friend class DeltaWriter;
+
+public:
+	// Opens a model file and reads its header and vocabulary (including the tokens added by delta
+	// segments). Returns false if it is not a model.
+	bool Open(const std::wstring & path);
+
+	// Reads the next record into key (order + 1 IDs) and count, with the counts of all segments
+	// added together. Returns false after the last one.
+	bool Next(unsigned int * key, unsigned long long & count);
+
+	// Returns true if Next() stopped early because the file is truncated.
+	bool Truncated() const;
+
+	// Returns false for files in the old format, which cannot take delta segments until compacted.
+	bool CanAppend() const;
+
+	int Order() const;
+	const std::wstring & TokenType() const;
+	const Vocabulary & GetVocabulary() const;
+	unsigned long long RecordCount() const; // in all segments; keys in several segments count repeatedly
+	unsigned int DeltaCount() const;
+};
+
+// Appends a delta segment to a model file.
+class DeltaWriter
+{
+	std::fstream file;
+	std::vector<char> fileBuffer;
+	int order = 0;
+	unsigned int deltaCount = 0;
+	std::streampos deltaCountPosition;
+	std::streampos recordCountPosition;
+	unsigned long long recordCount = 0;
+
+public:
+	// Opens a model file and writes the header of a new segment, with the tokens of vocabulary that
+	// the model does not have yet. vocabulary must extend the model's vocabulary, and order and
+	// tokenType must match the model's. Returns false if the segment cannot be added.
+	bool Open(const std::wstring & path, int order, const std::wstring & tokenType, 
+	          const Vocabulary & vocabulary);
+
+	// Appends a record. key holds order + 1 token IDs. Records must be written in sorted order.
+	void Write(const unsigned int * key, unsigned long long count);
+
+	// Fills in the record count and adds the segment to the model, which ignores it until then.
+	// Returns false if any write failed.
+	bool Close();
+};
+
+// Rewrites a model file with its delta segments folded into the base records (which also converts
+// old files to the current format). The new file replaces the old one only once it is complete.
+// Returns false and describes the problem in error on failure.
+bool CompactModel(const std::wstring & path, std::wstring & error);
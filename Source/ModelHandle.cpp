@@ -0,0 +1,148 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Publishing a model to readers that never wait. This is read-copy-update with reference counts  *
+ * in place of epochs: a reader's reference is its read-side critical section, and a replaced     *
+ * chain's grace period ends when the last reference to it is dropped. Acquire() and Publish() go *
+ * through the standard library's atomic operations on shared_ptr, so a reader either copies the  *
+ * old pointer or the new one, never anything in between, and the only thing a reader can wait    *
+ * for is the copy of a pointer, never a load or a free.                                          *
+ *                                                                                                *
+ * The last reference to be dropped frees the chain, and that would otherwise fall to whichever   *
+ * reader happened to finish last: a request on a server, say, would pay for freeing hundreds of  *
+ * megabytes. So the handle publishes each chain through a pointer of its own whose deleter,      *
+ * instead of freeing the chain, hands it to the handle's reclaimer, a thread that frees it in    *
+ * the background. Dropping the last reference costs a reader no more than taking a lock and      *
+ * appending to a list, and the chain is freed as soon as it is no longer used, without waiting   *
+ * for another Publish() or for anyone to ask.                                                    *
+ *                                                                                                *
+ * The reclaimer is shared by the handle and every pointer it has published, so a reader that     *
+ * outlives the handle can still hand its chain over; it stops once they are all gone, after      *
+ * freeing whatever it was given.                                                                 *
+ **************************************************************************************************/
+
+#include "ModelHandle.h"
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+// Frees the chains handed to it on a thread of its own.
+class ModelHandle::Reclaimer
+{
+	std::mutex lock;
+	std::condition_variable wake;
+	std::vector<std::shared_ptr<const CompiledChain>> pending; // chains no reader holds, to be freed
+	bool stopping = false;
+	std::thread thread; // started by the first chain handed over
+
+	void Run();
+
+public:
+	~Reclaimer();
+
+	// Frees chain on the reclaimer's thread.
+	void Free(std::shared_ptr<const CompiledChain> chain);
+};
+
+/**************************************************************************************************
+ * Stops the reclaimer's thread once it has freed every chain it was given.                       *
+ **************************************************************************************************/
+ModelHandle::Reclaimer::~Reclaimer()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_one();
+	if (thread.joinable()) thread.join();
+}
+
+/**************************************************************************************************
+ * Hands a chain over to be freed on the reclaimer's thread, starting the thread if it is not yet *
+ * running.                                                                                       *
+ *   Inputs:                                                                                      *
+ *      chain: The chain to free. No reader may hold it.                                          *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ModelHandle::Reclaimer::Free(std::shared_ptr<const CompiledChain> chain)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		pending.push_back(std::move(chain));
+		if (!thread.joinable()) thread = std::thread(&Reclaimer::Run, this);
+	}
+	wake.notify_one();
+}
+
+/**************************************************************************************************
+ * The reclaimer's thread. Frees the chains handed over until the reclaimer is destroyed. The     *
+ * chains are freed after the lock is released, so that a reader handing over another chain does  *
+ * not wait for them.                                                                             *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ModelHandle::Reclaimer::Run()
+{
+	std::vector<std::shared_ptr<const CompiledChain>> unused;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this]() { return stopping || !pending.empty(); });
+			if (pending.empty()) return;
+			unused.swap(pending);
+		}
+		unused.clear();
+	}
+}
+
+/**************************************************************************************************
+ * Constructor. The handle holds no chain until one is published.                                 *
+ **************************************************************************************************/
+ModelHandle::ModelHandle() : reclaimer(std::make_shared<Reclaimer>()) {}
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      chain: The chain to publish.                                                              *
+ **************************************************************************************************/
+ModelHandle::ModelHandle(std::shared_ptr<const CompiledChain> chain) : reclaimer(std::make_shared<Reclaimer>())
+{
+	current = Wrap(std::move(chain));
+}
+
+/**************************************************************************************************
+ * Returns a pointer to a chain whose last release hands the chain to the reclaimer instead of    *
+ * freeing it.                                                                                    *
+ *   Inputs:                                                                                      *
+ *      chain: The chain to publish.                                                              *
+ *   return value: The pointer to give readers, or NULL if chain is NULL.                         *
+ **************************************************************************************************/
+std::shared_ptr<const CompiledChain> ModelHandle::Wrap(std::shared_ptr<const CompiledChain> chain) const
+{
+	if (!chain) return chain;
+	const CompiledChain * pointer = chain.get();
+	std::shared_ptr<Reclaimer> to = reclaimer;
+	return std::shared_ptr<const CompiledChain>(pointer, [to, chain](const CompiledChain *) { to->Free(chain); });
+}
+
+/**************************************************************************************************
+ * Returns the current chain. The caller's reference keeps it alive even if it is replaced.       *
+ *   return value: The current chain, or NULL if none has been published.                         *
+ **************************************************************************************************/
+std::shared_ptr<const CompiledChain> ModelHandle::Acquire() const
+{
+	return std::atomic_load(&current);
+}
+
+/**************************************************************************************************
+ * Replaces the current chain. Readers that acquired the old chain keep using it; it is freed on  *
+ * the reclaimer's thread once they have all let it go.                                           *
+ *   Inputs:                                                                                      *
+ *      chain: The chain to publish.                                                              *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ModelHandle::Publish(std::shared_ptr<const CompiledChain> chain)
+{
+	std::atomic_exchange(&current, Wrap(std::move(chain)));
+}
@@ -0,0 +1,39 @@
+// A compiled chain that can be replaced while it is being generated from. Readers take the current
+// chain with Acquire() and keep it for as long as they need it, holding no lock; Publish() swaps in
+// a new chain in one atomic step, after which new readers get the new chain while readers that
+// began earlier finish on the old one. A replaced chain is freed as soon as the last reader lets it
+// go, but on a background thread rather than the reader's, so freeing a large model never delays a
+// reader or the swap itself.
+
+#pragma once
+
+#include "CompiledChain.h"
+#include <memory>
+#include <mutex>
+
+class ModelHandle
+{
+	class Reclaimer;
+	std::shared_ptr<Reclaimer> reclaimer;         // frees chains once no reader holds them
+	std::shared_ptr<const CompiledChain> current; // read and written only with std::atomic_load/exchange
+
+	// Returns a pointer to chain whose last release hands the chain to the reclaimer.
+	std::shared_ptr<const CompiledChain> Wrap(std::shared_ptr<const CompiledChain> chain) const;
+
+public:
+	// Constructor. Until something is published, Acquire() returns NULL.
+	ModelHandle();
+
+	// Constructor. chain is published at once.
+	explicit ModelHandle(std::shared_ptr<const CompiledChain> chain);
+
+	// A handle publishes each chain once, so handles are not copied.
+	ModelHandle(const ModelHandle &) = delete;
+	ModelHandle & operator=(const ModelHandle &) = delete;
+
+	// Returns the current chain, which stays valid for as long as the caller keeps the pointer.
+	std::shared_ptr<const CompiledChain> Acquire() const;
+
+	// Makes chain the current chain. The chain it replaces is freed once no reader holds it.
+	void Publish(std::shared_ptr<const CompiledChain> chain);
+};
@@ -0,0 +1,216 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Trains a Markov chain out of core. StringChain keeps every Prefix and its list of Suffixes in  *
+ * memory, so the size of the corpus it can learn from is limited by RAM. This class produces     *
+ * exactly the same chain (the same <Prefix, Suffix> pairs, with the same multiplicities) but     *
+ * keeps only the vocabulary and a fixed-size sort buffer in memory: each token is recorded as a  *
+ * fixed-length array of token IDs (the current Prefix followed by the token), and the            *
+ * ExternalSorter sorts and counts the records on disk.                                           *
+ *                                                                                                *
+ * The result is a model file (see ModelFile.h). Because a model file is nothing more than a      *
+ * sorted list of counted records, two model files of the same order and token type describe the  *
+ * same chain as training on the concatenation of their inputs would, once their counts are added *
+ * together. MergeModels() does exactly that, which allows a large corpus to be split across      *
+ * several machines, trained in pieces, and combined afterwards. AppendDelta() does the same for  *
+ * a corpus that grows: only the new texts are trained, and their counts are appended to the      *
+ * existing model file, to be added in whenever the model is read.                                *
+ **************************************************************************************************/
+
+#include "OutOfCoreTrainer.h"
+#include "ModelFile.h"
+#include "StringChain.h"
+#include <algorithm>
+#include <memory>
+
+/**************************************************************************************************
+ * Constructor. The current Prefix starts out filled with non-words, as in StringChain.           *
+ *   Inputs:                                                                                      *
+ *      order: How many words or characters per Prefix.                                           *
+ *      tokenType: "words" or "characters". Only recorded in the model file.                      *
+ *      tempDirectory: Where the sorter may create its temporary files.                           *
+ *      memoryBudget: Roughly how many bytes the sorter's buffer may use.                         *
+ **************************************************************************************************/
+OutOfCoreTrainer::OutOfCoreTrainer(int order, const std::wstring & tokenType, 
+                                   const std::wstring & tempDirectory, size_t memoryBudget)
+	: markovOrder(order), tokenType(tokenType), sorter(order + 1, tempDirectory, memoryBudget),
+	  record(order + 1, Vocabulary::NONWORD_ID)
+{
+}
+
+/**************************************************************************************************
+ * Records a single <Prefix, Suffix> pair, where the Prefix is the current Prefix and the Suffix  *
+ * is the given token, and then advances the current Prefix by one token.                         *
+ *   Inputs:                                                                                      *
+ *      token: The word or character that follows the current Prefix in the input text.           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void OutOfCoreTrainer::AddToken(const std::wstring & token)
+{
+	record[markovOrder] = vocabulary.Intern(token);
+	sorter.Add(record.data(), 1);
+	std::copy(record.begin() + 1, record.end(), record.begin());
+	anyRecords = true;
+	tokensInCurrentInput++;
+}
+
+/**************************************************************************************************
+ * Marks the end of an input text by adding non-word padding, exactly as StringChain::EndInput()  *
+ * does, so that generation can wrap from the end of one text into the beginning of the next.     *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void OutOfCoreTrainer::EndInput()
+{
+	if (tokensInCurrentInput == 0 && !anyRecords) AddToken(NONWORD);
+	for (int i = 0; i < markovOrder; ++i) AddToken(NONWORD);
+	tokensInCurrentInput = 0;
+}
+
+/**************************************************************************************************
+ * Makes the trainer continue an existing model instead of starting a new one. Tokens the model   *
+ * already has keep their IDs, and new ones are numbered after them, so that the recorded pairs   *
+ * can be appended to the model as a delta segment. The model counts as earlier input, so an      *
+ * empty text adds only its padding, just as it would if the new texts were trained together with *
+ * the model's.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      model: The opened model file. Its order and token type must match the trainer's.          *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void OutOfCoreTrainer::ContinueModel(const ModelReader & model)
+{
+	vocabulary = model.GetVocabulary();
+	anyRecords = model.RecordCount() > 0;
+}
+
+/**************************************************************************************************
+ * Sorts and counts every recorded pair and writes the result, along with the vocabulary, to a    *
+ * model file.                                                                                    *
+ *   Inputs:                                                                                      *
+ *      path: The model file to create.                                                           *
+ *   return value: false if a temporary file or the model file could not be written, true         *
+ *                 otherwise.                                                                     *
+ **************************************************************************************************/
+bool OutOfCoreTrainer::WriteModel(const std::wstring & path)
+{
+	ModelWriter writer;
+	if (!writer.Open(path, markovOrder, tokenType, vocabulary)) return false;
+	bool sorted = sorter.Finish([&writer](const unsigned int * key, unsigned long long count) {
+		writer.Write(key, count);
+	});
+	return writer.Close() && sorted;
+}
+
+/**************************************************************************************************
+ * Sorts and counts every recorded pair and appends the result to a model file as a delta         *
+ * segment.                                                                                       *
+ *   Inputs:                                                                                      *
+ *      path: The model file, which must be the one given to ContinueModel().                     *
+ *   return value: false if a temporary file could not be written, or the model file could not be *
+ *                 appended to, true otherwise.                                                   *
+ **************************************************************************************************/
+bool OutOfCoreTrainer::AppendDelta(const std::wstring & path)
+{
+	DeltaWriter writer;
+	if (!writer.Open(path, markovOrder, tokenType, vocabulary)) return false;
+	bool sorted = sorter.Finish([&writer](const unsigned int * key, unsigned long long count) {
+		writer.Write(key, count);
+	});
+	return sorted && writer.Close();
+}
+
+/**************************************************************************************************
+ * Combines several model files into one. Each input has its own vocabulary, so the vocabularies  *
+ * are first merged into one and every record is translated into the merged IDs. Translation      *
+ * changes the sort order, so the translated records are run through an ExternalSorter, which     *
+ * also adds together the counts of pairs found in several inputs.                                *
+ *   Inputs:                                                                                      *
+ *      inputs: The model files to combine. They must all have the same order and token type.     *
+ *      output: The model file to create.                                                         *
+ *      tempDirectory: Where the sorter may create its temporary files.                           *
+ *      memoryBudget: Roughly how many bytes the sorter's buffer may use.                         *
+ *      error: Receives a description of the problem if the merge fails.                          *
+ *   return value: true if the merged model was written, false otherwise.                         *
+ **************************************************************************************************/
+bool OutOfCoreTrainer::MergeModels(const std::vector<std::wstring> & inputs, const std::wstring & output,
+                                   const std::wstring & tempDirectory, size_t memoryBudget, 
+                                   std::wstring & error)
+{
+	if (inputs.empty())
+	{
+		error = L"No models to merge.";
+		return false;
+	}
+
+	// Open every input and check that they describe compatible chains:
+	std::vector<std::unique_ptr<ModelReader>> readers;
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		readers.emplace_back(new ModelReader);
+		if (!readers.back()->Open(inputs[i]))
+		{
+			error = L"\"" + inputs[i] + L"\" is not a model file.";
+			return false;
+		}
+		if (readers[i]->Order() != readers[0]->Order() || readers[i]->TokenType() != readers[0]->TokenType())
+		{
+			error = L"\"" + inputs[i] + L"\" has a different order or token type than \"" + inputs[0] + L"\".";
+			return false;
+		}
+	}
+	const int order = readers[0]->Order();
+
+	// Merge the vocabularies, remembering how each input's IDs translate into the merged IDs:
+	Vocabulary merged;
+	std::vector<std::vector<unsigned int>> translations(readers.size());
+	for (size_t i = 0; i < readers.size(); ++i)
+	{
+		const Vocabulary & vocabulary = readers[i]->GetVocabulary();
+		translations[i].resize(vocabulary.Size());
+		for (size_t id = 0; id < vocabulary.Size(); ++id)
+		{
+			translations[i][id] = merged.Intern(vocabulary.Token((unsigned int)id));
+		}
+	}
+
+	ExternalSorter sorter(order + 1, tempDirectory, memoryBudget);
+	std::vector<unsigned int> key(order + 1);
+	unsigned long long count;
+	for (size_t i = 0; i < readers.size(); ++i)
+	{
+		const std::vector<unsigned int> & translation = translations[i];
+		while (readers[i]->Next(key.data(), count))
+		{
+			for (int k = 0; k <= order; ++k)
+			{
+				if (key[k] >= translation.size())
+				{
+					error = L"\"" + inputs[i] + L"\" is corrupt.";
+					return false;
+				}
+				key[k] = translation[key[k]];
+			}
+			sorter.Add(key.data(), count);
+		}
+		if (readers[i]->Truncated())
+		{
+			error = L"\"" + inputs[i] + L"\" is truncated.";
+			return false;
+		}
+	}
+
+	ModelWriter writer;
+	if (!writer.Open(output, order, readers[0]->TokenType(), merged))
+	{
+		error = L"Could not create \"" + output + L"\".";
+		return false;
+	}
+	bool sorted = sorter.Finish([&writer](const unsigned int * key, unsigned long long count) {
+		writer.Write(key, count);
+	});
+	if (!writer.Close() || !sorted)
+	{
+		error = L"Could not write \"" + output + L"\" or a temporary file in \"" + tempDirectory + L"\".";
+		return false;
+	}
+	return true;
+}
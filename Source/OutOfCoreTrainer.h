@@ -0,0 +1,54 @@
+// Trains a Markov chain without holding the <Prefix, Suffix> map in memory. Every token is turned
+// into a <Prefix, Suffix> record of token IDs and handed to an ExternalSorter, which spills sorted
+// runs to disk and merges them into the counted records of a model file. Model files trained
+// separately (for example, on different machines) can be combined with MergeModels(), and new
+// texts can be added to an existing model file as a delta segment with AppendDelta().
+
+#pragma once
+
+#include "TokenSink.h"
+#include "Vocabulary.h"
+#include "ExternalSorter.h"
+#include "ModelFile.h"
+#include <string>
+#include <vector>
+
+class OutOfCoreTrainer : public TokenSink
+{
+	const int markovOrder;
+	const std::wstring tokenType;
+	Vocabulary vocabulary;
+	ExternalSorter sorter;
+	std::vector<unsigned int> record; // the current prefix, followed by room for the suffix
+	long long tokensInCurrentInput = 0;
+	bool anyRecords = false;
+
+public:
+	// Constructor. Temporary files go in tempDirectory; memoryBudget limits the sort buffer (bytes).
+	OutOfCoreTrainer(int order, const std::wstring & tokenType, const std::wstring & tempDirectory,
+	                 size_t memoryBudget);
+
+	// Records the <currentPrefix, token> pair and advances the current prefix.
+	void AddToken(const std::wstring & token) override;
+
+	// Adds the non-word padding that follows the last token of an input text.
+	void EndInput() override;
+
+	// Makes the trainer continue an existing model, giving tokens the model's IDs, so that the
+	// recorded pairs can be appended to it with AppendDelta(). Call before the first token.
+	void ContinueModel(const ModelReader & model);
+
+	// Merges the recorded pairs into a model file. Call once, after the last input. Returns false
+	// if a temporary file or the model file could not be written.
+	bool WriteModel(const std::wstring & path);
+
+	// Merges the recorded pairs into a delta segment and appends it to the model file given to
+	// ContinueModel(). Call once, after the last input. Returns false if a temporary file could not
+	// be written or the segment could not be appended.
+	bool AppendDelta(const std::wstring & path);
+
+	// Combines model files of the same order and token type into one, adding up the counts of
+	// pairs that occur in more than one. Returns false and describes the problem in error on failure.
+	static bool MergeModels(const std::vector<std::wstring> & inputs, const std::wstring & output,
+	                        const std::wstring & tempDirectory, size_t memoryBudget, std::wstring & error);
+};
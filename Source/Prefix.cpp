@@ -4,21 +4,22 @@
  * A class for storing "prefixes" for Markov chain generation. A prefix is a sequence of words or *
  * characters appearing in a given text. The number of items in a prefix is dictated by the       *
  * "order" of the markov chain. For example, 3rd-order word prefixes from Romeo and Juliet would  *
- * include "Wherefore art thou" and "But soft! What".                                             *
+ * include "Wherefore art thou" and "But soft! What". The items are stored as token IDs (see      *
+ * Vocabulary), which take less space than strings and are faster to compare.                     *
  **************************************************************************************************/
 
 #include "Prefix.h"
 
 /**************************************************************************************************
- * Constructor. Creates a prefix using a given list of words.                                     *
+ * Constructor. Creates a prefix using a given sequence of token IDs.                             *
  **************************************************************************************************/
-Prefix::Prefix(std::list<std::wstring> prefixSetter) : prefixWords(prefixSetter){}
+Prefix::Prefix(const unsigned int * ids, size_t length) : prefixWords(ids, ids + length){}
 
 /**************************************************************************************************
  * Accessor for the private list of prefix items.                                                 *
- *   return value: the list of prefix tokens                                                      *
+ *   return value: the IDs of the prefix tokens                                                   *
  **************************************************************************************************/
-std::list<std::wstring> Prefix::GetPrefix()
+const std::vector<unsigned int> & Prefix::GetPrefix() const
 {
 	return prefixWords;
 }
@@ -26,14 +27,16 @@ std::list<std::wstring> Prefix::GetPrefix()
 /**************************************************************************************************
  * Constructs a single string containing all the words or characters of the prefix, separated by  *
  * spaces. Created for debugging purposes.                                                        *
+ *   Inputs:                                                                                      *
+ *      vocabulary: The vocabulary that the prefix's token IDs refer to.                          *
  *   return value: A string representation of the entire prefix.                                  *
  **************************************************************************************************/
-std::wstring Prefix::GetPrefixString()
+std::wstring Prefix::GetPrefixString(const Vocabulary & vocabulary) const
 {
 	std::wstring output = L"";
 	for (auto it = prefixWords.begin(); it != prefixWords.end(); ++it)
 	{
-		output += (*it) + L" ";
+		output += vocabulary.Token(*it) + L" ";
 	}
 	return output;
 }
@@ -1,32 +1,55 @@
 #pragma once
 
+#include "Vocabulary.h"
 #include <string>
-#include <list>
+#include <algorithm>
+#include <vector>
 
 class Prefix
 {
-	std::list<std::wstring> prefixWords;
+	std::vector<unsigned int> prefixWords; // token IDs (see Vocabulary)
 public:
+	// A borrowed sequence of token IDs. Lets the <Prefix, Suffix> map be searched without first
+	// constructing (and allocating) a Prefix.
+	struct View
+	{
+		const unsigned int * ids;
+		size_t length;
+	};
+
 	// Constructor
-	Prefix(std::list<std::wstring> prefixSetter);
+	Prefix(const unsigned int * ids, size_t length);
 
 	// Accessor for the private list of prefix items.
-	std::list<std::wstring> GetPrefix();
+	const std::vector<unsigned int> & GetPrefix() const;
 
 	// Constructs a single string containing all the words or characters of the prefix
-	std::wstring GetPrefixString();
+	std::wstring GetPrefixString(const Vocabulary & vocabulary) const;
 
 	/**************************************************************************************************
      * Comparator needed for prefixSuffixMap's find() function. Note: the way the find() function     *
 	 * works is that it asks "is a < b?" and then "is b < a?" by invoking cmpPointees(a,b) and        *
-	 * cmpPointees(b,a), respectively. If both results are false, then a must be equal to b.          *
+	 * cmpPointees(b,a), respectively. If both results are false, then a must be equal to b. Since    *
+	 * the comparator is transparent, find() also accepts a View in place of a Prefix pointer.        *
      **************************************************************************************************/
 	struct cmpPointees
 	{
-		bool operator () (Prefix * lhs, Prefix * rhs) const
+		typedef void is_transparent;
+
+		bool operator () (const Prefix * lhs, const Prefix * rhs) const
 		{
 			return ((lhs->prefixWords)<(rhs->prefixWords));
 		}
+		bool operator () (const Prefix * lhs, const View & rhs) const
+		{
+			return std::lexicographical_compare(lhs->prefixWords.begin(), lhs->prefixWords.end(), 
+			                                    rhs.ids, rhs.ids + rhs.length);
+		}
+		bool operator () (const View & lhs, const Prefix * rhs) const
+		{
+			return std::lexicographical_compare(lhs.ids, lhs.ids + lhs.length, 
+			                                    rhs->prefixWords.begin(), rhs->prefixWords.end());
+		}
 	};
 };
 
@@ -0,0 +1,51 @@
+// A thread-safe record of how far a background training or generation job has gotten, plus a flag
+// through which the job can be asked to stop early. The job updates the counters as it runs; any
+// other thread may poll them (or register a callback) and may request cancellation at any time.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+struct ProgressMonitor
+{
+	std::atomic<long long> bytesConsumed;   // input bytes read so far
+	std::atomic<long long> bytesTotal;      // total size of all input files, or 0 if unknown
+	std::atomic<long long> tokensGenerated; // tokens produced by generation so far
+	std::atomic<bool> cancelRequested;      // set by Cancel(); polled by the running job
+
+	// Optional. Called on the worker thread every time the job reports progress.
+	std::function<void(const ProgressMonitor &)> onProgress;
+
+	// Constructor
+	ProgressMonitor() { Reset(); }
+
+	// Clears all counters and any pending cancellation request before a new job starts.
+	void Reset()
+	{
+		bytesConsumed = 0;
+		bytesTotal = 0;
+		tokensGenerated = 0;
+		cancelRequested = false;
+	}
+
+	// Asks the running job to stop at its next opportunity.
+	void Cancel() { cancelRequested = true; }
+
+	// Polled by the running job. Cheap enough to call once per token.
+	bool IsCancelled() const { return cancelRequested.load(std::memory_order_relaxed); }
+
+	// Records that another numBytes bytes of input have been consumed.
+	void AddBytes(long long numBytes)
+	{
+		bytesConsumed.fetch_add(numBytes, std::memory_order_relaxed);
+		if (onProgress) onProgress(*this);
+	}
+
+	// Records the total number of tokens generated so far.
+	void SetTokensGenerated(long long numTokens)
+	{
+		tokensGenerated.store(numTokens, std::memory_order_relaxed);
+		if (onProgress) onProgress(*this);
+	}
+};
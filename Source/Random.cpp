@@ -1,10 +1,13 @@
 /**************************************************************************************************
  * Author: Jonathan Roop                                                                          *
  *                                                                                                *
- * A wrapper class for the std::rand pseudorandom number generator. The generator can be          *
+ * A small wrapper around a Mersenne Twister pseudorandom number generator. The generator can be  *
  * initialized with an explicit seed value or automatically initialized using the current system  *
  * time in seconds. This wrapper class also provides a convenient nextInt method for generating a *
- * bounded pseudorandom integer.                                                                  *
+ * bounded pseudorandom integer. Every instance owns its own generator state (unlike std::rand,   *
+ * whose state is shared or per-thread depending on the C runtime), so a generator can be handed  *
+ * to a background thread and produce the same sequence there that it would have produced on the  *
+ * thread that created it.                                                                        *
  **************************************************************************************************/
 
 #include "Random.h"
@@ -14,26 +17,48 @@
   * std::time(nullptr) usually returns the current time since the Epoch *in seconds*. This means   *
   * that a unique seed would be produced by this constructor only once per second.                 *
   **************************************************************************************************/
-Random::Random(){
-	std::srand((int)std::time(nullptr));
-}
+Random::Random() : engine((unsigned int)std::time(nullptr)) {}
 
 /**************************************************************************************************
  * Explicit constructor. Seeds the pseudorandom number generator using the seed parameter.        *
  **************************************************************************************************/
-Random::Random(int seed){
-	std::srand(seed);
-}
+Random::Random(int seed) : engine((unsigned int)seed) {}
 
 /**************************************************************************************************
- * Computes an pseudorandom integer between 0 and maxValue-1, inclusive. The std::rand class is   *
- * used to generate a random integer, which is then truncated using the modulo operator. Note:    *
- * the upper bound on std::rand() is RAND_MAX, which is not guaranteed to be as large as INT_MAX  *
- * (although it probably is anyways).                                                             *
+ * Computes an pseudorandom integer between 0 and maxValue-1, inclusive. The generator produces a *
+ * 32-bit unsigned integer, which is then truncated using the modulo operator.                    *
  *   Inputs:                                                                                      *
  *      maxValue: The upper bound on the pseudorandom number to be generated.                     *
- *   return value: A pseudorandom integer between 0 and maxValue-1, inclusive.
+ *   return value: A pseudorandom integer between 0 and maxValue-1, inclusive.                    *
  **************************************************************************************************/
 int Random::nextInt(int maxValue){
-	return std::rand() % maxValue;
-}
\ No newline at end of file
+	return (int)(engine() % (unsigned int)maxValue);
+}
+
+/**************************************************************************************************
+ * Computes a 64-bit pseudorandom integer between 0 and maxValue-1, inclusive, for choosing among *
+ * more possibilities than fit in an int (such as the occurrences of a suffix in a very large     *
+ * corpus). Values that fit in 32 bits use a single output of the generator, like nextInt.        *
+ *   Inputs:                                                                                      *
+ *      maxValue: The upper bound on the pseudorandom number to be generated. Must not be 0.      *
+ *   return value: A pseudorandom integer between 0 and maxValue-1, inclusive.                    *
+ **************************************************************************************************/
+unsigned long long Random::nextLong(unsigned long long maxValue)
+{
+	if (maxValue <= 0xFFFFFFFFULL) return engine() % maxValue;
+	unsigned long long high = engine();
+	return ((high << 32) | engine()) % maxValue;
+}
+
+/**************************************************************************************************
+ * Computes a pseudorandom number in the range [0, 1), with 53 random bits (the full precision of *
+ * a double), for choosing in proportion to weights that are not whole numbers. Two outputs of    *
+ * the generator are combined, 27 bits from the first and 26 from the second, so the sequence is  *
+ * the same on every platform.                                                                    *
+ *   return value: A pseudorandom double between 0 (inclusive) and 1 (exclusive).                 *
+ **************************************************************************************************/
+double Random::nextDouble()
+{
+	unsigned long long high = engine() >> 5, low = engine() >> 6;
+	return (double)((high << 26) | low) / 9007199254740992.0;
+}
@@ -1,11 +1,13 @@
-// A wrapper class for the std::rand pseudorandom number generator.
+// A small pseudorandom number generator. Each instance owns its own generator state, so separate
+// instances may safely be used from separate threads.
 
 #pragma once
 
 #include <ctime>
-#include <cstdlib>
+#include <random>
 class Random
 {
+	std::mt19937 engine;
 public:
 	// Easy constructor.
 	Random();
@@ -15,5 +17,11 @@ public:
 
 	// Computes an pseudorandom integer between 0 and maxValue - 1, inclusive.
 	int nextInt(int maxVal);
+
+	// Computes a 64-bit pseudorandom integer between 0 and maxValue - 1, inclusive.
+	unsigned long long nextLong(unsigned long long maxValue);
+
+	// Computes a pseudorandom double-precision number in the range [0, 1).
+	double nextDouble();
 };
 
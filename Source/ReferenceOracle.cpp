@@ -0,0 +1,741 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * A differential test oracle for the Markov engine. The reference is the definition of what a    *
+ * trained chain is, written as plainly as possible and kept apart from the engine: the texts are *
+ * split into tokens by a simple loop of its own, and every <Prefix, Suffix> pair, as token       *
+ * strings, is counted in a std::map. It shares no code with the backends, StringChain included,  *
+ * because every one of them has been rewritten for speed (token IDs, Prefix views, compact and   *
+ * shared Suffix distributions, token loops compiled per policy), and a reference built from any  *
+ * of those parts could not catch a mistake in them. It should stay as it is unless what a chain  *
+ * means changes.                                                                                 *
+ *                                                                                                *
+ * Every route to a chain (StringChain, the IngestPipeline, the out-of-core, concurrent and bulk  *
+ * trainers and their model files, merging, compiling, compacting, archiving, the context trie)   *
+ * must reproduce the reference's counts exactly, so the oracle trains the same texts both ways   *
+ * and compares complete tables rather than spot checks. Texts are written to temporary UTF-8     *
+ * files so that the other backends read them the way they read real input.                       *
+ *                                                                                                *
+ * Sampling cannot be compared exactly, so it is tested statistically: for the most frequent      *
+ * Prefixes, many Suffixes are drawn from the compiled chain and compared with the reference      *
+ * counts using Pearson's chi-square test. A mixture of submodels is tested the same way, against *
+ * a reference trained on every submodel's texts as many times as the submodel's weight. The      *
+ * critical value is set for a false alarm rate of 1 in 10,000 per Prefix, and since the random   *
+ * number generator is seeded, a given build either always passes or always fails.                *
+ **************************************************************************************************/
+
+#include "ReferenceOracle.h"
+#include "BulkTrainer.h"
+#include "CompiledChain.h"
+#include "ConcurrentTrainer.h"
+#include "ContextTrie.h"
+#include "FilePath.h"
+#include "IngestPipeline.h"
+#include "MixtureChain.h"
+#include "ModelArchive.h"
+#include "ModelFile.h"
+#include "OutOfCoreTrainer.h"
+#include "StringChain.h"
+#include "TokenPolicy.h"
+#include "Utf8Encoder.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cwctype>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+	// The sort buffer of the out-of-core trainer is kept at its minimum, so that even small texts
+	// are spilled to several runs and merged.
+	const size_t MEMORY_BUDGET = 1;
+
+	// The normal deviate that a chi-square statistic may exceed with probability 1 in 10,000.
+	const double CRITICAL_DEVIATE = 3.719;
+
+	// Returns text as a text-mode stream reads it, with every "\r\n" turned into "\n". The backends
+	// read their files that way.
+	std::wstring TextMode(const std::wstring & text)
+	{
+		std::wstring converted;
+		for (size_t c = 0; c < text.size(); ++c)
+		{
+			if (text[c] != L'\r' || c + 1 == text.size() || text[c + 1] != L'\n') converted += text[c];
+		}
+		return converted;
+	}
+
+	// Splits a text into tokens for the reference. In "words" mode a token is a run of characters
+	// that are not whitespace; in "punctuation" mode each such word is split further, into one
+	// token for every punctuation mark at its start or end and one for what lies between; in any
+	// other mode every character is a token.
+	std::vector<std::wstring> ReferenceTokens(const std::wstring & text, const std::wstring & tokenType)
+	{
+		std::vector<std::wstring> tokens;
+		if (tokenType != L"words" && tokenType != L"punctuation")
+		{
+			for (size_t c = 0; c < text.size(); ++c) tokens.push_back(std::wstring(1, text[c]));
+			return tokens;
+		}
+		size_t c = 0;
+		while (c < text.size())
+		{
+			if (std::iswspace(text[c]))
+			{
+				++c;
+				continue;
+			}
+			size_t start = c;
+			while (c < text.size() && !std::iswspace(text[c])) ++c;
+			size_t stop = c;
+			if (tokenType == L"words")
+			{
+				tokens.push_back(text.substr(start, stop - start));
+				continue;
+			}
+			while (start < stop && std::iswpunct(text[start])) tokens.push_back(text.substr(start++, 1));
+			size_t middleEnd = stop;
+			while (middleEnd > start && std::iswpunct(text[middleEnd - 1])) --middleEnd;
+			if (middleEnd > start) tokens.push_back(text.substr(start, middleEnd - start));
+			for (size_t k = middleEnd; k < stop; ++k) tokens.push_back(text.substr(k, 1));
+		}
+		return tokens;
+	}
+
+	// Writes a token in a readable form: quoted, with whitespace and other control characters
+	// escaped. The non-word token is written as <nonword>.
+	std::wstring Quote(const std::wstring & token)
+	{
+		if (token == NONWORD) return L"<nonword>";
+		std::wstring quoted = L"\"";
+		for (size_t i = 0; i < token.size(); ++i)
+		{
+			if (token[i] == L'\n') quoted += L"\\n";
+			else if (token[i] == L'\t') quoted += L"\\t";
+			else if ((unsigned long)token[i] < 0x20) quoted += L"\\x" + std::to_wstring((unsigned long)token[i]);
+			else quoted += token[i];
+		}
+		return quoted + L"\"";
+	}
+
+	// Writes a Prefix in a readable form.
+	std::wstring DescribePrefix(const std::vector<std::wstring> & prefix)
+	{
+		std::wstring description = L"<";
+		for (size_t i = 0; i < prefix.size(); ++i) description += (i > 0 ? L" " : L"") + Quote(prefix[i]);
+		return description + L">";
+	}
+
+	// Writes a <Prefix, Suffix> pair (Prefix tokens followed by the Suffix) in a readable form.
+	std::wstring DescribePair(const std::vector<std::wstring> & pair)
+	{
+		std::wstring description = L"<";
+		for (size_t i = 0; i + 1 < pair.size(); ++i) description += Quote(pair[i]) + L" ";
+		return description + L"-> " + Quote(pair.back()) + L">";
+	}
+
+	// Approximates the critical value of the chi-square distribution with the given degrees of
+	// freedom (Wilson and Hilferty's approximation).
+	double CriticalChiSquare(int degreesOfFreedom)
+	{
+		const double k = degreesOfFreedom;
+		const double root = 1 - 2 / (9 * k) + CRITICAL_DEVIATE * std::sqrt(2 / (9 * k));
+		return k * root * root * root;
+	}
+}
+
+/**************************************************************************************************
+ * Constructor. Counts the reference's pairs.                                                     *
+ *   Inputs:                                                                                      *
+ *      order: How many words or characters per Prefix.                                           *
+ *      tokenType: "words" or "characters".                                                       *
+ *      texts: The texts to train on. Each is a separate input, as a separate file would be.      *
+ *      tempDirectory: Where the temporary text and model files are created.                      *
+ **************************************************************************************************/
+ReferenceOracle::ReferenceOracle(int order, const std::wstring & tokenType,
+                                 const std::vector<std::wstring> & texts, const std::wstring & tempDirectory)
+	: order(order), tokenType(tokenType), tempDirectory(tempDirectory), texts(texts)
+{
+	reference = TrainReference(order, tokenType, texts, 0, texts.size());
+}
+
+/**************************************************************************************************
+ * Destructor. Deletes the temporary files.                                                       *
+ **************************************************************************************************/
+ReferenceOracle::~ReferenceOracle()
+{
+	for (size_t i = 0; i < tempFiles.size(); ++i) RemoveFile(tempFiles[i]);
+}
+
+/**************************************************************************************************
+ * Counts the <Prefix, Suffix> pairs of some of the texts, as the reference (see the top of this  *
+ * file). A window of order tokens slides over the texts, starting out as order non-words; every  *
+ * token is counted as the Suffix of the window before it and then shifted into the window. Each  *
+ * text is followed by order non-words, which leave the window full of non-words for the next     *
+ * one, and if nothing at all has been counted by the end of a text (the texts so far are all     *
+ * empty), a single non-word is counted first, so that the chain is never empty. The backends     *
+ * read their files through a text-mode stream, which turns every "\r\n" into "\n", so the texts  *
+ * are split the same way.                                                                        *
+ *   Inputs:                                                                                      *
+ *      order: How many words or characters per Prefix.                                           *
+ *      tokenType: "words" or "characters".                                                       *
+ *      texts: The texts.                                                                         *
+ *      first, last: The range of texts to train on.                                              *
+ *   return value: The trained chain's counts.                                                    *
+ **************************************************************************************************/
+ReferenceOracle::Table ReferenceOracle::TrainReference(int order, const std::wstring & tokenType,
+                                                       const std::vector<std::wstring> & texts,
+                                                       size_t first, size_t last)
+{
+	Table table;
+	std::vector<std::wstring> window(order, NONWORD);
+	auto count = [&](const std::wstring & token) {
+		std::vector<std::wstring> pair(window);
+		pair.push_back(token);
+		table[pair]++;
+		if (order > 0)
+		{
+			window.erase(window.begin());
+			window.push_back(token);
+		}
+	};
+	for (size_t i = first; i < last; ++i)
+	{
+		std::vector<std::wstring> tokens = ReferenceTokens(TextMode(texts[i]), tokenType);
+		for (size_t t = 0; t < tokens.size(); ++t) count(tokens[t]);
+		if (table.empty()) count(NONWORD);
+		for (int k = 0; k < order; ++k) count(NONWORD);
+	}
+	return table;
+}
+
+/**************************************************************************************************
+ * Returns the name for a new temporary file, and remembers it so that the destructor deletes it. *
+ *   Inputs:                                                                                      *
+ *      extension: The file name extension, including the dot.                                    *
+ *   return value: The full path of the file.                                                     *
+ **************************************************************************************************/
+std::wstring ReferenceOracle::NewTempName(const std::wstring & extension)
+{
+	static const long long started = std::chrono::steady_clock::now().time_since_epoch().count();
+	std::wstring name = tempDirectory;
+	if (!name.empty() && name.back() != L'/' && name.back() != L'\\') name += L'/';
+	name += L"markov-oracle-" + std::to_wstring(started) + L"-" + std::to_wstring((unsigned long long)this) +
+		L"-" + std::to_wstring(nextFileNumber++) + extension;
+	tempFiles.push_back(name);
+	return name;
+}
+
+/**************************************************************************************************
+ * Writes some of the texts to temporary files, encoded as UTF-8.                                 *
+ *   Inputs:                                                                                      *
+ *      first, last: The range of texts to write.                                                 *
+ *   return value: The names of the files, in the same order as the texts.                        *
+ **************************************************************************************************/
+std::vector<std::wstring> ReferenceOracle::WriteTexts(size_t first, size_t last)
+{
+	std::vector<std::wstring> files;
+	for (size_t i = first; i < last; ++i)
+	{
+		files.push_back(NewTempName(L".txt"));
+		std::ofstream file(NativePath(files.back()), std::ios::binary);
+		file << EncodeUtf8(texts[i]);
+	}
+	return files;
+}
+
+/**************************************************************************************************
+ * Trains a model file out of core.                                                               *
+ *   Inputs:                                                                                      *
+ *      files: The text files to train on.                                                        *
+ *   return value: The name of the model file, or an empty string if it could not be written.     *
+ **************************************************************************************************/
+std::wstring ReferenceOracle::TrainModelFile(const std::vector<std::wstring> & files)
+{
+	OutOfCoreTrainer trainer(order, tokenType, tempDirectory, MEMORY_BUDGET);
+	IngestPipeline pipeline(tokenType);
+	pipeline.Run(files, trainer);
+	std::wstring model = NewTempName(L".mkv");
+	return trainer.WriteModel(model) ? model : L"";
+}
+
+/**************************************************************************************************
+ * The reference's counts.                                                                        *
+ *   return value: The table of every <Prefix, Suffix> pair that the reference counts.            *
+ **************************************************************************************************/
+const ReferenceOracle::Table & ReferenceOracle::Reference() const
+{
+	return reference;
+}
+
+/**************************************************************************************************
+ * Compares two tables of counts.                                                                 *
+ *   Inputs:                                                                                      *
+ *      expected: The correct counts.                                                             *
+ *      actual: The counts to check.                                                              *
+ *   return value: An empty string if the tables are equal. Otherwise, a description of the first *
+ *                 pair (in sorted order) that is missing, extra, or counted differently, and of  *
+ *                 how many pairs differ in all.                                                  *
+ **************************************************************************************************/
+std::wstring ReferenceOracle::Compare(const Table & expected, const Table & actual)
+{
+	std::wstring first;
+	size_t differences = 0;
+	auto e = expected.begin();
+	auto a = actual.begin();
+	while (e != expected.end() || a != actual.end())
+	{
+		std::wstring difference;
+		if (a == actual.end() || (e != expected.end() && e->first < a->first))
+		{
+			difference = DescribePair(e->first) + L" is missing";
+			++e;
+		}
+		else if (e == expected.end() || a->first < e->first)
+		{
+			difference = DescribePair(a->first) + L" should not be there";
+			++a;
+		}
+		else
+		{
+			if (e->second != a->second)
+			{
+				difference = DescribePair(e->first) + L" is counted " + std::to_wstring(a->second) +
+					L" times instead of " + std::to_wstring(e->second);
+			}
+			++e;
+			++a;
+		}
+		if (difference.empty()) continue;
+		if (differences++ == 0) first = difference;
+	}
+	if (differences == 0) return L"";
+	return first + L" (" + std::to_wstring(differences) + (differences == 1 ? L" pair differs)" : L" pairs differ)");
+}
+
+/**************************************************************************************************
+ * The counts of a StringChain.                                                                   *
+ *   Inputs:                                                                                      *
+ *      chain: The chain.                                                                         *
+ *   return value: The table of every <Prefix, Suffix> pair that the chain contains.              *
+ **************************************************************************************************/
+ReferenceOracle::Table ReferenceOracle::TableOf(const StringChain & chain)
+{
+	Table table;
+	chain.ForEachPair([&table](const std::list<std::wstring> & prefix, const std::wstring & suffix,
+	                           unsigned long long count) {
+		std::vector<std::wstring> pair(prefix.begin(), prefix.end());
+		pair.push_back(suffix);
+		table[pair] += count;
+	});
+	return table;
+}
+
+/**************************************************************************************************
+ * The counts of a CompiledChain.                                                                 *
+ *   Inputs:                                                                                      *
+ *      chain: The chain.                                                                         *
+ *   return value: The table of every <Prefix, Suffix> pair that the chain contains.              *
+ **************************************************************************************************/
+ReferenceOracle::Table ReferenceOracle::TableOf(const CompiledChain & chain)
+{
+	Table table;
+	chain.ForEachPair([&table](const std::list<std::wstring> & prefix, const std::wstring & suffix,
+	                           unsigned long long count) {
+		std::vector<std::wstring> pair(prefix.begin(), prefix.end());
+		pair.push_back(suffix);
+		table[pair] += count;
+	});
+	return table;
+}
+
+/**************************************************************************************************
+ * The counts stored in a model file. Records are added up rather than assigned, so that a file   *
+ * that stores a pair twice (which a correct file never does) shows up as a wrong count.          *
+ *   Inputs:                                                                                      *
+ *      modelFile: The path of the model file.                                                    *
+ *   return value: The table of every <Prefix, Suffix> pair that the file contains, or an empty   *
+ *                 table if the file cannot be opened.                                            *
+ **************************************************************************************************/
+ReferenceOracle::Table ReferenceOracle::TableOf(const std::wstring & modelFile)
+{
+	Table table;
+	ModelReader model;
+	if (!model.Open(modelFile)) return table;
+	const Vocabulary & vocabulary = model.GetVocabulary();
+	std::vector<unsigned int> key(model.Order() + 1);
+	unsigned long long count;
+	while (model.Next(key.data(), count))
+	{
+		std::vector<std::wstring> pair;
+		for (size_t i = 0; i < key.size(); ++i) pair.push_back(vocabulary.Token(key[i]));
+		table[pair] += count;
+	}
+	return table;
+}
+
+/**************************************************************************************************
+ * The counts of one of the chains held in a frozen ContextTrie.                                  *
+ *   Inputs:                                                                                      *
+ *      trie: The trie.                                                                           *
+ *      order: The order of the chain, from 1 to trie.MaxOrder().                                 *
+ *   return value: The table of every <Prefix, Suffix> pair of that order that the trie contains. *
+ **************************************************************************************************/
+ReferenceOracle::Table ReferenceOracle::TableOf(const ContextTrie & trie, int order)
+{
+	Table table;
+	const Vocabulary & vocabulary = trie.GetVocabulary();
+	trie.ForEachRecord(order, [&](const unsigned int * key, unsigned long long count) {
+		std::vector<std::wstring> pair;
+		for (int i = 0; i <= order; ++i) pair.push_back(vocabulary.Token(key[i]));
+		table[pair] += count;
+	});
+	return table;
+}
+
+/**************************************************************************************************
+ * Trains the texts with every backend and compares each result with the reference. The backends  *
+ * are checked in the order in which they depend on one another, so the first one reported is the *
+ * most likely culprit:                                                                           *
+ *   1. a StringChain fed by AddItems() from streams;                                             *
+ *   2. a StringChain fed by the IngestPipeline from UTF-8 files;                                 *
+ *   3. the same StringChain once its Suffixes are compacted;                                     *
+ *   4. a CompiledChain compiled from it;                                                         *
+ *   5. a ContextTrie of two orders more, fed by the IngestPipeline, read at this order and at    *
+ *     its own (which is compared with the reference of that order);                              *
+ *   6. a CompiledChain compiled from the trie at this order;                                     *
+ *   7. a model file trained out of core;                                                         *
+ *   8. a model file trained in memory by a ConcurrentTrainer, three files at a time;             *
+ *   9. a model file written by a BulkTrainer, and a CompiledChain compiled from the BulkTrainer; *
+ *   10. a CompiledChain loaded from the out-of-core model file;                                  *
+ *   11. a StringChain loaded from the model file;                                                *
+ *   12. the model file, packed into an archive and unpacked again;                               *
+ *   13. the model files of the first and second halves of the texts, merged;                     *
+ *   14. a model file of the first text, with each of the others appended as a delta segment;     *
+ *   15. a CompiledChain loaded from that model file;                                             *
+ *   16. the same model file, compacted.                                                          *
+ *                                                                                                *
+ *   return value: An empty string if every backend matches the reference. Otherwise, the name of *
+ *                 the first backend that does not, and the first difference.                     *
+ **************************************************************************************************/
+std::wstring ReferenceOracle::CheckBackends()
+{
+	std::wstring difference;
+	std::vector<std::wstring> files = WriteTexts(0, texts.size());
+
+	StringChain streamed(order);
+	for (size_t i = 0; i < texts.size(); ++i)
+	{
+		std::wistringstream stream(TextMode(texts[i]));
+		streamed.AddItems(stream, tokenType);
+	}
+	difference = Compare(reference, TableOf(streamed));
+	if (!difference.empty()) return L"StringChain::AddItems: " + difference;
+
+	StringChain chain(order);
+	IngestPipeline pipeline(tokenType);
+	pipeline.Run(files, chain);
+	difference = Compare(reference, TableOf(chain));
+	if (!difference.empty()) return L"IngestPipeline: " + difference;
+	chain.CompactSuffixes();
+	difference = Compare(reference, TableOf(chain));
+	if (!difference.empty()) return L"StringChain::CompactSuffixes: " + difference;
+
+	CompiledChain compiled;
+	compiled.Compile(chain, order, tokenType);
+	difference = Compare(reference, TableOf(compiled));
+	if (!difference.empty()) return L"CompiledChain::Compile: " + difference;
+
+	// A trie serves every order up to its own, so the trie is deeper than the chain it is compared
+	// with, and its deepest level is checked too:
+	ContextTrie trie(order + 2, tokenType);
+	IngestPipeline triePipeline(tokenType);
+	triePipeline.Run(files, trie);
+	trie.Freeze();
+	difference = Compare(reference, TableOf(trie, order));
+	if (!difference.empty()) return L"ContextTrie: " + difference;
+	difference = Compare(TrainReference(order + 2, tokenType, texts, 0, texts.size()), TableOf(trie, order + 2));
+	if (!difference.empty()) return L"ContextTrie (order " + std::to_wstring(order + 2) + L"): " + difference;
+	CompiledChain fromTrie;
+	fromTrie.Compile(trie, order);
+	difference = Compare(reference, TableOf(fromTrie));
+	if (!difference.empty()) return L"CompiledChain::Compile (from a ContextTrie): " + difference;
+
+	std::wstring model = TrainModelFile(files);
+	if (model.empty()) return L"OutOfCoreTrainer: the model file could not be written";
+	difference = Compare(reference, TableOf(model));
+	if (!difference.empty()) return L"OutOfCoreTrainer: " + difference;
+
+	std::wstring concurrentModel = NewTempName(L".mkv");
+	ConcurrentTrainer concurrent(order, tokenType);
+	concurrent.Train(files, 3);
+	if (!concurrent.WriteModel(concurrentModel)) return L"ConcurrentTrainer: the model file could not be written";
+	difference = Compare(reference, TableOf(concurrentModel));
+	if (!difference.empty()) return L"ConcurrentTrainer: " + difference;
+
+	BulkTrainer bulk(order, tokenType);
+	IngestPipeline bulkPipeline(tokenType);
+	bulkPipeline.Run(files, bulk);
+	std::wstring bulkModel = NewTempName(L".mkv");
+	if (!bulk.WriteModel(bulkModel)) return L"BulkTrainer: the model file could not be written";
+	difference = Compare(reference, TableOf(bulkModel));
+	if (!difference.empty()) return L"BulkTrainer: " + difference;
+	CompiledChain fromBulk;
+	fromBulk.Compile(bulk);
+	difference = Compare(reference, TableOf(fromBulk));
+	if (!difference.empty()) return L"CompiledChain::Compile (from a BulkTrainer): " + difference;
+
+	ModelReader reader;
+	CompiledChain loaded;
+	if (!reader.Open(model) || !loaded.Load(reader)) return L"CompiledChain::Load: the model file could not be read";
+	difference = Compare(reference, TableOf(loaded));
+	if (!difference.empty()) return L"CompiledChain::Load: " + difference;
+
+	ModelReader secondReader;
+	StringChain fromModel(order);
+	if (!secondReader.Open(model) || !fromModel.AddModel(secondReader))
+	{
+		return L"StringChain::AddModel: the model file could not be read";
+	}
+	difference = Compare(reference, TableOf(fromModel));
+	if (!difference.empty()) return L"StringChain::AddModel: " + difference;
+
+	// An archive renumbers the tokens, which the table of token strings does not see:
+	{
+		std::wstring archive = NewTempName(L".mka"), unpacked = NewTempName(L".mkv");
+		std::wstring error;
+		if (!PackModel(model, archive, tempDirectory, MEMORY_BUDGET, error)) return L"PackModel: " + error;
+		if (!UnpackModel(archive, unpacked, error)) return L"UnpackModel: " + error;
+		difference = Compare(reference, TableOf(unpacked));
+		if (!difference.empty()) return L"PackModel and UnpackModel: " + difference;
+	}
+
+	// Merging adds up the counts of chains trained separately, so it is compared with the sum of
+	// two references:
+	if (texts.size() >= 2)
+	{
+		const size_t middle = texts.size() / 2;
+		std::vector<std::wstring> models;
+		models.push_back(TrainModelFile(std::vector<std::wstring>(files.begin(), files.begin() + middle)));
+		models.push_back(TrainModelFile(std::vector<std::wstring>(files.begin() + middle, files.end())));
+		std::wstring merged = NewTempName(L".mkv");
+		std::wstring error;
+		if (!OutOfCoreTrainer::MergeModels(models, merged, tempDirectory, MEMORY_BUDGET, error))
+		{
+			return L"OutOfCoreTrainer::MergeModels: " + error;
+		}
+		Table expected = TrainReference(order, tokenType, texts, 0, middle);
+		Table second = TrainReference(order, tokenType, texts, middle, texts.size());
+		for (auto it = second.begin(); it != second.end(); ++it) expected[it->first] += it->second;
+		difference = Compare(expected, TableOf(merged));
+		if (!difference.empty()) return L"OutOfCoreTrainer::MergeModels: " + difference;
+	}
+
+	// Appending the texts one by one is the same as training them one after another:
+	if (texts.size() >= 2)
+	{
+		std::wstring grown = TrainModelFile(std::vector<std::wstring>(files.begin(), files.begin() + 1));
+		for (size_t i = 1; i < files.size(); ++i)
+		{
+			OutOfCoreTrainer trainer(order, tokenType, tempDirectory, MEMORY_BUDGET);
+			{
+				ModelReader model;
+				if (!model.Open(grown)) return L"OutOfCoreTrainer::AppendDelta: the model file could not be read";
+				trainer.ContinueModel(model);
+			}
+			IngestPipeline deltaPipeline(tokenType);
+			deltaPipeline.Run(std::vector<std::wstring>(1, files[i]), trainer);
+			if (!trainer.AppendDelta(grown)) return L"OutOfCoreTrainer::AppendDelta: the segment could not be added";
+		}
+		difference = Compare(reference, TableOf(grown));
+		if (!difference.empty()) return L"OutOfCoreTrainer::AppendDelta: " + difference;
+
+		{
+			ModelReader deltaReader; // closed before compaction replaces the file
+			CompiledChain fromDeltas;
+			if (!deltaReader.Open(grown) || !fromDeltas.Load(deltaReader)) 
+			{
+				return L"CompiledChain::Load (with deltas): the model file could not be read";
+			}
+			difference = Compare(reference, TableOf(fromDeltas));
+			if (!difference.empty()) return L"CompiledChain::Load (with deltas): " + difference;
+		}
+
+		std::wstring error;
+		if (!CompactModel(grown, error)) return L"CompactModel: " + error;
+		difference = Compare(reference, TableOf(grown));
+		if (!difference.empty()) return L"CompactModel: " + difference;
+	}
+	return L"";
+}
+
+/**************************************************************************************************
+ * Checks that a chain draws Suffixes in proportion to the reference counts. The Prefixes with    *
+ * the most occurrences and at least two different Suffixes are tested (Prefixes that contain the *
+ * non-word cannot be given as a context, and are skipped). For each one, Suffixes are drawn by   *
+ * generating a single token from the Prefix with the chain's GenerateFrom(), and the numbers of  *
+ * times each Suffix is drawn are compared with the expected numbers using Pearson's chi-square   *
+ * test. Suffixes that are expected fewer than five times are pooled, as the test requires.       *
+ *   Inputs:                                                                                      *
+ *      generateFrom: Calls the chain's GenerateFrom(), to generate a single token after a        *
+ *                    context.                                                                    *
+ *      rand: The random number generator used for drawing.                                       *
+ *      numPrefixes: The number of Prefixes to test.                                              *
+ *      drawsPerPrefix: The number of Suffixes to draw from each.                                 *
+ *   return value: An empty string if every Prefix passes. Otherwise, a description of the Prefix *
+ *                 whose chi-square statistic exceeds its critical value by the widest margin, or *
+ *                 of a Suffix that was drawn but never followed its Prefix.                      *
+ **************************************************************************************************/
+std::wstring ReferenceOracle::CheckDraws(const Sampler & generateFrom, Random & rand, int numPrefixes, 
+                                         int drawsPerPrefix) const
+{
+	// Group the reference's Suffixes by Prefix:
+	typedef std::map<std::wstring, unsigned long long> Suffixes;
+	std::map<std::vector<std::wstring>, Suffixes> prefixes;
+	for (auto it = reference.begin(); it != reference.end(); ++it)
+	{
+		std::vector<std::wstring> prefix(it->first.begin(), it->first.end() - 1);
+		if (std::find(prefix.begin(), prefix.end(), NONWORD) != prefix.end()) continue;
+		prefixes[prefix][it->first.back()] += it->second;
+	}
+
+	// Choose the most frequent Prefixes:
+	std::vector<std::pair<unsigned long long, const std::vector<std::wstring> *>> candidates;
+	for (auto it = prefixes.begin(); it != prefixes.end(); ++it)
+	{
+		if (it->second.size() < 2) continue;
+		unsigned long long total = 0;
+		for (auto s = it->second.begin(); s != it->second.end(); ++s) total += s->second;
+		candidates.push_back(std::make_pair(total, &it->first));
+	}
+	std::sort(candidates.begin(), candidates.end(),
+	          [](const std::pair<unsigned long long, const std::vector<std::wstring> *> & a,
+	             const std::pair<unsigned long long, const std::vector<std::wstring> *> & b) {
+		return a.first != b.first ? a.first > b.first : *a.second < *b.second;
+	});
+	if (candidates.size() > (size_t)numPrefixes) candidates.resize(numPrefixes);
+
+	// How the tokens of a context are separated, and how the chain writes tokens out:
+	bool separated = false;
+	void (*append)(std::wstring & output, const std::wstring & token) = NULL;
+	VisitTokenPolicy(tokenType, [&](auto policy) {
+		separated = decltype(policy)::WHITESPACE_SEPARATES;
+		append = &decltype(policy)::Append;
+	});
+
+	std::wstring worst;
+	double worstRatio = 1;
+	std::wstring output;
+	for (size_t c = 0; c < candidates.size(); ++c)
+	{
+		const std::vector<std::wstring> & prefix = *candidates[c].second;
+		const Suffixes & expected = prefixes.find(prefix)->second;
+		std::wstring context, written;
+		for (size_t i = 0; i < prefix.size(); ++i)
+		{
+			if (separated && i > 0) context += L' ';
+			context += prefix[i];
+			append(written, prefix[i]);
+		}
+		// The Suffix that each text drawn after the Prefix stands for:
+		std::map<std::wstring, std::wstring> suffixOfText;
+		for (auto s = expected.begin(); s != expected.end(); ++s)
+		{
+			std::wstring text;
+			if (s->first != NONWORD) append(text, s->first);
+			suffixOfText[text] = s->first;
+		}
+
+		Suffixes drawn;
+		for (int d = 0; d < drawsPerPrefix; ++d)
+		{
+			output.clear();
+			if (!generateFrom(context, rand, output) || output.compare(0, written.size(), written) != 0)
+			{
+				return L"the Prefix " + DescribePrefix(prefix) + L" cannot be found";
+			}
+			std::wstring suffix = output.substr(written.size());
+			auto known = suffixOfText.find(suffix);
+			if (known == suffixOfText.end())
+			{
+				std::vector<std::wstring> pair = prefix;
+				pair.push_back(suffix);
+				return DescribePair(pair) + L" was drawn, but never occurred";
+			}
+			drawn[known->second]++;
+		}
+
+		// Pearson's statistic, with the Suffixes expected fewer than five times pooled into one bin:
+		const double total = (double)candidates[c].first;
+		double statistic = 0, pooledExpected = 0, pooledObserved = 0;
+		int bins = 0;
+		for (auto s = expected.begin(); s != expected.end(); ++s)
+		{
+			double expectedDraws = drawsPerPrefix * (s->second / total);
+			double observedDraws = drawn.count(s->first) ? (double)drawn[s->first] : 0;
+			if (expectedDraws < 5)
+			{
+				pooledExpected += expectedDraws;
+				pooledObserved += observedDraws;
+				continue;
+			}
+			statistic += (observedDraws - expectedDraws) * (observedDraws - expectedDraws) / expectedDraws;
+			++bins;
+		}
+		if (pooledExpected > 0)
+		{
+			statistic += (pooledObserved - pooledExpected) * (pooledObserved - pooledExpected) / pooledExpected;
+			++bins;
+		}
+		if (bins < 2) continue;
+		const double critical = CriticalChiSquare(bins - 1);
+		if (statistic / critical > worstRatio)
+		{
+			worstRatio = statistic / critical;
+			worst = L"the Suffixes of " + DescribePrefix(prefix) + L" give a chi-square of " +
+				std::to_wstring(statistic) + L" with " + std::to_wstring(bins - 1) +
+				L" degrees of freedom (critical value " + std::to_wstring(critical) + L")";
+		}
+	}
+	return worst;
+}
+
+/**************************************************************************************************
+ * Checks that a compiled chain draws Suffixes in proportion to the reference counts (see         *
+ * CheckDraws()).                                                                                 *
+ *   Inputs:                                                                                      *
+ *      chain: A chain compiled from the same texts as the reference.                             *
+ *      rand: The random number generator used for drawing.                                       *
+ *      numPrefixes: The number of Prefixes to test.                                              *
+ *      drawsPerPrefix: The number of Suffixes to draw from each.                                 *
+ *   return value: An empty string if every Prefix passes, or else a description of the worst     *
+ *                 one.                                                                           *
+ **************************************************************************************************/
+std::wstring ReferenceOracle::CheckSampling(const CompiledChain & chain, Random & rand, int numPrefixes,
+                                            int drawsPerPrefix) const
+{
+	return CheckDraws([&chain](const std::wstring & context, Random & rand, std::wstring & output) {
+		return chain.GenerateFrom(context, 1, rand, output);
+	}, rand, numPrefixes, drawsPerPrefix);
+}
+
+/**************************************************************************************************
+ * Checks that a mixture of submodels draws Suffixes in proportion to the reference counts (see   *
+ * CheckDraws()). The reference must have been trained on every submodel's texts, each as many    *
+ * times as its weight.                                                                           *
+ *   Inputs:                                                                                      *
+ *      mixture: The mixture. Its weights must be whole numbers.                                  *
+ *      rand: The random number generator used for drawing.                                       *
+ *      numPrefixes: The number of Prefixes to test.                                              *
+ *      drawsPerPrefix: The number of Suffixes to draw from each.                                 *
+ *   return value: An empty string if every Prefix passes, or else a description of the worst     *
+ *                 one.                                                                           *
+ **************************************************************************************************/
+std::wstring ReferenceOracle::CheckSampling(const MixtureChain & mixture, Random & rand, int numPrefixes,
+                                            int drawsPerPrefix) const
+{
+	return CheckDraws([&mixture](const std::wstring & context, Random & rand, std::wstring & output) {
+		return mixture.GenerateFrom(context, 1, rand, output);
+	}, rand, numPrefixes, drawsPerPrefix);
+}
@@ -0,0 +1,88 @@
+// Checks every way of training and sampling a Markov chain against a reference: a plain table of
+// <Prefix, Suffix> counts, built by a tokenizer loop of its own that shares no code with any
+// backend. Every backend must arrive at exactly the same counts from the same texts, and a compiled
+// chain must draw each Suffix with the probability that the counts give it. Used by the selftest
+// console command.
+
+#pragma once
+
+#include "Random.h"
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+class StringChain;
+class CompiledChain;
+class ContextTrie;
+class MixtureChain;
+
+class ReferenceOracle
+{
+public:
+	// The counts of a chain: for every <Prefix, Suffix> pair, the Prefix's tokens followed by the
+	// Suffix, and the number of times the pair occurs.
+	typedef std::map<std::vector<std::wstring>, unsigned long long> Table;
+
+private:
+	const int order;
+	const std::wstring tokenType;
+	const std::wstring tempDirectory;
+	const std::vector<std::wstring> texts;
+	Table reference;
+	std::vector<std::wstring> tempFiles; // deleted by the destructor
+	unsigned int nextFileNumber = 0;
+
+	// Counts the pairs of texts[first] to texts[last - 1], as the reference.
+	static Table TrainReference(int order, const std::wstring & tokenType,
+	                            const std::vector<std::wstring> & texts, size_t first, size_t last);
+	// Generates a single token after a context, and appends both to output. Returns false if the
+	// context cannot be continued.
+	typedef std::function<bool(const std::wstring & context, Random & rand, std::wstring & output)> Sampler;
+	// Compares the Suffixes that generateFrom draws after the most frequent Prefixes with the reference.
+	std::wstring CheckDraws(const Sampler & generateFrom, Random & rand, int numPrefixes, 
+	                        int drawsPerPrefix) const;
+	// Returns the name for a new temporary file, which the destructor will delete.
+	std::wstring NewTempName(const std::wstring & extension);
+	// Writes texts[first] to texts[last - 1] to UTF-8 files, and returns their names.
+	std::vector<std::wstring> WriteTexts(size_t first, size_t last);
+	// Trains a model file out of core on the given text files. Returns its name, or "" on failure.
+	std::wstring TrainModelFile(const std::vector<std::wstring> & files);
+
+public:
+	// Constructor. Counts the reference's pairs in texts, each of which is a separate input.
+	// Temporary files are created in tempDirectory.
+	ReferenceOracle(int order, const std::wstring & tokenType, const std::vector<std::wstring> & texts,
+	                const std::wstring & tempDirectory);
+
+	// Destructor. Deletes the temporary files.
+	~ReferenceOracle();
+
+	// The reference's counts.
+	const Table & Reference() const;
+
+	// Compares two tables. Returns "" if they are equal, or else describes the first difference.
+	static std::wstring Compare(const Table & expected, const Table & actual);
+
+	// The counts of a chain trained by another backend. A model file that cannot be read yields an
+	// empty table.
+	static Table TableOf(const StringChain & chain);
+	static Table TableOf(const CompiledChain & chain);
+	static Table TableOf(const std::wstring & modelFile);
+	static Table TableOf(const ContextTrie & trie, int order);
+
+	// Trains the texts with every backend and compares the results with the reference. Returns
+	// "" if all of them match, or else names the first backend that differs and how.
+	std::wstring CheckBackends();
+
+	// Compares the Suffixes that chain draws after the reference's most frequent Prefixes with the
+	// reference counts, using Pearson's chi-square test. Returns "" if every Prefix passes, or else
+	// describes the worst one.
+	std::wstring CheckSampling(const CompiledChain & chain, Random & rand, int numPrefixes,
+	                           int drawsPerPrefix) const;
+
+	// The same, for a mixture of submodels whose weights are whole numbers. The reference must have
+	// been trained on the texts of every submodel, each as many times as the submodel's weight.
+	std::wstring CheckSampling(const MixtureChain & mixture, Random & rand, int numPrefixes,
+	                           int drawsPerPrefix) const;
+};
@@ -0,0 +1,222 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Scores texts under a compiled Markov chain. The probability of a token is the number of times  *
+ * it followed the current Prefix in the training texts, divided by the number of times that      *
+ * Prefix was followed by anything. A token that never followed the Prefix (or a Prefix that      *
+ * never occurred, or a token that is not in the chain's vocabulary at all) gets a fixed floor    *
+ * probability instead, so that one unseen token does not make a whole text infinitely unlikely.  *
+ * Texts are scored the way they were trained: each starts from a Prefix of non-words, tokens are *
+ * split exactly as Tokenizer splits them, and the end of the text can be scored as the non-word  *
+ * that training appends.                                                                         *
+ *                                                                                                *
+ * Scoring is a walk through the chain like generation, except that the next token is read from   *
+ * the text instead of drawn at random. While the text follows known edges, the next state is     *
+ * simply the edge's target; after an unseen token the walk has to find its Prefix in the chain's *
+ * state index (see CompiledChain::FindState()).                                                  *
+ *                                                                                                *
+ * On a large model nearly every step is a cache miss, and a single walk cannot start the next    *
+ * lookup until the current one has finished. So each thread scores several texts at once, in     *
+ * lockstep: it first prefetches the state of every text, then their edges, and only then scores  *
+ * one token of each, by which time the data has (mostly) arrived. The misses of the different    *
+ * texts overlap instead of being paid one after another. Each block of texts is a task on a      *
+ * ThreadPool, so a thread that draws short texts simply takes more blocks.                       *
+ **************************************************************************************************/
+
+#include "Scorer.h"
+#include "TokenPolicy.h"
+#include <algorithm>
+#include <cmath>
+#include <cwctype>
+
+namespace
+{
+	// The number of texts whose lookups are interleaved on each thread.
+	const size_t GROUP_SIZE = 8;
+	// The number of texts in each of ScoreBatch()'s tasks.
+	const size_t BLOCK_SIZE = 256;
+}
+
+// The progress of one text through the chain.
+struct Scorer::Cursor
+{
+	const std::wstring * text;
+	size_t position;                  // the index of the next character to read
+	Score * score;
+	unsigned int state;               // the state of the current Prefix, or NO_STATE if there is none
+	std::vector<unsigned int> prefix; // the last order token IDs, with NO_STATE for unknown tokens
+	int knownTokens;                  // how many tokens since the last unknown one (capped at order)
+	bool endScored;
+	std::wstring token;               // holds the token being read, to avoid allocating for each one
+};
+
+/**************************************************************************************************
+ * Returns the perplexity of the text: the exponential of the negative mean log-probability of    *
+ * its tokens. Lower is better; a model that always predicted the right token with certainty      *
+ * would score 1.                                                                                 *
+ *   return value: The perplexity, or 1 for a text without tokens.                                *
+ **************************************************************************************************/
+double Scorer::Score::Perplexity() const
+{
+	return numTokens == 0 ? 1.0 : std::exp(-logLikelihood / (double)numTokens);
+}
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      chain: The compiled chain to score texts against. Must outlive the Scorer.                *
+ *      options: Settings that control how texts are scored.                                      *
+ **************************************************************************************************/
+Scorer::Scorer(const CompiledChain & chain, const Options & options) : chain(chain), options(options)
+{
+	logFloor = std::log(options.floorProbability);
+	startState = chain.StartState();
+}
+
+/**************************************************************************************************
+ * Scores a single text.                                                                          *
+ *   Inputs:                                                                                      *
+ *      text: The text to score.                                                                  *
+ *   return value: The text's score.                                                              *
+ **************************************************************************************************/
+Scorer::Score Scorer::ScoreText(const std::wstring & text) const
+{
+	Score score;
+	ScoreRange(&text, &score, 1);
+	return score;
+}
+
+/**************************************************************************************************
+ * Scores many texts at once, on the threads of Options::pool (or some of them, if there are not  *
+ * enough texts to keep them all busy).                                                           *
+ *   Inputs:                                                                                      *
+ *      texts: The texts to score.                                                                *
+ *   return value: The scores of the texts, in the same order as the texts.                       *
+ **************************************************************************************************/
+std::vector<Scorer::Score> Scorer::ScoreBatch(const std::vector<std::wstring> & texts) const
+{
+	std::vector<Score> scores(texts.size());
+	const size_t numBlocks = (texts.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	ThreadPool & pool = options.pool ? *options.pool : ThreadPool::Shared();
+	pool.ParallelFor(numBlocks, [&](size_t block) {
+		size_t begin = block * BLOCK_SIZE;
+		ScoreRange(&texts[begin], &scores[begin], std::min(BLOCK_SIZE, texts.size() - begin));
+	});
+	return scores;
+}
+
+/**************************************************************************************************
+ * Scores a range of texts on the calling thread. GROUP_SIZE texts are in progress at any time,   *
+ * and each round prefetches the data for one token of every text before scoring any of them.     *
+ * When a text ends, the next one takes its place. The chain's tokenizer policy is chosen once    *
+ * per range, and ScoreRangeWith() does the work.                                                 *
+ *   Inputs:                                                                                      *
+ *      texts: The first text to score.                                                           *
+ *      scores: Receives the score of each text.                                                  *
+ *      count: The number of texts.                                                               *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void Scorer::ScoreRange(const std::wstring * texts, Score * scores, size_t count) const
+{
+	VisitTokenPolicy(chain.TokenType(), [&](auto policy) {
+		ScoreRangeWith<decltype(policy)>(texts, scores, count);
+	});
+}
+
+/**************************************************************************************************
+ * ScoreRange(), for one tokenizer policy.                                                        *
+ *   Inputs:                                                                                      *
+ *      texts: The first text to score.                                                           *
+ *      scores: Receives the score of each text.                                                  *
+ *      count: The number of texts.                                                               *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+template <class Policy>
+void Scorer::ScoreRangeWith(const std::wstring * texts, Score * scores, size_t count) const
+{
+	const int order = chain.Order();
+	std::vector<Cursor> cursors(std::min(GROUP_SIZE, count));
+	size_t next = 0;
+	auto start = [&](Cursor & cursor) {
+		cursor.text = &texts[next];
+		cursor.score = &scores[next];
+		cursor.position = 0;
+		cursor.state = startState;
+		cursor.prefix.assign(order, Vocabulary::NONWORD_ID);
+		cursor.knownTokens = order;
+		cursor.endScored = false;
+		next++;
+	};
+	for (size_t i = 0; i < cursors.size(); ++i) start(cursors[i]);
+
+	size_t active = cursors.size();
+	while (active > 0)
+	{
+		for (size_t i = 0; i < active; ++i) chain.PrefetchState(cursors[i].state);
+		for (size_t i = 0; i < active; ++i) chain.PrefetchEdges(cursors[i].state);
+		for (size_t i = 0; i < active; )
+		{
+			if (Advance<Policy>(cursors[i])) ++i;
+			else if (next < count) start(cursors[i++]); // finished; the next text takes its place
+			else std::swap(cursors[i], cursors[--active]); // finished, and there is nothing left to start
+		}
+	}
+}
+
+/**************************************************************************************************
+ * Reads the next token of a cursor's text, adds its log-probability to the text's score, and     *
+ * moves the cursor on to the next Prefix.                                                        *
+ *   Inputs:                                                                                      *
+ *      cursor: The text's progress.                                                              *
+ *   return value: true if a token was scored, false if the text has ended.                       *
+ **************************************************************************************************/
+template <class Policy> bool Scorer::Advance(Cursor & cursor) const
+{
+	const std::wstring & text = *cursor.text;
+	const int order = chain.Order();
+
+	// Read the next token:
+	unsigned int id = Vocabulary::NONWORD_ID;
+	bool known = true;
+	size_t start = cursor.position;
+	if (Policy::WHITESPACE_SEPARATES)
+	{
+		while (start < text.size() && std::iswspace(text[start])) ++start;
+		size_t wordEnd = start;
+		while (wordEnd < text.size() && !std::iswspace(text[wordEnd])) ++wordEnd;
+		cursor.position = start;
+		if (wordEnd > start) cursor.position = Policy::TokenEnd(&text[start], text.data() + wordEnd) - text.data();
+	}
+	else cursor.position = std::min(start + 1, text.size());
+	if (cursor.position > start)
+	{
+		cursor.token.assign(text, start, cursor.position - start);
+		known = chain.FindToken(cursor.token, id);
+	}
+	else if (options.scoreEnd && !cursor.endScored) cursor.endScored = true; // the end scores as a non-word
+	else return false;
+
+	// Score it:
+	unsigned long long count, total;
+	unsigned int target = CompiledChain::NO_STATE;
+	bool found = known && cursor.state != CompiledChain::NO_STATE && 
+	             chain.FindEdge(cursor.state, id, count, total, target);
+	double logProbability = found ? std::log((double)count / (double)total) : logFloor;
+	if (!found) cursor.score->numUnseen++;
+	cursor.score->logLikelihood += logProbability;
+	cursor.score->numTokens++;
+	if (options.keepTokenScores) cursor.score->tokenLogProbabilities.push_back(logProbability);
+
+	// Move on to the next Prefix. Along a known edge it is the edge's target; otherwise it has to be
+	// looked up, unless it contains an unknown token and so cannot be in the chain:
+	if (order > 0)
+	{
+		std::copy(cursor.prefix.begin() + 1, cursor.prefix.end(), cursor.prefix.begin());
+		cursor.prefix.back() = known ? id : CompiledChain::NO_STATE;
+	}
+	cursor.knownTokens = known ? std::min(cursor.knownTokens + 1, order) : 0;
+	if (found && target != CompiledChain::NO_STATE) cursor.state = target;
+	else if (cursor.knownTokens == order) cursor.state = chain.FindState(cursor.prefix.data());
+	else cursor.state = CompiledChain::NO_STATE;
+	return true;
+}
@@ -0,0 +1,64 @@
+// Scores texts under a compiled Markov chain: the probability that the chain gives each token of a
+// text, given the tokens before it, and from these the log-likelihood and perplexity of the whole
+// text. Many texts can be scored at once on several threads, for ranking or filtering large
+// collections of documents.
+
+#pragma once
+
+#include "CompiledChain.h"
+#include "ThreadPool.h"
+#include <string>
+#include <vector>
+
+class Scorer
+{
+public:
+	// Settings that control how texts are scored.
+	struct Options
+	{
+		double floorProbability; // given to tokens that the chain has never seen follow their Prefix
+		bool scoreEnd;           // whether the end of a text is scored, like one more token
+		bool keepTokenScores;    // whether Score::tokenLogProbabilities is filled in
+		ThreadPool * pool;       // the pool that ScoreBatch() runs on, or NULL for the shared pool
+
+		Options() : floorProbability(1e-6), scoreEnd(true), keepTokenScores(false), pool(NULL) {}
+	};
+
+	// The score of one text. Log-probabilities are natural logarithms.
+	struct Score
+	{
+		double logLikelihood = 0; // the sum of the tokens' log-probabilities
+		size_t numTokens = 0;     // the number of tokens scored, including the end if it is scored
+		size_t numUnseen = 0;     // how many of those were given the floor probability
+		std::vector<double> tokenLogProbabilities; // one per token, if Options::keepTokenScores
+
+		// Returns exp(-logLikelihood / numTokens), or 1 for a text without tokens.
+		double Perplexity() const;
+	};
+
+private:
+	struct Cursor; // the progress of one text through the chain
+
+	const CompiledChain & chain;
+	Options options;
+	double logFloor;
+	unsigned int startState;
+
+	// Scores count texts, a few at a time with their lookups interleaved.
+	void ScoreRange(const std::wstring * texts, Score * scores, size_t count) const;
+	// The same, with the chain's tokenizer policy (see TokenPolicy.h) compiled in.
+	template <class Policy>
+	void ScoreRangeWith(const std::wstring * texts, Score * scores, size_t count) const;
+	// Reads and scores the next token of a cursor's text. Returns false at the end of the text.
+	template <class Policy> bool Advance(Cursor & cursor) const;
+
+public:
+	// Constructor. The chain must outlive the Scorer.
+	Scorer(const CompiledChain & chain, const Options & options = Options());
+
+	// Scores a single text.
+	Score ScoreText(const std::wstring & text) const;
+
+	// Scores many texts on the threads of Options::pool. The scores are in the same order as the texts.
+	std::vector<Score> ScoreBatch(const std::vector<std::wstring> & texts) const;
+};
@@ -0,0 +1,1125 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * The self-test behind "Markov.exe selftest". Each check trains or generates from a synthetic    *
+ * corpus and reports PASS or FAIL on a line of its own.                                          *
+ *                                                                                                *
+ * The allocation checks guard the hot loops. Once a chain has seen a <Prefix, Suffix> pair,      *
+ * adding it again must not allocate, and a generation step must never allocate. (Allocations are *
+ * expensive on their own, and worse, they contend for the heap as soon as several threads train  *
+ * or generate at once.) The checks count allocations with an AllocationCounter. Training is      *
+ * measured by feeding the corpus a second time, so that every pair is already known; the corpus  *
+ * is chosen so that no count grows large enough to widen a Suffix's count storage, which is the  *
+ * only other (rare, and deliberate) allocation. Generation is measured by generating a short and *
+ * a long text into buffers that are already big enough: any allocation that happens per call is  *
+ * the same for both, so the counts differ only if the loop itself allocates.                     *
+ *                                                                                                *
+ * The thread pool checks run nested parallel loops on a small pool, whose tasks wait for loops   *
+ * of their own, and check that every iteration runs exactly once and that nothing deadlocks.     *
+ * They also check that a thread outside the pool that waits for a group runs none of its tasks,  *
+ * and that a task that throws lets Wait() return and rethrow the exception.                      *
+ *                                                                                                *
+ * The concurrent table check adds the same keys from several threads at once to a                *
+ * ConcurrentPairTable that starts out small, so that it grows many times while they add, and     *
+ * checks every key's count.                                                                      *
+ *                                                                                                *
+ * The tokenizer checks split a few awkward texts with every tokenizer policy, one character at a *
+ * time, and compare the tokens with the expected ones.                                           *
+ *                                                                                                *
+ * The seeding checks generate from contexts taken from the corpus and check that the first       *
+ * generated word is one that followed the context in the corpus.                                 *
+ *                                                                                                *
+ * The cursor checks generate from one shared compiled chain on several threads at once, each     *
+ * text a few tokens at a time with a GeneratorCursor, and check that every text is the one that  *
+ * a single call to CompiledChain::Generate() gives for the same seed.                            *
+ *                                                                                                *
+ * The pipeline cancellation check cancels an IngestPipeline while its reader is blocked on a     *
+ * pipe that nothing has been written to, and checks that Run() returns.                          *
+ *                                                                                                *
+ * The decompression checks train a chain from gzip and zstd files, some of them made of several  *
+ * members or frames, and compare it with the chain trained from the same texts uncompressed;     *
+ * they also check that truncated and corrupt files are reported as failed.                       *
+ *                                                                                                *
+ * The hot-swap check publishes a series of chains through one ModelHandle while several threads  *
+ * generate from whatever chain is current, and checks that every text is whole and matches the   *
+ * chain it was generated from, that a chain held across the swaps stays usable, and that every   *
+ * replaced chain is freed once nothing holds it, with no call to ask for it.                     *
+ *                                                                                                *
+ * The context trie checks generate from every order that one trie holds, and check that every    *
+ * run of tokens in the output occurs in the corpus; they also compare the trie's size with that  *
+ * of the same records stored separately for each order.                                          *
+ *                                                                                                *
+ * The built-in model checks compare the chain baked into the program with one compiled from its  *
+ * corpus at run time, and check that attaching the baked chain and generating from it allocate   *
+ * nothing.                                                                                       *
+ *                                                                                                *
+ * The reference checks train every backend on random and awkward corpora at every order the      *
+ * program allows, and compare the results with a plain table of counts that shares no code with  *
+ * any of them (see ReferenceOracle).                                                             *
+ *                                                                                                *
+ * The mixture checks train two halves of a corpus into submodels of their own, and check that a  *
+ * MixtureChain weighting them 2 to 1 draws like a chain trained on the first half twice and the  *
+ * second half once.                                                                              *
+ **************************************************************************************************/
+
+#include "SelfTest.h"
+#include "AllocationCounter.h"
+#include "CompiledChain.h"
+#include "ConcurrentPairTable.h"
+#include "ContextTrie.h"
+#include "Decompressor.h"
+#include "DefaultModel.h"
+#include "FilePath.h"
+#include "GeneratorCursor.h"
+#include "IngestPipeline.h"
+#include "MixtureChain.h"
+#include "ModelHandle.h"
+#include "ReferenceOracle.h"
+#include "StringChain.h"
+#include "ThreadPool.h"
+#include "Tokenizer.h"
+#include "Utf8Encoder.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <set>
+#include <sstream>
+#include <utility>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef MARKOV_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MARKOV_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+	// The highest order that the Advanced Options dialog box allows.
+	const int MAX_ORDER = 20;
+
+	// Builds a corpus of numTokens random tokens. Words are drawn from a vocabulary of made-up words,
+	// which for punctuation get marks before, inside and after some of them; characters are random
+	// letters and spaces.
+	std::vector<std::wstring> MakeCorpus(const std::wstring & tokenType, int numTokens, Random & rand)
+	{
+		std::vector<std::wstring> vocabulary;
+		if (tokenType != L"characters")
+		{
+			const wchar_t * marks = L"(\"'.,;:!?)-";
+			for (int i = 0; i < 500; ++i)
+			{
+				std::wstring word;
+				for (int length = 2 + rand.nextInt(7); length > 0; --length)
+				{
+					word += (wchar_t)(L'a' + rand.nextInt(26));
+				}
+				if (tokenType == L"punctuation")
+				{
+					if (rand.nextInt(4) == 0) word.insert(word.begin(), marks[rand.nextInt(11)]);
+					if (rand.nextInt(8) == 0) word.insert(word.begin() + word.size() / 2, L'\'');
+					for (int n = rand.nextInt(4) - 1; n > 0; --n) word += marks[rand.nextInt(11)];
+				}
+				vocabulary.push_back(word);
+			}
+		}
+		else
+		{
+			for (wchar_t c = L'a'; c <= L'z'; ++c) vocabulary.push_back(std::wstring(1, c));
+			vocabulary.push_back(L" ");
+		}
+
+		std::vector<std::wstring> corpus;
+		for (int i = 0; i < numTokens; ++i)
+		{
+			corpus.push_back(vocabulary[rand.nextInt((int)vocabulary.size())]);
+		}
+		return corpus;
+	}
+
+	// Writes the result of one check. Returns passed.
+	bool Report(std::ostream & out, bool passed, const std::wstring & description)
+	{
+		out << (passed ? "PASS  " : "FAIL  ") << EncodeUtf8(description) << std::endl;
+		return passed;
+	}
+
+	// Describes a chain configuration, e.g. "words, order 2".
+	std::wstring Describe(const std::wstring & tokenType, int order)
+	{
+		return tokenType + L", order " + std::to_wstring(order);
+	}
+
+	/**************************************************************************************************
+	 * Checks that StringChain::AddToken() does not allocate when it adds pairs that the chain has    *
+	 * already seen, and that neither StringChain::generate() nor CompiledChain::Generate() allocates *
+	 * per generated token.                                                                           *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the results are written.                                         *
+	 *      tokenType: "words", "characters" or "punctuation".                                        *
+	 *      order: The order of the chain to test.                                                    *
+	 *   return value: true if every check passed.                                                    *
+	 **************************************************************************************************/
+	bool CheckAllocations(std::ostream & out, const std::wstring & tokenType, int order)
+	{
+		Random rand(order);
+		const int numTokens = 20000;
+		std::vector<std::wstring> corpus = MakeCorpus(tokenType, numTokens, rand);
+		bool passed = true;
+
+		// Training:
+		StringChain chain(order);
+		for (size_t i = 0; i < corpus.size(); ++i) chain.AddToken(corpus[i]);
+		chain.EndInput();
+		unsigned long long allocations;
+		{
+			AllocationCounter counter;
+			for (size_t i = 0; i < corpus.size(); ++i) chain.AddToken(corpus[i]);
+			chain.EndInput();
+			allocations = counter.Allocations();
+		}
+		passed &= Report(out, allocations == 0, L"training (" + Describe(tokenType, order) + L"): " + 
+		                 std::to_wstring(allocations) + L" allocations while adding " + 
+		                 std::to_wstring(numTokens) + L" known tokens");
+
+		// Generation, from the StringChain and from the CompiledChain:
+		const int shortLength = 1000, longLength = 100000;
+		size_t longestToken = 0;
+		for (size_t i = 0; i < corpus.size(); ++i) longestToken = std::max(longestToken, corpus[i].size());
+		std::wstring shortOutput, longOutput;
+		shortOutput.reserve(shortLength * (longestToken + 1));
+		longOutput.reserve(longLength * (longestToken + 1));
+
+		unsigned long long shortAllocations, longAllocations;
+		{
+			AllocationCounter counter;
+			chain.generate(shortLength, order, tokenType, rand, shortOutput);
+			shortAllocations = counter.Allocations();
+		}
+		{
+			AllocationCounter counter;
+			chain.generate(longLength, order, tokenType, rand, longOutput);
+			longAllocations = counter.Allocations();
+		}
+		passed &= Report(out, shortAllocations == longAllocations, L"StringChain generation (" + 
+		                 Describe(tokenType, order) + L"): " + std::to_wstring(shortAllocations) + 
+		                 L" allocations for " + std::to_wstring(shortLength) + L" tokens, " + 
+		                 std::to_wstring(longAllocations) + L" for " + std::to_wstring(longLength));
+
+		CompiledChain compiled;
+		compiled.Compile(chain, order, tokenType);
+		shortOutput.clear();
+		longOutput.clear();
+		{
+			AllocationCounter counter;
+			compiled.Generate(shortLength, rand, shortOutput);
+			shortAllocations = counter.Allocations();
+		}
+		{
+			AllocationCounter counter;
+			compiled.Generate(longLength, rand, longOutput);
+			longAllocations = counter.Allocations();
+		}
+		passed &= Report(out, shortAllocations == longAllocations, L"CompiledChain generation (" + 
+		                 Describe(tokenType, order) + L"): " + std::to_wstring(shortAllocations) + 
+		                 L" allocations for " + std::to_wstring(shortLength) + L" tokens, " + 
+		                 std::to_wstring(longAllocations) + L" for " + std::to_wstring(longLength));
+		return passed;
+	}
+
+	// Splits text into its space-separated words.
+	std::vector<std::wstring> SplitWords(const std::wstring & text)
+	{
+		std::wistringstream stream(text);
+		std::vector<std::wstring> words;
+		std::wstring word;
+		while (stream >> word) words.push_back(word);
+		return words;
+	}
+
+	/**************************************************************************************************
+	 * Runs a parallel loop on a pool of two threads whose every iteration runs a parallel loop of    *
+	 * its own, so that tasks wait for other tasks on every thread of the pool at once. If            *
+	 * TaskGroup::Wait() did not run queued tasks while it waited, this would deadlock.               *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *   return value: true if every inner iteration ran exactly once.                                *
+	 **************************************************************************************************/
+	bool CheckThreadPool(std::ostream & out)
+	{
+		const size_t OUTER = 64, INNER = 256;
+		ThreadPool::Options options;
+		options.threads = 2;
+		ThreadPool pool(options);
+		std::vector<std::atomic<int>> runs(OUTER * INNER);
+		for (size_t i = 0; i < runs.size(); ++i) runs[i] = 0;
+		pool.ParallelFor(OUTER, [&](size_t outer) {
+			pool.ParallelFor(INNER, [&](size_t inner) { runs[outer * INNER + inner]++; });
+		});
+		size_t wrong = 0;
+		for (size_t i = 0; i < runs.size(); ++i) wrong += (runs[i] != 1);
+		return Report(out, wrong == 0, L"thread pool: nested parallel loops run every iteration once (" + 
+		              std::to_wstring(wrong) + L" did not)");
+	}
+
+	/**************************************************************************************************
+	 * Waits for task groups from a thread outside the pool. None of the group's tasks may run on the *
+	 * waiting thread, since that would run the pool's work on more threads than it has; and a task   *
+	 * that throws must still let Wait() return, rethrowing the exception, after every other task has *
+	 * run.                                                                                           *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the results are written.                                         *
+	 *   return value: true if both checks passed.                                                    *
+	 **************************************************************************************************/
+	bool CheckThreadPoolWait(std::ostream & out)
+	{
+		const size_t NUM_TASKS = 256;
+		ThreadPool::Options options;
+		options.threads = 2;
+		ThreadPool pool(options);
+		const std::thread::id caller = std::this_thread::get_id();
+		std::atomic<size_t> onCaller(0);
+		pool.ParallelFor(NUM_TASKS, [&](size_t) {
+			if (std::this_thread::get_id() == caller) onCaller++;
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		});
+		bool passed = Report(out, onCaller == 0, L"thread pool: a thread outside the pool runs none of the tasks it "
+		                     L"waits for (" + std::to_wstring(onCaller) + L" of " + std::to_wstring(NUM_TASKS) + L" did)");
+
+		std::atomic<size_t> ran(0);
+		bool rethrown = false;
+		ThreadPool::TaskGroup group(pool);
+		for (size_t i = 0; i < NUM_TASKS; ++i)
+		{
+			group.Run([&ran, i]() {
+				if (i == NUM_TASKS / 2) throw std::bad_alloc();
+				ran++;
+			});
+		}
+		try
+		{
+			group.Wait();
+		}
+		catch (const std::bad_alloc &)
+		{
+			rethrown = true;
+		}
+		passed &= Report(out, rethrown && ran == NUM_TASKS - 1, L"thread pool: a task that throws lets Wait() return "
+		                 L"and rethrow (" + std::to_wstring(ran) + L" of " + std::to_wstring(NUM_TASKS - 1) + L" other tasks ran)");
+		return passed;
+	}
+
+	/**************************************************************************************************
+	 * Adds the same keys to a ConcurrentPairTable from four threads at once, each in an order of its *
+	 * own, starting from a table so small that it must grow many times while they add. Every key     *
+	 * must end up in the table exactly once, with the sum of the counts that the threads added, and  *
+	 * the keys must come out in sorted order.                                                        *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *   return value: true if every key was counted correctly.                                       *
+	 **************************************************************************************************/
+	bool CheckConcurrentTable(std::ostream & out)
+	{
+		const unsigned int NUM_KEYS = 50000, NUM_THREADS = 4;
+		ConcurrentPairTable table(3, 64);
+		std::vector<std::thread> threads;
+		for (unsigned int t = 0; t < NUM_THREADS; ++t)
+		{
+			threads.emplace_back([&, t]() {
+				ConcurrentPairTable::Writer writer(table);
+				for (unsigned int i = 0; i < NUM_KEYS; ++i)
+				{
+					unsigned int n = (i * 7919 + t * 12345) % NUM_KEYS;
+					unsigned int key[3] = { n % 17, n / 17, n % 5 };
+					writer.Add(key, n % 3 + 1);
+				}
+			});
+		}
+		for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+
+		size_t wrong = 0, seen = 0;
+		std::vector<unsigned int> previous;
+		table.ForEachSorted([&](const unsigned int * key, unsigned long long count) {
+			unsigned int n = key[1] * 17 + key[0];
+			bool sorted = previous.empty() || std::lexicographical_compare(previous.begin(), previous.end(), key, key + 3);
+			if (!sorted || n >= NUM_KEYS || key[2] != n % 5 || count != NUM_THREADS * (n % 3 + 1)) wrong++;
+			previous.assign(key, key + 3);
+			seen++;
+		});
+		if (seen != NUM_KEYS || table.Size() != NUM_KEYS) wrong++;
+		return Report(out, wrong == 0, L"concurrent table: " + std::to_wstring(NUM_THREADS) + 
+		              L" threads count every key once (" + std::to_wstring(wrong) + L" errors)");
+	}
+
+	/**************************************************************************************************
+	 * Splits texts with every tokenizer policy and compares the tokens with the expected ones. Each  *
+	 * text is given to the Tokenizer one character at a time, so that every word is completed from   *
+	 * pieces.                                                                                        *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *   return value: true if every text was split as expected.                                      *
+	 **************************************************************************************************/
+	bool CheckTokenizers(std::ostream & out)
+	{
+		// The expected tokens are separated by "|":
+		struct Case { const wchar_t * tokenType, * text, * expected; };
+		const Case cases[] = {
+			{ L"words", L"  (yes,) don't \"no!\" ", L"(yes,)|don't|\"no!\"" },
+			{ L"characters", L"a b ", L"a| |b| " },
+			{ L"punctuation", L"  (yes,) don't \"no!\" ", L"(|yes|,|)|don't|\"|no|!|\"" },
+			{ L"punctuation", L"e-mail ... -- x.y. ?!", L"e-mail|.|.|.|-|-|x.y|.|?|!" },
+			{ L"punctuation", L"", L"" },
+		};
+		bool passed = true;
+		for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c)
+		{
+			Tokenizer tokenizer(cases[c].tokenType);
+			std::vector<std::wstring> tokens;
+			for (const wchar_t * p = cases[c].text; *p; ++p) tokenizer.Tokenize(p, p + 1, tokens);
+			tokenizer.Finish(tokens);
+			std::wstring joined;
+			for (size_t i = 0; i < tokens.size(); ++i) joined += (i > 0 ? L"|" : L"") + tokens[i];
+			passed &= Report(out, joined == cases[c].expected, L"tokenizer (" + 
+			                 std::wstring(cases[c].tokenType) + L"): \"" + cases[c].text + L"\" gives " + joined);
+		}
+		return passed;
+	}
+
+	/**************************************************************************************************
+	 * Checks CompiledChain::GenerateFrom() on a chain of words. Contexts of one and two words are    *
+	 * taken from the corpus; the output must begin with the context, and the word after it must be   *
+	 * one that followed the context somewhere in the corpus. A context whose last word is not in the *
+	 * corpus must be rejected.                                                                       *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the results are written.                                         *
+	 *      order: The order of the chain to test.                                                    *
+	 *   return value: true if every check passed.                                                    *
+	 **************************************************************************************************/
+	bool CheckSeeding(std::ostream & out, int order)
+	{
+		Random rand(order);
+		std::vector<std::wstring> corpus = MakeCorpus(L"words", 20000, rand);
+		StringChain chain(order);
+		for (size_t i = 0; i < corpus.size(); ++i) chain.AddToken(corpus[i]);
+		chain.EndInput();
+		CompiledChain compiled;
+		compiled.Compile(chain, order, L"words");
+
+		// Every sequence of one or two words in the corpus, followed by the word after it:
+		std::set<std::wstring> followed;
+		for (size_t i = 1; i < corpus.size(); ++i)
+		{
+			followed.insert(corpus[i - 1] + L' ' + corpus[i]);
+			if (i >= 2) followed.insert(corpus[i - 2] + L' ' + corpus[i - 1] + L' ' + corpus[i]);
+		}
+
+		bool passed = true;
+		for (size_t length = 1; length <= 2; ++length)
+		{
+			int failures = 0;
+			const int numContexts = 500;
+			for (int i = 0; i < numContexts; ++i)
+			{
+				// Contexts are taken from anywhere but the end of the corpus, so that a word follows them:
+				size_t start = (size_t)rand.nextInt((int)(corpus.size() - length - 1));
+				std::wstring context = corpus[start];
+				if (length == 2) context += L' ' + corpus[start + 1];
+				std::wstring output;
+				if (!compiled.GenerateFrom(context, 10, rand, output))
+				{
+					++failures;
+					continue;
+				}
+				// A chain of order 1 continues only the last word of the context:
+				std::wstring continued = ((int)length > order) ? corpus[start + length - 1] : context;
+				std::vector<std::wstring> words = SplitWords(output);
+				if (words.size() <= length) ++failures;
+				else if (!followed.count(continued + L' ' + words[length])) ++failures;
+				else if ((length == 1 ? words[0] : words[0] + L' ' + words[1]) != context) ++failures;
+			}
+			passed &= Report(out, failures == 0, L"seeded generation (" + Describe(L"words", order) + 
+			                 L"): " + std::to_wstring(failures) + L" bad continuations of " + 
+			                 std::to_wstring(numContexts) + L" contexts of " + std::to_wstring(length) + 
+			                 L" word" + (length == 1 ? L"" : L"s"));
+		}
+
+		std::wstring output;
+		bool rejected = !compiled.GenerateFrom(L"ZZZ", 10, rand, output) && output.empty();
+		passed &= Report(out, rejected, L"seeded generation (" + Describe(L"words", order) + 
+		                 L"): unknown context " + (rejected ? L"rejected" : L"accepted"));
+		return passed;
+	}
+
+	// Builds numTexts random texts of about numTokens tokens each, made of the tokens of MakeCorpus()
+	// separated by a mixture of spaces, tabs and line breaks.
+	std::vector<std::wstring> MakeTexts(const std::wstring & tokenType, int numTexts, int numTokens, 
+	                                    Random & rand)
+	{
+		const wchar_t * separators[] = { L" ", L" ", L" ", L"  ", L"\t", L"\n", L"\r\n" };
+		std::vector<std::wstring> texts;
+		for (int t = 0; t < numTexts; ++t)
+		{
+			std::vector<std::wstring> corpus = MakeCorpus(tokenType, numTokens, rand);
+			std::wstring text;
+			for (size_t i = 0; i < corpus.size(); ++i)
+			{
+				text += corpus[i];
+				if (tokenType != L"characters") text += separators[rand.nextInt(7)];
+			}
+			texts.push_back(text);
+		}
+		return texts;
+	}
+
+
+	/**************************************************************************************************
+	 * Generates texts from one compiled chain on four threads at once, each text in pieces of        *
+	 * varying length through a GeneratorCursor of its own, and compares each with the text that      *
+	 * CompiledChain::Generate() gives for the same seed in one call. Pieces end in the middle of     *
+	 * runs of single-edge states as well as between them, so the cursor must resume from both.       *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *      tokenType: "words", "characters" or "punctuation".                                        *
+	 *      order: The order of the chain to test.                                                    *
+	 *   return value: true if every text matched.                                                    *
+	 **************************************************************************************************/
+	bool CheckCursors(std::ostream & out, const std::wstring & tokenType, int order)
+	{
+		const int NUM_THREADS = 4, TEXTS_PER_THREAD = 25, TEXT_LENGTH = 500;
+		Random rand(order);
+		std::vector<std::wstring> corpus = MakeCorpus(tokenType, 20000, rand);
+		StringChain chain(order);
+		for (size_t i = 0; i < corpus.size(); ++i) chain.AddToken(corpus[i]);
+		chain.EndInput();
+		std::shared_ptr<CompiledChain> compiled(new CompiledChain);
+		compiled->Compile(chain, order, tokenType);
+		std::shared_ptr<const CompiledChain> shared = compiled;
+
+		std::atomic<int> mismatches(0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < NUM_THREADS; ++t)
+		{
+			threads.emplace_back([&, t]() {
+				for (int i = 0; i < TEXTS_PER_THREAD; ++i)
+				{
+					const int seed = t * TEXTS_PER_THREAD + i;
+					Random whole(seed);
+					std::wstring expected = shared->Generate(TEXT_LENGTH, whole);
+					GeneratorCursor cursor(shared, seed);
+					std::wstring pieces;
+					for (int done = 0, piece = 1; done < TEXT_LENGTH; done += piece, piece = piece % 37 + 1)
+					{
+						cursor.Generate(std::min(piece, TEXT_LENGTH - done), pieces);
+					}
+					if (pieces != expected) mismatches++;
+				}
+			});
+		}
+		for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+		return Report(out, mismatches == 0, L"generator cursors (" + Describe(tokenType, order) + L"): " + 
+		              std::to_wstring(mismatches.load()) + L" of " + std::to_wstring(NUM_THREADS * TEXTS_PER_THREAD) + 
+		              L" texts generated in pieces on " + std::to_wstring(NUM_THREADS) + L" threads differ");
+	}
+	// A named pipe that blocks whoever opens or reads it until it is released. It stands for an
+	// input file that is slow to read, such as one on a network share that has stopped answering.
+	class BlockingPipe
+	{
+		std::wstring name;
+#ifdef _WIN32
+		HANDLE handle;
+#endif
+
+	public:
+		// Constructor. On Windows, pipes have a namespace of their own and directory is not used.
+		BlockingPipe(const std::wstring & directory, long long id)
+		{
+#ifdef _WIN32
+			(void)directory;
+			name = L"\\\\.\\pipe\\markov-selftest-" + std::to_wstring(id);
+			handle = CreateNamedPipeW(name.c_str(), PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_NOWAIT, 1, 0, 0, 0, NULL);
+			if (handle == INVALID_HANDLE_VALUE) name.clear();
+#else
+			name = directory + L"/markov-selftest-" + std::to_wstring(id) + L".fifo";
+			if (mkfifo(NativePath(name).c_str(), 0600) != 0) name.clear();
+#endif
+		}
+
+		~BlockingPipe()
+		{
+#ifdef _WIN32
+			if (!name.empty()) CloseHandle(handle);
+#else
+			if (!name.empty()) RemoveFile(name);
+#endif
+		}
+
+		BlockingPipe(const BlockingPipe &) = delete;
+		BlockingPipe & operator=(const BlockingPipe &) = delete;
+
+		// The pipe's path, or an empty string if it could not be created.
+		const std::wstring & Name() const { return name; }
+
+		// Lets a reader that has the pipe open see the end of it. Returns false if no reader has opened
+		// the pipe yet.
+		bool Release()
+		{
+#ifdef _WIN32
+			if (!ConnectNamedPipe(handle, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) return false;
+			DisconnectNamedPipe(handle);
+			return true;
+#else
+			int writer = open(NativePath(name).c_str(), O_WRONLY | O_NONBLOCK);
+			if (writer < 0) return false;
+			close(writer);
+			return true;
+#endif
+		}
+	};
+
+	// A TokenSink that only counts what it is given.
+	class CountingSink : public TokenSink
+	{
+	public:
+		std::atomic<int> tokens;
+		std::atomic<int> texts;
+
+		CountingSink() : tokens(0), texts(0) {}
+		void AddToken(const std::wstring &) override { tokens++; }
+		void EndInput() override { texts++; }
+	};
+
+	/**************************************************************************************************
+	 * Cancels an IngestPipeline while its reader is blocked opening or reading a pipe, after the     *
+	 * inserter has taken every token of the file before it, so that every queue between the stages   *
+	 * is empty. Once the job is cancelled the pipe is released, and Run() must return false without  *
+	 * anything more being queued. Run() is called on a thread of its own, which is left behind if it *
+	 * never returns, so that a failure cannot hang the self-test.                                    *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *   return value: true if the check passed.                                                      *
+	 **************************************************************************************************/
+	bool CheckPipelineCancel(std::ostream & out)
+	{
+		struct Job
+		{
+			ProgressMonitor monitor;
+			CountingSink sink;
+			std::vector<std::wstring> filenames;
+			std::atomic<int> result; // -1 until Run() returns, then whether it completed
+		};
+		std::shared_ptr<Job> job(new Job);
+		job->result = -1;
+		const long long id = std::chrono::steady_clock::now().time_since_epoch().count();
+		BlockingPipe pipe(TempDirectory(), id);
+		if (pipe.Name().empty()) return Report(out, false, L"pipeline cancellation: could not create a pipe");
+		job->filenames.push_back(TempDirectory() + L"/markov-selftest-" + std::to_wstring(id) + L".txt");
+		{
+			std::ofstream file(NativePath(job->filenames[0]), std::ios::binary);
+			file << "the cat sat on the mat";
+		}
+		job->filenames.push_back(pipe.Name());
+
+		std::thread([job]() {
+			IngestPipeline pipeline(L"words", &job->monitor);
+			job->result = pipeline.Run(job->filenames, job->sink) ? 1 : 0;
+		}).detach();
+
+		// Cancel once the first file is in; the reader has moved on to the pipe by then, or is about to:
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (job->sink.texts == 0 && std::chrono::steady_clock::now() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		const int tokensBefore = job->sink.tokens;
+		job->monitor.Cancel();
+		bool released = false;
+		while (job->result < 0 && std::chrono::steady_clock::now() < deadline)
+		{
+			if (!released) released = pipe.Release();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		RemoveFile(job->filenames[0]);
+		const int result = job->result;
+		return Report(out, result == 0 && job->sink.tokens == tokensBefore, 
+		              std::wstring(L"pipeline cancellation: ") + (result < 0 ? L"Run() did not return" : 
+		              result > 0 ? L"Run() finished the cancelled job" : 
+		              job->sink.tokens != tokensBefore ? L"tokens were inserted after the job was cancelled" :
+		              L"Run() returned once the reader was released"));
+	}
+
+	// Compresses bytes into a single gzip member or zstd frame. Returns an empty string if this build
+	// cannot write the format.
+	std::string Compress(Decompressor::Format format, const std::string & bytes)
+	{
+		std::string compressed;
+#ifdef MARKOV_WITH_ZLIB
+		if (format == Decompressor::GZIP)
+		{
+			z_stream stream = z_stream();
+			if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			{
+				return compressed;
+			}
+			compressed.resize(deflateBound(&stream, (uLong)bytes.size()));
+			stream.next_in = (Bytef *)bytes.data();
+			stream.avail_in = (uInt)bytes.size();
+			stream.next_out = (Bytef *)&compressed[0];
+			stream.avail_out = (uInt)compressed.size();
+			const bool finished = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+			compressed.resize(finished ? (size_t)stream.total_out : 0);
+			deflateEnd(&stream);
+		}
+#endif
+#ifdef MARKOV_WITH_ZSTD
+		if (format == Decompressor::ZSTD)
+		{
+			compressed.resize(ZSTD_compressBound(bytes.size()));
+			size_t size = ZSTD_compress(&compressed[0], compressed.size(), bytes.data(), bytes.size(), 3);
+			compressed.resize(ZSTD_isError(size) ? 0 : size);
+		}
+#endif
+		return compressed;
+	}
+
+	/**************************************************************************************************
+	 * Trains a chain from compressed files and compares it with the chain trained from the same      *
+	 * texts uncompressed. The first text is compressed as a single gzip member or zstd frame, the    *
+	 * second as three, one after another in the same file, and the third is so repetitive that a few *
+	 * kilobytes of it inflate to more than the decompressor's output block. The files are read in    *
+	 * chunks much smaller than they are, so that members, frames and output blocks all end in the    *
+	 * middle of a chunk. A file cut short and a file that is corrupt after its first few bytes must  *
+	 * both be reported as failed.                                                                    *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *      format: GZIP or ZSTD.                                                                     *
+	 *   return value: true if every check passed.                                                    *
+	 **************************************************************************************************/
+	bool CheckDecompression(std::ostream & out, Decompressor::Format format)
+	{
+		const std::wstring name = (format == Decompressor::GZIP) ? L"gzip" : L"zstd";
+		if (!Decompressor::IsSupported(format))
+		{
+			return Report(out, false, L"decompression (" + name + L"): this build cannot read " + name + L" files");
+		}
+
+		Random rand((int)format);
+		std::vector<std::wstring> texts = MakeTexts(L"words", 2, 20000, rand);
+		std::wstring repetitive;
+		for (int i = 0; i < 200000; ++i) repetitive += L"the cat sat on the mat ";
+		texts.push_back(repetitive);
+		std::vector<std::string> plain, packed(texts.size());
+		for (size_t t = 0; t < texts.size(); ++t) plain.push_back(EncodeUtf8(texts[t]));
+		packed[0] = Compress(format, plain[0]);
+		const size_t third = plain[1].size() / 3;
+		packed[1] = Compress(format, plain[1].substr(0, third)) + Compress(format, plain[1].substr(third, third)) +
+			Compress(format, plain[1].substr(2 * third));
+		packed[2] = Compress(format, plain[2]);
+
+		const long long id = std::chrono::steady_clock::now().time_since_epoch().count();
+		std::vector<std::wstring> files;
+		auto write = [&](const std::string & contents) {
+			files.push_back(TempDirectory() + L"/markov-selftest-" + std::to_wstring(id) + L"-" + 
+			                std::to_wstring(files.size()));
+			std::ofstream file(NativePath(files.back()), std::ios::binary);
+			file << contents;
+			return files.back();
+		};
+		std::vector<std::wstring> plainFiles, packedFiles, damagedFiles;
+		for (size_t t = 0; t < texts.size(); ++t) plainFiles.push_back(write(plain[t]));
+		for (size_t t = 0; t < texts.size(); ++t) packedFiles.push_back(write(packed[t]));
+		damagedFiles.push_back(write(packed[0].substr(0, packed[0].size() / 2)));
+		damagedFiles.push_back(write(packed[0].substr(0, 4) + std::string(256, '\xFF')));
+
+		IngestPipeline::Options options;
+		options.chunkSize = 4096;
+		StringChain plainChain(2), packedChain(2), damagedChain(2);
+		IngestPipeline pipeline(L"words", NULL, options);
+		pipeline.Run(plainFiles, plainChain);
+		pipeline.Run(packedFiles, packedChain);
+		std::wstring failure;
+		if (!pipeline.GetFailedFiles().empty()) failure = L"an intact file was reported as failed";
+		else failure = ReferenceOracle::Compare(ReferenceOracle::TableOf(plainChain), ReferenceOracle::TableOf(packedChain));
+		pipeline.Run(damagedFiles, damagedChain);
+		if (failure.empty() && pipeline.GetFailedFiles() != damagedFiles)
+		{
+			failure = std::to_wstring(pipeline.GetFailedFiles().size()) + L" of 2 damaged files reported as failed";
+		}
+		for (size_t f = 0; f < files.size(); ++f) RemoveFile(files[f]);
+		return Report(out, failure.empty(), L"decompression (" + name + L"): " + 
+		              (failure.empty() ? L"single and multi-member files train like plain text, damaged files fail" : failure));
+	}
+
+	/**************************************************************************************************
+	 * Publishes new chains through a ModelHandle while four threads generate from it. Each thread    *
+	 * acquires the current chain for every text, generates it through a GeneratorCursor, and         *
+	 * compares it with what the same chain gives for the same seed in one call; a text that mixed    *
+	 * two chains, or a chain freed while in use, would not match. Once the readers have stopped,     *
+	 * every replaced chain but the first must be freed without anything asking for it, while the     *
+	 * first, acquired before the first swap, must still give the same text; once that is let go too, *
+	 * it must be freed as well.                                                                      *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *   return value: true if every check passed.                                                    *
+	 **************************************************************************************************/
+	bool CheckHotSwap(std::ostream & out)
+	{
+		const int NUM_CHAINS = 8, NUM_THREADS = 4, TEXT_LENGTH = 200;
+		Random rand(NUM_CHAINS);
+		std::vector<std::shared_ptr<const CompiledChain>> chains;
+		std::vector<std::weak_ptr<const CompiledChain>> published;
+		for (int c = 0; c < NUM_CHAINS; ++c)
+		{
+			std::vector<std::wstring> corpus = MakeCorpus(L"words", 2000, rand);
+			StringChain chain(2);
+			for (size_t i = 0; i < corpus.size(); ++i) chain.AddToken(corpus[i]);
+			chain.EndInput();
+			std::shared_ptr<CompiledChain> compiled(new CompiledChain);
+			compiled->Compile(chain, 2, L"words");
+			chains.push_back(compiled);
+			published.push_back(compiled);
+		}
+
+		ModelHandle handle(chains[0]);
+		std::shared_ptr<const CompiledChain> held = handle.Acquire();
+		Random heldRand(1);
+		const std::wstring heldText = held->Generate(TEXT_LENGTH, heldRand);
+
+		std::atomic<bool> swapping(true);
+		std::atomic<int> mismatches(0), texts(0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < NUM_THREADS; ++t)
+		{
+			threads.emplace_back([&, t]() {
+				for (int seed = t; swapping || seed < t + NUM_THREADS * 10; seed += NUM_THREADS)
+				{
+					std::shared_ptr<const CompiledChain> chain = handle.Acquire();
+					GeneratorCursor cursor(chain, seed);
+					std::wstring text;
+					cursor.Generate(TEXT_LENGTH, text);
+					Random whole(seed);
+					if (text != chain->Generate(TEXT_LENGTH, whole)) mismatches++;
+					texts++;
+				}
+			});
+		}
+		// The handle holds the only other reference to each chain once it is published:
+		for (int c = 1; c < NUM_CHAINS; ++c)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			std::shared_ptr<const CompiledChain> next = std::move(chains[c]);
+			handle.Publish(std::move(next));
+		}
+		swapping = false;
+		for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+		chains.clear();
+
+		// Replaced chains are freed on the handle's own thread, so give it a while to get to them:
+		auto countFreed = [&](int first) {
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+			int freed = 0;
+			for (;;)
+			{
+				freed = 0;
+				for (int c = first; c + 1 < NUM_CHAINS; ++c) freed += published[c].expired() ? 1 : 0;
+				if (freed == NUM_CHAINS - 1 - first || std::chrono::steady_clock::now() > deadline) return freed;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		};
+		const int unheldFreed = countFreed(1);
+		const bool heldKept = !published[0].expired();
+		std::wstring heldAgain;
+		GeneratorCursor(held, 1).Generate(TEXT_LENGTH, heldAgain);
+		held.reset();
+		const int freed = countFreed(0);
+		return Report(out, mismatches == 0 && heldAgain == heldText && unheldFreed == NUM_CHAINS - 2 && heldKept &&
+		              freed == NUM_CHAINS - 1 && !published.back().expired(),
+		              L"model hot swap: " + std::to_wstring(mismatches.load()) + L" of " +
+		              std::to_wstring(texts.load()) + L" texts generated across " + std::to_wstring(NUM_CHAINS - 1) +
+		              L" swaps differ, " + std::to_wstring(NUM_CHAINS - 1 - freed) + L" replaced chains not freed");
+	}
+
+	/**************************************************************************************************
+	 * Trains a ContextTrie of words on a single repetitive text and generates from each order that   *
+	 * it holds. A chain of order k only ever emits a token that followed the last k tokens somewhere *
+	 * in the corpus, so every k + 1 consecutive generated words must occur in the corpus; because    *
+	 * generation carries on from the end of the text to its start, the corpus is searched as if it   *
+	 * were written twice. Also reports the size of the packed trie beside that of the records of     *
+	 * every order stored one order at a time, as key and count, which the trie must beat.            *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the results are written.                                         *
+	 *      maxOrder: The order of the trie.                                                          *
+	 *   return value: true if every check passed.                                                    *
+	 **************************************************************************************************/
+	bool CheckContextTrie(std::ostream & out, int maxOrder)
+	{
+		// A text with some of the repetitiveness of natural language, in which each word is followed
+		// by one of only three others:
+		Random rand(maxOrder);
+		std::vector<std::wstring> lexicon = MakeCorpus(L"words", 500, rand);
+		std::vector<std::wstring> corpus;
+		for (size_t i = 0, word = 0; i < 20000; ++i, word = (word * 7 + 1 + rand.nextInt(3)) % lexicon.size())
+		{
+			corpus.push_back(lexicon[word]);
+		}
+		ContextTrie trie(maxOrder, L"words");
+		for (size_t i = 0; i < corpus.size(); ++i) trie.AddToken(corpus[i]);
+		trie.EndInput();
+		trie.Freeze();
+
+		bool passed = true;
+		size_t separateBytes = 0;
+		for (int order = 1; order <= maxOrder; ++order)
+		{
+			// Every run of order + 1 words in the corpus, written twice:
+			std::set<std::vector<std::wstring>> runs;
+			for (size_t i = 0; i < corpus.size(); ++i)
+			{
+				std::vector<std::wstring> run;
+				for (size_t j = i; j <= i + order; ++j) run.push_back(corpus[j % corpus.size()]);
+				runs.insert(run);
+			}
+
+			std::wstring output;
+			trie.Generate(order, 2000, rand, output);
+			std::vector<std::wstring> words = SplitWords(output);
+			int failures = 0;
+			for (size_t i = 0; i + order < words.size(); ++i)
+			{
+				if (!runs.count(std::vector<std::wstring>(words.begin() + i, words.begin() + i + order + 1))) ++failures;
+			}
+			passed &= Report(out, failures == 0 && !words.empty(), L"context trie (" + 
+			                 Describe(L"words", order) + L" of " + std::to_wstring(maxOrder) + L"): " + 
+			                 std::to_wstring(failures) + L" of " + std::to_wstring(words.size()) + 
+			                 L" generated words do not follow their context");
+
+			size_t records = 0;
+			trie.ForEachRecord(order, [&records](const unsigned int *, unsigned long long) { ++records; });
+			separateBytes += records * ((order + 1) * sizeof(unsigned int) + sizeof(unsigned long long));
+		}
+		return passed & Report(out, trie.MemoryUsage() < separateBytes, L"context trie (" + 
+		                       Describe(L"words", maxOrder) + L"): " + std::to_wstring(trie.MemoryUsage()) + 
+		                       L" bytes, against " + std::to_wstring(separateBytes) + 
+		                       L" for the records of each order stored separately");
+	}
+
+	/**************************************************************************************************
+	 * Checks the chain built into the program (see DefaultModel.h) against one trained and compiled  *
+	 * from the built-in corpus now: both must hold the same counts and, laid out the same way,       *
+	 * generate the same text from the same seed. A baked chain that fails was baked before something *
+	 * it depends on changed, and must be baked again. Also checks that attaching a chain to the      *
+	 * built-in arrays allocates nothing at all, and that generating from it into a buffer that is    *
+	 * big enough allocates nothing at all.                                                           *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the results are written.                                         *
+	 *   return value: true if every check passed.                                                    *
+	 **************************************************************************************************/
+	bool CheckDefaultModel(std::ostream & out)
+	{
+		const CompiledChain::Image & image = DefaultModelImage();
+		const std::wstring tokenType = image.tokenType;
+		StringChain trained(image.order);
+		std::wistringstream text(DefaultModelText());
+		trained.AddItems(text, tokenType);
+		CompiledChain fresh;
+		fresh.Compile(trained, image.order, tokenType);
+
+		const CompiledChain & baked = DefaultModelChain();
+		std::wstring failure = ReferenceOracle::Compare(ReferenceOracle::TableOf(fresh), ReferenceOracle::TableOf(baked));
+		Random freshRand(7), bakedRand(7);
+		if (failure.empty() && fresh.Generate(1000, freshRand) != baked.Generate(1000, bakedRand))
+		{
+			failure = L"the same seed generates different texts";
+		}
+		bool passed = Report(out, failure.empty(), L"built-in model (" + Describe(tokenType, image.order) + L"): " + 
+		                     (failure.empty() ? L"matches the chain compiled from its corpus" : failure));
+
+		const int numGen = 1000;
+		std::wstring output;
+		output.reserve(numGen * 64);
+		unsigned long long attachAllocations, generateAllocations;
+		{
+			AllocationCounter counter;
+			CompiledChain attached(image);
+			attachAllocations = counter.Allocations();
+			Random rand(numGen);
+			attached.Generate(numGen, rand, output);
+			generateAllocations = counter.Allocations() - attachAllocations;
+		}
+		return passed & Report(out, attachAllocations == 0 && generateAllocations == 0 && !output.empty(), 
+		                       L"built-in model: " + std::to_wstring(attachAllocations) + L" allocations to attach, " + 
+		                       std::to_wstring(generateAllocations) + L" to generate " + std::to_wstring(numGen) + 
+		                       L" tokens");
+	}
+
+	/**************************************************************************************************
+	 * Trains every backend on a corpus, at each of the given orders, and compares the result with    *
+	 * the reference (see ReferenceOracle::CheckBackends()).                                          *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *      name: A short description of the corpus.                                                  *
+	 *      texts: The corpus, as separate input texts.                                               *
+	 *      tokenType: "words", "characters" or "punctuation".                                        *
+	 *      minOrder, maxOrder: The range of orders to test.                                          *
+	 *   return value: true if every backend matched the reference at every order.                    *
+	 **************************************************************************************************/
+	bool CheckAgainstReference(std::ostream & out, const std::wstring & name, 
+	                           const std::vector<std::wstring> & texts, const std::wstring & tokenType, 
+	                           int minOrder, int maxOrder)
+	{
+		std::wstring failure;
+		for (int order = minOrder; order <= maxOrder && failure.empty(); ++order)
+		{
+			ReferenceOracle oracle(order, tokenType, texts, TempDirectory());
+			failure = oracle.CheckBackends();
+			if (!failure.empty()) failure = L"order " + std::to_wstring(order) + L", " + failure;
+		}
+		std::wstring orders = (minOrder == maxOrder) ? L"order " + std::to_wstring(minOrder) : 
+			L"orders " + std::to_wstring(minOrder) + L"-" + std::to_wstring(maxOrder);
+		return Report(out, failure.empty(), L"reference (" + tokenType + L", " + orders + L"): " + name + 
+		              L": " + (failure.empty() ? L"every backend matches" : failure));
+	}
+
+	/**************************************************************************************************
+	 * Compares the Suffixes that a compiled chain draws with the reference counts (see               *
+	 * ReferenceOracle::CheckSampling()).                                                             *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *      tokenType: "words", "characters" or "punctuation".                                        *
+	 *      order: The order of the chain to test.                                                    *
+	 *   return value: true if the draws are consistent with the reference counts.                    *
+	 **************************************************************************************************/
+	bool CheckSampling(std::ostream & out, const std::wstring & tokenType, int order)
+	{
+		Random rand(order);
+		std::vector<std::wstring> texts = MakeTexts(tokenType, 1, 20000, rand);
+		ReferenceOracle oracle(order, tokenType, texts, TempDirectory());
+		StringChain chain(order);
+		std::wistringstream stream(texts[0]);
+		chain.AddItems(stream, tokenType);
+		CompiledChain compiled;
+		compiled.Compile(chain, order, tokenType);
+		std::wstring failure = oracle.CheckSampling(compiled, rand, 10, 5000);
+		return Report(out, failure.empty(), L"sampling (" + Describe(tokenType, order) + L"): " + 
+		              (failure.empty() ? L"suffix frequencies match the reference" : failure));
+	}
+
+	/**************************************************************************************************
+	 * Compares the Suffixes that a mixture of two submodels draws with the reference counts (see     *
+	 * ReferenceOracle::CheckSampling()).                                                             *
+	 *   Inputs:                                                                                      *
+	 *      out: The stream to which the result is written.                                           *
+	 *      tokenType: "words", "characters" or "punctuation".                                        *
+	 *      order: The order of the submodels.                                                        *
+	 *   return value: true if the draws are consistent with the reference counts.                    *
+	 **************************************************************************************************/
+	bool CheckMixture(std::ostream & out, const std::wstring & tokenType, int order)
+	{
+		Random rand(order);
+		std::wstring text = MakeTexts(tokenType, 1, 20000, rand)[0];
+		std::vector<std::wstring> halves;
+		halves.push_back(text.substr(0, text.size() / 2));
+		halves.push_back(text.substr(text.size() / 2));
+
+		CompiledChain submodels[2];
+		MixtureChain mixture;
+		for (int h = 0; h < 2; ++h)
+		{
+			StringChain chain(order);
+			std::wistringstream stream(halves[h]);
+			chain.AddItems(stream, tokenType);
+			submodels[h].Compile(chain, order, tokenType);
+			mixture.Add(submodels[h], h == 0 ? 2 : 1);
+		}
+		std::vector<std::wstring> texts;
+		texts.push_back(halves[0]);
+		texts.push_back(halves[0]);
+		texts.push_back(halves[1]);
+		ReferenceOracle oracle(order, tokenType, texts, TempDirectory());
+		std::wstring failure = oracle.CheckSampling(mixture, rand, 10, 5000);
+		return Report(out, failure.empty(), L"mixture (" + Describe(tokenType, order) + L"): " + 
+		              (failure.empty() ? L"suffix frequencies match the weighted reference" : failure));
+	}
+}
+
+/**************************************************************************************************
+ * Runs every check.                                                                              *
+ *   Inputs:                                                                                      *
+ *      out: The stream to which the results are written, one line per check.                     *
+ *   return value: true if every check passed.                                                    *
+ **************************************************************************************************/
+bool RunSelfTest(std::ostream & out)
+{
+	bool passed = true;
+	for (int order = 1; order <= 3; ++order) passed &= CheckAllocations(out, L"words", order);
+	for (int order = 1; order <= 5; order += 2) passed &= CheckAllocations(out, L"characters", order);
+	passed &= CheckThreadPool(out);
+	passed &= CheckThreadPoolWait(out);
+	passed &= CheckConcurrentTable(out);
+	passed &= CheckTokenizers(out);
+	for (int order = 1; order <= 3; ++order) passed &= CheckSeeding(out, order);
+	for (int order = 1; order <= 3; ++order) passed &= CheckCursors(out, L"words", order);
+	for (int order = 1; order <= 5; order += 2) passed &= CheckCursors(out, L"characters", order);
+	passed &= CheckPipelineCancel(out);
+	passed &= CheckDecompression(out, Decompressor::GZIP);
+	passed &= CheckDecompression(out, Decompressor::ZSTD);
+	passed &= CheckHotSwap(out);
+	passed &= CheckContextTrie(out, 4);
+	passed &= CheckDefaultModel(out);
+
+	// Awkward corpora, at every order:
+	std::vector<std::pair<std::wstring, std::vector<std::wstring>>> corpora;
+	corpora.push_back(std::make_pair(L"no texts", std::vector<std::wstring>()));
+	corpora.push_back(std::make_pair(L"one empty text", std::vector<std::wstring>(1, L"")));
+	corpora.push_back(std::make_pair(L"only whitespace", std::vector<std::wstring>(1, L" \t\r\n  \n")));
+	corpora.push_back(std::make_pair(L"a single token", std::vector<std::wstring>(1, L"x")));
+	corpora.push_back(std::make_pair(L"one token repeated", std::vector<std::wstring>(1, L"a a a a a a a a a a")));
+	std::vector<std::wstring> mixed;
+	mixed.push_back(L"");
+	mixed.push_back(L"the cat sat");
+	mixed.push_back(L"");
+	mixed.push_back(L"x");
+	mixed.push_back(L"the cat ran\nthe dog sat");
+	corpora.push_back(std::make_pair(L"empty texts between others", mixed));
+	std::vector<std::wstring> unicode;
+	unicode.push_back(L"na\u00EFve caf\u00E9 \u2014 \u65E5\u672C\u8A9E\u306E\u30C6\u30AD\u30B9\u30C8 "
+	                  L"\U0001F600 smile \U0001F600 e\u0301 \u00E9");
+	unicode.push_back(L"\u0391\u03B8\u03AE\u03BD\u03B1 \u041C\u043E\u0441\u043A\u0432\u0430 "
+	                  L"\U0001D11E\U0001D11E \u65E5\u672C\u8A9E \U0001F600");
+	corpora.push_back(std::make_pair(L"Unicode", unicode));
+	Random rand(0);
+	const wchar_t * tokenTypes[] = { L"words", L"characters", L"punctuation" };
+	for (int t = 0; t < 3; ++t)
+	{
+		std::vector<std::wstring> random = MakeTexts(tokenTypes[t], 3, 1000, rand);
+		for (size_t c = 0; c < corpora.size(); ++c)
+		{
+			passed &= CheckAgainstReference(out, corpora[c].first, corpora[c].second, tokenTypes[t], 1, MAX_ORDER);
+		}
+		passed &= CheckAgainstReference(out, L"random texts", random, tokenTypes[t], 1, MAX_ORDER);
+	}
+	// A corpus large enough to make the out-of-core trainer merge its runs in more than one pass:
+	passed &= CheckAgainstReference(out, L"large random texts", MakeTexts(L"words", 4, 30000, rand), L"words", 2, 2);
+
+	for (int order = 1; order <= 3; ++order) passed &= CheckSampling(out, L"words", order);
+	for (int order = 1; order <= 5; order += 2) passed &= CheckSampling(out, L"characters", order);
+	for (int order = 1; order <= 3; ++order) passed &= CheckSampling(out, L"punctuation", order);
+	for (int order = 1; order <= 3; ++order) passed &= CheckMixture(out, L"words", order);
+	for (int order = 1; order <= 5; order += 2) passed &= CheckMixture(out, L"characters", order);
+	out << (passed ? "All checks passed." : "Some checks FAILED.") << std::endl;
+	return passed;
+}
@@ -0,0 +1,10 @@
+// Checks guarantees of the Markov engine that ordinary use would not notice being broken, such as
+// training and generation running without allocating memory once warmed up. Run by the selftest
+// console command.
+
+#pragma once
+
+#include <ostream>
+
+// Runs every check, writing one line per check to out. Returns true if all of them passed.
+bool RunSelfTest(std::ostream & out);
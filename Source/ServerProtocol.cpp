@@ -0,0 +1,158 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Encoding and decoding of the generation server's messages (the format is described in          *
+ * ServerProtocol.h). Each message is assembled in a byte buffer and sent with a single write, so *
+ * that a response is never interleaved with anything else on the connection.                     *
+ **************************************************************************************************/
+
+#include "ServerProtocol.h"
+#include "Utf8Decoder.h"
+#include "Utf8Encoder.h"
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const unsigned int GENERATE = 1;
+	const unsigned int GENERATE_FROM = 2;
+	const unsigned int RELOAD = 3;
+
+	template <class T> void Append(std::string & buffer, T value)
+	{
+		buffer.append((const char *)&value, sizeof(value));
+	}
+
+	template <class T> T Extract(const char * bytes)
+	{
+		T value;
+		std::memcpy(&value, bytes, sizeof(value));
+		return value;
+	}
+
+	// Sends a length-prefixed message.
+	bool SendMessage(LocalSocket & socket, const std::string & payload)
+	{
+		std::string message;
+		Append(message, (unsigned int)payload.size());
+		message += payload;
+		return socket.WriteAll(message.data(), message.size());
+	}
+
+	// Receives a length-prefixed message of at most maxSize bytes.
+	bool ReceiveMessage(LocalSocket & socket, std::string & payload, unsigned int maxSize)
+	{
+		unsigned int length;
+		if (!socket.ReadAll(&length, sizeof(length)) || length > maxSize) return false;
+		payload.resize(length);
+		return length == 0 || socket.ReadAll(&payload[0], length);
+	}
+
+	// Decodes UTF-8 text into a wide string.
+	std::wstring DecodeUtf8(const std::string & text)
+	{
+		std::vector<wchar_t> output(text.size() + 4);
+		Utf8Decoder decoder;
+		size_t length = decoder.Decode(text.data(), text.data() + text.size(), output.data());
+		length += decoder.Finish(output.data() + length);
+		return std::wstring(output.data(), length);
+	}
+}
+
+/**************************************************************************************************
+ * Sends a generation request, or a request to reload a model. A request without a context is     *
+ * sent as a plain generate operation, which servers that predate contexts also understand.       *
+ *   Inputs:                                                                                      *
+ *      socket: A connection to the server.                                                       *
+ *      request: The request to send.                                                             *
+ *   return value: false if the connection failed, true otherwise.                                *
+ **************************************************************************************************/
+bool ServerProtocol::SendRequest(LocalSocket & socket, const GenerationRequest & request)
+{
+	std::string payload;
+	Append(payload, request.reload ? RELOAD : request.context.empty() ? GENERATE : GENERATE_FROM);
+	Append(payload, (unsigned int)request.order);
+	Append(payload, (unsigned int)request.numGen);
+	Append(payload, request.seed);
+	if (request.reload || request.context.empty())
+	{
+		payload += EncodeUtf8(request.modelName);
+	}
+	else
+	{
+		std::string name = EncodeUtf8(request.modelName);
+		Append(payload, (unsigned int)name.size());
+		payload += name;
+		payload += EncodeUtf8(request.context);
+	}
+	return SendMessage(socket, payload);
+}
+
+/**************************************************************************************************
+ * Receives and decodes a generation request.                                                     *
+ *   Inputs:                                                                                      *
+ *      socket: A connection from a client.                                                       *
+ *      request: Receives the request.                                                            *
+ *   return value: false if the connection closed or failed, or if the message is not a valid     *
+ *                 request. The connection should be closed in either case, because it can no     *
+ *                 longer be trusted to be at a message boundary.                                 *
+ **************************************************************************************************/
+bool ServerProtocol::ReceiveRequest(LocalSocket & socket, GenerationRequest & request)
+{
+	std::string payload;
+	if (!ReceiveMessage(socket, payload, MAX_REQUEST_SIZE)) return false;
+	const size_t headerSize = 3 * sizeof(unsigned int) + sizeof(long long);
+	if (payload.size() < headerSize) return false;
+	const unsigned int operation = Extract<unsigned int>(&payload[0]);
+	if (operation != GENERATE && operation != GENERATE_FROM && operation != RELOAD) return false;
+	request.order = (int)Extract<unsigned int>(&payload[4]);
+	request.numGen = (int)Extract<unsigned int>(&payload[8]);
+	request.seed = Extract<long long>(&payload[12]);
+	if (request.seed > MAX_SEED) return false;
+	request.reload = operation == RELOAD;
+	if (operation != GENERATE_FROM)
+	{
+		request.modelName = DecodeUtf8(payload.substr(headerSize));
+		request.context.clear();
+		return true;
+	}
+
+	if (payload.size() < headerSize + sizeof(unsigned int)) return false;
+	const size_t nameSize = Extract<unsigned int>(&payload[headerSize]);
+	const size_t nameStart = headerSize + sizeof(unsigned int);
+	if (nameSize > payload.size() - nameStart) return false;
+	request.modelName = DecodeUtf8(payload.substr(nameStart, nameSize));
+	request.context = DecodeUtf8(payload.substr(nameStart + nameSize));
+	return true;
+}
+
+/**************************************************************************************************
+ * Sends the response to a request.                                                               *
+ *   Inputs:                                                                                      *
+ *      socket: The connection the request arrived on.                                            *
+ *      response: The response to send.                                                           *
+ *   return value: false if the connection failed, true otherwise.                                *
+ **************************************************************************************************/
+bool ServerProtocol::SendResponse(LocalSocket & socket, const GenerationResponse & response)
+{
+	std::string payload;
+	Append(payload, (unsigned int)response.status);
+	payload += response.text;
+	return SendMessage(socket, payload);
+}
+
+/**************************************************************************************************
+ * Receives the response to a request.                                                            *
+ *   Inputs:                                                                                      *
+ *      socket: A connection to the server.                                                       *
+ *      response: Receives the response.                                                          *
+ *   return value: false if the connection closed or failed, true otherwise.                      *
+ **************************************************************************************************/
+bool ServerProtocol::ReceiveResponse(LocalSocket & socket, GenerationResponse & response)
+{
+	std::string payload;
+	if (!ReceiveMessage(socket, payload, 0xFFFFFFFF) || payload.size() < sizeof(unsigned int)) return false;
+	response.status = (GenerationResponse::Status)Extract<unsigned int>(&payload[0]);
+	response.text = payload.substr(sizeof(unsigned int));
+	return true;
+}
@@ -0,0 +1,70 @@
+// The messages exchanged between the generation server and its clients. Every message is a 32-bit
+// length followed by that many bytes of payload; all integers are little-endian and all text is
+// UTF-8. A client may send any number of requests over one connection, and receives one response
+// for each, in the same order.
+//
+// Request payload:   operation (uint32, 1 = generate), order (uint32), numGen (uint32),
+//                    seed (int64, negative for a random seed, at most MAX_SEED), model name (the
+//                    remaining bytes)
+//                    or, to continue a context:
+//                    operation (uint32, 2 = generate from), order (uint32), numGen (uint32),
+//                    seed (int64), model name length in bytes (uint32), model name,
+//                    context (the remaining bytes)
+//                    or, to reload a model from its file:
+//                    operation (uint32, 3 = reload), order (uint32), numGen (uint32, ignored),
+//                    seed (int64, ignored), model name (the remaining bytes)
+// Response payload:  status (uint32, see GenerationResponse::Status), text (the remaining bytes):
+//                    the generated gibberish, or an error message
+
+#pragma once
+
+#include "LocalSocket.h"
+#include <climits>
+#include <string>
+
+// A request to generate text from one of the server's models.
+struct GenerationRequest
+{
+	std::wstring modelName; // the model's file name, without directory or extension
+	int order;              // must match the model's order
+	int numGen;             // number of words or characters to generate
+	long long seed;         // seed for the random number generator, or -1 for a random seed
+	std::wstring context;   // optional text for the generated text to continue
+	bool reload;            // true to reload the model from its file instead of generating
+
+	GenerationRequest() : order(2), numGen(100), seed(-1), reload(false) {}
+};
+
+// The server's answer to a GenerationRequest.
+struct GenerationResponse
+{
+	enum Status { OK = 0, UNKNOWN_MODEL = 1, BAD_REQUEST = 2, SHUTTING_DOWN = 3, UNKNOWN_CONTEXT = 4, RELOAD_FAILED = 5 };
+
+	Status status;
+	std::string text; // UTF-8; empty after a reload
+
+	GenerationResponse() : status(OK) {}
+};
+
+namespace ServerProtocol
+{
+	// Requests larger than this are rejected without being read.
+	const unsigned int MAX_REQUEST_SIZE = 64 * 1024;
+	// The largest numGen a server will accept.
+	const int MAX_NUM_GEN = 10 * 1000 * 1000;
+	// The largest seed a server will accept. Random is seeded with an int, and a larger seed would
+	// be truncated into the same one as some smaller seed.
+	const long long MAX_SEED = INT_MAX;
+
+	// Sends a request. Returns false if the connection failed.
+	bool SendRequest(LocalSocket & socket, const GenerationRequest & request);
+
+	// Receives a request. Returns false if the connection closed or the request was malformed.
+	bool ReceiveRequest(LocalSocket & socket, GenerationRequest & request);
+
+	// Sends a response. Returns false if the connection failed.
+	bool SendResponse(LocalSocket & socket, const GenerationResponse & response);
+
+	// Receives a response. Returns false if the connection closed or failed.
+	bool ReceiveResponse(LocalSocket & socket, GenerationResponse & response);
+}
@@ -0,0 +1,83 @@
+// A bounded, lock-free queue connecting exactly one producer thread to exactly one consumer thread.
+// Used to link the stages of the IngestPipeline. Push() blocks while the queue is full and Pop()
+// blocks while it is empty; either side can Abandon() the queue to release the other. A producer
+// abandons the queue once it has nothing more to push: the consumer still gets the items already
+// queued, and then Pop() returns false instead of waiting for more.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template <class T> class SpscQueue
+{
+	std::vector<T> slots;
+	const size_t capacity;
+	alignas(64) std::atomic<size_t> head; // index of the next item to pop; written by the consumer
+	alignas(64) std::atomic<size_t> tail; // index of the next free slot; written by the producer
+	alignas(64) std::atomic<bool> abandoned;
+
+	// Waits a little longer each time the queue is found full (or empty).
+	static void Backoff(int & attempts)
+	{
+		if (++attempts < 64) std::this_thread::yield();
+		else std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+
+public:
+	// Constructor. The queue holds at most maxItems items.
+	explicit SpscQueue(size_t maxItems) : slots(maxItems), capacity(maxItems), head(0), tail(0),
+		abandoned(false) {}
+
+	// Producer side. Moves item into the queue unless the queue is full. Never blocks.
+	bool TryPush(T & item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == capacity) return false;
+		slots[t % capacity] = std::move(item);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side. Moves the oldest item out of the queue unless the queue is empty. Never blocks.
+	bool TryPop(T & item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		item = std::move(slots[h % capacity]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Producer side. Waits for room, then pushes. Returns false if the queue was abandoned.
+	bool Push(T item)
+	{
+		int attempts = 0;
+		while (!TryPush(item))
+		{
+			if (abandoned.load(std::memory_order_relaxed)) return false;
+			Backoff(attempts);
+		}
+		return true;
+	}
+
+	// Consumer side. Waits for an item, then pops it. Returns false if the queue was abandoned and
+	// is empty.
+	bool Pop(T & item)
+	{
+		int attempts = 0;
+		while (!TryPop(item))
+		{
+			// An item pushed just before the queue was abandoned is still popped:
+			if (abandoned.load(std::memory_order_acquire)) return TryPop(item);
+			Backoff(attempts);
+		}
+		return true;
+	}
+
+	// Releases any thread blocked in Push() or Pop(). Used to shut a pipeline down early.
+	void Abandon() { abandoned = true; }
+};
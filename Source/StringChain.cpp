@@ -16,80 +16,217 @@
  **************************************************************************************************/
 
 #include "StringChain.h"
+#include "ModelFile.h"
+#include "TokenPolicy.h"
+#include <algorithm>
+#include <vector>
 
 /**************************************************************************************************
  * Constructor. The "currentPrefix" buffer is initialized with non-word padding.                  *
  *   Inputs:                                                                                      *
  *      order: How many words or characters per Prefix.                                           *
  **************************************************************************************************/
-StringChain::StringChain(int order) : markovOrder(order)
+StringChain::StringChain(int order) : markovOrder(order), currentPrefix(order, Vocabulary::NONWORD_ID)
 {
-	for(int i=0; i<order; ++i){
-		currentPrefix.push_back(NONWORD); 
-	}
 }
 
 /**************************************************************************************************
- * Reads words or characters from the given input filestream and adds all of its Prefixes and     *
- * Suffixes to the Markov chain. Tokens (words or characters) are read one at a time.             *
+ * Destructor. Frees the <Prefix, Suffix> map, unless deleteMap() has already done so.            *
+ **************************************************************************************************/
+StringChain::~StringChain()
+{
+	deleteMap();
+}
+
+/**************************************************************************************************
+ * Reads tokens from the given input stream and adds all of its Prefixes and Suffixes to the      *
+ * Markov chain. The tokenizer policy that tokenType names is chosen once, and AddTokens() reads  *
+ * the whole stream with it. If a ProgressMonitor is supplied, its cancellation flag is checked   *
+ * before every word or character; when it is set, reading stops immediately and the padding is   *
+ * not added, so the chain should be discarded.                                                   *
  *   Inputs:                                                                                      *
- *      filestream: An opened input filestream                                                    *
- *      tokenType: A string indicating whether words or characters are being used for the Markov  *
- *                  chain. Allowed values: "words", "characters".                                 *
- *   return value: none                                                                           *
+ *      filestream: An opened input stream (a std::wifstream, or a std::wistream reading from a   *
+ *                  Utf8StreamBuf)                                                                *
+ *      tokenType: A string indicating how the text is split into tokens. Allowed values:         *
+ *                 "words", "characters", "punctuation".                                          *
+ *      monitor: Optional. Polled for cancellation requests.                                      *
+ *   return value: true if the entire stream was read, false if the read was cancelled.           *
  **************************************************************************************************/
-void  StringChain::AddItems(std::wifstream & filestream, std::wstring tokenType)
+bool StringChain::AddItems(std::wistream & filestream, const std::wstring & tokenType, 
+                           ProgressMonitor * monitor)
 {
-	do{ 
-		// read the next token
-		if (tokenType == L"words") filestream >> nextToken; // read a word
-		else nextToken = std::wstring(1,filestream.get());  // read a character
-		
-		// If the user specified an empty file, just put in a nonword entry. This ensures that
-		// there's at least *something* in the prefixsuffixmap so that generate() won't explode.
-		if (filestream.eof() && prefixSuffixMap.empty()) nextToken = NONWORD;
-		
-		// Check to see whether the prefix already exists in the map:
-		Prefix tempPrefix(currentPrefix);
-		auto it = prefixSuffixMap.find(&tempPrefix);
-		
-		// If it doesn't, then add this <Prefix,Suffix> pair to the map:
-		if(it == prefixSuffixMap.end()){
-			std::list<std::wstring> newSuffixList;
-			newSuffixList.push_back(nextToken);
-			prefixSuffixMap.insert(std::make_pair(new Prefix(currentPrefix), 
-				                                  new Suffix(newSuffixList)));
+	bool finished = false;
+	VisitTokenPolicy(tokenType, [&](auto policy) {
+		finished = AddTokens<decltype(policy)>(filestream, monitor);
+	});
+	return finished;
+}
+
+/**************************************************************************************************
+ * AddItems(), for one tokenizer policy. Words are extracted with operator>> and characters with  *
+ * get(); each token is passed to AddToken(), and EndInput() then adds the non-word padding. A    *
+ * word that is a single token is added as it is, without being copied.                           *
+ *   Inputs:                                                                                      *
+ *      filestream: An opened input stream.                                                       *
+ *      monitor: Optional. Polled for cancellation requests.                                      *
+ *   return value: true if the entire stream was read, false if the read was cancelled.           *
+ **************************************************************************************************/
+template <class Policy> bool StringChain::AddTokens(std::wistream & filestream, ProgressMonitor * monitor)
+{
+	while (true)
+	{
+		if (monitor && monitor->IsCancelled()) return false;
+
+		// read the next word or character, stopping at the end of the stream
+		if (Policy::WHITESPACE_SEPARATES)
+		{
+			if (!(filestream >> nextWord)) break; // read a word
+			const wchar_t * begin = nextWord.data();
+			const wchar_t * end = begin + nextWord.size();
+			if (Policy::TokenEnd(begin, end) == end) AddToken(nextWord);
+			else SplitWord<Policy>(begin, end, [this](const wchar_t * tokenBegin, const wchar_t * tokenEnd) {
+				nextToken.assign(tokenBegin, tokenEnd);
+				AddToken(nextToken);
+			});
 		}
-		
-		// If it does, then grab the word list of the suffix and add nextToken to it.
-		else{ 
-			(*(it->second)).AddSuffix(nextToken);
-			multiples++; // for debugging pursposes
+		else
+		{
+			std::wistream::int_type c = filestream.get(); // read a character
+			if (c == std::wistream::traits_type::eof()) break;
+			nextToken.assign(1, std::wistream::traits_type::to_char_type(c));
+			AddToken(nextToken);
 		}
-	
-		// Advance the buffer by 1 token:
-		currentPrefix.push_back(nextToken);
-		currentPrefix.pop_front();
-	} while (!filestream.eof());
+	}
+
+	EndInput();
+	return true;
+}
+
+/**************************************************************************************************
+ * Adds a model file's <Prefix, Suffix> pairs to the Markov chain. Model files are produced by    *
+ * the out-of-core trainer (see OutOfCoreTrainer), and store each distinct pair once along with   *
+ * the number of times it occurred, so a chain loaded from a model generates exactly the same     *
+ * text as a chain trained directly on the model's source texts. The model's order must match     *
+ * this chain's order. The model's token IDs are translated to this chain's IDs once, up front,   *
+ * rather than once per record.                                                                   *
+ *   Inputs:                                                                                      *
+ *      model: An opened model file.                                                              *
+ *      monitor: Optional. Polled for cancellation requests once per record.                      *
+ *   return value: true if every record was read, false if the file is truncated or the read was  *
+ *                 cancelled.                                                                     *
+ **************************************************************************************************/
+bool StringChain::AddModel(ModelReader & model, ProgressMonitor * monitor)
+{
+	const Vocabulary & modelVocabulary = model.GetVocabulary();
+	std::vector<unsigned int> ids(modelVocabulary.Size());
+	for (size_t i = 0; i < ids.size(); ++i) ids[i] = vocabulary.Intern(modelVocabulary.Token((unsigned int)i));
+
+	std::vector<unsigned int> key(markovOrder + 1);
+	unsigned long long count;
+	while (model.Next(key.data(), count))
+	{
+		if (monitor && monitor->IsCancelled()) return false;
+		for (int i = 0; i <= markovOrder; ++i) key[i] = ids[key[i]];
+		AddCount(key.data(), key[markovOrder], count);
+	}
+	return !model.Truncated();
+}
+
+/**************************************************************************************************
+ * Adds the <prefix, suffix> pair to the Markov chain count times, as if it had been read count   *
+ * times.                                                                                         *
+ *   Inputs:                                                                                      *
+ *      prefix: Exactly markovOrder words or characters.                                          *
+ *      suffix: The word or character that follows the prefix.                                    *
+ *      count: The number of times the suffix followed the prefix.                                *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void StringChain::AddCount(const std::list<std::wstring> & prefix, const std::wstring & suffix,
+                           unsigned long long count)
+{
+	std::vector<unsigned int> ids;
+	for (auto it = prefix.begin(); it != prefix.end(); ++it) ids.push_back(vocabulary.Intern(*it));
+	AddCount(ids.data(), vocabulary.Intern(suffix), count);
+}
+
+/**************************************************************************************************
+ * Adds the <prefix, suffix> pair, given as token IDs, to the Markov chain count times.           *
+ *   Inputs:                                                                                      *
+ *      prefix: Exactly markovOrder token IDs.                                                    *
+ *      suffix: The ID of the token that follows the prefix.                                      *
+ *      count: The number of times the suffix followed the prefix.                                *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void StringChain::AddCount(const unsigned int * prefix, unsigned int suffix, unsigned long long count)
+{
+	if (count == 0) return;
+	Prefix::View view = { prefix, (size_t)markovOrder };
+	auto it = prefixSuffixMap.find(view);
+	if (it == prefixSuffixMap.end())
+	{
+		prefixSuffixMap.insert(std::make_pair(new Prefix(prefix, markovOrder), Suffix(suffix, count)));
+	}
+	else it->second.AddSuffix(suffix, count);
+}
+
+/**************************************************************************************************
+ * Adds a single <Prefix, Suffix> pair to the Markov chain: the Prefix is the current contents of *
+ * the currentPrefix buffer and the Suffix is the given token. The buffer is then advanced by one *
+ * token. This is the building block used both by AddItems() and by the IngestPipeline, which     *
+ * reads and tokenizes files on separate threads and then hands the tokens over one at a time.    *
+ *                                                                                                *
+ * Once the chain has seen a <Prefix, Suffix> pair, adding it again allocates no memory: the map  *
+ * is searched with a View of the currentPrefix buffer instead of a temporary Prefix, and the     *
+ * buffer holds token IDs, which are shifted in place.                                            *
+ *   Inputs:                                                                                      *
+ *      token: The word or character that follows currentPrefix in the input text.                *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void StringChain::AddToken(const std::wstring & token)
+{
+	// Check to see whether the prefix already exists in the map:
+	Prefix::View view = { currentPrefix.data(), currentPrefix.size() };
+	auto it = prefixSuffixMap.find(view);
+
+	// If it doesn't, then add this <Prefix,Suffix> pair to the map:
+	unsigned int id = vocabulary.Intern(token);
+	if(it == prefixSuffixMap.end()){
+		prefixSuffixMap.insert(std::make_pair(new Prefix(currentPrefix.data(), currentPrefix.size()), Suffix(id)));
 
-	//add nonword padding to the end. 
-	nextToken = NONWORD;
+		// Share identical Suffix distributions every time the map doubles in size:
+		if (prefixSuffixMap.size() >= 2 * sizeAtLastCompaction && prefixSuffixMap.size() >= 65536) 
+			CompactSuffixes();
+	}
+
+	// If it does, then add the token to the prefix's list of suffixes.
+	else{ 
+		it->second.AddSuffix(id);
+		multiples++; // for debugging pursposes
+	}
+
+	// Advance the buffer by 1 token:
+	if (!currentPrefix.empty())
+	{
+		std::copy(currentPrefix.begin() + 1, currentPrefix.end(), currentPrefix.begin());
+		currentPrefix.back() = id;
+	}
+	tokensInCurrentInput++;
+}
+
+/**************************************************************************************************
+ * Marks the end of an input text by adding non-word padding, which leaves the currentPrefix      *
+ * buffer filled with non-words again, ready for the next text. If the user specified an empty    *
+ * file and nothing else has been read, a nonword entry is added first. This ensures that there's *
+ * at least *something* in the prefixsuffixmap so that generate() won't explode.                  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void StringChain::EndInput()
+{
+	if (tokensInCurrentInput == 0 && prefixSuffixMap.empty()) AddToken(NONWORD);
 	for(int i=0; i<markovOrder; ++i){
-		Prefix tempPrefix(currentPrefix);
-		auto it = prefixSuffixMap.find(&tempPrefix);
-		if(it == prefixSuffixMap.end()){
-			std::list<std::wstring> newSuffixList;
-			newSuffixList.push_back(nextToken);
-			prefixSuffixMap.insert(std::make_pair(new Prefix(currentPrefix), 
-				                                  new Suffix(newSuffixList)));
-		}
-		else{ 
-			(*(it->second)).AddSuffix(nextToken);
-			multiples++;
-		}
-		currentPrefix.push_back(nextToken);
-		currentPrefix.pop_front();
+		AddToken(NONWORD);
 	}
+	tokensInCurrentInput = 0;
 }
 
 /**************************************************************************************************
@@ -97,77 +234,167 @@ void  StringChain::AddItems(std::wifstream & filestream, std::wstring tokenType)
  * is chosen at random from the list of that Prefix's possible Suffixes and added to the output.  *
  * The first word of the current Prefix is then discarded and the chosen Suffix becomes the last  *
  * token of the current Prefix for the next randomly-chosen word.                                 *
+ *                                                                                                *
+ * The output is built in place (see the overload below), so apart from the output itself no      *
+ * memory is allocated per generated token.                                                       *
  *   Inputs:                                                                                      *
  *      numGen: The number of words or characters to be generated.                                *
  *      order: The order of the Markov chain. That is, the number of words/characters per Prefix  *
  *      tokenType: A string indicating whether words or characters are being used for the Markov  *
- *                  chain. Allowed values: "words", "characters".                                 *
+ *                 chain. Allowed values: "words", "characters".                                  *
  *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests. A cancelled generation returns the output produced so     *
+ *               far.                                                                             *
  *   return value: A string containing numGen tokens of generated gibberish.                      *
  **************************************************************************************************/
-std::wstring StringChain::generate(int numGen, int order, std::wstring tokenType, Random rand)
+std::wstring StringChain::generate(int numGen, int order, const std::wstring & tokenType, Random & rand,
+                                   ProgressMonitor * monitor) const
 {	
 	std::wstring output;
+	generate(numGen, order, tokenType, rand, output, monitor);
+	return output;
+}
+
+/**************************************************************************************************
+ * Appends a string of gibberish to output, as described above. The walk uses its own buffer of   *
+ * token IDs, so that generating does not disturb the currentPrefix buffer used for training. If  *
+ * output has room for the generated text, the loop performs no heap allocations at all.          *
+ *   Inputs:                                                                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      order: The order of the Markov chain. That is, the number of words/characters per Prefix  *
+ *      tokenType: A string indicating how tokens are written out. Allowed values: "words",       *
+ *                 "characters", "punctuation".                                                   *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the gibberish is appended.                                    *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests. A cancelled generation leaves the output produced so far. *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void StringChain::generate(int numGen, int order, const std::wstring & tokenType, Random & rand, 
+                           std::wstring & output, ProgressMonitor * monitor) const
+{
+	VisitTokenPolicy(tokenType, [&](auto policy) {
+		Walk<decltype(policy)>(numGen, rand, output, monitor);
+	});
+}
+
+/**************************************************************************************************
+ * generate(), for one tokenizer policy, which decides how each token is written to the output.   *
+ *   Inputs:                                                                                      *
+ *      numGen: The number of words or characters to be generated.                                *
+ *      rand: An object of type Random (pseudorandom number generator)                            *
+ *      output: The string to which the gibberish is appended.                                    *
+ *      monitor: Optional. Receives the number of tokens generated so far, and is polled for      *
+ *               cancellation requests.                                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+template <class Policy>
+void StringChain::Walk(int numGen, Random & rand, std::wstring & output, ProgressMonitor * monitor) const
+{
+	if (prefixSuffixMap.empty()) return; // nothing was read
 
 	// Select a random prefix to begin the Markov generation. Assign it to the curent buffer.
 	int startingPrefixIndex = rand.nextInt(prefixSuffixMap.size());
-	std::map<Prefix*, Suffix*>::iterator startingPrefixPointer = prefixSuffixMap.begin();
+	auto startingPrefixPointer = prefixSuffixMap.begin();
 	for (int i = startingPrefixIndex; i > 0; i--) ++startingPrefixPointer;
-	currentPrefix = (startingPrefixPointer->first)->GetPrefix();
+	std::vector<unsigned int> buffer = (startingPrefixPointer->first)->GetPrefix();
 
 	for(int i=0; i<numGen; ++i){
+		// Report progress and honor cancellation requests every so often:
+		if (monitor && i % 256 == 0)
+		{
+			monitor->SetTokensGenerated(i);
+			if (monitor->IsCancelled()) return;
+		}
+
 		// find the Prefix in prefixSuffixMap corresponding to the current buffer:
-		Prefix tempPrefix(currentPrefix);
-		auto mapEntry = prefixSuffixMap.find(&tempPrefix);
+		Prefix::View view = { buffer.data(), buffer.size() };
+		auto mapEntry = prefixSuffixMap.find(view);
 		
 		// If a prefix somehow doesn't exist in the map, stop execution and print an error message:
 		if (mapEntry == prefixSuffixMap.end())
 		{
 			output += L"Error! The Prefix \""; 
-			for (auto it = tempPrefix.GetPrefix().begin(); it != tempPrefix.GetPrefix().end(); ++it)
+			for (auto it = buffer.begin(); it != buffer.end(); ++it)
 			{
-				std::wstring prefixString = *it;
-				std::wstring prefixWString;
-				prefixWString.assign(prefixString.begin(), prefixString.end());
-				output += L" " + prefixWString;
+				output += L" " + vocabulary.Token(*it);
 			}
 			output += L"\" does not exist in map. There must be an error in the program's ";
 			output += L"logic somewhere. The length of the prefix is ";
-			output += std::to_wstring(tempPrefix.GetPrefix().size()) + L"\r\n";
+			output += std::to_wstring(buffer.size()) + L"\r\n";
 			output += printMap();
-			return output;
+			return;
 		}
 
 		// Choose one of the Prefix's possible Suffixes:
-		nextToken = (*(mapEntry->second)).GetRandomSuffix(rand);
+		unsigned int id = mapEntry->second.GetRandomSuffix(rand);
 	
 		// advance the buffer by 1 word:
-		currentPrefix.push_back(nextToken);
-		currentPrefix.pop_front();
-	
-		//save the word to the output, unless it is a nonword:
-		if(nextToken != NONWORD)
+		if (!buffer.empty())
 		{
-			if(tokenType == L"words") output += L" " + nextToken;
-			else output += nextToken;
+			std::copy(buffer.begin() + 1, buffer.end(), buffer.begin());
+			buffer.back() = id;
 		}
+	
+		//save the word to the output, unless it is a nonword:
+		if(id != Vocabulary::NONWORD_ID) Policy::Append(output, vocabulary.Token(id));
 	}
 
-	return output;
+	if (monitor) monitor->SetTokensGenerated(numGen);
+}
+
+/**************************************************************************************************
+ * Makes all Prefixes whose Suffix distributions are identical share a single copy of the         *
+ * distribution (see Suffix::Deduplicate()). AddToken() calls this every time the map doubles in  *
+ * size, so the memory saved is available during training and not just afterwards, at an          *
+ * amortized cost of a constant amount of work per Prefix.                                        *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void StringChain::CompactSuffixes()
+{
+	Suffix::DistributionPool pool;
+	for (auto it = prefixSuffixMap.begin(); it != prefixSuffixMap.end(); ++it) it->second.Deduplicate(pool);
+	sizeAtLastCompaction = prefixSuffixMap.size();
+}
+
+/**************************************************************************************************
+ * Calls visit once for every distinct <Prefix, Suffix> pair in the Markov chain, in order of     *
+ * Prefix, with the number of times the Suffix follows the Prefix. This is how the contents of    *
+ * the chain are handed to CompiledChain.                                                         *
+ *   Inputs:                                                                                      *
+ *      visit: The function to call for each pair.                                                *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void StringChain::ForEachPair(const std::function<void(const std::list<std::wstring> & prefix,
+                              const std::wstring & suffix, unsigned long long count)> & visit) const
+{
+	for (auto it = prefixSuffixMap.begin(); it != prefixSuffixMap.end(); ++it)
+	{
+		const std::vector<unsigned int> & ids = it->first->GetPrefix();
+		std::list<std::wstring> prefix;
+		for (auto id = ids.begin(); id != ids.end(); ++id) prefix.push_back(vocabulary.Token(*id));
+		it->second.ForEachSuffix([&](unsigned int token, unsigned long long count) {
+			visit(prefix, vocabulary.Token(token), count);
+		});
+	}
 }
 
 /**************************************************************************************************
  * Frees all memmory that was allocated for the <Prefix, Suffix> map. Called after gibberish is   *
- * generated to prevent memory leakage.                                                           *
+ * generated to prevent memory leakage. The map is left empty, so calling this twice is harmless. *
  *   return value: none                                                                           *
  **************************************************************************************************/
 void StringChain::deleteMap() 
 {
 	for (auto it = prefixSuffixMap.begin(); it != prefixSuffixMap.end(); ++it) 
 	{
-		delete it->second;
 		delete it->first;
 	}
+	prefixSuffixMap.clear();
+	vocabulary = Vocabulary();
+	sizeAtLastCompaction = 0;
+	currentPrefix.assign(markovOrder, Vocabulary::NONWORD_ID); // the IDs it held are gone
 }
 
 // Debugging utilities
@@ -182,7 +409,7 @@ std::wstring StringChain::PrintCurrentPrefix()
 	std::wstring output = L"currentPrefix: {";
 	for(auto it=currentPrefix.begin(); it != currentPrefix.end(); ++it)
 	{
-		output += (*it) + L" ";
+		output += vocabulary.Token(*it) + L" ";
 	}
 	output += L"}";
 	return output;
@@ -203,14 +430,14 @@ std::wstring StringChain::printnextToken()
  * Created for debugging purposes.                                                                *
  *   return value: A string each prefix-suffix pairing on its own line                            *
  **************************************************************************************************/
-std::wstring StringChain::printMap(){
+std::wstring StringChain::printMap() const {
 	std::wstring output;
 	for(auto it = prefixSuffixMap.begin(); it != prefixSuffixMap.end(); ++it)
 	{
 		output += L"PREFIX {";
-		output += (*(it->first)).GetPrefixString();
+		output += (*(it->first)).GetPrefixString(vocabulary);
 		output += L"}; SUFFIXES {";
-		output += (*(it->second)).GetAllSuffixes();
+		output += it->second.GetAllSuffixes(vocabulary);
 		output += L"}\r\n";
 	}	
 	output += L"pairs with multiple suffixes: " + std::to_wstring(multiples);
@@ -6,30 +6,83 @@
 #include "Prefix.h"
 #include "Suffix.h"
 #include "Random.h"
+#include "Vocabulary.h"
+#include "ProgressMonitor.h"
+#include "TokenSink.h"
 #include <map>
 #include <list>
+#include <functional>
 #include <string>
-#include <fstream>
+#include <istream>
+#include <vector>
 
 #define NONWORD L""
-class StringChain
+class ModelReader;
+class StringChain : public TokenSink
 {
 	const int markovOrder;
-	std::map<Prefix*,Suffix*,Prefix::cmpPointees> prefixSuffixMap;
-	std::list<std::wstring> currentPrefix;
+	std::map<Prefix*,Suffix,Prefix::cmpPointees> prefixSuffixMap;
+	Vocabulary vocabulary; // maps the token IDs stored in the Suffixes to tokens
+	size_t sizeAtLastCompaction = 0;
+	std::vector<unsigned int> currentPrefix; // token IDs of the last markovOrder tokens read
 	std::wstring nextToken;
+	std::wstring nextWord;
 	int multiples = 0;
+	long long tokensInCurrentInput = 0;
+
+	// Adds the <prefix, suffix> pair, given as token IDs, to the Markov Chain count times.
+	void AddCount(const unsigned int * prefix, unsigned int suffix, unsigned long long count);
+
+	// AddItems() and generate(), compiled once for each tokenizer policy (see TokenPolicy.h).
+	template <class Policy> bool AddTokens(std::wistream & filestream, ProgressMonitor * monitor);
+	template <class Policy> void Walk(int n, Random & rand, std::wstring & output, ProgressMonitor * monitor) const;
 
 public:
 	// Constructor.
 	StringChain(int order); 
 
-	// Adds all Prefixes and Suffixes from the given input filestream to the Markov Chain.
-	void AddItems(std::wifstream & filestream, std::wstring tokenType);
+	// Destructor. Frees the <Prefix, Suffix> map if it has not already been freed.
+	~StringChain();
+
+	// The map owns its Prefixes, which a copy would free a second time, so chains are not copied.
+	StringChain(const StringChain &) = delete;
+	StringChain & operator=(const StringChain &) = delete;
+
+	// Adds all Prefixes and Suffixes from the given input stream to the Markov Chain. Returns false
+	// if the monitor's cancellation flag stopped the read before the end of the stream.
+	bool AddItems(std::wistream & filestream, const std::wstring & tokenType, 
+	              ProgressMonitor * monitor = NULL);
+
+	// Adds every counted <Prefix, Suffix> pair stored in a model file to the Markov Chain. Returns
+	// false if the file is truncated or the monitor cancelled the read.
+	bool AddModel(ModelReader & model, ProgressMonitor * monitor = NULL);
+
+	// Adds the <prefix, suffix> pair to the Markov Chain count times.
+	void AddCount(const std::list<std::wstring> & prefix, const std::wstring & suffix, 
+	              unsigned long long count);
+
+	// Adds the <currentPrefix, token> pair to the Markov Chain and advances currentPrefix.
+	void AddToken(const std::wstring & token) override;
+
+	// Adds the non-word padding that follows the last token of an input text.
+	void EndInput() override;
 	
-	// Generates a string of gibberish from the Markov Chain.
-	std::wstring generate(int n, int order, std::wstring tokenType, Random rand);
+	// Generates a string of gibberish from the Markov Chain. Generation only reads the chain, so
+	// several threads may generate from it at once, each with a Random of its own.
+	std::wstring generate(int n, int order, const std::wstring & tokenType, Random & rand, 
+	                      ProgressMonitor * monitor = NULL) const;
+
+	// Appends n tokens of gibberish to output. Allocates nothing if output has enough capacity.
+	void generate(int n, int order, const std::wstring & tokenType, Random & rand, std::wstring & output,
+	              ProgressMonitor * monitor = NULL) const;
 	
+	// Makes all Prefixes with identical Suffix distributions share one copy of the distribution.
+	void CompactSuffixes();
+
+	// Calls visit once for every distinct <Prefix, Suffix> pair, with the number of times it occurs.
+	void ForEachPair(const std::function<void(const std::list<std::wstring> & prefix, 
+	                 const std::wstring & suffix, unsigned long long count)> & visit) const;
+
 	// Frees all memmory that was allocated for the <Prefix, Suffix> map.
 	void deleteMap();
 	
@@ -40,5 +93,5 @@ public:
 	std::wstring StringChain::printnextToken();
 
 	// Constructs a string containing a readable representation of the entire prefix-suffx map.
-	std::wstring printMap();	
+	std::wstring printMap() const;	
 };
\ No newline at end of file
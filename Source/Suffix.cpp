@@ -4,56 +4,212 @@
  * A class for storing "suffixes" for Markov chain generation. A suffix is a word or character    *
  * that tends to follow a group of other words or characters. For example, Suffixes for "Beam us  *
  * up," might include "Scotty" and "Enterprise." Since a group of words can have multiple         *
- * possible Suffixes, the suffixes are stored in a list.                                          *
+ * possible Suffixes, each Prefix has a list of them.                                             *
+ *                                                                                                *
+ * The list is stored compactly, because a trained chain holds one for every distinct Prefix in   *
+ * the input. Tokens are stored as IDs from the chain's Vocabulary, and each distinct token is    *
+ * stored once along with the number of times it occurred. In a higher-order chain most Prefixes  *
+ * are followed by only one distinct token; such a list is held entirely inside the Suffix object *
+ * (which in turn is held inside the chain's map), with no memory allocated for it at all. Longer *
+ * lists are kept in a separate Distribution whose counts are only as wide as they need to be: a  *
+ * byte each until some count exceeds 255, two bytes until one exceeds 65535, and so on.          *
+ *                                                                                                *
+ * Distributions can also be shared. Many Prefixes that end in the same words are followed by     *
+ * exactly the same tokens in exactly the same proportions, so after training (and periodically   *
+ * during training) the chain passes every Suffix through Deduplicate(), which makes all          *
+ * identical distributions point at one copy. A shared distribution is never modified:            *
+ * AddSuffix() makes a private copy first.                                                        *
  **************************************************************************************************/
 
 #include "Suffix.h"
+#include <algorithm>
+#include <cstring>
 
 /**************************************************************************************************
- * Constructor. Initializes the list of possible suffixes with the list passed as a parameter.    *
+ * Adds count occurrences of a token. The tokens are kept sorted, so the token is found by binary *
+ * search.                                                                                        *
+ *   Inputs:                                                                                      *
+ *      token: The ID of a word or character.                                                     *
+ *      count: The number of occurrences to add.                                                  *
+ *   return value: none                                                                           *
  **************************************************************************************************/
-Suffix::Suffix(std::list<std::wstring> suffixSetter) : possibleSuffixes(suffixSetter){}
+void Suffix::Distribution::Add(unsigned int token, unsigned long long count)
+{
+	size_t index = std::lower_bound(tokens.begin(), tokens.end(), token) - tokens.begin();
+	if (index == tokens.size() || tokens[index] != token)
+	{
+		tokens.insert(tokens.begin() + index, token);
+		counts.insert(counts.begin() + index * countWidth, countWidth, 0);
+	}
+	SetCount(index, Count(index) + count);
+	total += count;
+}
 
 /**************************************************************************************************
- * A method for adding a word to the list of possible suffixes.                                   *
+ * Returns the number of occurrences of the token at the given index.                             *
+ **************************************************************************************************/
+unsigned long long Suffix::Distribution::Count(size_t index) const
+{
+	const unsigned char * bytes = &counts[index * countWidth];
+	switch (countWidth)
+	{
+	case 1: return bytes[0];
+	case 2: { unsigned short value; std::memcpy(&value, bytes, 2); return value; }
+	case 4: { unsigned int value; std::memcpy(&value, bytes, 4); return value; }
+	default: { unsigned long long value; std::memcpy(&value, bytes, 8); return value; }
+	}
+}
+
+/**************************************************************************************************
+ * Stores the count of the token at the given index. If the count does not fit in the current     *
+ * width, every count is first rewritten at the smallest width that holds it.                     *
  *   Inputs:                                                                                      *
- *      newSuffix: A std:wstring containing the suffix to add to the list of poosible suffixes.   *
+ *      index: The position of the token.                                                         *
+ *      count: The token's new count.                                                             *
  *   return value: none                                                                           *
  **************************************************************************************************/
-void Suffix::AddSuffix(std::wstring newSuffix)
+void Suffix::Distribution::SetCount(size_t index, unsigned long long count)
+{
+	unsigned char width = count <= 0xFF ? 1 : count <= 0xFFFF ? 2 : count <= 0xFFFFFFFFULL ? 4 : 8;
+	if (width > countWidth)
+	{
+		std::vector<unsigned char> widened(tokens.size() * width);
+		for (size_t i = 0; i < tokens.size(); ++i)
+		{
+			unsigned long long value = Count(i); // little-endian, so the low bytes come first
+			std::memcpy(&widened[i * width], &value, width);
+		}
+		counts.swap(widened);
+		countWidth = width;
+	}
+	std::memcpy(&counts[index * countWidth], &count, countWidth);
+}
+
+/**************************************************************************************************
+ * Computes a hash of the distribution's tokens and counts.                                       *
+ **************************************************************************************************/
+size_t Suffix::Distribution::Hash() const
+{
+	size_t hash = tokens.size();
+	for (size_t i = 0; i < tokens.size(); ++i)
+	{
+		hash = hash * 1000003 ^ tokens[i];
+		hash = hash * 1000003 ^ (size_t)Count(i);
+	}
+	return hash;
+}
+
+/**************************************************************************************************
+ * Returns true if both distributions hold the same tokens with the same counts.                  *
+ **************************************************************************************************/
+bool Suffix::Distribution::operator==(const Distribution & other) const
+{
+	return total == other.total && countWidth == other.countWidth && tokens == other.tokens && 
+		counts == other.counts;
+}
+
+/**************************************************************************************************
+ * Constructor. Creates a suffix list holding count occurrences of one token.                     *
+ **************************************************************************************************/
+Suffix::Suffix(unsigned int token, unsigned long long count) : singleToken(token), singleCount(0)
 {
-	possibleSuffixes.push_back(newSuffix);
+	AddSuffix(token, count);
 }
 
 /**************************************************************************************************
- * Retrieves a random word (or character) from the list of possible suffixes. This method is      *
- * called frequently while generating gibberish from the Markov chain. Note: Operator += is not   *
- * defined for list iterators, so "randomWordPointer += randomIndex" won't work. Instead, we must *
- * construct a loop and use ++. For better performance, possibleSuffixes can be made into a       *
- * std::vector instead of a std::list. Such a data structure consumes more memory.                *
+ * A method for adding occurrences of a token to the list of possible suffixes. A list that holds *
+ * a single distinct token is stored inline; adding a second distinct token (or a count too large *
+ * for 32 bits) moves it into a Distribution. A Distribution that is shared with other Suffixes   *
+ * is copied before it is changed.                                                                *
+ *   Inputs:                                                                                      *
+ *      token: The ID of the word or character to add.                                            *
+ *      count: The number of occurrences to add.                                                  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void Suffix::AddSuffix(unsigned int token, unsigned long long count)
+{
+	if (!distribution)
+	{
+		if (token == singleToken && singleCount + count <= 0xFFFFFFFFULL)
+		{
+			singleCount += (unsigned int)count;
+			return;
+		}
+		distribution = std::make_shared<Distribution>();
+		if (singleCount > 0) distribution->Add(singleToken, singleCount);
+	}
+	else if (distribution.use_count() > 1)
+	{
+		distribution = std::make_shared<Distribution>(*distribution);
+	}
+	distribution->Add(token, count);
+}
+
+/**************************************************************************************************
+ * Retrieves a random token from the list of possible suffixes. Each distinct token is chosen     *
+ * with probability proportional to its count, exactly as if one occurrence had been picked from  *
+ * a list holding every occurrence.                                                               *
  *   Inputs:                                                                                      *
  *      rand: An object of type Random (pseudorandom number generator)                            *
- *   return value: a wstring containing a single token from the suffix list.                      *
+ *   return value: The ID of a single token from the suffix list.                                 *
  **************************************************************************************************/
-std::wstring Suffix::GetRandomSuffix(Random rand)
+unsigned int Suffix::GetRandomSuffix(Random & rand) const
 {
-	int randomIndex = rand.nextInt(possibleSuffixes.size());
-	auto randomWordPointer = possibleSuffixes.begin();
-	for(int i=0; i<randomIndex; ++i) ++randomWordPointer;
-	return *randomWordPointer;
+	if (!distribution) return singleToken;
+	unsigned long long draw = rand.nextLong(distribution->Total());
+	size_t last = distribution->Size() - 1;
+	for (size_t i = 0; i < last; ++i)
+	{
+		unsigned long long count = distribution->Count(i);
+		if (draw < count) return distribution->Token(i);
+		draw -= count;
+	}
+	return distribution->Token(last);
 }
 
 /**************************************************************************************************
- * Constructs a string containing all the words or characters in the suffix list, separated by    *
- * commas. Created for debugging purposes.                                                        *
- *   return value: A single wstring with all the possible suffixes.                               *
+ * Calls visit once for each distinct token in the list, in increasing order of ID, with the      *
+ * number of times it occurs. Used when a chain is compiled (see CompiledChain).                  *
+ *   Inputs:                                                                                      *
+ *      visit: The function to call for each token.                                               *
+ *   return value: none                                                                           *
  **************************************************************************************************/
-std::wstring Suffix::GetAllSuffixes()
+void Suffix::ForEachSuffix(const std::function<void(unsigned int token, unsigned long long count)> & visit) const
 {
-	std::wstring output = L"";
-	for (auto it = possibleSuffixes.begin(); it != possibleSuffixes.end(); ++it)
+	if (!distribution)
 	{
-		output += (*it) + L", ";
+		visit(singleToken, singleCount);
+		return;
 	}
+	for (size_t i = 0; i < distribution->Size(); ++i) visit(distribution->Token(i), distribution->Count(i));
+}
+
+/**************************************************************************************************
+ * Shares this suffix's distribution with every other Suffix passed to the same pool whose        *
+ * distribution is identical. Inline suffixes have nothing to share.                              *
+ *   Inputs:                                                                                      *
+ *      pool: The distributions seen so far.                                                      *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void Suffix::Deduplicate(DistributionPool & pool)
+{
+	if (!distribution) return;
+	auto inserted = pool.distributions.insert(distribution);
+	if (!inserted.second) distribution = *inserted.first;
+}
+
+/**************************************************************************************************
+ * Constructs a string containing all the words or characters in the suffix list, each followed   *
+ * by its count in parentheses and separated by commas. Created for debugging purposes.           *
+ *   Inputs:                                                                                      *
+ *      vocabulary: The vocabulary that maps this suffix's token IDs to tokens.                   *
+ *   return value: A single wstring with all the possible suffixes.                               *
+ **************************************************************************************************/
+std::wstring Suffix::GetAllSuffixes(const Vocabulary & vocabulary) const
+{
+	std::wstring output = L"";
+	ForEachSuffix([&](unsigned int token, unsigned long long count) {
+		output += vocabulary.Token(token) + L" (" + std::to_wstring(count) + L"), ";
+	});
 	return output;
-}
\ No newline at end of file
+}
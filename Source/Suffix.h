@@ -3,21 +3,79 @@
 #pragma once
 
 #include "Random.h"
+#include "Vocabulary.h"
+#include <functional>
+#include <memory>
 #include <string>
-#include <list>
+#include <unordered_set>
+#include <vector>
 
 class Suffix{
-	std::list<std::wstring> possibleSuffixes;
 public:
-	// Constructor
-	Suffix(std::list<std::wstring> suffixSetter);
+	// The counts of two or more distinct suffixes. Counts are stored as 1, 2, 4 or 8 bytes each,
+	// whichever is the smallest width that holds the largest count.
+	class Distribution
+	{
+		std::vector<unsigned int> tokens;  // distinct token IDs, in increasing order
+		std::vector<unsigned char> counts; // countWidth bytes per token
+		unsigned char countWidth = 1;
+		unsigned long long total = 0;
 
-	// A method for adding a word to the list of possible suffixes. 
-	void AddSuffix(std:: wstring newSuffix);
+		// Stores a count, widening every count first if it does not fit.
+		void SetCount(size_t index, unsigned long long count);
 
-	// Retrieves a random word (or character) from the list of possible suffixes.
-	std::wstring GetRandomSuffix(Random rand);
+	public:
+		// Adds count occurrences of token.
+		void Add(unsigned int token, unsigned long long count);
+		// The number of distinct tokens, the i'th token and its count, and the sum of all counts.
+		size_t Size() const { return tokens.size(); }
+		unsigned int Token(size_t index) const { return tokens[index]; }
+		unsigned long long Count(size_t index) const;
+		unsigned long long Total() const { return total; }
+		// Hashing and comparison, for finding identical distributions.
+		size_t Hash() const;
+		bool operator==(const Distribution & other) const;
+	};
+
+	// Collects distinct distributions, so that identical ones can be shared (see Deduplicate()).
+	class DistributionPool
+	{
+		struct HashContents
+		{
+			size_t operator()(const std::shared_ptr<Distribution> & d) const { return d->Hash(); }
+		};
+		struct CompareContents
+		{
+			bool operator()(const std::shared_ptr<Distribution> & a, 
+			                const std::shared_ptr<Distribution> & b) const { return *a == *b; }
+		};
+		std::unordered_set<std::shared_ptr<Distribution>, HashContents, CompareContents> distributions;
+		friend class Suffix;
+	};
+
+private:
+	// A suffix with a single distinct token (the usual case in higher-order chains) is stored
+	// inline; distribution is then NULL. Otherwise singleToken and singleCount are unused.
+	unsigned int singleToken;
+	unsigned int singleCount;
+	std::shared_ptr<Distribution> distribution;
+
+public:
+	// Constructor. Creates a suffix list holding count occurrences of one token.
+	Suffix(unsigned int token, unsigned long long count = 1);
+
+	// A method for adding count occurrences of a token to the list of possible suffixes. 
+	void AddSuffix(unsigned int token, unsigned long long count = 1);
+
+	// Retrieves a random token from the list of possible suffixes.
+	unsigned int GetRandomSuffix(Random & rand) const;
+
+	// Calls visit once for each distinct token, with the number of times it occurs.
+	void ForEachSuffix(const std::function<void(unsigned int token, unsigned long long count)> & visit) const;
+
+	// Replaces this suffix's distribution with an identical one from the pool, if there is one.
+	void Deduplicate(DistributionPool & pool);
 
 	// Constructs a string containing all the words or characters in the suffix list.
-	std::wstring GetAllSuffixes();
+	std::wstring GetAllSuffixes(const Vocabulary & vocabulary) const;
 };
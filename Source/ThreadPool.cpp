@@ -0,0 +1,321 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * A work-stealing thread pool. Every worker owns a deque of tasks. A task submitted by a worker  *
+ * (typically a piece of a larger task that it is splitting up) goes on the back of that worker's *
+ * own deque, and the worker takes its next task from the back too, so it keeps working on the    *
+ * most recently split, and therefore still cached, data. A worker whose deque is empty steals    *
+ * from the front of the others', where the oldest and usually largest pieces of work are. Tasks  *
+ * submitted from outside the pool are dealt out to the workers in turn.                          *
+ *                                                                                                *
+ * Idle workers sleep on a condition variable, and a count of queued tasks tells them when there  *
+ * is something to steal. A deque's lock is only ever contended by a thief, so pushing and        *
+ * popping cost the owner an uncontended lock.                                                    *
+ *                                                                                                *
+ * TaskGroup::Wait() does not simply block when it is called on a worker: while the group has     *
+ * unfinished tasks, the worker runs queued tasks itself. A task running on a worker can          *
+ * therefore split its work into a group and wait for it without leaving its worker idle, and     *
+ * without deadlocking a pool whose workers are all waiting. Any other thread that waits (a       *
+ * server's connection thread, say) only blocks, so that the pool's tasks never run on more       *
+ * threads than the pool has, nor on cores it was not pinned to.                                  *
+ *                                                                                                *
+ * A task that throws (only std::bad_alloc is expected) still counts as finished, so its group's  *
+ * waiter is not left waiting forever; Wait() rethrows the exception on the waiting thread        *
+ * instead.                                                                                       *
+ *                                                                                                *
+ * The engine shares a single pool (see Shared()), so that sorting during training, scoring and   *
+ * the generation server never run more threads than the pool has, however they overlap. Its size *
+ * and CPU affinity can be set with Configure() before it is first used.                          *
+ **************************************************************************************************/
+
+#include "ThreadPool.h"
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+	// The pool and worker index of the calling thread, if it is a worker:
+	thread_local ThreadPool * currentPool = nullptr;
+	thread_local size_t currentWorker = 0;
+
+	// The shared pool, and the options with which it will be created:
+	std::mutex sharedLock;
+	ThreadPool::Options sharedOptions;
+	ThreadPool * sharedPool = nullptr;
+}
+
+/**************************************************************************************************
+ * Constructor. Starts the worker threads, pinning each to its core if requested. A core that     *
+ * cannot be pinned to (because it does not exist, say) leaves its worker free to run anywhere.   *
+ *   Inputs:                                                                                      *
+ *      options: The number of threads, and whether and where they are pinned.                    *
+ **************************************************************************************************/
+ThreadPool::ThreadPool(const Options & options) : queued(0), nextWorker(0)
+{
+	unsigned int numThreads = options.threads;
+	if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+	if (numThreads == 0) numThreads = 1;
+	for (unsigned int i = 0; i < numThreads; ++i) workers.emplace_back(new Worker);
+	for (unsigned int i = 0; i < numThreads; ++i)
+	{
+		workers[i]->thread = std::thread([this, i, options]() {
+			if (options.pinThreads) PinToCore(options.firstCore + i);
+			WorkerLoop(i);
+		});
+	}
+}
+
+/**************************************************************************************************
+ * Destructor. The workers finish every task that is still queued before they exit.               *
+ **************************************************************************************************/
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i) workers[i]->thread.join();
+}
+
+/**************************************************************************************************
+ * Returns the number of worker threads.                                                          *
+ **************************************************************************************************/
+size_t ThreadPool::NumThreads() const
+{
+	return workers.size();
+}
+
+/**************************************************************************************************
+ * Calls a function once for every index in a range, in parallel. Each index is a task of its     *
+ * own, so the calls should each do a worthwhile amount of work.                                  *
+ *   Inputs:                                                                                      *
+ *      count: The number of indices.                                                             *
+ *      body: The function to call. Called on several threads at once.                            *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)> & body)
+{
+	if (count == 1)
+	{
+		body(0);
+		return;
+	}
+	TaskGroup group(*this);
+	for (size_t i = 0; i < count; ++i) group.Run([&body, i]() { body(i); });
+	group.Wait();
+}
+
+/**************************************************************************************************
+ * Returns the engine-wide pool, creating it the first time with the options given to             *
+ * Configure(), or the default options (one unpinned thread per core).                            *
+ **************************************************************************************************/
+ThreadPool & ThreadPool::Shared()
+{
+	std::lock_guard<std::mutex> guard(sharedLock);
+	// Never destroyed: its workers may still be running tasks while static objects are destroyed.
+	if (!sharedPool) sharedPool = new ThreadPool(sharedOptions);
+	return *sharedPool;
+}
+
+/**************************************************************************************************
+ * Sets the options with which the shared pool will be created.                                   *
+ *   Inputs:                                                                                      *
+ *      options: The number of threads, and whether and where they are pinned.                    *
+ *   return value: true if the options were set, false if the shared pool already exists.         *
+ **************************************************************************************************/
+bool ThreadPool::Configure(const Options & options)
+{
+	std::lock_guard<std::mutex> guard(sharedLock);
+	if (sharedPool) return false;
+	sharedOptions = options;
+	return true;
+}
+
+/**************************************************************************************************
+ * Queues a task. A worker of this pool puts it on its own deque; any other thread puts it on the *
+ * deques in turn. One sleeping worker is woken to take it.                                       *
+ *   Inputs:                                                                                      *
+ *      task: The task to queue.                                                                  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ThreadPool::Push(Task task)
+{
+	size_t index = (currentPool == this) ? currentWorker : nextWorker++ % workers.size();
+	{
+		std::lock_guard<std::mutex> guard(workers[index]->lock);
+		workers[index]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		++queued;
+	}
+	wake.notify_one();
+}
+
+/**************************************************************************************************
+ * Runs one queued task on the calling thread. A worker looks in its own deque first, taking the  *
+ * newest task; then every thread tries the other deques in turn, taking the oldest task of the   *
+ * first one that has any.                                                                        *
+ *   return value: true if a task was run, false if every deque was empty.                        *
+ **************************************************************************************************/
+bool ThreadPool::RunOne()
+{
+	Task task;
+	const bool isWorker = (currentPool == this);
+	const size_t start = isWorker ? currentWorker : nextWorker % workers.size();
+	if (isWorker)
+	{
+		Worker & own = *workers[start];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+		}
+	}
+	for (size_t i = isWorker ? 1 : 0; !task && i < workers.size(); ++i)
+	{
+		Worker & victim = *workers[(start + i) % workers.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+		}
+	}
+	if (!task) return false;
+	--queued;
+	task();
+	return true;
+}
+
+/**************************************************************************************************
+ * The body of a worker thread. Runs tasks for as long as there are any, and sleeps when there    *
+ * are none. When the pool is destroyed, the worker exits once no tasks are left.                 *
+ *   Inputs:                                                                                      *
+ *      index: The worker's position in workers.                                                  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ThreadPool::WorkerLoop(size_t index)
+{
+	currentPool = this;
+	currentWorker = index;
+	while (true)
+	{
+		if (RunOne()) continue;
+		std::unique_lock<std::mutex> lock(sleepLock);
+		wake.wait(lock, [this]() { return stopping || queued > 0; });
+		if (stopping && queued <= 0) return;
+	}
+}
+
+/**************************************************************************************************
+ * Restricts the calling thread to a single core.                                                 *
+ *   Inputs:                                                                                      *
+ *      core: The index of the core, counting from 0.                                             *
+ *   return value: true if the thread was pinned, false if the core does not exist or pinning is  *
+ *                 not supported on this system.                                                  *
+ **************************************************************************************************/
+bool ThreadPool::PinToCore(unsigned int core)
+{
+#ifdef _WIN32
+	if (core >= sizeof(DWORD_PTR) * 8) return false;
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) != 0;
+#elif defined(__linux__)
+	if (core >= CPU_SETSIZE) return false;
+	cpu_set_t cores;
+	CPU_ZERO(&cores);
+	CPU_SET(core, &cores);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) == 0;
+#else
+	return false;
+#endif
+}
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      pool: The pool on which the group's tasks run.                                            *
+ **************************************************************************************************/
+ThreadPool::TaskGroup::TaskGroup(ThreadPool & pool) : pool(pool), pending(0) {}
+
+/**************************************************************************************************
+ * Destructor. Waits for the group's tasks, which may still refer to the group. An exception      *
+ * thrown by one of them is dropped: either Wait() has already rethrown it, or the group is being *
+ * destroyed because of another.                                                                  *
+ **************************************************************************************************/
+ThreadPool::TaskGroup::~TaskGroup()
+{
+	Drain();
+}
+
+/**************************************************************************************************
+ * Submits a task to the group's pool. The group counts the task as unfinished until it returns   *
+ * or throws; the first exception thrown by any of its tasks is kept for Wait() to rethrow.       *
+ *   Inputs:                                                                                      *
+ *      task: The task to run.                                                                    *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ThreadPool::TaskGroup::Run(Task task)
+{
+	++pending;
+	pool.Push([this, task]() {
+		std::exception_ptr thrown;
+		try
+		{
+			task();
+		}
+		catch (...)
+		{
+			thrown = std::current_exception();
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		if (thrown && !error) error = thrown;
+		if (--pending == 0) finished.notify_all();
+	});
+}
+
+/**************************************************************************************************
+ * Returns once every task of the group has finished, and rethrows the first exception that any   *
+ * of them threw.                                                                                 *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ThreadPool::TaskGroup::Wait()
+{
+	Drain();
+	std::exception_ptr thrown;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		thrown.swap(error);
+	}
+	if (thrown) std::rethrow_exception(thrown);
+}
+
+/**************************************************************************************************
+ * Returns once every task of the group has finished. A worker of the pool runs queued tasks (of  *
+ * this group or any other) in the meantime; when there is nothing left to run, the remaining     *
+ * tasks are running on other threads, and it sleeps until the last of them finishes, looking for *
+ * new work every millisecond in case one of those tasks queues more. Any other thread sleeps     *
+ * until the group is finished, running nothing.                                                  *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void ThreadPool::TaskGroup::Drain()
+{
+	const bool isWorker = (currentPool == &pool);
+	while (pending > 0)
+	{
+		if (isWorker && pool.RunOne()) continue;
+		std::unique_lock<std::mutex> guard(lock);
+		if (isWorker) finished.wait_for(guard, std::chrono::milliseconds(1), [this]() { return pending == 0; });
+		else finished.wait(guard, [this]() { return pending == 0; });
+	}
+	// The last task may still hold the lock, and must release it before the group can be destroyed:
+	std::lock_guard<std::mutex> guard(lock);
+}
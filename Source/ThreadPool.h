@@ -0,0 +1,143 @@
+// A work-stealing pool of worker threads. One pool is shared by every part of the engine that runs
+// in parallel (sorting and merging during training, scoring, and serving generation requests), so
+// that a process keeps a fixed, predictable number of busy cores however many of those run at once.
+// Each worker has a deque of tasks of its own: tasks it submits go on the back, it takes its next
+// task from the back, and when its deque is empty it steals from the front of another worker's.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	// Settings for a pool.
+	struct Options
+	{
+		unsigned int threads;   // the number of worker threads, or 0 for one per core
+		bool pinThreads;        // whether worker i runs only on core firstCore + i
+		unsigned int firstCore;
+
+		Options() : threads(0), pinThreads(false), firstCore(0) {}
+	};
+
+	// A set of tasks that can be waited for together. A worker of the pool runs queued tasks while it
+	// waits, so a task may start a group of its own and wait for it without tying up a worker; any
+	// other thread simply blocks, so that only the pool's own threads ever run its tasks.
+	class TaskGroup
+	{
+		ThreadPool & pool;
+		std::atomic<size_t> pending;
+		std::mutex lock;
+		std::condition_variable finished;
+		std::exception_ptr error; // the first exception thrown by a task; guarded by lock
+
+		// Returns once every task has finished, without rethrowing anything.
+		void Drain();
+
+	public:
+		// Constructor. The group's tasks run on pool.
+		explicit TaskGroup(ThreadPool & pool);
+
+		// Destructor. Waits for the group's tasks.
+		~TaskGroup();
+
+		// Submits a task.
+		void Run(Task task);
+
+		// Returns once every task submitted so far (and every task they submit) has finished. If any
+		// of them threw, rethrows the first exception.
+		void Wait();
+	};
+
+private:
+	// A worker thread and its deque. The deque is guarded by its own lock, which is only contended
+	// when another thread steals from it.
+	struct Worker
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+		std::thread thread;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<long> queued;             // tasks in all deques; briefly negative while a push lands
+	std::atomic<unsigned int> nextWorker; // where the next task from outside the pool goes
+	bool stopping = false;
+
+	// Puts a task on the calling worker's deque, or on the next worker's if called from elsewhere.
+	void Push(Task task);
+	// Takes a task from the calling worker's own deque or, failing that, steals one, and runs it.
+	// Returns false if every deque was empty.
+	bool RunOne();
+	// The body of worker number index.
+	void WorkerLoop(size_t index);
+	// Restricts the calling thread to one core. Returns false if the system refuses.
+	static bool PinToCore(unsigned int core);
+
+public:
+	// Constructor. Starts the worker threads.
+	explicit ThreadPool(const Options & options = Options());
+
+	// Destructor. Runs the tasks still queued, then stops the workers.
+	~ThreadPool();
+
+	// The number of worker threads.
+	size_t NumThreads() const;
+
+	// Calls body(i) for every i in [0, count), in parallel, and returns once every call has returned.
+	void ParallelFor(size_t count, const std::function<void(size_t)> & body);
+
+	// Sorts items with less. Slices of at least minSlice items are sorted in parallel, one per thread,
+	// and then merged in pairs, each round of merges also in parallel.
+	template <class T, class Less> void ParallelSort(std::vector<T> & items, Less less, size_t minSlice)
+	{
+		const size_t numItems = items.size();
+		size_t numSlices = numItems / (minSlice > 0 ? minSlice : 1);
+		if (numSlices > workers.size()) numSlices = workers.size();
+		if (numSlices < 2)
+		{
+			std::sort(items.begin(), items.end(), less);
+			return;
+		}
+		std::vector<size_t> bounds(numSlices + 1);
+		for (size_t slice = 0; slice <= numSlices; ++slice) bounds[slice] = numItems * slice / numSlices;
+		ParallelFor(numSlices, [&](size_t slice) {
+			std::sort(items.begin() + bounds[slice], items.begin() + bounds[slice + 1], less);
+		});
+		std::vector<T> merged(numItems);
+		for (size_t width = 1; width < numSlices; width *= 2)
+		{
+			// Merge each pair of neighbouring sorted spans of width slices into one:
+			ParallelFor((numSlices + 2 * width - 1) / (2 * width), [&](size_t pair) {
+				size_t middle = 2 * pair * width + width, last = middle + width;
+				size_t first = bounds[2 * pair * width];
+				middle = bounds[middle < numSlices ? middle : numSlices];
+				last = bounds[last < numSlices ? last : numSlices];
+				std::merge(items.begin() + first, items.begin() + middle, items.begin() + middle,
+				           items.begin() + last, merged.begin() + first, less);
+			});
+			items.swap(merged);
+		}
+	}
+
+	// The engine-wide pool. It is created on first use, with the options last given to Configure().
+	static ThreadPool & Shared();
+
+	// Sets the options of the shared pool. Returns false, and changes nothing, if the shared pool has
+	// already been created.
+	static bool Configure(const Options & options);
+};
@@ -0,0 +1,99 @@
+// Tokenizer policies: the rules that split text into tokens and write tokens back out as text. Each
+// policy is a struct of static functions, chosen once per text or job by name (see
+// VisitTokenPolicy()) and passed on as a template argument, so that the loops that read and write
+// tokens are compiled separately for each policy instead of deciding what a token is once per
+// token. A new tokenizer is a new struct plus one line in VisitTokenPolicy() and IsTokenType().
+//
+// Every policy has:
+//   Name()                 the tokenType that selects it.
+//   WHITESPACE_SEPARATES   true if no token contains whitespace, so that text is first split into
+//                          whitespace-delimited words which TokenEnd() then divides; false if
+//                          every character, whitespace included, is a token of its own.
+//   TokenEnd(begin, end)   the end of the token that starts at begin, within the word [begin, end).
+//   Append(output, token)  writes a token (never the non-word) to generated text.
+
+#pragma once
+
+#include <cwchar>
+#include <cwctype>
+#include <string>
+#include <vector>
+
+// Whitespace-delimited words, written with a space before each one.
+struct WordTokens
+{
+	static const wchar_t * Name() { return L"words"; }
+	static const bool WHITESPACE_SEPARATES = true;
+	static const wchar_t * TokenEnd(const wchar_t *, const wchar_t * end) { return end; }
+	static void Append(std::wstring & output, const std::wstring & token)
+	{
+		output += L' ';
+		output += token;
+	}
+};
+
+// Single characters, whitespace included, written as they are.
+struct CharacterTokens
+{
+	static const wchar_t * Name() { return L"characters"; }
+	static const bool WHITESPACE_SEPARATES = false;
+	static const wchar_t * TokenEnd(const wchar_t * begin, const wchar_t *) { return begin + 1; }
+	static void Append(std::wstring & output, const std::wstring & token) { output += token; }
+};
+
+// Words with their leading and trailing punctuation split off, one token per mark: "(yes," is "(",
+// "yes" and ",". Marks inside a word stay in it, as in "don't" or "e-mail". A mark that ends a
+// phrase is written straight after the token before it; every other token after a space.
+struct PunctuationTokens
+{
+	static const wchar_t * Name() { return L"punctuation"; }
+	static const bool WHITESPACE_SEPARATES = true;
+	static const wchar_t * TokenEnd(const wchar_t * begin, const wchar_t * end)
+	{
+		if (std::iswpunct(*begin)) return begin + 1;
+		while (std::iswpunct(end[-1])) --end;
+		return end;
+	}
+	static void Append(std::wstring & output, const std::wstring & token)
+	{
+		if (token.size() != 1 || token[0] == 0 || !std::wcschr(L".,;:!?)]}%", token[0])) output += L' ';
+		output += token;
+	}
+};
+
+// Calls visit(policy) with an instance of the policy that tokenType names, so that visit (usually a
+// generic lambda) can pass decltype(policy) on as a template argument. Names that match no policy
+// get CharacterTokens, as every tokenType other than "words" always has.
+template <class Visitor> void VisitTokenPolicy(const std::wstring & tokenType, Visitor && visit)
+{
+	if (tokenType == WordTokens::Name()) visit(WordTokens());
+	else if (tokenType == PunctuationTokens::Name()) visit(PunctuationTokens());
+	else visit(CharacterTokens());
+}
+
+// Whether tokenType names a policy.
+inline bool IsTokenType(const std::wstring & tokenType)
+{
+	return tokenType == WordTokens::Name() || tokenType == CharacterTokens::Name() ||
+	       tokenType == PunctuationTokens::Name();
+}
+
+// Calls emit(tokenBegin, tokenEnd) for every token of the whitespace-free word [begin, end).
+template <class Policy, class Emit> void SplitWord(const wchar_t * begin, const wchar_t * end, Emit && emit)
+{
+	while (begin != end)
+	{
+		const wchar_t * tokenEnd = Policy::TokenEnd(begin, end);
+		emit(begin, tokenEnd);
+		begin = tokenEnd;
+	}
+}
+
+// Writes tokens to output the way the policy that tokenType names writes generated text.
+inline void AppendTokens(const std::wstring & tokenType, const std::vector<std::wstring> & tokens,
+                         std::wstring & output)
+{
+	VisitTokenPolicy(tokenType, [&](auto policy) {
+		for (size_t i = 0; i < tokens.size(); ++i) decltype(policy)::Append(output, tokens[i]);
+	});
+}
@@ -0,0 +1,18 @@
+// An interface for anything that is built from a stream of tokens, such as a StringChain. The
+// IngestPipeline reads and tokenizes input files and hands the tokens to a TokenSink.
+
+#pragma once
+
+#include <string>
+
+class TokenSink
+{
+public:
+	virtual ~TokenSink() {}
+
+	// Adds the next token (word or character) of the current input text.
+	virtual void AddToken(const std::wstring & token) = 0;
+
+	// Marks the end of the current input text.
+	virtual void EndInput() = 0;
+};
@@ -0,0 +1,111 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * Splits decoded text into tokens. The rules come from a tokenizer policy (see TokenPolicy.h),   *
+ * which the constructor chooses once by name; Tokenize() and Finish() then run a loop compiled   *
+ * for that policy alone. In "words" mode, a token is a maximal run of non-whitespace characters, *
+ * exactly as std::wistream's operator>> would extract it. In "characters" mode, every character  *
+ * (including whitespace) is its own token, exactly as std::wistream::get() would read it. In     *
+ * "punctuation" mode, the words of "words" mode are further split by                             *
+ * PunctuationTokens::TokenEnd().                                                                 *
+ **************************************************************************************************/
+
+#include "Tokenizer.h"
+#include "TokenPolicy.h"
+#include <cwctype>
+
+/**************************************************************************************************
+ * Constructor.                                                                                   *
+ *   Inputs:                                                                                      *
+ *      tokenType: A string indicating how text is split into tokens. Allowed values: "words",    *
+ *                 "characters", "punctuation".                                                   *
+ **************************************************************************************************/
+Tokenizer::Tokenizer(const std::wstring & tokenType)
+{
+	VisitTokenPolicy(tokenType, [this](auto policy) {
+		tokenize = &TokenizeWith<decltype(policy)>;
+		finish = &FinishWith<decltype(policy)>;
+	});
+}
+
+/**************************************************************************************************
+ * Appends the tokens completed by the given characters to a list. A word that runs to the end of *
+ * the chunk is held back until the next chunk (or Finish()) shows where it ends.                 *
+ *   Inputs:                                                                                      *
+ *      begin: Pointer to the first character of the chunk.                                       *
+ *      end: Pointer one past the last character of the chunk.                                    *
+ *      tokens: The list to append completed tokens to.                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void Tokenizer::Tokenize(const wchar_t * begin, const wchar_t * end, std::vector<std::wstring> & tokens)
+{
+	tokenize(begin, end, partial, tokens);
+}
+
+/**************************************************************************************************
+ * Appends the final token of the text (if the text ended in the middle of a word) to a list, and *
+ * prepares the Tokenizer for a new text.                                                         *
+ *   Inputs:                                                                                      *
+ *      tokens: The list to append the final token to.                                            *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+void Tokenizer::Finish(std::vector<std::wstring> & tokens)
+{
+	finish(partial, tokens);
+}
+
+/**************************************************************************************************
+ * Tokenize(), for one policy. A word that lies entirely within the chunk is split straight from  *
+ * the chunk; only a word that began in an earlier chunk is first collected in partial.           *
+ *   Inputs:                                                                                      *
+ *      begin: Pointer to the first character of the chunk.                                       *
+ *      end: Pointer one past the last character of the chunk.                                    *
+ *      partial: The unfinished word at the end of the last chunk. Receives the one at the end of *
+ *               this chunk.                                                                      *
+ *      tokens: The list to append completed tokens to.                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+template <class Policy>
+void Tokenizer::TokenizeWith(const wchar_t * begin, const wchar_t * end, std::wstring & partial,
+                             std::vector<std::wstring> & tokens)
+{
+	auto emit = [&tokens](const wchar_t * tokenBegin, const wchar_t * tokenEnd) {
+		tokens.push_back(std::wstring(tokenBegin, tokenEnd));
+	};
+	if (!Policy::WHITESPACE_SEPARATES)
+	{
+		SplitWord<Policy>(begin, end, emit);
+		return;
+	}
+
+	const wchar_t * wordStart = begin;
+	for (const wchar_t * p = begin; p != end; ++p)
+	{
+		if (!std::iswspace(*p)) continue;
+		if (partial.empty()) SplitWord<Policy>(wordStart, p, emit);
+		else
+		{
+			partial.append(wordStart, p);
+			SplitWord<Policy>(partial.data(), partial.data() + partial.size(), emit);
+			partial.clear();
+		}
+		wordStart = p + 1;
+	}
+	partial.append(wordStart, end);
+}
+
+/**************************************************************************************************
+ * Finish(), for one policy.                                                                      *
+ *   Inputs:                                                                                      *
+ *      partial: The unfinished word at the end of the last chunk. Cleared.                       *
+ *      tokens: The list to append the final tokens to.                                           *
+ *   return value: none                                                                           *
+ **************************************************************************************************/
+template <class Policy> void Tokenizer::FinishWith(std::wstring & partial, std::vector<std::wstring> & tokens)
+{
+	SplitWord<Policy>(partial.data(), partial.data() + partial.size(), 
+	                  [&tokens](const wchar_t * tokenBegin, const wchar_t * tokenEnd) {
+		tokens.push_back(std::wstring(tokenBegin, tokenEnd));
+	});
+	partial.clear();
+}
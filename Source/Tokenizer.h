@@ -0,0 +1,34 @@
+// Splits decoded text into tokens, by the rules of a tokenizer policy (see TokenPolicy.h). Text may
+// be supplied in arbitrary chunks; a word that is split across two chunks is completed when the next
+// chunk arrives.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+class Tokenizer
+{
+	typedef void (*TokenizeFunction)(const wchar_t * begin, const wchar_t * end, std::wstring & partial,
+	                                 std::vector<std::wstring> & tokens);
+	typedef void (*FinishFunction)(std::wstring & partial, std::vector<std::wstring> & tokens);
+
+	TokenizeFunction tokenize; // TokenizeWith<Policy>, chosen by the constructor
+	FinishFunction finish;     // FinishWith<Policy>
+	std::wstring partial;      // the unfinished word at the end of the last chunk
+
+	// The loops behind Tokenize() and Finish(), compiled once for each policy.
+	template <class Policy> static void TokenizeWith(const wchar_t * begin, const wchar_t * end, 
+	                                                 std::wstring & partial, std::vector<std::wstring> & tokens);
+	template <class Policy> static void FinishWith(std::wstring & partial, std::vector<std::wstring> & tokens);
+
+public:
+	// Constructor. tokenType names a policy: "words", "characters" or "punctuation".
+	Tokenizer(const std::wstring & tokenType);
+
+	// Appends the tokens completed by the characters in [begin, end) to tokens.
+	void Tokenize(const wchar_t * begin, const wchar_t * end, std::vector<std::wstring> & tokens);
+
+	// Appends the final token of the text (if one is unfinished) to tokens.
+	void Finish(std::vector<std::wstring> & tokens);
+};
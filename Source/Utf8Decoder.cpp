@@ -0,0 +1,111 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * An incremental UTF-8 decoder. The standard library's codecvt facets can only be used through a *
+ * wifstream, which hides how many bytes of the file have actually been read; decoding the raw    *
+ * bytes ourselves makes it possible to report exact progress and to feed the decoder from        *
+ * sources other than a plain file. Code points outside the Basic Multilingual Plane are written  *
+ * as UTF-16 surrogate pairs when wchar_t is 16 bits wide (as it is on Windows), matching the     *
+ * behavior of std::codecvt_utf8_utf16. Malformed sequences are replaced with U+FFFD rather than  *
+ * aborting the read.                                                                             *
+ **************************************************************************************************/
+
+#include "Utf8Decoder.h"
+#include <cwchar>
+
+/**************************************************************************************************
+ * Writes a single code point to the output buffer. On platforms where wchar_t is 16 bits wide,   *
+ * code points above U+FFFF are split into a surrogate pair. A carriage return is held back until *
+ * the next code point shows whether it begins a "\r\n" pair, in which case it is dropped.        *
+ *   Inputs:                                                                                      *
+ *      codePoint: The Unicode code point to write.                                               *
+ *      output: The buffer to write to. Must have room for 3 characters.                          *
+ *   return value: The number of wchar_t's written (0 to 3).                                      *
+ **************************************************************************************************/
+size_t Utf8Decoder::Emit(unsigned long codePoint, wchar_t * output)
+{
+	wchar_t * out = output;
+	if (heldCarriageReturn && codePoint != L'\n') *out++ = L'\r';
+	heldCarriageReturn = (codePoint == L'\r');
+	if (heldCarriageReturn) return out - output;
+
+#if WCHAR_MAX <= 0xFFFF
+	if (codePoint > 0xFFFF)
+	{
+		codePoint -= 0x10000;
+		*out++ = (wchar_t)(0xD800 + (codePoint >> 10));
+		*out++ = (wchar_t)(0xDC00 + (codePoint & 0x3FF));
+		return out - output;
+	}
+#endif
+	*out++ = (wchar_t)codePoint;
+	return out - output;
+}
+
+/**************************************************************************************************
+ * Decodes a chunk of UTF-8 bytes. A sequence left incomplete at the end of the chunk is          *
+ * remembered and completed by the next call to Decode() (or replaced by Finish()).               *
+ *   Inputs:                                                                                      *
+ *      begin: Pointer to the first byte of the chunk.                                            *
+ *      end: Pointer one past the last byte of the chunk.                                         *
+ *      output: The buffer to write decoded characters to. Must have room for (end - begin) + 1   *
+ *              characters.                                                                       *
+ *   return value: The number of wchar_t's written to output.                                     *
+ **************************************************************************************************/
+size_t Utf8Decoder::Decode(const char * begin, const char * end, wchar_t * output)
+{
+	wchar_t * out = output;
+	for (const char * p = begin; p != end; ++p)
+	{
+		unsigned char byte = (unsigned char)*p;
+
+		// Continuation byte of a sequence in progress:
+		if (bytesStillNeeded > 0)
+		{
+			if ((byte & 0xC0) == 0x80)
+			{
+				partialCodePoint = (partialCodePoint << 6) | (byte & 0x3F);
+				if (--bytesStillNeeded == 0)
+				{
+					// Reject overlong encodings, surrogates, and values beyond U+10FFFF:
+					static const unsigned long minimum[] = { 0, 0, 0x80, 0x800, 0x10000 };
+					bool valid = partialCodePoint >= minimum[sequenceLength] &&
+						partialCodePoint <= 0x10FFFF &&
+						(partialCodePoint < 0xD800 || partialCodePoint > 0xDFFF);
+					out += Emit(valid ? partialCodePoint : REPLACEMENT, out);
+				}
+				continue;
+			}
+			// The sequence was cut short. Replace it and decode this byte from scratch.
+			out += Emit(REPLACEMENT, out);
+			bytesStillNeeded = 0;
+		}
+
+		// Lead byte:
+		if (byte < 0x80) out += Emit(byte, out);
+		else if ((byte & 0xE0) == 0xC0) { partialCodePoint = byte & 0x1F; bytesStillNeeded = 1; }
+		else if ((byte & 0xF0) == 0xE0) { partialCodePoint = byte & 0x0F; bytesStillNeeded = 2; }
+		else if ((byte & 0xF8) == 0xF0) { partialCodePoint = byte & 0x07; bytesStillNeeded = 3; }
+		else out += Emit(REPLACEMENT, out); // stray continuation byte or invalid lead byte
+		sequenceLength = bytesStillNeeded + 1;
+	}
+	return out - output;
+}
+
+/**************************************************************************************************
+ * Flushes the decoder at the end of the input. If the input ended in the middle of a multi-byte  *
+ * sequence, a single replacement character is written for it; a trailing carriage return that    *
+ * was held back is written as well. The decoder is then ready for a new input.                   *
+ *   Inputs:                                                                                      *
+ *      output: The buffer to write to. Must have room for 2 characters.                          *
+ *   return value: The number of wchar_t's written to output (0 to 2).                            *
+ **************************************************************************************************/
+size_t Utf8Decoder::Finish(wchar_t * output)
+{
+	wchar_t * out = output;
+	if (bytesStillNeeded > 0) out += Emit(REPLACEMENT, out);
+	if (heldCarriageReturn) *out++ = L'\r';
+	bytesStillNeeded = 0;
+	heldCarriageReturn = false;
+	return out - output;
+}
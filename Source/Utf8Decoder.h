@@ -0,0 +1,28 @@
+// An incremental UTF-8 to wide-character decoder. Input may arrive in arbitrary chunks; a
+// multi-byte sequence that is split across two chunks is completed when the next chunk arrives.
+// Like a stream opened in text mode on Windows, "\r\n" line endings are translated to "\n".
+
+#pragma once
+
+#include <cstddef>
+
+class Utf8Decoder
+{
+	unsigned long partialCodePoint = 0; // bits collected so far from an incomplete sequence
+	int bytesStillNeeded = 0;           // continuation bytes still expected for that sequence
+	int sequenceLength = 0;             // total length of the incomplete sequence
+	bool heldCarriageReturn = false;    // a '\r' that may turn out to be half of "\r\n"
+
+	// Writes a single code point to output. Returns the number of wchar_t's written (0 to 3).
+	size_t Emit(unsigned long codePoint, wchar_t * output);
+
+public:
+	// The replacement character emitted for malformed input.
+	static const wchar_t REPLACEMENT = 0xFFFD;
+
+	// Decodes the bytes in [begin, end). output must have room for (end - begin) + 2 characters.
+	size_t Decode(const char * begin, const char * end, wchar_t * output);
+
+	// Flushes whatever is held back at the end of the input. output needs room for 2 characters.
+	size_t Finish(wchar_t * output);
+};
@@ -0,0 +1,51 @@
+// Converts wide-character text to UTF-8. The counterpart of Utf8Decoder, for writing tokens to
+// model files and generated text to the console.
+
+#pragma once
+
+#include <cwchar>
+#include <string>
+
+// Appends the UTF-8 encoding of text to output. Surrogate pairs (on platforms where wchar_t is 16
+// bits wide) are combined into a single code point; unpaired surrogates become U+FFFD.
+inline void AppendUtf8(const std::wstring & text, std::string & output)
+{
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		unsigned long c = (unsigned long)text[i];
+		if (c >= 0xD800 && c <= 0xDBFF && i + 1 < text.size() &&
+			(unsigned long)text[i + 1] >= 0xDC00 && (unsigned long)text[i + 1] <= 0xDFFF)
+		{
+			c = 0x10000 + ((c - 0xD800) << 10) + ((unsigned long)text[++i] - 0xDC00);
+		}
+		else if (c >= 0xD800 && c <= 0xDFFF) c = 0xFFFD;
+
+		if (c < 0x80) output += (char)c;
+		else if (c < 0x800)
+		{
+			output += (char)(0xC0 | (c >> 6));
+			output += (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			output += (char)(0xE0 | (c >> 12));
+			output += (char)(0x80 | ((c >> 6) & 0x3F));
+			output += (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			output += (char)(0xF0 | (c >> 18));
+			output += (char)(0x80 | ((c >> 12) & 0x3F));
+			output += (char)(0x80 | ((c >> 6) & 0x3F));
+			output += (char)(0x80 | (c & 0x3F));
+		}
+	}
+}
+
+// Returns the UTF-8 encoding of text.
+inline std::string EncodeUtf8(const std::wstring & text)
+{
+	std::string output;
+	AppendUtf8(text, output);
+	return output;
+}
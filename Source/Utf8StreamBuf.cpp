@@ -0,0 +1,60 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * A std::wstreambuf that decodes UTF-8 from a byte stream in 64 KB chunks. Each time a chunk is  *
+ * read, its size is added to the ProgressMonitor (if one was given) so that a background job can *
+ * report how much of its input it has consumed.                                                  *
+ **************************************************************************************************/
+
+#include "Utf8StreamBuf.h"
+
+namespace
+{
+	const size_t CHUNK_SIZE = 64 * 1024;
+}
+
+/**************************************************************************************************
+ * Constructor. No input is read until the first character is requested.                          *
+ *   Inputs:                                                                                      *
+ *      byteSource: An opened byte stream (preferably opened in binary mode) containing UTF-8     *
+ *                  text.                                                                         *
+ *      progressMonitor: Optional. Receives the number of bytes consumed after every chunk.       *
+ **************************************************************************************************/
+Utf8StreamBuf::Utf8StreamBuf(std::istream & byteSource, ProgressMonitor * progressMonitor)
+	: source(byteSource), monitor(progressMonitor), byteBuffer(CHUNK_SIZE), charBuffer(CHUNK_SIZE + 4)
+{
+	setg(charBuffer.data(), charBuffer.data(), charBuffer.data());
+}
+
+/**************************************************************************************************
+ * Refills the character buffer. Called by the std::wistream whenever it runs out of decoded      *
+ * characters. A chunk of bytes may decode to zero characters (if it holds only part of a         *
+ * multi-byte sequence), so reading continues until at least one character is available or the    *
+ * byte stream is exhausted.                                                                      *
+ *   return value: The next character, or traits_type::eof() at the end of the input.             *
+ **************************************************************************************************/
+Utf8StreamBuf::int_type Utf8StreamBuf::underflow()
+{
+	if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+	size_t decoded = 0;
+	while (decoded == 0 && !finished)
+	{
+		source.read(byteBuffer.data(), byteBuffer.size());
+		std::streamsize bytesRead = source.gcount();
+		if (bytesRead > 0)
+		{
+			decoded = decoder.Decode(byteBuffer.data(), byteBuffer.data() + bytesRead, charBuffer.data());
+			if (monitor) monitor->AddBytes(bytesRead);
+		}
+		if (bytesRead < (std::streamsize)byteBuffer.size())
+		{
+			finished = true;
+			decoded += decoder.Finish(charBuffer.data() + decoded);
+		}
+	}
+
+	setg(charBuffer.data(), charBuffer.data(), charBuffer.data() + decoded);
+	if (decoded == 0) return traits_type::eof();
+	return traits_type::to_int_type(*gptr());
+}
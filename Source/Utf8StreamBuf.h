@@ -0,0 +1,29 @@
+// A wide-character stream buffer that decodes UTF-8 from an underlying byte stream. Wrapping it in a
+// std::wistream gives the same tokens as a wifstream imbued with std::codecvt_utf8_utf16, but the
+// number of bytes consumed is known exactly and can be reported to a ProgressMonitor.
+
+#pragma once
+
+#include "Utf8Decoder.h"
+#include "ProgressMonitor.h"
+#include <istream>
+#include <streambuf>
+#include <vector>
+
+class Utf8StreamBuf : public std::wstreambuf
+{
+	std::istream & source;
+	ProgressMonitor * monitor;
+	Utf8Decoder decoder;
+	std::vector<char> byteBuffer;
+	std::vector<wchar_t> charBuffer;
+	bool finished = false;
+
+protected:
+	// Refills the character buffer from the byte stream.
+	int_type underflow() override;
+
+public:
+	// Constructor. The byte stream should be opened in binary mode. monitor may be NULL.
+	Utf8StreamBuf(std::istream & byteSource, ProgressMonitor * progressMonitor = NULL);
+};
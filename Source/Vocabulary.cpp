@@ -0,0 +1,68 @@
+/**************************************************************************************************
+ * Author: Jonathan Roop                                                                          *
+ *                                                                                                *
+ * A two-way mapping between tokens and integer IDs. IDs are handed out consecutively in the      *
+ * order in which tokens are first seen, starting with the non-word padding token at ID 0.        *
+ * Working with IDs instead of strings makes every prefix a fixed-size array of integers, which   *
+ * is cheap to copy, compare, hash, sort, and write to disk.                                      *
+ **************************************************************************************************/
+
+#include "Vocabulary.h"
+#include "StringChain.h"
+
+const unsigned int Vocabulary::NONWORD_ID;
+
+/**************************************************************************************************
+ * Constructor. The non-word token is added first, so that it receives ID 0 (NONWORD_ID).         *
+ **************************************************************************************************/
+Vocabulary::Vocabulary()
+{
+	Intern(NONWORD);
+}
+
+/**************************************************************************************************
+ * Returns the ID of a token, assigning the next free ID if the token has not been seen before.   *
+ *   Inputs:                                                                                      *
+ *      token: A word or character.                                                               *
+ *   return value: The token's ID.                                                                *
+ **************************************************************************************************/
+unsigned int Vocabulary::Intern(const std::wstring & token)
+{
+	auto it = ids.find(token);
+	if (it != ids.end()) return it->second;
+	unsigned int id = (unsigned int)tokens.size();
+	ids.insert(std::make_pair(token, id));
+	tokens.push_back(token);
+	return id;
+}
+
+/**************************************************************************************************
+ * Looks up the ID of a token without adding it to the vocabulary.                                *
+ *   Inputs:                                                                                      *
+ *      token: A word or character.                                                               *
+ *      id: Receives the token's ID, if it is known.                                              *
+ *   return value: true if the token is in the vocabulary, false otherwise.                       *
+ **************************************************************************************************/
+bool Vocabulary::Find(const std::wstring & token, unsigned int & id) const
+{
+	auto it = ids.find(token);
+	if (it == ids.end()) return false;
+	id = it->second;
+	return true;
+}
+
+/**************************************************************************************************
+ * Returns the token with the given ID. The ID must be less than Size().                          *
+ **************************************************************************************************/
+const std::wstring & Vocabulary::Token(unsigned int id) const
+{
+	return tokens[id];
+}
+
+/**************************************************************************************************
+ * Returns the number of distinct tokens, including the non-word token.                           *
+ **************************************************************************************************/
+size_t Vocabulary::Size() const
+{
+	return tokens.size();
+}
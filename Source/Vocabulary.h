@@ -0,0 +1,34 @@
+// Assigns a small integer ID to every distinct token (word or character), so that prefixes and
+// suffixes can be stored and compared as arrays of integers instead of arrays of strings. The
+// non-word padding token always has ID 0.
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Vocabulary
+{
+	std::unordered_map<std::wstring, unsigned int> ids;
+	std::vector<std::wstring> tokens;
+
+public:
+	// The ID of the non-word padding token (NONWORD).
+	static const unsigned int NONWORD_ID = 0;
+
+	// Constructor. The vocabulary starts out containing only the non-word token.
+	Vocabulary();
+
+	// Returns the ID of a token, assigning the next free ID if the token has not been seen before.
+	unsigned int Intern(const std::wstring & token);
+
+	// Looks up the ID of a token without adding it. Returns false if the token is unknown.
+	bool Find(const std::wstring & token, unsigned int & id) const;
+
+	// Returns the token with the given ID.
+	const std::wstring & Token(unsigned int id) const;
+
+	// Returns the number of distinct tokens, including the non-word token.
+	size_t Size() const;
+};